@@ -4,40 +4,95 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
+#include "../frame.h"
 
 #define NAME_SERVER_IP "127.0.0.1"
 #define NAME_SERVER_PORT 8080
 #define MAX_USERNAME_LEN 1024
 #define MAX_RESPONSE_LEN 8192
+#define SS_CONNECT_TIMEOUT_MS 3000 // Each attempt to reach an SS
+#define SS_CONNECT_ATTEMPTS 3      // Tries, 200 ms apart, before giving up
+#define SS_REPLY_TIMEOUT_MS 30000  // For a whole SS reply (the NS waits 5 s)
 
-// connection to the storage server (no change)
+// connection to the storage server. Nothing has been sent when a connect
+// fails, so it is tried again a few times before giving up.
 int connect_to_ss(const char* ip, int port) { 
     int sock;
     struct sockaddr_in ss_addr;
 
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock == -1) {
-        perror("Could not create SS socket");
-        return -1;
-    }
-
     ss_addr.sin_addr.s_addr = inet_addr(ip);
     ss_addr.sin_family = AF_INET;
     ss_addr.sin_port = htons(port);
 
-    if (connect(sock, (struct sockaddr*)&ss_addr, sizeof(ss_addr)) < 0) { 
-        perror("SS Connect failed");
+    for (int attempt = 1;; attempt++) {
+        sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock == -1) {
+            perror("Could not create SS socket");
+            return -1;
+        }
+        if (deadline_connect(sock, (struct sockaddr*)&ss_addr, sizeof(ss_addr), deadline_in(SS_CONNECT_TIMEOUT_MS)) == 0) {
+            return sock;
+        }
         close(sock);
-        return -1;
+        if (attempt == SS_CONNECT_ATTEMPTS) break;
+        usleep(200000);
     }
-    return sock;
+    perror("SS Connect failed");
+    return -1;
+}
+
+// Sends a command to an SS: a request frame if the NS said it takes them
+// ('framed'), else the text line.
+int send_to_ss(int sock, int framed, const char* command) {
+    if (framed) return frame_send_command(sock, 1, command);
+    return send(sock, command, strlen(command), 0) >= 0;
+}
+
+// Reads one short SS acknowledgement (ACK_LOCK, ACK_DATA) into 'reply'.
+// Returns its length, or -1 if the connection failed or the SS took longer
+// than SS_REPLY_TIMEOUT_MS.
+int recv_ss_ack(int sock, int framed, char* reply, int cap) {
+    long long deadline = deadline_in(SS_REPLY_TIMEOUT_MS);
+    reply[0] = '\0';
+    if (framed) return frame_recv_reply_by(sock, reply, cap, deadline) < 0 ? -1 : (int)strlen(reply);
+    int read_size = deadline_recv(sock, reply, cap - 1, 0, deadline);
+    if (read_size < 0) return -1;
+    reply[read_size] = '\0';
+    return read_size;
 }
 
-// read_from_ss (no change)
-void read_from_ss(int sock) {
+// Tells the user an SS reply did not arrive in full.
+static void report_ss_failure() {
+    if (errno == ETIMEDOUT) printf("\nError: Storage Server did not answer within %d seconds.\n", SS_REPLY_TIMEOUT_MS / 1000);
+}
+
+// Prints an SS reply as it arrives, giving up after SS_REPLY_TIMEOUT_MS
+void read_from_ss(int sock, int framed) {
     char ss_reply[MAX_RESPONSE_LEN];
     int read_size;
-    while ((read_size = recv(sock, ss_reply, MAX_RESPONSE_LEN - 1, 0)) > 0) {
+    long long deadline = deadline_in(SS_REPLY_TIMEOUT_MS);
+    errno = 0;
+    if (framed) {
+        FrameHeader h;
+        do {
+            if (!frame_recv_header_by(sock, &h, deadline)) {
+                report_ss_failure();
+                return;
+            }
+            uint32_t left = h.length;
+            while (left > 0) {
+                read_size = deadline_recv(sock, ss_reply, left < sizeof(ss_reply) ? left : sizeof(ss_reply), 0, deadline);
+                if (read_size <= 0) {
+                    report_ss_failure();
+                    return;
+                }
+                fwrite(ss_reply, 1, read_size, stdout);
+                left -= read_size;
+            }
+        } while (h.opcode == FRAME_REPLY_PART);
+        return;
+    }
+    while ((read_size = deadline_recv(sock, ss_reply, MAX_RESPONSE_LEN - 1, 0, deadline)) > 0) {
         ss_reply[read_size] = '\0';
         char* end_token = strstr(ss_reply, "__SS_END__");
         if (end_token != NULL) {
@@ -48,25 +103,26 @@ void read_from_ss(int sock) {
             break;
         }
     }
+    if (read_size < 0) report_ss_failure();
 }
 
 // REMOVED: handle_ss_create
 // Reason: This is now handled by the Name Server.
 
-// Handles the SS_READ operation (no change)
-void handle_ss_read(const char* ip, int port, const char* filename) {
+// Handles the SS_READ operation
+void handle_ss_read(const char* ip, int port, const char* filename, int framed) {
     int ss_sock = connect_to_ss(ip, port);
     if (ss_sock < 0) return;
     
     char command[1024];
     snprintf(command, sizeof(command), "SS_READ;%s\n", filename);
-    send(ss_sock, command, strlen(command), 0);
-    read_from_ss(ss_sock);
+    send_to_ss(ss_sock, framed, command);
+    read_from_ss(ss_sock, framed);
     close(ss_sock);
 }
 
-// Handles the stateful SS_WRITE session (no change)
-void handle_ss_write_session(const char* ip, int port, const char* filename, int sentence_num) {
+// Handles the stateful SS_WRITE session
+void handle_ss_write_session(const char* ip, int port, const char* filename, int sentence_num, int framed) {
     int ss_sock = connect_to_ss(ip, port);
     if (ss_sock < 0) return;
     
@@ -75,12 +131,11 @@ void handle_ss_write_session(const char* ip, int port, const char* filename, int
     int read_size;
     
     snprintf(command, sizeof(command), "SS_LOCK_SENTENCE;%s;%d\n", filename, sentence_num);
-    send(ss_sock, command, strlen(command), 0);
+    send_to_ss(ss_sock, framed, command);
     
-    read_size = recv(ss_sock, ss_reply, 127, 0);
-    ss_reply[read_size] = '\0';
+    read_size = recv_ss_ack(ss_sock, framed, ss_reply, sizeof(ss_reply));
     
-    if (strncmp(ss_reply, "ACK_LOCK", 8) != 0) {
+    if (read_size < 0 || strncmp(ss_reply, "ACK_LOCK", 8) != 0) {
         printf("Error: Could not acquire lock from storage server: %s\n", ss_reply);
         close(ss_sock);
         return;
@@ -95,8 +150,8 @@ void handle_ss_write_session(const char* ip, int port, const char* filename, int
         input[strcspn(input, "\n")] = 0;
 
         if (strcasecmp(input, "ETIRW") == 0) {
-            send(ss_sock, "COMMIT_WRITE;\n", 15, 0);
-            read_from_ss(ss_sock); // Read final ACK_COMMIT__SS_END__
+            send_to_ss(ss_sock, framed, "COMMIT_WRITE;\n");
+            read_from_ss(ss_sock, framed); // Read final ACK_COMMIT
             snprintf(command, sizeof(command), "UPDATE_META;%s\n", filename);   
             handle_ns_command(command);
             break;
@@ -111,11 +166,10 @@ void handle_ss_write_session(const char* ip, int port, const char* filename, int
         }
         
         snprintf(command, sizeof(command), "WRITE_DATA;%d;%s\n", atoi(index_str), content);
-        send(ss_sock, command, strlen(command), 0);
+        send_to_ss(ss_sock, framed, command);
         
-        read_size = recv(ss_sock, ss_reply, 127, 0);
-        ss_reply[read_size] = '\0';
-        if (strncmp(ss_reply, "ACK_DATA", 8) != 0) {
+        read_size = recv_ss_ack(ss_sock, framed, ss_reply, sizeof(ss_reply));
+        if (read_size < 0 || strncmp(ss_reply, "ACK_DATA", 8) != 0) {
             printf("Error: Write data not acknowledged.\n");
             break;
         }
@@ -124,7 +178,7 @@ void handle_ss_write_session(const char* ip, int port, const char* filename, int
     close(ss_sock);
     printf("Write session finished.\n");
 }
-void stream_from_ss(int ss_sock, const char* filename) {
+void stream_from_ss(int ss_sock, const char* filename, int framed) {
     char* total_reply = malloc(MAX_RESPONSE_LEN * 10); // 40KB buffer
     if (total_reply == NULL) {
         perror("malloc failed");
@@ -138,7 +192,16 @@ void stream_from_ss(int ss_sock, const char* filename) {
     char* end_token = NULL;
 
     // 2. Read loop: receive all data from SS into the single 'total_reply' buffer.
-    while ((read_size = recv(ss_sock, recv_buf, MAX_RESPONSE_LEN - 1, 0)) > 0) {
+    long long deadline = deadline_in(SS_REPLY_TIMEOUT_MS);
+    errno = 0;
+    if (framed) {
+        int status = frame_recv_reply_by(ss_sock, total_reply, MAX_RESPONSE_LEN * 10, deadline);
+        if (status < 0) {
+            total_reply[0] = '\0';
+            report_ss_failure();
+        }
+    }
+    while (!framed && (read_size = deadline_recv(ss_sock, recv_buf, MAX_RESPONSE_LEN - 1, 0, deadline)) > 0) {
         recv_buf[read_size] = '\0';
         
         // Check for end token *before* concatenating
@@ -154,6 +217,7 @@ void stream_from_ss(int ss_sock, const char* filename) {
             break; // We found the end, stop reading
         }
     }
+    if (!framed && read_size < 0) report_ss_failure();
     close(ss_sock); // We have all the data, close the socket.
 
     // 3. Now, parse the *complete* text and stream it word-by-word
@@ -170,14 +234,14 @@ void stream_from_ss(int ss_sock, const char* filename) {
 
     free(total_reply); // Clean up the buffer
 }
-void handle_ss_stream(const char* ip, int port, const char* filename) {
+void handle_ss_stream(const char* ip, int port, const char* filename, int framed) {
     char cmd[1024];
     int ss_sock = connect_to_ss(ip, port);
     if (ss_sock < 0)
         return;
     snprintf(cmd, sizeof(cmd), "SS_STREAM;%s\n", filename);
-    send(ss_sock, cmd, strlen(cmd), 0);
-    stream_from_ss(ss_sock, filename);
+    send_to_ss(ss_sock, framed, cmd);
+    stream_from_ss(ss_sock, filename, framed);
 }
 
 
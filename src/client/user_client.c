@@ -15,47 +15,129 @@ void handle_ns_command(const char* command_str);
 
 char username[50];
 int ns_sock = -1; // MODIFIED: Global socket for persistent NS connection
+int ns_framed = 0; // The session negotiated FRAMED/1 (frame.h) at registration
+uint32_t ns_request_id = 0;
+
+// Sends one command line to the NS: a request frame on a framed session,
+// the line itself otherwise.
+int ns_send(const char* command_str) {
+    if (ns_framed) return frame_send_command(ns_sock, ++ns_request_id, command_str);
+    return send(ns_sock, command_str, strlen(command_str), 0) >= 0;
+}
+
+// Buffered reader for the NS socket.
+static char ns_rx_buf[4096];
+static int ns_rx_len = 0, ns_rx_pos = 0;
+
+static int ns_rx_byte() {
+    if (ns_rx_pos == ns_rx_len) {
+        ns_rx_pos = 0;
+        ns_rx_len = recv(ns_sock, ns_rx_buf, sizeof(ns_rx_buf), 0);
+        if (ns_rx_len <= 0) {
+            ns_rx_len = 0;
+            return -1;
+        }
+    }
+    return (unsigned char)ns_rx_buf[ns_rx_pos++];
+}
+
+#define NS_REPLY_END 2 // read_ns_line(): the reply is over
+
+// Framed session: what is left of the reply being read.
+static uint32_t ns_frame_left = 0; // Payload bytes of the current frame
+static int ns_frame_final = 1;     // The current frame is the reply's last
+static int ns_between_replies = 1; // The next byte starts a new reply
+static int ns_end_pending = 0;     // A last unterminated line was returned
+
+// Next payload byte of a framed reply, NS_REPLY_END once it is all read,
+// or -1 if the connection failed.
+static int ns_frame_byte() {
+    while (ns_frame_left == 0) {
+        if (ns_frame_final && !ns_between_replies) {
+            ns_between_replies = 1;
+            return NS_REPLY_END + 256; // Not a byte value
+        }
+        unsigned char header[FRAME_HEADER_LEN];
+        FrameHeader h;
+        for (int i = 0; i < FRAME_HEADER_LEN; i++) {
+            int c = ns_rx_byte();
+            if (c < 0) return -1;
+            header[i] = (unsigned char)c;
+        }
+        if (!frame_unpack(header, &h)) return -1;
+        ns_frame_left = h.length;
+        ns_frame_final = h.opcode == FRAME_REPLY;
+        ns_between_replies = 0;
+    }
+    ns_frame_left--;
+    return ns_rx_byte();
+}
+
+// Reads one line of an NS reply into 'line' (newline stripped; longer lines
+// are cut to fit). Returns 1 for a line, NS_REPLY_END when the reply is
+// over (the "__END__" line, or the last frame), or 0 if the connection
+// failed.
+int read_ns_line(char* line, size_t cap) {
+    size_t n = 0;
+    if (ns_end_pending) {
+        ns_end_pending = 0;
+        return NS_REPLY_END;
+    }
+    while (1) {
+        int c = ns_framed ? ns_frame_byte() : ns_rx_byte();
+        if (c < 0) return 0;
+        if (c == NS_REPLY_END + 256) {
+            if (n == 0) return NS_REPLY_END;
+            ns_end_pending = 1; // Hand back the last line first
+            break;
+        }
+        if (c == '\n') break;
+        if (n + 1 < cap) line[n++] = (char)c;
+    }
+    line[n] = '\0';
+    if (!ns_framed && strcmp(line, "__END__") == 0) return NS_REPLY_END;
+    return 1;
+}
 
 // MODIFIED: This function replaces NS_comms. It handles the logic
 // for a persistent connection.
 void handle_ns_command(const char* command_str) {
-    char server_reply[MAX_RESPONSE_LEN];
-    
     // --- 1. Send command on persistent socket ---
-    if (send(ns_sock, command_str, strlen(command_str), 0) < 0) {
+    if (!ns_send(command_str)) {
         perror("Send to NS failed");
         ns_sock = -1; // Mark socket as dead
         return;
     }
 
-    // --- 2. Receive loop for full response ---
-    int total_read = 0;
-    int read_size;
+    // --- 2. Read the whole reply, a line at a time ---
+    size_t cap = MAX_RESPONSE_LEN, total = 0;
+    char* server_reply = malloc(cap);
+    char line[MAX_RESPONSE_LEN];
+    int got;
+    if (!server_reply) return;
     server_reply[0] = '\0';
-    
-    while ((read_size = recv(ns_sock, server_reply + total_read, MAX_RESPONSE_LEN - total_read - 1, 0)) > 0) {
-        total_read += read_size;
-        server_reply[total_read] = '\0';
-        
-        // Check if the full response has ended
-        if (strstr(server_reply, "__END__\n")) {
-            break;
+    while ((got = read_ns_line(line, sizeof(line))) == 1) {
+        size_t len = strlen(line);
+        if (total + len + 2 > cap) {
+            char* grown = realloc(server_reply, cap * 2 + len);
+            if (!grown) break;
+            server_reply = grown;
+            cap = cap * 2 + len;
         }
+        memcpy(server_reply + total, line, len);
+        total += len;
+        server_reply[total++] = '\n';
+        server_reply[total] = '\0';
     }
 
-    if (read_size <= 0) {
+    if (got == 0) {
         perror("recv from NS failed");
         ns_sock = -1; // Mark socket as dead
+        free(server_reply);
         return;
     }
 
-    // --- 3. Process the response ---
-    char* end_token = strstr(server_reply, "__END__");
-    if (end_token != NULL) {
-        *end_token = '\0';
-    }
-
-    // --- 4. NEW LOGIC: Check type BEFORE tokenizing ---
+    // --- 3. NEW LOGIC: Check type BEFORE tokenizing ---
 
     // Case A: ERROR
     if (strncmp(server_reply, "ERROR", 5) == 0) {
@@ -78,16 +160,20 @@ void handle_ns_command(const char* command_str) {
 
         if (ip && port_str && filename) {
             if (strcmp(type, "REDIRECT_READ") == 0) {
-                handle_ss_read(ip, atoi(port_str), filename);
+                char* framing = strtok(NULL, ";\n"); // FRAMED/1 if the SS takes frames
+                handle_ss_read(ip, atoi(port_str), filename, framing && strcmp(framing, FRAME_CAPABILITY) == 0);
             }
             else if (strcmp(type, "REDIRECT_WRITE") == 0) {
                 char* sent_num_str = strtok(NULL, ";\n");
+                char* framing = strtok(NULL, ";\n");
                 if (sent_num_str) {
-                    handle_ss_write_session(ip, atoi(port_str), filename, atoi(sent_num_str));
+                    handle_ss_write_session(ip, atoi(port_str), filename, atoi(sent_num_str),
+                                            framing && strcmp(framing, FRAME_CAPABILITY) == 0);
                 }
             }
             else if (strcmp(type, "REDIRECT_STREAM") == 0) {
-                handle_ss_stream(ip, atoi(port_str), filename);
+                char* framing = strtok(NULL, ";\n");
+                handle_ss_stream(ip, atoi(port_str), filename, framing && strcmp(framing, FRAME_CAPABILITY) == 0);
             }
         }
     }
@@ -95,16 +181,64 @@ void handle_ns_command(const char* command_str) {
     else {
         // Do NOT use strtok here. Print the whole multi-line buffer.
         printf("%s", server_reply);
-        
-        // Add a newline for formatting if the server didn't send one at the end
-        int len = strlen(server_reply);
-        if (len > 0 && server_reply[len - 1] != '\n') {
-            printf("\n");
-        }
     }
+    free(server_reply);
 }
 
 
+// Runs a listing command (VIEW, VIEWFOLDER, LIST) and prints the reply a
+// line at a time as it arrives. The server sends one page per request and
+// ends it with "-- More: <command> --" if there is more; with 'follow' set
+// that command is sent for the next page straight away, so the whole
+// listing prints with no more memory than one line.
+void handle_ns_listing(const char* command_str, int follow) {
+    char next[MAX_RESPONSE_LEN];
+    char line[MAX_RESPONSE_LEN];
+    snprintf(next, sizeof(next), "%s", command_str);
+
+    while (next[0]) {
+        if (!ns_send(next)) {
+            perror("Send to NS failed");
+            ns_sock = -1;
+            return;
+        }
+        next[0] = '\0';
+        while (1) {
+            int got = read_ns_line(line, sizeof(line));
+            if (!got) {
+                perror("recv from NS failed");
+                ns_sock = -1;
+                return;
+            }
+            if (got == NS_REPLY_END) break;
+            if (strncmp(line, "ERROR;", 6) == 0) {
+                char* code = strtok(line + 6, ";");
+                char* message = strtok(NULL, "");
+                printf("Error [%s]: %s\n", code ? code : "?", message ? message : "");
+                continue;
+            }
+            size_t len = strlen(line);
+            if (follow && strncmp(line, "-- More: ", 9) == 0 && len > 12 && strcmp(line + len - 3, " --") == 0) {
+                // "-- More: VIEW -l 200 <cursor> --" -> "VIEW;-l;200;<cursor>"
+                line[len - 3] = '\0';
+                char* arg = line + 9;
+                int out = 0;
+                if (strncmp(arg, "LIST ", 5) == 0) {
+                    out = snprintf(next, sizeof(next), "LIST_USERS");
+                    arg += 4;
+                }
+                for (; *arg && out < (int)sizeof(next) - 2; arg++) {
+                    next[out++] = (*arg == ' ') ? ';' : *arg;
+                }
+                next[out++] = '\n';
+                next[out] = '\0';
+                continue;
+            }
+            printf("%s\n", line);
+        }
+    }
+}
+
 int main() {
     char message[MAX_RESPONSE_LEN];
 
@@ -130,11 +264,30 @@ int main() {
     printf("Enter your username: ");
     fgets(username, 50, stdin);
     username[strcspn(username, "\n")] = 0;
-    snprintf(message, sizeof(message), "REGISTER_CLIENT;%s\n", username);
+    // Ask for framing; a Name Server that does not offer it ignores the
+    // extra field and the session stays in text.
+    snprintf(message, sizeof(message), "REGISTER_CLIENT;%s;%s\n", username, FRAME_CAPABILITY);
     
     printf("Registering with server...\n");
-    // Use the new command handler for registration
-    handle_ns_command(message);
+    if (!ns_send(message)) {
+        perror("Send to NS failed");
+        close(ns_sock);
+        return 1;
+    }
+    int framed = 0, got;
+    while ((got = read_ns_line(message, sizeof(message))) == 1) {
+        if (strcmp(message, "ACK_CLIENT_REG;" FRAME_CAPABILITY) == 0) {
+            framed = 1;
+            message[strlen("ACK_CLIENT_REG")] = '\0';
+        }
+        printf("%s\n", message);
+    }
+    if (!got) {
+        perror("recv from NS failed");
+        close(ns_sock);
+        return 1;
+    }
+    ns_framed = framed; // Everything after the ACK is framed
     
     printf("\nSuccessfully registered as '%s'. Type 'exit' to quit.\n", username);
     printf("------------------------------------------------------\n");
@@ -164,14 +317,42 @@ int main() {
 
         char* command = strtok(input_copy, " ");
         if (command == NULL) continue;
+        int is_listing = 0;     // Paged reply (handle_ns_listing)
+        char* limit_arg = NULL; // A listing's page size, if one was given
 
         // (Command parsing logic is unchanged)
         if (strcasecmp(command, "VIEW") == 0) {
+            // Optional: VIEW [-flags] [<page size> [<cursor>]]. Without a
+            // page size every page is fetched.
             char* flags = strtok(NULL, " ");
-            snprintf(command_to_send, sizeof(command_to_send), "VIEW;%s\n", flags ? flags : "-");
+            if (flags && flags[0] != '-') {
+                limit_arg = flags;
+                flags = NULL;
+            } else {
+                limit_arg = strtok(NULL, " ");
+            }
+            char* after = limit_arg ? strtok(NULL, " ") : NULL;
+            snprintf(command_to_send, sizeof(command_to_send), "VIEW;%s;%s;%s\n", flags ? flags : "-", limit_arg ? limit_arg : "0", after ? after : "-");
+            is_listing = 1;
         } 
         else if (strcasecmp(command, "LIST") == 0) {
-            snprintf(command_to_send, sizeof(command_to_send), "LIST_USERS;\n");
+            // Optional: LIST <page size> <last user of the previous page>
+            limit_arg = strtok(NULL, " ");
+            char* after = strtok(NULL, " ");
+            snprintf(command_to_send, sizeof(command_to_send), "LIST_USERS;%s;%s\n", limit_arg ? limit_arg : "0", after ? after : "-");
+            is_listing = 1;
+        }
+        else if (strcasecmp(command, "CACHESTATS") == 0) {
+            snprintf(command_to_send, sizeof(command_to_send), "CACHE_STATS;\n");
+        }
+        else if (strcasecmp(command, "MEMSTATS") == 0) {
+            snprintf(command_to_send, sizeof(command_to_send), "MEM_STATS;\n");
+        }
+        else if (strcasecmp(command, "CMDSTATS") == 0) {
+            snprintf(command_to_send, sizeof(command_to_send), "COMMAND_STATS;\n");
+        }
+        else if (strcasecmp(command, "SSSTATS") == 0) {
+            snprintf(command_to_send, sizeof(command_to_send), "STORAGE_STATS;\n");
         }
         else if (strcasecmp(command, "CREATE") == 0) {
             char* filename = strtok(NULL, " ");
@@ -238,8 +419,17 @@ int main() {
         }
         else if (strcasecmp(command, "VIEWFOLDER") == 0) {
             char* fname = strtok(NULL, " ");
-            if (!fname) { printf("Usage: VIEWFOLDER <foldername>\n"); continue; }
-            snprintf(command_to_send, sizeof(command_to_send), "VIEWFOLDER;%s\n", fname);
+            if (!fname) { printf("Usage: VIEWFOLDER <foldername> [<page size> [<cursor>]]\n"); continue; }
+            limit_arg = strtok(NULL, " ");
+            char* after = limit_arg ? strtok(NULL, " ") : NULL;
+            snprintf(command_to_send, sizeof(command_to_send), "VIEWFOLDER;%s;%s;%s\n", fname, limit_arg ? limit_arg : "0", after ? after : "-");
+            is_listing = 1;
+        }
+        else if (strcasecmp(command, "MOVE") == 0 || strcasecmp(command, "RENAME") == 0) {
+            char* fname = strtok(NULL, " ");
+            char* new_name = strtok(NULL, " ");
+            if (!fname || !new_name) { printf("Usage: MOVE <name> <new_name>\n"); continue; }
+            snprintf(command_to_send, sizeof(command_to_send), "MOVE;%s;%s\n", fname, new_name);
         }
         else if (strcasecmp(command, "CHECKPOINT") == 0) {
             char* fname = strtok(NULL, " ");
@@ -298,7 +488,11 @@ int main() {
         }
 
         // MODIFIED: Call the new persistent command handler
-        handle_ns_command(command_to_send);
+        if (is_listing) {
+            handle_ns_listing(command_to_send, limit_arg == NULL); // An explicit page size shows one page
+        } else {
+            handle_ns_command(command_to_send);
+        }
     }
 
     // --- 3. Close persistent connection ---
@@ -0,0 +1,210 @@
+#ifndef COMMAND_TABLE_H
+#define COMMAND_TABLE_H
+
+/*
+ * command_table.h
+ *
+ * Table-driven command dispatch, shared by the Name Server and the Storage
+ * Server.
+ *
+ * Each server lists its commands in a static CommandSpec array: the name,
+ * an argument schema, the permission the caller needs on the first
+ * argument, and the handler. command_table_build() runs once at startup
+ * and picks a hash seed under which every name lands in its own slot (a
+ * perfect hash), so looking a command up is one hash of its name and one
+ * string compare, however many commands there are.
+ *
+ * An argument schema is a string with one letter per ';'-separated field:
+ *   F  a file or folder name, at most COMMAND_NAME_MAX characters
+ *   U  a user name, at most COMMAND_USER_MAX characters
+ *   P  a permission letter (only the first character is kept)
+ *   N  an integer
+ *   S  any field
+ *   R  the rest of the line, ';' included (must come last)
+ * Fields after a '|' are optional and are passed as NULL when left out.
+ * Empty fields are skipped, as strtok() always did here, and extra fields
+ * are ignored.
+ *
+ * Every spec also keeps counters (calls, error replies, permission
+ * denials, total time) that the servers report through a stats command.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "error_codes.h"
+
+#define COMMAND_SLOTS 128   // Hash slots; keep at least twice the command count
+#define COMMAND_MAX_ARGS 8
+#define COMMAND_NAME_MAX 99 // Longest file or folder name a command accepts
+#define COMMAND_USER_MAX 49 // Longest user name
+
+// Permission the caller needs on the file a command names. Checked by the
+// handler itself, under the file's lock, so a concurrent ACL change cannot
+// slip in between the check and the work.
+#define PERM_NONE 0
+#define PERM_READ 'R'
+#define PERM_WRITE 'W'
+#define PERM_OWNER 'O'
+
+// Results of command_parse_args()
+#define CMD_ARGS_OK 0
+#define CMD_ARGS_MISSING 1
+#define CMD_ARGS_TOO_LONG 2
+#define CMD_ARGS_NOT_NUMBER 3
+
+typedef void (*CommandHandler)(void* session, char** args);
+
+typedef struct CommandSpec {
+    const char* name;
+    const char* args;       // Argument schema, see above
+    char perm;              // PERM_*
+    CommandHandler run;
+    // Counters, updated atomically
+    unsigned long calls;
+    unsigned long errors;   // Replies that were errors
+    unsigned long denied;   // ...of which permission denials
+    unsigned long long nanos;
+} CommandSpec;
+
+typedef struct CommandTable {
+    CommandSpec* specs;
+    int count;
+    uint32_t seed;
+    uint8_t slots[COMMAND_SLOTS]; // Index into specs + 1; 0 for an empty slot
+    unsigned long unknown;  // Commands that matched no spec
+} CommandTable;
+
+#define COMMAND_TABLE(specs) { specs, (int)(sizeof(specs) / sizeof((specs)[0])), 0, { 0 }, 0 }
+
+static inline uint32_t command_hash(const char* name, uint32_t seed) {
+    uint32_t h = 2166136261u ^ seed; // FNV-1a
+    for (; *name; name++) {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+    return (h ^ (h >> 15)) & (COMMAND_SLOTS - 1);
+}
+
+// Finds a seed that gives every command its own slot. Returns 0 if there
+// is none (a duplicate name, or too many commands for the table).
+static inline int command_table_build(CommandTable* t) {
+    if (t->count > COMMAND_SLOTS / 2) return 0;
+    for (uint32_t seed = 0; seed < (1u << 20); seed++) {
+        memset(t->slots, 0, sizeof(t->slots));
+        int i;
+        for (i = 0; i < t->count; i++) {
+            uint32_t slot = command_hash(t->specs[i].name, seed);
+            if (t->slots[slot]) break;
+            t->slots[slot] = (uint8_t)(i + 1);
+        }
+        if (i == t->count) {
+            t->seed = seed;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// The spec for a command name, or NULL (and the unknown counter bumped).
+static inline CommandSpec* command_lookup(CommandTable* t, const char* name) {
+    uint8_t index = t->slots[command_hash(name, t->seed)];
+    if (index && strcmp(t->specs[index - 1].name, name) == 0) return &t->specs[index - 1];
+    __atomic_fetch_add(&t->unknown, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// Splits the fields after the command name (strtok_r() state in 'saveptr')
+// into args[] as the spec's schema says. On failure '*bad' is the 1-based
+// position of the offending argument.
+static inline int command_parse_args(const CommandSpec* spec, char** saveptr, char** args, int* bad) {
+    int optional = 0, n = 0;
+    for (const char* kind = spec->args; *kind && n < COMMAND_MAX_ARGS; kind++) {
+        if (*kind == '|') {
+            optional = 1;
+            continue;
+        }
+        char* value = strtok_r(NULL, *kind == 'R' ? "\n" : ";\n", saveptr);
+        *bad = n + 1;
+        if (!value) {
+            if (!optional) return CMD_ARGS_MISSING;
+            args[n++] = NULL;
+            continue;
+        }
+        size_t len = strlen(value);
+        if ((*kind == 'F' && len > COMMAND_NAME_MAX) || (*kind == 'U' && len > COMMAND_USER_MAX)) {
+            return CMD_ARGS_TOO_LONG;
+        }
+        if (*kind == 'P') value[1] = '\0';
+        if (*kind == 'N') {
+            char* end;
+            strtol(value, &end, 10);
+            if (end == value || *end) return CMD_ARGS_NOT_NUMBER;
+        }
+        args[n++] = value;
+    }
+    while (n < COMMAND_MAX_ARGS) args[n++] = NULL;
+    return CMD_ARGS_OK;
+}
+
+// Why command_parse_args() failed, e.g. "Usage: MOVE;<name>;<name>".
+static inline void command_args_error(const CommandSpec* spec, int result, int bad, char* out, size_t cap) {
+    if (result == CMD_ARGS_TOO_LONG) {
+        snprintf(out, cap, "Argument %d of %s is too long.", bad, spec->name);
+        return;
+    }
+    if (result == CMD_ARGS_NOT_NUMBER) {
+        snprintf(out, cap, "Argument %d of %s must be a number.", bad, spec->name);
+        return;
+    }
+    size_t len = snprintf(out, cap, "Usage: %s", spec->name);
+    int optional = 0;
+    for (const char* kind = spec->args; *kind && len < cap; kind++) {
+        const char* label = "<arg>";
+        switch (*kind) {
+        case '|': optional = 1; continue;
+        case 'F': label = "<name>"; break;
+        case 'U': label = "<user>"; break;
+        case 'P': label = "<R|W>"; break;
+        case 'N': label = "<number>"; break;
+        case 'R': label = "<text>"; break;
+        }
+        len += snprintf(out + len, cap - len, optional ? "[;%s]" : ";%s", label);
+    }
+}
+
+static inline unsigned long long command_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Counts one run of 'spec' that replied with 'status' (0 or an ERR_* code)
+// and began at command_clock() time 'started'.
+static inline void command_record(CommandSpec* spec, int status, unsigned long long started) {
+    __atomic_fetch_add(&spec->calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&spec->nanos, command_clock() - started, __ATOMIC_RELAXED);
+    if (status) __atomic_fetch_add(&spec->errors, 1, __ATOMIC_RELAXED);
+    if (status == ERR_PERMISSION_DENIED || status == ERR_NOT_OWNER) {
+        __atomic_fetch_add(&spec->denied, 1, __ATOMIC_RELAXED);
+    }
+}
+
+#define COMMAND_STATS_HEADER "command              needs     calls    errors    denied    avg us\n"
+
+// One line of a stats report for 'spec'. Returns its length.
+static inline int command_stats_line(const CommandSpec* spec, char* out, size_t cap) {
+    unsigned long calls = __atomic_load_n(&spec->calls, __ATOMIC_RELAXED);
+    unsigned long long nanos = __atomic_load_n(&spec->nanos, __ATOMIC_RELAXED);
+    const char* needs = spec->perm == PERM_READ ? "read" : spec->perm == PERM_WRITE ? "write"
+                      : spec->perm == PERM_OWNER ? "owner" : "-";
+    int n = snprintf(out, cap, "%-20s %-5s %9lu %9lu %9lu %9.1f\n", spec->name, needs, calls,
+                     __atomic_load_n(&spec->errors, __ATOMIC_RELAXED),
+                     __atomic_load_n(&spec->denied, __ATOMIC_RELAXED),
+                     calls ? nanos / 1000.0 / calls : 0.0);
+    return n < (int)cap ? n : (int)cap - 1;
+}
+
+#endif // COMMAND_TABLE_H
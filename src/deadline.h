@@ -0,0 +1,104 @@
+#ifndef DEADLINE_H
+#define DEADLINE_H
+
+/*
+ * deadline.h
+ *
+ * Time limits for blocking socket calls, shared by the Name Server and the
+ * client, so a peer that stops answering cannot hold a caller forever.
+ *
+ * A deadline is an absolute CLOCK_MONOTONIC time in milliseconds, so one
+ * deadline can cover every call an operation makes (connect, send, each
+ * read of a reply) rather than restarting with each one. 0 means none, in
+ * which case these are plain blocking calls.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+static inline long long deadline_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+// The deadline 'ms' from now, or none if 'ms' <= 0.
+static inline long long deadline_in(int ms) {
+    return ms > 0 ? deadline_now() + ms : 0;
+}
+
+// The earlier of two deadlines.
+static inline long long deadline_min(long long a, long long b) {
+    if (!a) return b;
+    if (!b) return a;
+    return a < b ? a : b;
+}
+
+// Milliseconds left, as a poll() timeout: -1 for no deadline, 0 once it
+// has passed.
+static inline int deadline_left(long long deadline) {
+    if (!deadline) return -1;
+    long long left = deadline - deadline_now();
+    return left > 0 ? (int)left : 0;
+}
+
+// Fills 'ts' with 'deadline' for pthread_cond_timedwait() on a condition
+// variable that uses CLOCK_MONOTONIC.
+static inline void deadline_timespec(long long deadline, struct timespec* ts) {
+    ts->tv_sec = deadline / 1000;
+    ts->tv_nsec = (deadline % 1000) * 1000000;
+}
+
+// Waits until 'sock' has 'events' (POLLIN, POLLOUT). Returns 1 when it
+// does, or 0 with errno ETIMEDOUT (or the poll() error).
+static inline int deadline_wait(int sock, short events, long long deadline) {
+    struct pollfd p = { sock, events, 0 };
+    while (1) {
+        int n = poll(&p, 1, deadline_left(deadline));
+        if (n > 0) return 1;
+        if (n == 0) {
+            errno = ETIMEDOUT;
+            return 0;
+        }
+        if (errno != EINTR) return 0;
+    }
+}
+
+// connect() that gives up at 'deadline': the connect runs non-blocking
+// and poll() waits for it. The socket is left blocking. Returns 0 on
+// success, -1 with errno set (ETIMEDOUT if time ran out).
+static inline int deadline_connect(int sock, const struct sockaddr* addr, socklen_t len, long long deadline) {
+    if (!deadline) return connect(sock, addr, len);
+    int flags = fcntl(sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(sock, F_SETFL, flags | O_NONBLOCK) < 0) return -1;
+    int result = connect(sock, addr, len);
+    if (result < 0 && errno == EINPROGRESS) {
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        if (!deadline_wait(sock, POLLOUT, deadline)) {
+            result = -1;
+        } else if (getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error) {
+            if (error) errno = error;
+            result = -1;
+        } else {
+            result = 0;
+        }
+    }
+    int saved = errno;
+    fcntl(sock, F_SETFL, flags);
+    errno = saved;
+    return result;
+}
+
+// recv() that returns -1 with errno ETIMEDOUT if nothing arrives by
+// 'deadline'.
+static inline ssize_t deadline_recv(int sock, void* buf, size_t len, int flags, long long deadline) {
+    if (deadline && !deadline_wait(sock, POLLIN, deadline)) return -1;
+    return recv(sock, buf, len, flags);
+}
+
+#endif // DEADLINE_H
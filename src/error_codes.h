@@ -14,6 +14,7 @@
 #define ERR_NO_SS_AVAILABLE 503
 #define ERR_SS_FAILURE 504
 #define ERR_INVALID_ARGS 422
+#define ERR_FILE_BUSY 423 // Another create, delete or move of it is in flight
 #define ERR_NOT_OWNER 401
 #define ERR_INVALID_INPUT     106
 #define ERR_SERVER_MISC       107
@@ -0,0 +1,197 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+/*
+ * frame.h
+ *
+ * Length-prefixed framing, shared by the Name Server, the Storage Servers
+ * and the client.
+ *
+ * A framed message is a FRAME_HEADER_LEN byte header followed by 'length'
+ * payload bytes. The payload is the text the line protocol would carry,
+ * minus the newline that ends a command and the "__END__" / "__SS_END__"
+ * line that ends a reply. The receiver knows from the header where a
+ * message stops, so it never scans for a terminator and a payload can hold
+ * any bytes, including those tokens.
+ *
+ * A reply may be sent as several FRAME_REPLY_PART frames and a final
+ * FRAME_REPLY, so a sender can stream output it has not finished producing.
+ * Every frame of a reply repeats the request ID and status of the request.
+ *
+ * Framing is opt-in, so older peers keep the text protocol:
+ *   - A client adds FRAME_CAPABILITY to REGISTER_CLIENT. If the Name
+ *     Server answers "ACK_CLIENT_REG;FRAMED/1" (still in text), everything
+ *     after that on the session is framed both ways.
+ *   - A Storage Server adds ";FRAMED/1" after its file list in REGISTER_SS,
+ *     and the Name Server then frames its own requests to that server and
+ *     tells framed clients so in their READ/WRITE/STREAM redirects.
+ *   - A Storage Server takes either form on any connection: a message that
+ *     starts with FRAME_MAGIC is a frame, anything else is a text line.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include "error_codes.h"
+#include "deadline.h"
+
+#define FRAME_MAGIC 0xF5          // Never the first byte of a text command
+#define FRAME_VERSION 1
+#define FRAME_CAPABILITY "FRAMED/1"
+#define FRAME_HEADER_LEN 16
+#define FRAME_MAX_REQUEST (32 * 1024) // Commands only; replies may be longer
+
+// Opcodes
+#define FRAME_REQUEST 1
+#define FRAME_REPLY 2      // The last (often only) frame of a reply
+#define FRAME_REPLY_PART 3 // More frames of this reply follow
+
+// Decoded header. On the wire: magic, version, opcode, flags (1 byte each),
+// status and a reserved field (2 bytes each), request ID and payload length
+// (4 bytes each), all in network byte order.
+typedef struct FrameHeader {
+    uint8_t opcode;
+    uint16_t status;     // 0, or the ERR_* code of an error reply
+    uint32_t request_id; // Chosen by the requester, echoed in the reply
+    uint32_t length;     // Payload bytes that follow the header
+} FrameHeader;
+
+static inline void frame_pack(unsigned char* out, int opcode, int status, uint32_t request_id, uint32_t length) {
+    uint16_t status_n = htons((uint16_t)status), reserved = 0;
+    uint32_t id_n = htonl(request_id), length_n = htonl(length);
+    out[0] = FRAME_MAGIC;
+    out[1] = FRAME_VERSION;
+    out[2] = (unsigned char)opcode;
+    out[3] = 0;
+    memcpy(out + 4, &status_n, 2);
+    memcpy(out + 6, &reserved, 2);
+    memcpy(out + 8, &id_n, 4);
+    memcpy(out + 12, &length_n, 4);
+}
+
+// Decodes a header. Returns 0 if it is not a frame this version understands.
+static inline int frame_unpack(const unsigned char* in, FrameHeader* h) {
+    if (in[0] != FRAME_MAGIC || in[1] != FRAME_VERSION) return 0;
+    uint16_t status_n;
+    uint32_t id_n, length_n;
+    memcpy(&status_n, in + 4, 2);
+    memcpy(&id_n, in + 8, 4);
+    memcpy(&length_n, in + 12, 4);
+    h->opcode = in[2];
+    h->status = ntohs(status_n);
+    h->request_id = ntohl(id_n);
+    h->length = ntohl(length_n);
+    return h->opcode >= FRAME_REQUEST && h->opcode <= FRAME_REPLY_PART;
+}
+
+// The status for a reply starting with 'text': the code of an
+// "ERROR;<code>;..." reply, or 0.
+static inline int frame_status_of(const char* text, size_t len) {
+    size_t prefix = sizeof(ERROR_PREFIX) - 1;
+    if (len <= prefix + 1 || memcmp(text, ERROR_PREFIX ";", prefix + 1) != 0) return 0;
+    int code = 0;
+    for (size_t i = prefix + 1; i < len && text[i] >= '0' && text[i] <= '9' && code < 10000; i++) {
+        code = code * 10 + (text[i] - '0');
+    }
+    return code;
+}
+
+// Writes all of 'iov', resuming after short writes. Returns 0 on failure.
+static inline int frame_writev_all(int sock, struct iovec* iov, int count) {
+    while (count > 0) {
+        ssize_t n = writev(sock, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 1;
+}
+
+// Sends one frame. Returns 0 if the peer is gone.
+static inline int frame_send(int sock, int opcode, int status, uint32_t request_id, const void* payload, size_t len) {
+    unsigned char header[FRAME_HEADER_LEN];
+    frame_pack(header, opcode, status, request_id, (uint32_t)len);
+    struct iovec iov[2] = { { header, FRAME_HEADER_LEN }, { (void*)payload, len } };
+    return frame_writev_all(sock, iov, len ? 2 : 1);
+}
+
+// Sends a text command as a request frame, without its trailing newline.
+static inline int frame_send_command(int sock, uint32_t request_id, const char* command) {
+    size_t len = strlen(command);
+    if (len && command[len - 1] == '\n') len--;
+    return frame_send(sock, FRAME_REQUEST, 0, request_id, command, len);
+}
+
+// Reads exactly 'len' bytes. Returns 0 if the connection failed first, or
+// if 'deadline' (deadline.h; 0 for none) passed.
+static inline int frame_recv_all_by(int sock, void* buf, size_t len, long long deadline) {
+    char* p = (char*)buf;
+    while (len > 0) {
+        ssize_t n = deadline_recv(sock, p, len, 0, deadline);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static inline int frame_recv_all(int sock, void* buf, size_t len) {
+    return frame_recv_all_by(sock, buf, len, 0);
+}
+
+// Reads and decodes the next header. Returns 0 on a failed connection or a
+// header that is not a frame.
+static inline int frame_recv_header_by(int sock, FrameHeader* h, long long deadline) {
+    unsigned char header[FRAME_HEADER_LEN];
+    return frame_recv_all_by(sock, header, sizeof(header), deadline) && frame_unpack(header, h);
+}
+
+static inline int frame_recv_header(int sock, FrameHeader* h) {
+    return frame_recv_header_by(sock, h, 0);
+}
+
+// Reads a whole reply (every part) into 'buf' as a string, keeping the
+// first cap - 1 bytes and dropping the rest. Returns the reply's status, or
+// -1 if the connection failed or the whole reply had not come by
+// 'deadline'.
+static inline int frame_recv_reply_by(int sock, char* buf, size_t cap, long long deadline) {
+    size_t used = 0;
+    FrameHeader h;
+    do {
+        if (!frame_recv_header_by(sock, &h, deadline)) return -1;
+        uint32_t left = h.length;
+        while (left > 0) {
+            char discard[1024];
+            size_t room = cap - 1 - used;
+            char* dest = room ? buf + used : discard;
+            size_t n = room ? room : sizeof(discard);
+            if (n > left) n = left;
+            if (!frame_recv_all_by(sock, dest, n, deadline)) return -1;
+            if (room) used += n;
+            left -= n;
+        }
+    } while (h.opcode == FRAME_REPLY_PART);
+    buf[used] = '\0';
+    return h.status;
+}
+
+static inline int frame_recv_reply(int sock, char* buf, size_t cap) {
+    return frame_recv_reply_by(sock, buf, cap, 0);
+}
+
+#endif // FRAME_H
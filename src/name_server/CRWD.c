@@ -17,276 +17,512 @@
 #include "../error_codes.h" // MODIFIED INCLUDE
 #include "../logger.h"
 #include "hash_table.h"
+#include "user_ids.h"
+#include "access_list.h"
+#include "user_files.h"
+#include "dir_index.h"
+#include "intents.h"
+#include "metadata_cache.h"
+#include "wal.h"
+#include "metadata_image.h"
+#include "response.h"
+#include "ss_pool.h"
+#include "ss_health.h"
+#include "placement.h"
 
 
 #define MAX_BUFFER_SIZE 1024
 #define SS_RESPONSE_LEN 4096 // For reading SS ACKs
-void save_metadata();
 void load_metadata();
+FileMetadata* image_fault_in(const char* filename);
+void image_fault_in_all();
+void image_fault_in_tree(const char* folder);
+void image_prefault(const char* filename);
+
+// --- Persistence files ---
+// metadata.img is the last checkpoint; metadata.wal holds every mutation
+// since. metadata.wal.old only exists while a checkpoint is in progress.
+// The .dat text files are the older checkpoint format, read only when there
+// is no image yet.
+#define METADATA_IMAGE "metadata.img"
+#define USER_DATA_FILE "user_data.dat"
+#define FILE_METADATA_FILE "file_metadata.dat"
+#define ANNOTATIONS_FILE "annotations.dat"
+#define METADATA_WAL "metadata.wal"
+#define METADATA_WAL_OLD "metadata.wal.old"
+#define CHECKPOINT_INTERVAL 30          // Seconds between checkpoints
+#define CHECKPOINT_WAL_BYTES (4 << 20)  // Checkpoint early past this much log
+
+// Metadata log record types. Stored on disk: never renumber.
+enum {
+    META_ADD_USER = 1,      // username
+    META_CREATE_FILE,       // filename, owner, ss_ip, ss_port, is_directory
+    META_DELETE_FILE,       // filename
+    META_SET_ACCESS,        // filename, username, permission
+    META_REMOVE_ACCESS,     // filename, username
+    META_ANNOTATE,          // filename, annotation
+    META_RENAME,            // filename, new filename
+    META_INTENT,            // filename, op, new filename, ss_ip, ss_port, tree (intents.h)
+    META_INTENT_DONE        // filename: its intent ended without changing the metadata
+};
 
 
 
-FileMetadata* file_list_head = NULL;
 StorageServer* ss_list_head = NULL;
-User* user_list_head = NULL;
-pthread_mutex_t data_mutex;
 HashTable* file_hash_table = NULL;
-#define CACHE_SIZE 16 // We will cache the 16 most recently accessed files
 
-// A node in the cache's linked list
-typedef struct CacheNode {
-    char key[100];
-    FileMetadata* file;
-    struct CacheNode *prev, *next;
-} CacheNode;
-
-// The cache object itself
-typedef struct {
-    int size;
-    CacheNode *head, *tail;
-    HashTable* lookup; // A separate hash table to quickly find nodes WITHIN the cache
-} LRUCache;
+// Object pools (slab.h) for the per-file structures
+_Static_assert(sizeof(FileMetadata) <= 64, "keep the hot file record to one cache line");
+SlabPool file_pool = SLAB_POOL("file", sizeof(FileMetadata), 64);
+SlabPool file_cold_pool = SLAB_POOL("file_cold", sizeof(FileColdData), 8);
+SlabPool request_pool = SLAB_POOL("request", sizeof(RequestNode), 8);
+
+// --- Lock hierarchy ---
+// Always acquire in this order (any subset), release in any order:
+//   1. ns_lock         file_hash_table, the directory tree and ss_list_head.
+//                      Shared for lookups; exclusive only to add, remove or
+//                      move entries.
+//                      Redirect lookups skip it entirely (see find_file_rcu).
+//   2. image_mutex     materializing files from the boot image (shared
+//                      ns_lock holders may add entries this way).
+//   3. dir_index.lock  the directory tree (dir_index.h), taken inside
+//                      file_link()/file_unlink()/file_move() and by walks.
+//   4. user_lock       who is registered, and from where (user_ids.h).
+//   5. file->cold->lock     per-file ACL, requests, annotation, counters.
+//   6. user_files_locks    each user's visible-file set (user_files.h).
+//   7. cache shard locks   metadata_cache.h, in front of file_hash_table.
+//   8. user_ids.lock   interning a new username (user_ids.h).
+//   9. wal.mutex       the metadata log buffer (wal.h). Never held across I/O.
+//  10. SsPool.lock, then an SsConn's send_lock or turn_lock   connections
+//                      to Storage Servers (ss_pool.h). The pool lock is
+//                      never held across connect() or a reply.
+//  11. slab pool and arena locks   object allocation (slab.h). Leaves.
+// Mutations append their log record while still holding the locks that
+// ordered them, then wait for it with wal_commit() after unlocking.
+// No lock is held across a request to a Storage Server: CREATE, DELETE and
+// MOVE reserve their paths (intents.h) and take ns_lock again afterwards.
+pthread_rwlock_t ns_lock = PTHREAD_RWLOCK_INITIALIZER;
+pthread_rwlock_t user_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+// Resolves 'path' through the directory tree (dir_index.h) to its entry in
+// file_hash_table: one probe per directory along the way, plus one for the
+// entry. Takes no lock: call with ns_lock held or inside an epoch read
+// section.
+FileMetadata* file_lookup(const char* path) {
+    const char* leaf;
+    DirNode* dir = dir_resolve(path, &leaf, 0);
+    if (!dir) return NULL;
+    char key[DIR_KEY_MAX];
+    dir_entry_key(key, dir->ino, leaf, strlen(leaf));
+    return (FileMetadata*) ht_search(file_hash_table, key);
+}
 
-// Global pointer to our cache
-LRUCache* file_cache = NULL;
+// Helper to find a file (UPGRADED WITH CACHE)
+// Caller must hold ns_lock (shared is enough).
+FileMetadata* find_file(const char* filename) {
+    // Step 1: Try to get the file from the metadata cache.
+    FileMetadata* file = cache_lookup(filename);
+    
+    if (!file) {
+        // Step 2: If it was a cache MISS, search the main hash table.
+        file = file_lookup(filename);
 
-// --- LRU Cache Helper Functions ---
+        // Files untouched since boot are still in the mapped image.
+        if (!file) {
+            file = image_fault_in(filename);
+        }
 
-// Detaches a node from the cache's internal linked list
-void detach_node(CacheNode* node) {
-    if (node->prev) {
-        node->prev->next = node->next;
-    } else { // It was the head
-        file_cache->head = node->next;
-    }
-    
-    if (node->next) {
-        node->next->prev = node->prev;
-    } else { // It was the tail
-        file_cache->tail = node->prev;
+        // Step 3: If we found it, offer it to the cache for next time.
+        if (file) {
+            cache_admit(filename, file);
+        }
     }
+    return file;
 }
 
-// Attaches a node to the front (most-recently-used position) of the list
-void attach_node(CacheNode* node) {
-    node->next = file_cache->head;
-    node->prev = NULL;
-    if (file_cache->head) {
-        file_cache->head->prev = node;
-    }
-    file_cache->head = node;
-    if (file_cache->tail == NULL) {
-        file_cache->tail = node;
+// Looks up a file and locks it for a handler: ns_lock shared, plus the
+// file's own lock (exclusive if 'exclusive'). Returns NULL, holding nothing,
+// if the file does not exist. Pair with release_file().
+FileMetadata* acquire_file(const char* filename, int exclusive) {
+    pthread_rwlock_rdlock(&ns_lock);
+    FileMetadata* file = find_file(filename);
+    if (!file) {
+        pthread_rwlock_unlock(&ns_lock);
+        return NULL;
     }
+    if (exclusive) pthread_rwlock_wrlock(&file->cold->lock);
+    else pthread_rwlock_rdlock(&file->cold->lock);
+    return file;
 }
 
-// Tries to get a file from the cache.
-FileMetadata* lru_get(const char* key) {
-    if (!file_cache) return NULL;
-    // Use the cache's internal hash table to find the node
-    CacheNode* node = (CacheNode*) ht_search(file_cache->lookup, key);
-    
-    if (node) {
-        // CACHE HIT!
-        log_message(LOG_DEBUG, "Cache", "HIT");
-        // Move the accessed node to the front of the list
-        detach_node(node);
-        attach_node(node);
-        return node->file;
-    }
-    
-    // CACHE MISS!
-    log_message(LOG_DEBUG, "Cache", "MISS");
-    return NULL;
+void release_file(FileMetadata* file) {
+    pthread_rwlock_unlock(&file->cold->lock);
+    pthread_rwlock_unlock(&ns_lock);
 }
-// Puts a file into the cache.
-void lru_put(FileMetadata* file) {
-    if (!file_cache || !file) return;
 
-    // First, check if it's already in the cache
-    CacheNode* node = (CacheNode*) ht_search(file_cache->lookup, file->filename);
-    if (node) { 
-        // It exists, just move it to the front
-        detach_node(node);
-        attach_node(node);
-    } else {
-        // It's a new entry for the cache
-        if (file_cache->size == CACHE_SIZE) {
-            // Cache is full. Evict the least recently used item (the tail).
-            CacheNode* tail_node = file_cache->tail;
-            log_message(LOG_DEBUG, "Cache", "EVICT");
-            detach_node(tail_node);
-            ht_delete(file_cache->lookup, tail_node->key);
-            free(tail_node);
-            file_cache->size--;
-        }
-        
-        // Add the new file to the front of the cache
-        CacheNode* new_node = (CacheNode*)malloc(sizeof(CacheNode));
-        strcpy(new_node->key, file->filename);
-        new_node->file = file;
-        
-        attach_node(new_node);
-        // We "trick" the hash table by casting our CacheNode to a FileMetadata pointer.
-        // This is safe because we only ever access the 'key' field for searching.
-        ht_insert(file_cache->lookup, new_node->key, new_node);
-        file_cache->size++;
-    }
+// Lock-free lookup for the redirect handlers (READ, WRITE, STREAM), which
+// only need the immutable fields plus check_permission(). Call between
+// epoch_enter() and epoch_exit(); the result is valid until epoch_exit().
+// It skips the metadata cache, which would only add a second lookup.
+FileMetadata* find_file_rcu(const char* filename) {
+    return file_lookup(filename);
 }
-// +++ END OF THE CACHE CODE BLOCK +++
 
+// Writes the file's full path to 'buf' (DIR_PATH_MAX bytes) and returns it.
+// Caller holds ns_lock (shared is enough).
+const char* file_path(const FileMetadata* file, char* buf) {
+    if (!file->parent) { // Not linked yet: the key is still the path
+        snprintf(buf, DIR_PATH_MAX, "%s", file->key);
+        return buf;
+    }
+    return dir_path(file->parent, dir_key_name(file->key), buf);
+}
 
-// --- ADD THIS FUNCTION DEFINITION ---
-// Creates and initializes the global file_cache object
-void lru_init() {
-    file_cache = (LRUCache*)malloc(sizeof(LRUCache));
-    file_cache->size = 0;
-    file_cache->head = NULL;
-    file_cache->tail = NULL;
-    file_cache->lookup = ht_create(); // Each cache needs its own hash table
-    log_message(LOG_INFO, "Cache", "LRU Cache Initialized.");
+// The owner's name, resolved from its interned ID. Lives forever.
+const char* file_owner(const FileMetadata* file) {
+    return user_id_name(file->owner_id);
 }
 
-// Helper to find a file (UPGRADED WITH CACHE)
-FileMetadata* find_file(const char* filename) {
-    //pthread_mutex_lock(&data_mutex); // Lock before accessing shared data
+// The file's note, or "" if it has none. Caller holds the file lock.
+const char* file_annotation(const FileMetadata* file) {
+    return file->cold->annotation ? file->cold->annotation : "";
+}
 
-    // Step 1: Try to get the file from the LRU cache.
-    FileMetadata* file = (FileMetadata*) lru_get(filename);
-    
-    if (file) {
-        // It was a cache HIT! We can unlock and return immediately.
-        //pthread_mutex_unlock(&data_mutex);
-        return file;
+// Replaces the file's note ("" removes it). Caller holds the file lock
+// exclusively. Returns 0 if out of memory, leaving the old note.
+int file_set_annotation(FileMetadata* file, const char* note) {
+    char* copy = NULL;
+    if (note[0]) {
+        copy = slab_strndup(note, 255);
+        if (!copy) return 0;
     }
+    slab_strfree(file->cold->annotation);
+    file->cold->annotation = copy;
+    return 1;
+}
 
-    // Step 2: If it was a cache MISS, search the main hash table.
-    file = (FileMetadata*) ht_search(file_hash_table, filename);
+// Allocates metadata with every field initialized. The owner always gets an
+// explicit 'W' entry, matching what load_metadata() rebuilds; 'extra' more
+// ACL entries (ACL_ENTRY values, e.g. from a saved image) may be passed in.
+// Names are cut at 99 characters and owners at 49, as the text format did.
+FileMetadata* file_metadata_create_acl(const char* filename, const char* owner, StorageServer* ss, int is_directory,
+                                       const uint32_t* extra, uint32_t extra_count) {
+    FileMetadata* file = (FileMetadata*)slab_alloc(&file_pool);
+    if (!file) return NULL;
+    memset(file, 0, sizeof(FileMetadata));
+    file->cold = (FileColdData*)slab_alloc(&file_cold_pool);
+    file->key = slab_strndup(filename, 99); // file_link() turns it into the real key
+    if (!file->cold || !file->key) {
+        slab_free(&file_cold_pool, file->cold);
+        slab_strfree((char*)file->key);
+        slab_free(&file_pool, file);
+        return NULL;
+    }
+    memset(file->cold, 0, sizeof(FileColdData));
+    char owner_name[50] = "";
+    strncpy(owner_name, owner, sizeof(owner_name) - 1);
+    file->owner_id = user_id_intern(owner_name);
+    file->is_directory = is_directory;
+    file->last_access = time(NULL);
+    file->ss = ss;
+    file->dir_slot = DIR_SLOT_NONE;
+    pthread_rwlock_init(&file->cold->lock, NULL);
 
-    // Step 3: If we found it in the main table, add it to the cache for next time.
-    if (file) {
-        lru_put(file);
+    uint32_t* entries = (uint32_t*)malloc((extra_count + 1) * sizeof(uint32_t));
+    if (entries) {
+        if (extra_count) memcpy(entries, extra, extra_count * sizeof(uint32_t));
+        entries[extra_count] = ACL_ENTRY(file->owner_id, 'W');
+        file->acl = acl_build(entries, extra_count + 1);
+        free(entries);
     }
-    
-    //pthread_mutex_unlock(&data_mutex);
     return file;
-    //return ht_search(file_hash_table, filename);
 }
 
-// 'R' = Read, 'W' = Write (no change)
-int check_permission(FileMetadata* file, const char* username, char perm) {
-    if (strcmp(file->owner, username) == 0) {
-        return 1; // Owner has all permissions
-    }
-    AccessNode* current = file->access_list;
-    while (current) {
-        if (strcmp(current->username, username) == 0) {
-            if (current->permission == 'W' || current->permission == perm) {
-                return 1;
-            }
-        }
-        current = current->next;
-    }
-    return 0; // No permission
+FileMetadata* file_metadata_create(const char* filename, const char* owner, StorageServer* ss, int is_directory) {
+    return file_metadata_create_acl(filename, owner, ss, is_directory, NULL, 0);
 }
 
-// +++ ADDED: Helper function for NS to command SS +++
-// This is used for the NM-mediated CREATE and DELETE flows.
-// Returns 1 on success, 0 on failure. Fills response_buffer.
-int connect_and_send_to_ss(const char* ip, int port, const char* command, char* response_buffer) {
-    int sock;
-    struct sockaddr_in ss_addr;
-
-    sock = socket(AF_INET, SOCK_STREAM, 0);
-    if (sock == -1) {
-        perror("[NS] Could not create socket to SS");
-        snprintf(response_buffer, SS_RESPONSE_LEN, "ERROR: NS could not create socket to SS");
-        return 0;
-    }
+void file_metadata_free(FileMetadata* file) {
+    acl_free(file->acl);
+    RequestNode* req = file->cold->pending_requests;
+    while (req) {
+        RequestNode* temp = req;
+        req = req->next;
+        slab_free(&request_pool, temp);
+    }
+    slab_strfree(file->cold->annotation);
+    pthread_rwlock_destroy(&file->cold->lock);
+    slab_free(&file_cold_pool, file->cold);
+    slab_strfree((char*)file->key);
+    slab_free(&file_pool, file);
+}
 
-    ss_addr.sin_addr.s_addr = inet_addr(ip);
-    ss_addr.sin_family = AF_INET;
-    ss_addr.sin_port = htons(port);
+// epoch_retire() callback for metadata unlinked from the namespace
+void file_metadata_free_deferred(void* file) {
+    file_metadata_free((FileMetadata*)file);
+}
 
-    if (connect(sock, (struct sockaddr*)&ss_addr, sizeof(ss_addr)) < 0) {
-        perror("[NS] SS Connect failed");
-        snprintf(response_buffer, SS_RESPONSE_LEN, "ERROR: NS could not connect to SS");
-        close(sock);
+// Adds 'file' to the namespace: the directory tree, file_hash_table, its
+// owner's file count and the visible-file sets of everyone who can see it.
+// Caller holds ns_lock exclusively, or shared plus image_mutex (see
+// image_materialize()); lookups holding ns_lock shared may run alongside.
+// Returns 0 if out of memory; the caller still owns the file.
+int file_link(FileMetadata* file) {
+    if (!dir_index_add(file)) {
+        log_message(LOG_ERROR, "Namespace", "Out of memory; could not add a file.");
         return 0;
     }
-
-    // Send command to SS
-    if (send(sock, command, strlen(command), 0) < 0) {
-        perror("[NS] Send to SS failed");
-        snprintf(response_buffer, SS_RESPONSE_LEN, "ERROR: NS could not send to SS");
-        close(sock);
+    if (!ht_insert(file_hash_table, file->key, file)) {
+        dir_index_remove(file);
+        log_message(LOG_ERROR, "Namespace", "Out of memory; could not add a file.");
         return 0;
     }
+    user_files_link(file);
+    UserRecord* owner = user_record(file->owner_id);
+    if (owner) __atomic_fetch_add(&owner->owned_files, 1, __ATOMIC_RELAXED);
+    return 1;
+}
 
-    // Read loop to get the full response until __SS_END__
-    int total_read = 0;
-    int read_size;
-    response_buffer[0] = '\0';
+// Takes 'file' back out of the namespace and the metadata cache. The caller
+// still owns it: free it with epoch_retire() if lock-free readers may hold
+// it. Caller holds ns_lock exclusively.
+void file_unlink(FileMetadata* file) {
+    char path[DIR_PATH_MAX];
+    cache_remove(file_path(file, path)); // The cache must not keep a dangling pointer
+    ht_delete(file_hash_table, file->key);
+    dir_index_remove(file);
+    user_files_unlink(file);
+    UserRecord* owner = user_record(file->owner_id);
+    if (owner) __atomic_fetch_sub(&owner->owned_files, 1, __ATOMIC_RELAXED);
+}
 
-    while ((read_size = recv(sock, response_buffer + total_read, SS_RESPONSE_LEN - total_read - 1, 0)) > 0) {
-        total_read += read_size;
-        response_buffer[total_read] = '\0';
-        if (strstr(response_buffer, "__SS_END__")) {
-            break;
-        }
-    }
+// Replaces a file's ACL with 'acl' (built by acl_with()/acl_without()) and
+// updates the visible-file sets to match. Readers in check_permission()
+// load it without the file lock, so the old list is retired rather than
+// freed. Caller holds the file lock exclusively and is not inside an epoch
+// read section.
+void acl_publish(FileMetadata* file, AccessList* acl) {
+    AccessList* old = file->acl;
+    __atomic_store_n(&file->acl, acl, __ATOMIC_RELEASE);
+    user_files_acl_changed(file, old, acl);
+    if (old) epoch_retire(old, acl_free);
+}
 
-    if (read_size <= 0) {
-        perror("[NS] Recv from SS failed");
-        snprintf(response_buffer, SS_RESPONSE_LEN, "ERROR: NS did not receive reply from SS");
-        close(sock);
-        return 0;
-    }
+// --- Metadata log ---
+// Each helper appends one record and returns its LSN for wal_commit().
+// Call them right after the in-memory change, under the same locks.
+
+uint64_t meta_log_add_user(const char* username) {
+    WalRecord rec;
+    wal_record_init(&rec, META_ADD_USER);
+    wal_put_str(&rec, username);
+    return wal_append(&rec);
+}
+
+uint64_t meta_log_create_file(FileMetadata* file) {
+    WalRecord rec;
+    char path[DIR_PATH_MAX];
+    wal_record_init(&rec, META_CREATE_FILE);
+    wal_put_str(&rec, file_path(file, path));
+    wal_put_str(&rec, file_owner(file));
+    wal_put_str(&rec, file->ss ? file->ss->ip_addr : "");
+    wal_put_int(&rec, file->ss ? file->ss->port : 0);
+    wal_put_int(&rec, file->is_directory);
+    return wal_append(&rec);
+}
+
+uint64_t meta_log_delete_file(const char* filename) {
+    WalRecord rec;
+    wal_record_init(&rec, META_DELETE_FILE);
+    wal_put_str(&rec, filename);
+    return wal_append(&rec);
+}
+
+uint64_t meta_log_set_access(const char* filename, const char* username, char permission) {
+    char perm[2] = { permission, '\0' };
+    WalRecord rec;
+    wal_record_init(&rec, META_SET_ACCESS);
+    wal_put_str(&rec, filename);
+    wal_put_str(&rec, username);
+    wal_put_str(&rec, perm);
+    return wal_append(&rec);
+}
+
+uint64_t meta_log_remove_access(const char* filename, const char* username) {
+    WalRecord rec;
+    wal_record_init(&rec, META_REMOVE_ACCESS);
+    wal_put_str(&rec, filename);
+    wal_put_str(&rec, username);
+    return wal_append(&rec);
+}
+
+uint64_t meta_log_annotate(const char* filename, const char* note) {
+    WalRecord rec;
+    wal_record_init(&rec, META_ANNOTATE);
+    wal_put_str(&rec, filename);
+    wal_put_str(&rec, note);
+    return wal_append(&rec);
+}
+
+uint64_t meta_log_rename(const char* filename, const char* new_filename) {
+    WalRecord rec;
+    wal_record_init(&rec, META_RENAME);
+    wal_put_str(&rec, filename);
+    wal_put_str(&rec, new_filename);
+    return wal_append(&rec);
+}
+
+// Unlike the others, this one goes to disk before the change is made: the
+// caller waits for it with wal_commit() before contacting the SS.
+uint64_t meta_log_intent(const NsIntent* in) {
+    WalRecord rec;
+    wal_record_init(&rec, META_INTENT);
+    wal_put_str(&rec, in->path);
+    wal_put_int(&rec, in->op);
+    wal_put_str(&rec, in->new_path ? in->new_path : "");
+    wal_put_str(&rec, in->ss->ip_addr);
+    wal_put_int(&rec, in->ss->port);
+    wal_put_int(&rec, in->tree);
+    return wal_append(&rec);
+}
+
+uint64_t meta_log_intent_done(const char* filename) {
+    WalRecord rec;
+    wal_record_init(&rec, META_INTENT_DONE);
+    wal_put_str(&rec, filename);
+    return wal_append(&rec);
+}
 
-    // Clean up the __SS_END__ token
-    char* end_token = strstr(response_buffer, "__SS_END__");
-    if (end_token) {
-        *end_token = '\0';
+// 'R' = Read, 'W' = Write (no change). 'user' is an interned user ID; use
+// this form when checking many files for the same user.
+// Safe with either the file lock held or inside an epoch read section.
+int check_permission_id(FileMetadata* file, uint32_t user, char perm) {
+    if (user == USER_ID_NONE) return 0; // Never seen: owns nothing, in no ACL
+    if (user == file->owner_id) {
+        return 1; // Owner has all permissions
     }
+    char granted = acl_lookup(__atomic_load_n(&file->acl, __ATOMIC_ACQUIRE), user);
+    return granted == 'W' || (granted && granted == perm);
+}
 
-    close(sock);
-    return 1;
+int check_permission(FileMetadata* file, const char* username, char perm) {
+    return check_permission_id(file, user_id_lookup(username), perm);
 }
-User* find_user(const char* username) {
-    User* current = user_list_head;
-    while (current) {
-        if (strcmp(current->username, username) == 0) {
-            return current;
+
+// +++ ADDED: Helper function for NS to command SS +++
+// This is used for the NM-mediated CREATE and DELETE flows.
+// Returns 1 on success, 0 on failure. Fills response_buffer.
+// A server that registered with FRAMED/1 gets a request frame and answers
+// in frames (frame.h); any other gets the text line and ends its reply with
+// __SS_END__. The connection comes from the server's pool (ss_pool.h), and
+// the whole exchange must finish within ss_timeout_ms.
+// A command is only sent again when the SS cannot have run it: after a
+// failed connect (up to ss_max_attempts, with backoff, within the SS's
+// retry budget), or once when a reused idle connection turns out to be
+// dead.
+int connect_and_send_to_ss(StorageServer* ss, const char* command, char* response_buffer) {
+    long long deadline = deadline_in(ss_timeout_ms);
+    int backoff_ms = SS_RETRY_BACKOFF_MS, idle_retried = 0, connected = 0, result = SS_REQ_FAILED;
+    for (int attempt = 1;; attempt++) {
+        int how;
+        SsConn* conn = ss_pool_acquire(ss, &how, deadline);
+        if (conn) {
+            connected = 1;
+            result = ss_conn_request(conn, command, response_buffer, SS_RESPONSE_LEN, deadline);
+            ss_pool_release(ss, conn, result);
+            if (result == SS_REQ_OK) return 1;
+            if (result == SS_REQ_FAILED && how == SS_CONN_IDLE && !idle_retried) {
+                idle_retried = 1;
+                attempt--;
+                continue;
+            }
+            break; // The SS may have run it
         }
-        current = current->next;
+        result = errno == ETIMEDOUT ? SS_REQ_TIMEOUT : SS_REQ_FAILED;
+        if (attempt >= ss_max_attempts || deadline_left(deadline) <= backoff_ms || !ss_pool_may_retry(ss)) break;
+        usleep(backoff_ms * 1000);
+        backoff_ms *= 2;
+    }
+    if (!connected) ss_connect_failed(ss);
+    if (result == SS_REQ_TIMEOUT) {
+        printf("[NS] Request to SS at %s:%d timed out\n", ss->ip_addr, ss->port);
+        snprintf(response_buffer, SS_RESPONSE_LEN, "ERROR: NS timed out waiting for SS");
+    } else {
+        printf("[NS] Request to SS at %s:%d failed\n", ss->ip_addr, ss->port);
+        snprintf(response_buffer, SS_RESPONSE_LEN, "ERROR: NS could not reach SS");
+    }
+    return 0;
+}
+
+// Once a second, marks down Storage Servers whose heartbeats stopped
+// (ss_health.h). Every SS_POOL_IDLE_SECS / 6 it also closes pooled SS
+// connections left idle for SS_POOL_IDLE_SECS, so neither side keeps a
+// socket (nor the SS a thread) for a server nobody is using.
+static void* ss_monitor_main(void* arg) {
+    (void)arg;
+    for (unsigned long tick = 1;; tick++) {
+        sleep(1);
+        time_t now = time(NULL);
+        int reap = tick % (SS_POOL_IDLE_SECS / 6) == 0;
+        pthread_rwlock_rdlock(&ns_lock);
+        for (StorageServer* ss = ss_list_head; ss; ss = ss->next) {
+            ss_health_sweep(ss, now);
+            if (reap) ss_pool_reap(&ss->pool, now - SS_POOL_IDLE_SECS);
+        }
+        pthread_rwlock_unlock(&ns_lock);
     }
     return NULL;
 }
+
+void ss_monitor_start() {
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, ss_monitor_main, NULL) == 0) pthread_detach(tid);
+}
+
+// ";FRAMED/1" for a redirect to 'ss' on a framed session, so the client
+// frames its requests to that server as well; "" otherwise.
+static const char* redirect_framing(const Response* r, StorageServer* ss) {
+    return r->framed && __atomic_load_n(&ss->framed, __ATOMIC_RELAXED) ? ";" FRAME_CAPABILITY : "";
+}
+// Returns 1 if 'username' has registered. Takes no lock.
+int user_exists(const char* username) {
+    UserRecord* record = user_record(user_id_lookup(username));
+    return record && __atomic_load_n(&record->registered, __ATOMIC_ACQUIRE);
+}
+
+// Marks 'username' as registered from 'ip_addr' and returns its record, or
+// NULL if out of memory. Sets '*was_new' if it had not registered before.
+// Takes user_lock itself.
+UserRecord* user_set_registered(const char* username, const char* ip_addr, int* was_new) {
+    UserRecord* record = user_record(user_id_intern(username));
+    if (!record) return NULL;
+    pthread_rwlock_wrlock(&user_lock);
+    *was_new = !record->registered;
+    strncpy(record->ip_addr, ip_addr, sizeof(record->ip_addr) - 1);
+    __atomic_store_n(&record->registered, 1, __ATOMIC_RELEASE);
+    pthread_rwlock_unlock(&user_lock);
+    return record;
+}
 // Add this entire function to CRWD.c, near the other "handle_" functions
 
 void handle_info(int sock, const char* filename, const char* username) {
-    char response[MAX_BUFFER_SIZE * 2] = ""; // Increased buffer size
-    int len = 0;
+    Response r;
+    resp_init(&r, sock);
 
-    pthread_mutex_lock(&data_mutex);
-
-    FileMetadata* file = find_file(filename);
+    FileMetadata* file = acquire_file(filename, 0);
 
     // 1. Check if file exists
     if (!file) {
-        snprintf(response, sizeof(response), "%s;%d;File '%s' not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
-        pthread_mutex_unlock(&data_mutex);
-        strcat(response, "__END__\n");
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File '%s' not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
+        resp_end(&r);
         return;
     }
 
     // 2. Check for read permission
     if (!check_permission(file, username, 'R')) {
-        snprintf(response, sizeof(response), "%s;%d;Permission denied for file '%s'.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
-        pthread_mutex_unlock(&data_mutex);
-        strcat(response, "__END__\n");
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;Permission denied for file '%s'.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
+        release_file(file);
+        resp_end(&r);
         return;
     }
 
@@ -297,494 +533,776 @@ void handle_info(int sock, const char* filename, const char* username) {
     strftime(time_buf, sizeof(time_buf), "%Y-%m-%d %H:%M:%S", localtime(&file->last_access));
 
     // Add file details
-    len += snprintf(response + len, sizeof(response) - len, "File: %s\n", file->filename);
-    len += snprintf(response + len, sizeof(response) - len, "Owner: %s\n", file->owner);
-    len += snprintf(response + len, sizeof(response) - len, "Last Modified: %s\n", time_buf);
-    len += snprintf(response + len, sizeof(response) - len, "Word Count: %d\n", file->word_count);
-    len += snprintf(response + len, sizeof(response) - len, "Char Count: %d\n", file->char_count);
+    char path[DIR_PATH_MAX];
+    resp_printf(&r, "File: %s\n", file_path(file, path));
+    resp_printf(&r, "Owner: %s\n", file_owner(file));
+    resp_printf(&r, "Last Modified: %s\n", time_buf);
+    resp_printf(&r, "Word Count: %d\n", file->cold->word_count);
+    resp_printf(&r, "Char Count: %d\n", file->cold->char_count);
 
     // Add access list
-    len += snprintf(response + len, sizeof(response) - len, "Access: ");
-    len += snprintf(response + len, sizeof(response) - len, "%s (RW)", file->owner); // Owner
+    resp_printf(&r, "Access: ");
+    resp_printf(&r, "%s (RW)", file_owner(file)); // Owner
 
-    AccessNode* current = file->access_list;
-    while (current) {
-        if (len < sizeof(response) - 100) {
-            len += snprintf(response + len, sizeof(response) - len, ", %s (%c)", current->username, current->permission);
-        }
-        current = current->next;
+    uint32_t pos = 0, user;
+    char perm;
+    while (acl_next(file->acl, &pos, &user, &perm)) {
+        resp_printf(&r, ", %s (%c)", user_id_name(user), perm);
     }
-    len += snprintf(response + len, sizeof(response) - len, "\n");
+    resp_printf(&r, "\n");
 
-    pthread_mutex_unlock(&data_mutex);
+    release_file(file);
 
     // 4. Send the final response
-    strncat(response, "__END__\n", sizeof(response) - strlen(response) - 1);
-    send(sock, response, strlen(response), 0);
+    resp_end(&r);
 }
 void handle_add_access(int sock, const char* filename, const char* target_user, const char* perm, const char* current_user)
 {
-    char response[MAX_BUFFER_SIZE];
-    int access_updated = 0; // Flag to see if we updated an existing node
+    Response r;
+    resp_init(&r, sock);
 
-    pthread_mutex_lock(&data_mutex);
+    // Resolve the target before taking the file lock.
+    int target_exists = user_exists(target_user);
+    uint32_t target_id = target_exists ? user_id_intern(target_user) : USER_ID_NONE;
 
-    FileMetadata* file = find_file(filename);
+    FileMetadata* file = acquire_file(filename, 1);
 
     // 1. Check 1: Does the file exist?
     if (!file) {
-        snprintf(response, sizeof(response), "%s;%d;File '%s' not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
-        pthread_mutex_unlock(&data_mutex);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File '%s' not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
+        resp_end(&r);
         return;
     }
 
     // 2. Check 2: Is the current user the owner?
-    if (strcmp(file->owner, current_user) != 0) {
-        snprintf(response, sizeof(response), "%s;%d;Only the file owner ('%s') can change permissions.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, file->owner);
-        pthread_mutex_unlock(&data_mutex);
-        send(sock, response, strlen(response), 0);
+    if (strcmp(file_owner(file), current_user) != 0) {
+        resp_printf(&r, "%s;%d;Only the file owner ('%s') can change permissions.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, file_owner(file));
+        release_file(file);
+        resp_end(&r);
         return;
     }
 
     // 3. Check 3: Does the target user exist in the system? (Per Q&A)
-    if (find_user(target_user) == NULL) {
-        snprintf(response, sizeof(response), "%s;%d;User '%s' is not registered in the system.\n__END__\n", ERROR_PREFIX, ERR_USER_NOT_FOUND, target_user);
-        pthread_mutex_unlock(&data_mutex);
-        send(sock, response, strlen(response), 0);
+    if (!target_exists) {
+        resp_printf(&r, "%s;%d;User '%s' is not registered in the system.\n", ERROR_PREFIX, ERR_USER_NOT_FOUND, target_user);
+        release_file(file);
+        resp_end(&r);
         return;
     }
 
     // 4. Check 4: Is the permission flag valid?
     if (perm[0] != 'R' && perm[0] != 'W') {
-         snprintf(response, sizeof(response), "%s;%d;Invalid permission '%s'. Must be 'R' or 'W'.\n__END__\n", ERROR_PREFIX, ERR_INVALID_INPUT, perm);
-        pthread_mutex_unlock(&data_mutex);
-        send(sock, response, strlen(response), 0);
+         resp_printf(&r, "%s;%d;Invalid permission '%s'. Must be 'R' or 'W'.\n", ERROR_PREFIX, ERR_INVALID_INPUT, perm);
+        release_file(file);
+        resp_end(&r);
         return;
     }
 
-    // 5. Logic: Find and update, or create new access node
-    AccessNode* current = file->access_list;
-    while(current) {
-        if (strcmp(current->username, target_user) == 0) {
-            // Found the user! Just update their permission.
-            current->permission = perm[0];
-            access_updated = 1;
-            break;
-        }
-        current = current->next;
-    }
-
-    if (!access_updated) {
-        // User was not in the list, create a new node
-        AccessNode* new_node = (AccessNode*)malloc(sizeof(AccessNode));
-        if (!new_node) {
-             snprintf(response, sizeof(response), "%s;%d;Name Server out of memory.\n__END__\n", ERROR_PREFIX, ERR_SERVER_MISC);
-             pthread_mutex_unlock(&data_mutex);
-             send(sock, response, strlen(response), 0);
-             return;
-        }
-        strcpy(new_node->username, target_user);
-        new_node->permission = perm[0];
-
-        // Add to the head of the list
-        new_node->next = file->access_list;
-        file->access_list = new_node;
+    // 5. Logic: Set the user's entry (added, or updated in place)
+    AccessList* acl = target_id != USER_ID_NONE ? acl_with(file->acl, target_id, perm[0]) : NULL;
+    if (!acl) {
+        resp_printf(&r, "%s;%d;Name Server out of memory.\n", ERROR_PREFIX, ERR_SERVER_MISC);
+        release_file(file);
+        resp_end(&r);
+        return;
     }
+    acl_publish(file, acl);
 
     // 6. Send success response
-    snprintf(response, sizeof(response), "Access for '%s' on '%s' set to '%c'.\n__END__\n", target_user, filename, perm[0]);
-    save_metadata();
-    pthread_mutex_unlock(&data_mutex);
-    send(sock, response, strlen(response), 0);
+    resp_printf(&r, "Access for '%s' on '%s' set to '%c'.\n", target_user, filename, perm[0]);
+    uint64_t lsn = meta_log_set_access(filename, target_user, perm[0]);
+    release_file(file);
+    wal_commit(lsn);
+    resp_end(&r);
 }
 
 
 // --- COMPLETED FUNCTION ---
 void handle_rem_access(int sock, const char* filename, const char* target_user, const char* current_user)
 {
-    char response[MAX_BUFFER_SIZE];
+    Response r;
+    resp_init(&r, sock);
     int node_found = 0;
+    uint64_t lsn = 0;
+    uint32_t target_id = user_id_lookup(target_user);
 
-    pthread_mutex_lock(&data_mutex);
-
-    FileMetadata* file = find_file(filename);
+    FileMetadata* file = acquire_file(filename, 1);
 
     // 1. Check 1: Does the file exist?
     if (!file) {
-        snprintf(response, sizeof(response), "%s;%d;File '%s' not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
-        pthread_mutex_unlock(&data_mutex);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File '%s' not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
+        resp_end(&r);
         return;
     }
 
     // 2. Check 2: Is the current user the owner?
-    if (strcmp(file->owner, current_user) != 0) {
-        snprintf(response, sizeof(response), "%s;%d;Only the file owner ('%s') can change permissions.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, file->owner);
-        pthread_mutex_unlock(&data_mutex);
-        send(sock, response, strlen(response), 0);
-        return;
-    }
-
-    // 3. Logic: Find and remove the node
-    AccessNode* current = file->access_list;
-    AccessNode* prev = NULL;
-
-    while (current != NULL) {
-        if (strcmp(current->username, target_user) == 0) {
-            // Found the node to remove
-            node_found = 1;
-            if (prev == NULL) {
-                // It's the head of the list
-                file->access_list = current->next;
-            } else {
-                // It's in the middle or at the end
-                prev->next = current->next;
-            }
-            free(current);
-            break;
+    if (strcmp(file_owner(file), current_user) != 0) {
+        resp_printf(&r, "%s;%d;Only the file owner ('%s') can change permissions.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, file_owner(file));
+        release_file(file);
+        resp_end(&r);
+        return;
+    }
+
+    // 3. Logic: Find and remove the entry
+    if (acl_lookup(file->acl, target_id)) {
+        AccessList* acl = acl_without(file->acl, target_id);
+        if (!acl) {
+            resp_printf(&r, "%s;%d;Name Server out of memory.\n", ERROR_PREFIX, ERR_SERVER_MISC);
+            release_file(file);
+            resp_end(&r);
+            return;
         }
-        // Move to the next node
-        prev = current;
-        current = current->next;
+        acl_publish(file, acl);
+        node_found = 1;
+        lsn = meta_log_remove_access(filename, target_user);
     }
 
     // 4. Send response
     if (node_found) {
-        snprintf(response, sizeof(response), "Access for '%s' on '%s' has been removed.\n__END__\n", target_user, filename);
+        resp_printf(&r, "Access for '%s' on '%s' has been removed.\n", target_user, filename);
     } else {
-        snprintf(response, sizeof(response), "INFO: User '%s' had no special access on '%s' to remove.\n__END__\n", target_user, filename);
+        resp_printf(&r, "INFO: User '%s' had no special access on '%s' to remove.\n", target_user, filename);
     }
-    save_metadata();
-
-    pthread_mutex_unlock(&data_mutex);
-    send(sock, response, strlen(response), 0);
+    release_file(file);
+    wal_commit(lsn);
+    resp_end(&r);
 }
 
 // --- BONUS: Folder Functions ---
 
+// The Storage Server of the folder 'path' goes in, for placement_choose():
+// NULL unless co-locating, or if 'path' is at the top level or its folder
+// does not exist. Caller holds ns_lock.
+static StorageServer* parent_folder_ss(const char* path) {
+    if (!placement_colocate) return NULL;
+    const char* slash = strrchr(path, '/');
+    if (!slash || slash == path) return NULL;
+    char parent[256];
+    size_t len = slash - path;
+    if (len >= sizeof(parent)) return NULL;
+    memcpy(parent, path, len);
+    parent[len] = '\0';
+    FileMetadata* folder = find_file(parent);
+    return folder && folder->is_directory ? folder->ss : NULL;
+}
+
 void handle_create_folder(int sock, const char* foldername, const char* username) {
-    char response[MAX_BUFFER_SIZE];
+    Response r;
+    resp_init(&r, sock);
     
-    pthread_mutex_lock(&data_mutex);
+    pthread_rwlock_wrlock(&ns_lock);
 
     // Check if folder or file already exists
     if (find_file(foldername)) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Item '%s' already exists.\n__END__\n", ERROR_PREFIX, ERR_FILE_EXISTS, foldername);
-        send(sock, response, strlen(response), 0);
-        return;
-    }
-
-    // Create Metadata marked as directory
-    FileMetadata* newFile = (FileMetadata*)malloc(sizeof(FileMetadata));
-    strcpy(newFile->filename, foldername);
-    // Note: Ensure you added 'int is_directory;' to FileMetadata in types.h!
-    newFile->is_directory = 1; 
-    strcpy(newFile->owner, username);
-    newFile->word_count = 0;
-    newFile->char_count = 0;
-    newFile->last_access = time(NULL);
-    newFile->ss = ss_list_head; // Assign to a default SS
-    newFile->access_list = NULL; 
-    
-    // Add owner access
-    AccessNode* ownerAccess = (AccessNode*)malloc(sizeof(AccessNode));
-    strcpy(ownerAccess->username, username);
-    ownerAccess->permission = 'W'; 
-    ownerAccess->next = NULL;
-    newFile->access_list = ownerAccess;
-
-    // Add to lists
-    newFile->next = file_list_head;
-    file_list_head = newFile;
-    ht_insert(file_hash_table, newFile->filename, newFile);
-
-    save_metadata();
-    pthread_mutex_unlock(&data_mutex);
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;Item '%s' already exists.\n", ERROR_PREFIX, ERR_FILE_EXISTS, foldername);
+        resp_end(&r);
+        return;
+    }
+
+    if (intent_conflicts(foldername, 0)) {
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;'%s' is being changed by another request; try again.\n", ERROR_PREFIX, ERR_FILE_BUSY, foldername);
+        resp_end(&r);
+        return;
+    }
+
+    // A folder only exists in the metadata; its SS is where its files go
+    // when co-locating (placement.h). Every entry needs one, since READ,
+    // DELETE and checkpoints use it.
+    StorageServer* folder_ss = placement_choose(ss_list_head, parent_folder_ss(foldername));
+    if (!folder_ss) {
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;No Storage Servers available.\n", ERROR_PREFIX, ERR_NO_SS_AVAILABLE);
+        resp_end(&r);
+        return;
+    }
+
+    // Create Metadata marked as directory (owner gets 'W' access)
+    FileMetadata* newFile = file_metadata_create(foldername, username, folder_ss, 1);
+    if (!newFile || !file_link(newFile)) {
+        pthread_rwlock_unlock(&ns_lock);
+        if (newFile) file_metadata_free(newFile);
+        resp_printf(&r, "%s;%d;Name Server out of memory.\n", ERROR_PREFIX, ERR_SERVER_MISC);
+        resp_end(&r);
+        return;
+    }
+
+    uint64_t lsn = meta_log_create_file(newFile);
+    pthread_rwlock_unlock(&ns_lock);
+    wal_commit(lsn);
     
-    snprintf(response, sizeof(response), "Folder '%s' created successfully.\n__END__\n", foldername);
-    send(sock, response, strlen(response), 0);
+    resp_printf(&r, "Folder '%s' created successfully.\n", foldername);
+    resp_end(&r);
+}
+
+// --- Paged listings ---
+// VIEW, VIEWFOLDER and LIST_USERS answer one page at a time: at most
+// 'limit' lines and LISTING_PAGE_BYTES, built into a Response
+// (response.h) and sent after the locks are released. If anything is
+// left, the page ends with
+//   -- More: <command> <limit> <cursor> --
+// which is the user_client command for the next page; the cursor is
+// opaque to clients. Server and client memory stays at one page however
+// large the listing.
+#define LISTING_PAGE_BYTES (MAX_BUFFER_SIZE * 16)
+#define LISTING_DEFAULT_LIMIT 200
+#define LISTING_MAX_LIMIT 1000
+
+typedef struct ListingPage {
+    Response resp;
+    int limit;
+    int shown;
+    int more;                  // Set once a line did not fit
+    char cursor[DIR_PATH_MAX]; // Resume point: after the last line shown
+} ListingPage;
+
+// 'limit_str' is the client's page size; missing or 0 means 'default_limit'.
+void listing_init(ListingPage* page, int sock, const char* limit_str, int default_limit) {
+    int limit = limit_str ? atoi(limit_str) : 0;
+    page->limit = limit > 0 ? (limit < LISTING_MAX_LIMIT ? limit : LISTING_MAX_LIMIT) : default_limit;
+    page->shown = 0;
+    page->more = 0;
+    page->cursor[0] = '\0';
+    resp_init(&page->resp, sock);
+}
+
+// Appends one item, 'n' bytes of 'line', and remembers 'cursor' as the
+// place to resume after it. Returns 0 if the page is full, in which case
+// the item is left for the next page.
+int listing_add(ListingPage* page, const char* line, int n, const char* cursor) {
+    if (page->shown == page->limit || resp_length(&page->resp) + n > LISTING_PAGE_BYTES) {
+        page->more = 1;
+        return 0;
+    }
+    resp_write(&page->resp, line, n);
+    snprintf(page->cursor, sizeof(page->cursor), "%s", cursor);
+    page->shown++;
+    return 1;
+}
+
+// Ends the page, with the "More" line if items are left, and sends it.
+// 'command' is the client command the line repeats, arguments included.
+void listing_end(ListingPage* page, const char* command) {
+    if (page->more && page->shown) {
+        resp_printf(&page->resp, "-- More: %s %d %s --\n", command, page->limit, page->cursor);
+    }
+    resp_end(&page->resp);
+}
+
+// Looks up the entry a walk cursor names: its key in file_hash_table, which
+// survives renames of the folders above it. Caller holds ns_lock.
+FileMetadata* listing_cursor_entry(const char* cursor) {
+    return (FileMetadata*)ht_search(file_hash_table, cursor);
 }
 
-void handle_view_folder(int sock, const char* foldername) {
-    char response[MAX_BUFFER_SIZE * 4] = "";
-    size_t prefix_len = strlen(foldername);
+static int folder_listing_add(FileMetadata* file, const char* folder, void* arg) {
+    char line[DIR_PATH_MAX + 16];
+    int n = snprintf(line, sizeof(line), "-> %s%s%s\n", folder, dir_key_name(file->key), file->is_directory ? " (DIR)" : "");
+    if (n >= (int)sizeof(line)) n = sizeof(line) - 1;
+    return listing_add((ListingPage*)arg, line, n, file->key);
+}
 
-    pthread_mutex_lock(&data_mutex);
+// VIEWFOLDER;<folder>[;<limit>[;<cursor>]]: everything under the folder,
+// nested folders included, one page at a time.
+void handle_view_folder(int sock, const char* foldername, const char* limit_str, const char* after) {
+    ListingPage page;
+    listing_init(&page, sock, limit_str, LISTING_DEFAULT_LIMIT);
+    int resuming = after && *after && strcmp(after, "-") != 0;
+
+    // Only names and is_directory are read, and those never change,
+    // so the per-file locks are not needed.
+    pthread_rwlock_rdlock(&ns_lock);
+    image_fault_in_tree(foldername);
     
     // Check if folder exists
     FileMetadata* folder = find_file(foldername);
     if (!folder || !folder->is_directory) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Folder '%s' not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, foldername);
-        send(sock, response, strlen(response), 0);
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&page.resp, "%s;%d;Folder '%s' not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, foldername);
+        resp_end(&page.resp);
         return;
     }
 
-    snprintf(response, sizeof(response), "Contents of %s:\n----------------\n", foldername);
-
-    int found = 0;
-    for (FileMetadata* curr = file_list_head; curr != NULL; curr = curr->next) {
-        // Check if filename starts with "foldername/"
-        if (strncmp(curr->filename, foldername, prefix_len) == 0 && 
-            curr->filename[prefix_len] == '/') {
-            
-            strcat(response, "-> ");
-            strcat(response, curr->filename); 
-            if (curr->is_directory) strcat(response, " (DIR)");
-            strcat(response, "\n");
-            found = 1;
-        }
+    int valid = 1;
+    if (resuming) {
+        FileMetadata* from = listing_cursor_entry(after);
+        valid = from && dir_index_walk_after(foldername, from, folder_listing_add, &page);
+    } else {
+        resp_printf(&page.resp, "Contents of %s:\n----------------\n", foldername);
+        dir_index_walk(foldername, folder_listing_add, &page);
     }
-    
-    if (!found) strcat(response, "(Empty Folder)\n");
+    pthread_rwlock_unlock(&ns_lock);
 
-    pthread_mutex_unlock(&data_mutex);
-    strcat(response, "__END__\n");
-    send(sock, response, strlen(response), 0);
+    if (!valid) {
+        resp_printf(&page.resp, "%s;%d;Listing cursor '%s' is no longer valid; list again from the start.\n",
+                    ERROR_PREFIX, ERR_INVALID_INPUT, after);
+        resp_end(&page.resp);
+        return;
+    }
+    if (!resuming && page.shown == 0) resp_puts(&page.resp, "(Empty Folder)\n");
+    char command[DIR_PATH_MAX + 16];
+    snprintf(command, sizeof(command), "VIEWFOLDER %s", foldername);
+    listing_end(&page, command);
 }
 // MODIFIED: Complete rewrite to be NM-mediated
 void handle_create(int sock, const char* filename, const char* username) {
-    char response[MAX_BUFFER_SIZE];
+    Response r;
+    resp_init(&r, sock);
     char ss_command[MAX_BUFFER_SIZE];
     char ss_response[SS_RESPONSE_LEN];
+    NsIntent intent;
+    uint64_t lsn = 0;
 
-    pthread_mutex_lock(&data_mutex);
+    pthread_rwlock_wrlock(&ns_lock);
 
     if (find_file(filename)) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File '%s' already exists.\n__END__\n", ERROR_PREFIX, ERR_FILE_EXISTS, filename);
-        send(sock, response, strlen(response), 0);
-        return;
-    }
-
-    if (!ss_list_head) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;No Storage Servers available.\n__END__\n", ERROR_PREFIX, ERR_NO_SS_AVAILABLE);
-        send(sock, response, strlen(response), 0);
-        return;
-    }
-
-    StorageServer* target_ss = ss_list_head; // Simple load balancing: just pick the first
-
-    // --- 1. Add metadata to NS first ---
-    FileMetadata* newFile = (FileMetadata*)malloc(sizeof(FileMetadata));
-    strcpy(newFile->filename, filename);
-    strcpy(newFile->owner, username);
-    newFile->word_count = 0;
-    newFile->char_count = 0;
-    newFile->last_access = time(NULL);
-    newFile->ss = target_ss;
-    strcpy(newFile->annotation, ""); // Initialize empty note
-    AccessNode* ownerAccess = (AccessNode*)malloc(sizeof(AccessNode));
-    strcpy(ownerAccess->username, username);
-    ownerAccess->permission = 'W';
-    ownerAccess->next = NULL;
-    newFile->access_list = ownerAccess;
-
-    // NEW (update both):
-    newFile->next = file_list_head;
-    file_list_head = newFile;          // Add to linked list
-    ht_insert(file_hash_table, newFile->filename, newFile); // Add to hash table index
-    // --- END MODIFICATION ---
-    save_metadata();
-    // We are done with global lists, unlock
-    pthread_mutex_unlock(&data_mutex);
-
-    // --- 2. Forward request to SS ---
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;File '%s' already exists.\n", ERROR_PREFIX, ERR_FILE_EXISTS, filename);
+        resp_end(&r);
+        return;
+    }
+
+    if (intent_conflicts(filename, 0)) {
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;'%s' is being changed by another request; try again.\n", ERROR_PREFIX, ERR_FILE_BUSY, filename);
+        resp_end(&r);
+        return;
+    }
+
+    StorageServer* target_ss = placement_choose(ss_list_head, parent_folder_ss(filename));
+    if (!target_ss) {
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;No Storage Servers available.\n", ERROR_PREFIX, ERR_NO_SS_AVAILABLE);
+        resp_end(&r);
+        return;
+    }
+
+    // --- 1. Reserve the name; the metadata waits for the SS (intents.h) ---
+    intent_add(&intent, INTENT_CREATE, filename, 0, NULL, target_ss);
+    lsn = meta_log_intent(&intent);
+    pthread_rwlock_unlock(&ns_lock);
+    wal_commit(lsn);
+    lsn = 0;
+
+    // --- 2. Forward request to SS, with no lock held ---
     printf("[NS] Forwarding CREATE request to SS at %s:%d\n", target_ss->ip_addr, target_ss->port);
     snprintf(ss_command, sizeof(ss_command), "SS_CREATE;%s\n", filename);
-
-    if (connect_and_send_to_ss(target_ss->ip_addr, target_ss->port, ss_command, ss_response)) {
-        // SS responded
-        if (strstr(ss_response, "ACK_CREATE")) {
-            snprintf(response, sizeof(response), "File '%s' created successfully.\n__END__\n", filename);
+    int reached = connect_and_send_to_ss(target_ss, ss_command, ss_response);
+    int created = reached && strstr(ss_response, "ACK_CREATE");
+    int undo = 0;
+
+    // --- 3. Add the metadata only once the file exists ---
+    pthread_rwlock_wrlock(&ns_lock);
+    if (created) {
+        FileMetadata* newFile = file_metadata_create(filename, username, target_ss, 0);
+        if (newFile && file_link(newFile)) { // Add to the directory tree and the hash table index
+            lsn = meta_log_create_file(newFile);
+            resp_printf(&r, "File '%s' created successfully.\n", filename);
         } else {
-            // SS failed. TODO: Roll back metadata creation?
-            printf("[NS] SS Error for CREATE: %s\n", ss_response);
-            snprintf(response, sizeof(response), "%s;%d;Storage Server failed: %.500s\n__END__\n", ERROR_PREFIX, ERR_SS_FAILURE, ss_response);
-            // For now, we leave the "zombie" metadata.
+            if (newFile) file_metadata_free(newFile);
+            undo = 1;
+            resp_printf(&r, "%s;%d;Name Server out of memory.\n", ERROR_PREFIX, ERR_SERVER_MISC);
         }
+    } else if (reached) {
+        printf("[NS] SS Error for CREATE: %s\n", ss_response);
+        resp_printf(&r, "%s;%d;Storage Server failed: %.500s\n", ERROR_PREFIX, ERR_SS_FAILURE, ss_response);
     } else {
-        // NS-SS connection failed. TODO: Roll back.
         printf("[NS] Failed to contact SS for CREATE.\n");
-        snprintf(response, sizeof(response), "%s;%d;Name Server could not contact Storage Server.\n__END__\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
+        resp_printf(&r, "%s;%d;Name Server could not contact Storage Server.\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
+    }
+    if (!lsn) lsn = meta_log_intent_done(filename);
+    intent_remove(&intent);
+    pthread_rwlock_unlock(&ns_lock);
+
+    if (undo) { // No metadata points at it, so take the file back off the SS
+        snprintf(ss_command, sizeof(ss_command), "SS_DELETE;%s\n", filename);
+        connect_and_send_to_ss(target_ss, ss_command, ss_response);
     }
 
-    // --- 3. Send final ACK to client ---
-    send(sock, response, strlen(response), 0);
+    // --- 4. Send final ACK to client ---
+    wal_commit(lsn);
+    resp_end(&r);
 }
 
 // MODIFIED: Added permission check
 void handle_read(int sock, const char* filename, const char* username) {
-    char response[MAX_BUFFER_SIZE];
-    pthread_mutex_lock(&data_mutex);
-
-    FileMetadata* file = find_file(filename);
+    Response r;
+    resp_init(&r, sock);
+    // Redirects never block on writers: no ns_lock, no file lock.
+    image_prefault(filename);
+    epoch_enter();
+    FileMetadata* file = find_file_rcu(filename);
 
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File '%s' not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
-        send(sock, response, strlen(response), 0);
+        epoch_exit();
+        resp_printf(&r, "%s;%d;File '%s' not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
+        resp_end(&r);
         return;
     }
 
     // +++ ADDED: Permission Check +++
     if (!check_permission(file, username, 'R')) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Permission denied for file '%s'.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
-        send(sock, response, strlen(response), 0);
+        epoch_exit();
+        resp_printf(&r, "%s;%d;Permission denied for file '%s'.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
+        resp_end(&r);
         return;
     }
     // +++ END ADDED +++
 
     StorageServer* target_ss = file->ss;
-    pthread_mutex_unlock(&data_mutex);
+    epoch_exit();
 
     printf("[NS] Redirecting client '%s' to SS at %s:%d for READ\n", username, target_ss->ip_addr, target_ss->port);
-    snprintf(response, sizeof(response), "REDIRECT_READ;%s;%d;%s\n__END__\n",
-            target_ss->ip_addr, target_ss->port, filename);
-    send(sock, response, strlen(response), 0);
+    resp_printf(&r, "REDIRECT_READ;%s;%d;%s%s\n",
+            target_ss->ip_addr, target_ss->port, filename, redirect_framing(&r, target_ss));
+    resp_end(&r);
 }
 
 // MODIFIED: Added permission check
 void handle_write(int sock, const char* filename, int sentence_num, const char* username) {
-    char response[MAX_BUFFER_SIZE];
-    pthread_mutex_lock(&data_mutex);
-
-    FileMetadata* file = find_file(filename);
+    Response r;
+    resp_init(&r, sock);
+    image_prefault(filename);
+    epoch_enter();
+    FileMetadata* file = find_file_rcu(filename);
 
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File '%s' not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
-        send(sock, response, strlen(response), 0);
+        epoch_exit();
+        resp_printf(&r, "%s;%d;File '%s' not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
+        resp_end(&r);
         return;
     }
 
     // +++ ADDED: Permission Check (must have 'W' to write) +++
     if (!check_permission(file, username, 'W')) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Write permission denied for file '%s'.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
-        send(sock, response, strlen(response), 0);
+        epoch_exit();
+        resp_printf(&r, "%s;%d;Write permission denied for file '%s'.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
+        resp_end(&r);
         return;
     }
     // +++ END ADDED +++
 
     StorageServer* target_ss = file->ss;
-    pthread_mutex_unlock(&data_mutex);
+    epoch_exit();
 
     printf("[NS] Redirecting client '%s' to SS at %s:%d for WRITE\n", username, target_ss->ip_addr, target_ss->port);
-    snprintf(response, sizeof(response), "REDIRECT_WRITE;%s;%d;%s;%d\n__END__\n",
-            target_ss->ip_addr, target_ss->port, filename, sentence_num);
-    send(sock, response, strlen(response), 0);
+    resp_printf(&r, "REDIRECT_WRITE;%s;%d;%s;%d%s\n",
+            target_ss->ip_addr, target_ss->port, filename, sentence_num, redirect_framing(&r, target_ss));
+    resp_end(&r);
 }
 
 // MODIFIED: Complete rewrite to be NM-mediated and atomic
 void handle_delete(int sock, const char* filename, const char* username) {
-    char response[MAX_BUFFER_SIZE];
+    Response r;
+    resp_init(&r, sock);
     char ss_command[MAX_BUFFER_SIZE];
     char ss_response[SS_RESPONSE_LEN];
+    NsIntent intent;
+    uint64_t lsn = 0;
 
-    pthread_mutex_lock(&data_mutex);
+    // Removing an entry is a structural change: exclusive namespace lock.
+    pthread_rwlock_wrlock(&ns_lock);
 
     FileMetadata* file = find_file(filename);
 
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File '%s' not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
-        send(sock, response, strlen(response), 0);
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;File '%s' not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
+        resp_end(&r);
         return;
     }
 
-    if (strcmp(file->owner, username) != 0) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Only the owner can delete file '%s'.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
-        send(sock, response, strlen(response), 0);
+    if (strcmp(file_owner(file), username) != 0) {
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;Only the owner can delete file '%s'.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
+        resp_end(&r);
         return;
     }
 
+    if (intent_conflicts(filename, file->is_directory)) {
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;'%s' is being changed by another request; try again.\n", ERROR_PREFIX, ERR_FILE_BUSY, filename);
+        resp_end(&r);
+        return;
+    }
+
+    // --- 1. Mark the entry; it stays readable until the SS is done ---
+    // The intent also keeps 'file' from being deleted or moved meanwhile.
     StorageServer* target_ss = file->ss;
+    intent_add(&intent, INTENT_DELETE, filename, file->is_directory, NULL, target_ss);
+    lsn = meta_log_intent(&intent);
+    pthread_rwlock_unlock(&ns_lock);
+    wal_commit(lsn);
 
-    // --- 1. Forward request to SS WHILE STILL HOLDING LOCK ---
+    // --- 2. Forward request to SS, with no lock held ---
     printf("[NS] Forwarding DELETE request to SS at %s:%d\n", target_ss->ip_addr, target_ss->port);
     snprintf(ss_command, sizeof(ss_command), "SS_DELETE;%s\n", filename);
+    int reached = connect_and_send_to_ss(target_ss, ss_command, ss_response);
+
+    // --- 3. Delete the metadata only if the SS did ---
+    pthread_rwlock_wrlock(&ns_lock);
+    if (reached && strstr(ss_response, "ACK_DELETE")) {
+        file_unlink(file);
+        // No other thread can hold file->cold->lock: we own ns_lock exclusively.
+        // Lock-free redirect lookups may still be reading it, though.
+        epoch_retire(file, file_metadata_free_deferred);
+        printf("[NS] Deleted metadata for '%s'\n", filename);
+        lsn = meta_log_delete_file(filename);
+        resp_printf(&r, "File '%s' successfully deleted from system.\n", filename);
+    } else if (reached) {
+        // SS failed to delete, so we don't touch metadata
+        printf("[NS] SS Error for DELETE: %s\n", ss_response);
+        lsn = meta_log_intent_done(filename);
+        resp_printf(&r, "%s;%d;Storage Server failed: %.500s\n", ERROR_PREFIX, ERR_SS_FAILURE, ss_response);
+    } else {
+        // NS-SS connection failed. Do not delete metadata.
+        printf("[NS] Failed to contact SS for DELETE.\n");
+        lsn = meta_log_intent_done(filename);
+        resp_printf(&r, "%s;%d;Name Server could not contact Storage Server.\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
+    }
+    intent_remove(&intent);
+    pthread_rwlock_unlock(&ns_lock);
 
-    if (connect_and_send_to_ss(target_ss->ip_addr, target_ss->port, ss_command, ss_response)) {
-        // SS responded
-        if (strstr(ss_response, "ACK_DELETE")) {
-            // --- 2. SS succeeded, now delete metadata ---
-            // This is the logic from old handle_delete_metadata
-            ht_delete(file_hash_table, filename); // Remove from hash table
-            FileMetadata* prev = NULL;
-            FileMetadata* current = file_list_head;
-            while(current) {
-                if (strcmp(current->filename, filename) == 0) {
-                    if (prev) {
-                        prev->next = current->next;
-                    } else {
-                        file_list_head = current->next;
-                    }
+    // --- 4. Send final response to client ---
+    wal_commit(lsn);
+    resp_end(&r);
+}
 
-                    AccessNode* access = current->access_list;
-                    while (access) {
-                        AccessNode* temp = access;
-                        access = access->next;
-                        free(temp);
-                    }
-                    free(current);
-                    printf("[NS] Deleted metadata for '%s'\n", filename);
-                    save_metadata();
-                    break;
-                }
-                prev = current;
-                current = current->next;
-            }
-            snprintf(response, sizeof(response), "File '%s' successfully deleted from system.\n__END__\n", filename);
+// epoch_retire() callback for a key replaced by a rename
+static void file_key_free(void* key) {
+    slab_strfree((char*)key);
+}
+
+// Checks that 'file' may move from 'old_path' to 'new_path'. Returns 0 if
+// so, or an error code with the reason in *why. Caller holds ns_lock.
+static int file_move_check(FileMetadata* file, const char* old_path, const char* new_path, const char** why) {
+    size_t old_len = strlen(old_path), new_len = strlen(new_path);
+    if (new_len == 0 || new_path[new_len - 1] == '/') {
+        *why = "is not a valid name";
+        return ERR_INVALID_ARGS;
+    }
+    if (file_lookup(new_path)) {
+        *why = "already exists";
+        return ERR_FILE_EXISTS;
+    }
+    if (file->is_directory && strncmp(new_path, old_path, old_len) == 0 && new_path[old_len] == '/') {
+        *why = "is inside the folder being moved";
+        return ERR_INVALID_ARGS;
+    }
+    if (file->is_directory && dir_lookup(old_path) && dir_lookup(new_path)) {
+        *why = "already has entries under it";
+        return ERR_FILE_EXISTS;
+    }
+    return 0;
+}
+
+// Moves 'file' from 'old_path' to 'new_path' in the namespace, and with it
+// everything under it if it is a folder: one entry and one directory node
+// are re-keyed (dir_index.h), however much is inside. Caller holds ns_lock
+// exclusively, has materialized the boot image (image_fault_in_all()) and
+// has passed file_move_check(). Returns 0 if out of memory, changing nothing.
+int file_move(FileMetadata* file, const char* old_path, const char* new_path) {
+    DirNode* subtree = file->is_directory ? dir_lookup(old_path) : NULL;
+    const char* old_key;
+    // Lock-free lookups find the file under one path or the other throughout.
+    if (!dir_index_move(file, subtree, new_path, file_hash_table, &old_key)) return 0;
+    ht_delete(file_hash_table, old_key);
+    epoch_retire((void*)old_key, file_key_free);
+    // Cached paths under a moved folder are all stale now.
+    if (subtree) cache_clear();
+    else cache_remove(old_path);
+    return 1;
+}
+
+// dir_index_walk() callback for move_holders(): adds the entry's SS to the
+// NULL-terminated array 'arg' unless it is there already.
+static int move_holder_add(FileMetadata* file, const char* folder, void* arg) {
+    (void)folder;
+    StorageServer** servers = (StorageServer**)arg;
+    int i = 0;
+    while (servers[i] && servers[i] != file->ss) i++;
+    servers[i] = file->ss;
+    return 1;
+}
+
+// The Storage Servers holding 'file' (at 'path') or, for a folder, anything
+// under it: the only ones a MOVE has to rename on. Returns a NULL-terminated
+// array to free(), or NULL if out of memory. Caller holds ns_lock and has
+// materialized the boot image (image_fault_in_all()).
+static StorageServer** move_holders(FileMetadata* file, const char* path) {
+    int count = 0;
+    for (StorageServer* ss = ss_list_head; ss; ss = ss->next) count++;
+    StorageServer** servers = (StorageServer**)calloc(count + 1, sizeof(StorageServer*));
+    if (!servers) return NULL;
+    move_holder_add(file, NULL, servers);
+    if (file->is_directory) dir_index_walk(path, move_holder_add, servers);
+    return servers;
+}
+
+// Renames 'to' back to 'from' on the first 'count' servers of 'servers'
+// (all of them if 'count' < 0). One that cannot be is logged: it is left
+// half renamed, with the metadata still at 'from'.
+static void ss_rename_back(StorageServer** servers, int count, const char* from, const char* to) {
+    char ss_command[MAX_BUFFER_SIZE];
+    char ss_response[SS_RESPONSE_LEN];
+    snprintf(ss_command, sizeof(ss_command), "SS_RENAME;%s;%s\n", to, from);
+    for (int i = 0; servers[i] && (count < 0 || i < count); i++) {
+        if (connect_and_send_to_ss(servers[i], ss_command, ss_response) && strstr(ss_response, "ACK_RENAME")) continue;
+        char log_buf[400];
+        snprintf(log_buf, sizeof(log_buf), "Could not rename '%s' back to '%s' on SS %s:%d; it is left under the new name there.",
+                 to, from, servers[i]->ip_addr, servers[i]->port);
+        log_message(LOG_ERROR, "Namespace", log_buf);
+    }
+}
+
+// Renames 'from' to 'to' on each SS in 'servers' (NULL-terminated, see
+// move_holders()). If one fails, those already done are put back. Returns
+// 1 on success, 0 if an SS refused (its reply is in 'ss_response') or -1
+// if one is down or could not be reached. Takes no lock: SS records are
+// never freed.
+static int ss_rename(StorageServer** servers, const char* from, const char* to, char* ss_response) {
+    char ss_command[MAX_BUFFER_SIZE];
+    snprintf(ss_command, sizeof(ss_command), "SS_RENAME;%s;%s\n", from, to);
+    int done, result = 1;
+    for (done = 0; servers[done]; done++) {
+        if (!ss_is_up(servers[done]) || !connect_and_send_to_ss(servers[done], ss_command, ss_response)) {
+            result = -1;
+            break;
+        }
+        if (!strstr(ss_response, "ACK_RENAME")) { // ACK_RENAME_NONE: nothing of it there
+            result = 0;
+            break;
+        }
+    }
+    if (result != 1) ss_rename_back(servers, done, from, to);
+    return result;
+}
+
+// MOVE: renames a file or folder. Only the owner may move an entry.
+void handle_move(int sock, const char* filename, const char* new_filename, const char* username) {
+    Response r;
+    resp_init(&r, sock);
+    char ss_response[SS_RESPONSE_LEN];
+    NsIntent intent;
+    uint64_t lsn = 0;
+
+    // Moving an entry is a structural change: exclusive namespace lock.
+    pthread_rwlock_wrlock(&ns_lock);
+    image_fault_in_all(); // Image records are keyed by their old paths
+
+    FileMetadata* file = find_file(filename);
+    const char* why = NULL;
+    int code = 0;
+
+    if (!file) {
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;File '%s' not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
+        resp_end(&r);
+        return;
+    }
+
+    if (strcmp(file_owner(file), username) != 0) {
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;Only the owner can move '%s'.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
+        resp_end(&r);
+        return;
+    }
+
+    if ((code = file_move_check(file, filename, new_filename, &why)) != 0) {
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;Cannot move '%s': '%s' %s.\n", ERROR_PREFIX, code, filename, new_filename, why);
+        resp_end(&r);
+        return;
+    }
+
+    // The destination is reserved as a tree whatever moves there, so nothing
+    // can be created under it either.
+    if (intent_conflicts(filename, file->is_directory) || intent_conflicts(new_filename, 1)) {
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;'%s' or '%s' is being changed by another request; try again.\n",
+                    ERROR_PREFIX, ERR_FILE_BUSY, filename, new_filename);
+        resp_end(&r);
+        return;
+    }
+
+    StorageServer** servers = move_holders(file, filename);
+    if (!servers) {
+        pthread_rwlock_unlock(&ns_lock);
+        resp_printf(&r, "%s;%d;Name Server out of memory.\n", ERROR_PREFIX, ERR_SERVER_MISC);
+        resp_end(&r);
+        return;
+    }
 
+    // --- 1. Reserve both names; the checks above hold until we are done ---
+    intent_add(&intent, INTENT_MOVE, filename, file->is_directory, new_filename, file->ss);
+    lsn = meta_log_intent(&intent);
+    pthread_rwlock_unlock(&ns_lock);
+    wal_commit(lsn);
+    lsn = 0;
+
+    // --- 2. Rename on the SS side, with no lock held ---
+    printf("[NS] Forwarding MOVE '%s' -> '%s' to Storage Servers\n", filename, new_filename);
+    int result = ss_rename(servers, filename, new_filename, ss_response);
+    int undo = 0;
+
+    // --- 3. Move the metadata only if the SS did ---
+    pthread_rwlock_wrlock(&ns_lock);
+    if (result == 1) {
+        if (file_move(file, filename, new_filename)) {
+            lsn = meta_log_rename(filename, new_filename);
+            resp_printf(&r, "Moved '%s' to '%s'.\n", filename, new_filename);
         } else {
-            // SS failed to delete, so we don't touch metadata
-            printf("[NS] SS Error for DELETE: %s\n", ss_response);
-            snprintf(response, sizeof(response), "%s;%d;Storage Server failed: %.500s\n__END__\n", ERROR_PREFIX, ERR_SS_FAILURE, ss_response);
+            undo = 1;
+            resp_printf(&r, "%s;%d;Name Server out of memory.\n", ERROR_PREFIX, ERR_SERVER_MISC);
         }
+    } else if (result == 0) {
+        printf("[NS] SS Error for MOVE: %s\n", ss_response);
+        resp_printf(&r, "%s;%d;Storage Server failed: %.500s\n", ERROR_PREFIX, ERR_SS_FAILURE, ss_response);
     } else {
-        // NS-SS connection failed. Do not delete metadata.
-        printf("[NS] Failed to contact SS for DELETE.\n");
-        snprintf(response, sizeof(response), "%s;%d;Name Server could not contact Storage Server.\n__END__\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
+        printf("[NS] Failed to contact SS for MOVE.\n");
+        resp_printf(&r, "%s;%d;Name Server could not contact Storage Server.\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
     }
+    if (!lsn) lsn = meta_log_intent_done(filename);
+    intent_remove(&intent);
+    pthread_rwlock_unlock(&ns_lock);
 
-    // --- 3. Unlock mutex and send final response to client ---
-    pthread_mutex_unlock(&data_mutex);
-    send(sock, response, strlen(response), 0);
+    if (undo) ss_rename_back(servers, -1, filename, new_filename);
+    free(servers);
+
+    // --- 4. Send final response to client ---
+    wal_commit(lsn);
+    resp_end(&r);
 }
 
 void handle_stream(int sock, const char* filename, const char* username) {
-    char response[MAX_BUFFER_SIZE];
-    pthread_mutex_lock(&data_mutex);
-
-    FileMetadata* file = find_file(filename);
+    Response r;
+    resp_init(&r, sock);
+    image_prefault(filename);
+    epoch_enter();
+    FileMetadata* file = find_file_rcu(filename);
 
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File '%s' not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
-        send(sock, response, strlen(response), 0);
+        epoch_exit();
+        resp_printf(&r, "%s;%d;File '%s' not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
+        resp_end(&r);
         return;
     }
 
     if (!check_permission(file, username, 'R')) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Permission denied for file '%s'.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
-        send(sock, response, strlen(response), 0);
+        epoch_exit();
+        resp_printf(&r, "%s;%d;Permission denied for file '%s'.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
+        resp_end(&r);
         return;
     }
 
     StorageServer* target_ss = file->ss;
-    pthread_mutex_unlock(&data_mutex);
+    epoch_exit();
 
     printf("[NS] Redirecting client '%s' to SS at %s:%d for STREAM\n", username, target_ss->ip_addr, target_ss->port);
-    snprintf(response, sizeof(response), "REDIRECT_STREAM;%s;%d;%s\n__END__\n",
-            target_ss->ip_addr, target_ss->port, filename);
-    send(sock, response, strlen(response), 0);
+    resp_printf(&r, "REDIRECT_STREAM;%s;%d;%s%s\n",
+            target_ss->ip_addr, target_ss->port, filename, redirect_framing(&r, target_ss));
+    resp_end(&r);
 }
 
 // This assumes you have connect_and_send_to_ss in this file
@@ -792,54 +1310,52 @@ void handle_stream(int sock, const char* filename, const char* username) {
 
 void handle_undo(int sock, const char* filename, const char* current_user)
 {
-    char response[MAX_BUFFER_SIZE];
+    Response r;
+    resp_init(&r, sock);
     char ss_command[MAX_BUFFER_SIZE];
     char ss_response[SS_RESPONSE_LEN];
 
-    pthread_mutex_lock(&data_mutex);
-
-    FileMetadata* file = find_file(filename);
+    FileMetadata* file = acquire_file(filename, 0);
 
     if (!file) {
-        snprintf(response, sizeof(response), "%s;%d;File '%s' not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
-        pthread_mutex_unlock(&data_mutex);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File '%s' not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
+        resp_end(&r);
         return;
     }
 
     // 1. Check Permission (as per Q&A)
     //    (Fixing bug: must pass 'file' object, not 'filename' string)
     if (!check_permission(file, current_user, 'W')) {
-        snprintf(response, sizeof(response), "%s;%d;Write permission required to undo '%s'.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
-        pthread_mutex_unlock(&data_mutex);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;Write permission required to undo '%s'.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
+        release_file(file);
+        resp_end(&r);
         return;
     }
 
     StorageServer* target_ss = file->ss;
 
     // We are done with metadata, unlock
-    pthread_mutex_unlock(&data_mutex);
+    release_file(file);
 
     // 2. Forward request to SS (NM-mediated)
     printf("[NS] Forwarding UNDO request to SS at %s:%d\n", target_ss->ip_addr, target_ss->port);
     snprintf(ss_command, sizeof(ss_command), "SS_UNDO;%s\n", filename);
 
-    if (connect_and_send_to_ss(target_ss->ip_addr, target_ss->port, ss_command, ss_response)) {
+    if (connect_and_send_to_ss(target_ss, ss_command, ss_response)) {
         // SS responded
         if (strstr(ss_response, "ACK_UNDO")) {
-            snprintf(response, sizeof(response), "Undo successful for '%s'.\n__END__\n", filename);
+            resp_printf(&r, "Undo successful for '%s'.\n", filename);
         } else {
             // SS failed (e.g., no .bak file)
-            snprintf(response, sizeof(response), "%s;%d;Undo failed on Storage Server: %.500s\n__END__\n", ERROR_PREFIX, ERR_SS_FAILURE, ss_response);
+            resp_printf(&r, "%s;%d;Undo failed on Storage Server: %.500s\n", ERROR_PREFIX, ERR_SS_FAILURE, ss_response);
         }
     } else {
         // NS-SS connection failed
-        snprintf(response, sizeof(response), "%s;%d;Name Server could not contact Storage Server for undo.\n__END__\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
+        resp_printf(&r, "%s;%d;Name Server could not contact Storage Server for undo.\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
     }
 
     // 3. Send final ACK to client
-    send(sock, response, strlen(response), 0);
+    resp_end(&r);
 }
 // Delete your old calc_words and calc_chars functions.
 // Use this corrected handle_update_meta function instead.
@@ -847,105 +1363,102 @@ void handle_undo(int sock, const char* filename, const char* current_user)
 // --- BONUS: Checkpoint Functions ---
 
 void handle_checkpoint(int sock, const char* filename, const char* tag, const char* username) {
-    char response[MAX_BUFFER_SIZE];
+    Response r;
+    resp_init(&r, sock);
     char ss_command[MAX_BUFFER_SIZE];
     char ss_response[SS_RESPONSE_LEN];
 
-    pthread_mutex_lock(&data_mutex);
-    FileMetadata* file = find_file(filename);
+    FileMetadata* file = acquire_file(filename, 0);
 
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
+        resp_end(&r);
         return;
     }
     
     // Check Read Permission to create a backup
     if (!check_permission(file, username, 'R')) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Permission denied.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
-        send(sock, response, strlen(response), 0);
+        release_file(file);
+        resp_printf(&r, "%s;%d;Permission denied.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
+        resp_end(&r);
         return;
     }
     
     StorageServer* target_ss = file->ss;
-    pthread_mutex_unlock(&data_mutex);
+    release_file(file);
 
     // Forward to SS
     snprintf(ss_command, sizeof(ss_command), "SS_CHECKPOINT;%s;%s\n", filename, tag);
-    if (connect_and_send_to_ss(target_ss->ip_addr, target_ss->port, ss_command, ss_response)) {
+    if (connect_and_send_to_ss(target_ss, ss_command, ss_response)) {
         if (strstr(ss_response, "ACK_CHECKPOINT")) {
-            snprintf(response, sizeof(response), "Checkpoint '%s' created for '%s'.\n__END__\n", tag, filename);
+            resp_printf(&r, "Checkpoint '%s' created for '%s'.\n", tag, filename);
         } else {
-            snprintf(response, sizeof(response), "%s;%d;SS Error: %.500s", ERROR_PREFIX, ERR_SS_FAILURE, ss_response);
+            resp_printf(&r, "%s;%d;SS Error: %.500s\n", ERROR_PREFIX, ERR_SS_FAILURE, ss_response);
         }
     } else {
-        snprintf(response, sizeof(response), "%s;%d;SS Unreachable.\n__END__\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
+        resp_printf(&r, "%s;%d;SS Unreachable.\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
     }
-    send(sock, response, strlen(response), 0);
+    resp_end(&r);
 }
 
 void handle_revert(int sock, const char* filename, const char* tag, const char* username) {
-    char response[MAX_BUFFER_SIZE];
+    Response r;
+    resp_init(&r, sock);
     char ss_command[MAX_BUFFER_SIZE];
     char ss_response[SS_RESPONSE_LEN];
 
-    pthread_mutex_lock(&data_mutex);
-    FileMetadata* file = find_file(filename);
+    FileMetadata* file = acquire_file(filename, 0);
 
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
+        resp_end(&r);
         return;
     }
     
     if (!check_permission(file, username, 'W')) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Permission denied.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
-        send(sock, response, strlen(response), 0);
+        release_file(file);
+        resp_printf(&r, "%s;%d;Permission denied.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
+        resp_end(&r);
         return;
     }
     
     StorageServer* target_ss = file->ss;
-    pthread_mutex_unlock(&data_mutex);
+    release_file(file);
 
     snprintf(ss_command, sizeof(ss_command), "SS_REVERT;%s;%s\n", filename, tag);
-    if (connect_and_send_to_ss(target_ss->ip_addr, target_ss->port, ss_command, ss_response)) {
+    if (connect_and_send_to_ss(target_ss, ss_command, ss_response)) {
         if (strstr(ss_response, "ACK_REVERT")) {
-            snprintf(response, sizeof(response), "File '%s' reverted to checkpoint '%s'.\n__END__\n", filename, tag);
+            resp_printf(&r, "File '%s' reverted to checkpoint '%s'.\n", filename, tag);
         } else {
             // FIX: Added \n__END__\n to error message
-            snprintf(response, sizeof(response), "%s;%d;SS Error: %.500s\n__END__\n", ERROR_PREFIX, ERR_SS_FAILURE, ss_response);
+            resp_printf(&r, "%s;%d;SS Error: %.500s\n", ERROR_PREFIX, ERR_SS_FAILURE, ss_response);
         }
     } else {
-        snprintf(response, sizeof(response), "%s;%d;SS Unreachable.\n__END__\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
+        resp_printf(&r, "%s;%d;SS Unreachable.\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
     }
-    send(sock, response, strlen(response), 0);
+    resp_end(&r);
 }
 
 void handle_view_checkpoint(int sock, const char* filename, const char* tag, const char* username) {
-    char response[MAX_BUFFER_SIZE];
-    pthread_mutex_lock(&data_mutex);
-    FileMetadata* file = find_file(filename);
+    Response r;
+    resp_init(&r, sock);
+    FileMetadata* file = acquire_file(filename, 0);
 
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
+        resp_end(&r);
         return;
     }
     
     if (!check_permission(file, username, 'R')) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Permission denied.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
-        send(sock, response, strlen(response), 0);
+        release_file(file);
+        resp_printf(&r, "%s;%d;Permission denied.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
+        resp_end(&r);
         return;
     }
     
     StorageServer* target_ss = file->ss;
-    pthread_mutex_unlock(&data_mutex);
+    release_file(file);
 
     // This requires a direct read, similar to normal READ but pointing to checkpoint
     // We will tell the client to redirect to SS with a special flag
@@ -962,15 +1475,14 @@ void handle_view_checkpoint(int sock, const char* filename, const char* tag, con
     char file_content[SS_RESPONSE_LEN]; 
     
     snprintf(ss_command, sizeof(ss_command), "SS_READ_CHECKPOINT;%s;%s\n", filename, tag);
-    if (connect_and_send_to_ss(target_ss->ip_addr, target_ss->port, ss_command, file_content)) {
-         // Send content to client
-         send(sock, file_content, strlen(file_content), 0);        
-         
-         char terminator[] = "\n__END__\n";
-         send(sock, terminator, strlen(terminator), 0);
+    if (connect_and_send_to_ss(target_ss, ss_command, file_content)) {
+         // Send content to client, straight from the SS reply buffer
+         resp_ref(&r, file_content, strlen(file_content));
+         resp_puts(&r, "\n");
+         resp_end(&r);
     } else {
-         snprintf(response, sizeof(response), "%s;%d;Failed to retrieve checkpoint.\n__END__\n", ERROR_PREFIX, ERR_SS_FAILURE);
-         send(sock, response, strlen(response), 0);
+         resp_printf(&r, "%s;%d;Failed to retrieve checkpoint.\n", ERROR_PREFIX, ERR_SS_FAILURE);
+         resp_end(&r);
     }
 }
 void handle_update_meta(int sock, const char* filename)
@@ -981,20 +1493,18 @@ void handle_update_meta(int sock, const char* filename)
     FileMetadata* file;
 
     // --- 1. Find file and update time ---
-    pthread_mutex_lock(&data_mutex);
-    file = find_file(filename);
+    file = acquire_file(filename, 1);
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
         // No need to send error, client doesn't wait for one
         return;
     }
     file->last_access = time(NULL);
     target_ss = file->ss; // Get SS info
-    pthread_mutex_unlock(&data_mutex);
+    release_file(file);
 
     // --- 2. Fetch file content from SS (outside the lock) ---
     snprintf(ss_command, sizeof(ss_command), "SS_READ;%s\n", filename);
-    if (!connect_and_send_to_ss(target_ss->ip_addr, target_ss->port, ss_command, file_content)) {
+    if (!connect_and_send_to_ss(target_ss, ss_command, file_content)) {
         printf("[NS] UPDATE_META: Failed to fetch file %s from SS.\n", filename);
         return;
     }
@@ -1008,68 +1518,64 @@ void handle_update_meta(int sock, const char* filename)
     char* content_copy = strdup(file_content);
     if (!content_copy) return; // Out of memory
 
-    char* word = strtok(content_copy, " \t\n\r");
+    char* word_saveptr;
+    char* word = strtok_r(content_copy, " \t\n\r", &word_saveptr);
     while (word != NULL) {
         word_count++;
-        word = strtok(NULL, " \t\n\r");
+        word = strtok_r(NULL, " \t\n\r", &word_saveptr);
     }
     free(content_copy); // Clean up the copy
 
     // --- 4. Re-lock and update the metadata struct ---
-    pthread_mutex_lock(&data_mutex);
-    file = find_file(filename); // Find file again, it might have been deleted
+    file = acquire_file(filename, 1); // Find file again, it might have been deleted
     if (file) {
-        file->word_count = word_count;
-        file->char_count = char_count;
+        file->cold->word_count = word_count;
+        file->cold->char_count = char_count;
         printf("[NS] Updated metadata for %s: %d words, %d chars\n", filename, word_count, char_count);
+        release_file(file);
     }
-    pthread_mutex_unlock(&data_mutex);
-    char response[] = "ACK_META_UPDATE\n__END__\n";
-    send(sock, response, strlen(response), 0);
+    Response r;
+    resp_init(&r, sock);
+    resp_puts(&r, "ACK_META_UPDATE\n");
+    resp_end(&r);
 }
 
 #include <sys/wait.h> // Make sure this is included at the top of CRWD.c
 
 void handle_exec(int sock, const char* filename, const char* current_user)
 {
-    char response[MAX_BUFFER_SIZE * 4]; // Buffer for the command's output
+    Response r;
+    resp_init(&r, sock);
     char ss_command[MAX_BUFFER_SIZE];
     char file_content[SS_RESPONSE_LEN];
     StorageServer* target_ss;
-    char ss_ip[20];
-    int ss_port;
-
-    pthread_mutex_lock(&data_mutex);
 
-    FileMetadata* file = find_file(filename);
+    FileMetadata* file = acquire_file(filename, 0);
 
     // 1. Check permissions
     if (!file) {
-        snprintf(response, sizeof(response), "%s;%d;File '%s' not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
-        pthread_mutex_unlock(&data_mutex);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File '%s' not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND, filename);
+        resp_end(&r);
         return;
     }
 
     if (!check_permission(file, current_user, 'R')) {
-        snprintf(response, sizeof(response), "%s;%d;Read permission denied for file '%s'.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
-        pthread_mutex_unlock(&data_mutex);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;Read permission denied for file '%s'.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED, filename);
+        release_file(file);
+        resp_end(&r);
         return;
     }
 
-    // Copy SS info so we can unlock the mutex
+    // Storage Server records are never freed, so it outlives the lock
     target_ss = file->ss;
-    strcpy(ss_ip, target_ss->ip_addr);
-    ss_port = target_ss->port;
 
-    pthread_mutex_unlock(&data_mutex);
+    release_file(file);
 
     // 2. NS acts as a client to get the file from SS
     snprintf(ss_command, sizeof(ss_command), "SS_READ;%s\n", filename);
-    if (!connect_and_send_to_ss(ss_ip, ss_port, ss_command, file_content)) {
-        snprintf(response, sizeof(response), "%s;%d;NS failed to fetch file from SS.\n__END__\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
-        send(sock, response, strlen(response), 0);
+    if (!connect_and_send_to_ss(target_ss, ss_command, file_content)) {
+        resp_printf(&r, "%s;%d;NS failed to fetch file from SS.\n", ERROR_PREFIX, ERR_SS_UNREACHABLE);
+        resp_end(&r);
         return;
     }
 
@@ -1077,8 +1583,8 @@ void handle_exec(int sock, const char* filename, const char* current_user)
     char tmp_filename[] = "/tmp/docs_exec.XXXXXX";
     int tmp_fd = mkstemp(tmp_filename);
     if (tmp_fd == -1) {
-        snprintf(response, sizeof(response), "%s;%d;NS failed to create temp file for execution.\n__END__\n", ERROR_PREFIX, ERR_SERVER_MISC);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;NS failed to create temp file for execution.\n", ERROR_PREFIX, ERR_SERVER_MISC);
+        resp_end(&r);
         return;
     }
     write(tmp_fd, file_content, strlen(file_content));
@@ -1087,16 +1593,16 @@ void handle_exec(int sock, const char* filename, const char* current_user)
     // 4. Fork, execute, and capture output
     int pipe_fd[2];
     if (pipe(pipe_fd) == -1) {
-        snprintf(response, sizeof(response), "%s;%d;NS failed to create pipe.\n__END__\n", ERROR_PREFIX, ERR_SERVER_MISC);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;NS failed to create pipe.\n", ERROR_PREFIX, ERR_SERVER_MISC);
+        resp_end(&r);
         remove(tmp_filename);
         return;
     }
 
     pid_t pid = fork();
     if (pid == -1) {
-        snprintf(response, sizeof(response), "%s;%d;NS failed to fork.\n__END__\n", ERROR_PREFIX, ERR_SERVER_MISC);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;NS failed to fork.\n", ERROR_PREFIX, ERR_SERVER_MISC);
+        resp_end(&r);
         remove(tmp_filename);
         return;
     }
@@ -1118,89 +1624,88 @@ void handle_exec(int sock, const char* filename, const char* current_user)
         close(pipe_fd[1]); // Close write end of pipe
 
         char output_buffer[MAX_BUFFER_SIZE * 4];
-        int total_read = 0;
         int read_size;
 
-        // Read all output from the child process
-        while ((read_size = read(pipe_fd[0], output_buffer + total_read, (sizeof(output_buffer) - total_read - 1))) > 0) {
-            total_read += read_size;
+        // Pass on all output from the child process as it comes
+        while ((read_size = read(pipe_fd[0], output_buffer, sizeof(output_buffer))) > 0) {
+            resp_write(&r, output_buffer, read_size);
         }
-        output_buffer[total_read] = '\0';
 
         wait(NULL); // Wait for the child to terminate
         close(pipe_fd[0]);
         remove(tmp_filename); // Clean up the temp file
 
         // 5. Send the captured output back to the client
-        strncat(output_buffer, "\n__END__\n", sizeof(output_buffer) - strlen(output_buffer) - 1);
-        send(sock, output_buffer, strlen(output_buffer), 0);
+        resp_puts(&r, "\n");
+        resp_end(&r);
     }
 }
 // --- BONUS: Access Request Functions ---
 
 void handle_req_access(int sock, const char* filename, const char* username) {
-    char response[MAX_BUFFER_SIZE];
-    pthread_mutex_lock(&data_mutex);
-
-    FileMetadata* file = find_file(filename);
+    Response r;
+    resp_init(&r, sock);
+    FileMetadata* file = acquire_file(filename, 1);
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
+        resp_end(&r);
         return;
     }
 
     // Check if user already has access
     if (check_permission(file, username, 'R')) {
-         pthread_mutex_unlock(&data_mutex);
-         snprintf(response, sizeof(response), "You already have access to this file.\n__END__\n");
-         send(sock, response, strlen(response), 0);
+         release_file(file);
+         resp_printf(&r, "You already have access to this file.\n");
+         resp_end(&r);
          return;
     }
 
     // Check if request already exists
-    RequestNode* curr = file->pending_requests;
+    RequestNode* curr = file->cold->pending_requests;
     while(curr) {
         if (strcmp(curr->username, username) == 0) {
-            pthread_mutex_unlock(&data_mutex);
-            snprintf(response, sizeof(response), "Request already pending.\n__END__\n");
-            send(sock, response, strlen(response), 0);
+            release_file(file);
+            resp_printf(&r, "Request already pending.\n");
+            resp_end(&r);
             return;
         }
         curr = curr->next;
     }
 
     // Add request
-    RequestNode* new_req = (RequestNode*)malloc(sizeof(RequestNode));
+    RequestNode* new_req = (RequestNode*)slab_alloc(&request_pool);
+    if (!new_req) {
+        release_file(file);
+        resp_printf(&r, "%s;%d;Name Server out of memory.\n", ERROR_PREFIX, ERR_SERVER_MISC);
+        resp_end(&r);
+        return;
+    }
     strcpy(new_req->username, username);
-    new_req->next = file->pending_requests;
-    file->pending_requests = new_req;
+    new_req->next = file->cold->pending_requests;
+    file->cold->pending_requests = new_req;
 
     printf("[DEBUG] Added request for '%s' from user '%s'\n", filename, username);
-    pthread_mutex_unlock(&data_mutex);
-    snprintf(response, sizeof(response), "Access request sent to owner '%s'.\n__END__\n", file->owner);
-    send(sock, response, strlen(response), 0);
+    resp_printf(&r, "Access request sent to owner '%s'.\n", file_owner(file));
+    release_file(file);
+    resp_end(&r);
 }
 
 void handle_view_reqs(int sock, const char* filename, const char* username) {
-    char response[MAX_BUFFER_SIZE * 2] = "";
-    int offset = 0;
+    Response r;
+    resp_init(&r, sock);
     
-    pthread_mutex_lock(&data_mutex);
-
-    FileMetadata* file = find_file(filename);
+    FileMetadata* file = acquire_file(filename, 0);
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
+        resp_end(&r);
         return;
     }
 
     // Only owner can view requests
-    if (strcmp(file->owner, username) != 0) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Only owner can view requests.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
-        send(sock, response, strlen(response), 0);
+    if (strcmp(file_owner(file), username) != 0) {
+        release_file(file);
+        resp_printf(&r, "%s;%d;Only owner can view requests.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
+        resp_end(&r);
         return;
     }
 
@@ -1208,39 +1713,37 @@ void handle_view_reqs(int sock, const char* filename, const char* username) {
     printf("[DEBUG] Listing requests for file '%s' (Owner: %s)\n", filename, username);
 
     // Build the response string safely
-    offset += snprintf(response + offset, sizeof(response) - offset, "Pending requests for '%s':\n", filename);
+    resp_printf(&r, "Pending requests for '%s':\n", filename);
 
-    RequestNode* curr = file->pending_requests;
+    RequestNode* curr = file->cold->pending_requests;
     int count = 0;
     while(curr) {
         printf("[DEBUG] Found request from: %s\n", curr->username); // Debug print
         // Append user to response
-        offset += snprintf(response + offset, sizeof(response) - offset, "- %s\n", curr->username);
+        resp_printf(&r, "- %s\n", curr->username);
         curr = curr->next;
         count++;
     }
 
     if (count == 0) {
         printf("[DEBUG] No pending requests found.\n");
-        offset += snprintf(response + offset, sizeof(response) - offset, "(None)\n");
+        resp_printf(&r, "(None)\n");
     }
 
-    pthread_mutex_unlock(&data_mutex);
+    release_file(file);
 
-    // Append termination token
-    snprintf(response + offset, sizeof(response) - offset, "__END__\n");
-    send(sock, response, strlen(response), 0);
+    resp_end(&r);
 }
 
 // Helper to remove request node
 void remove_request(FileMetadata* file, const char* target_user) {
-    RequestNode* curr = file->pending_requests;
+    RequestNode* curr = file->cold->pending_requests;
     RequestNode* prev = NULL;
     while(curr) {
         if (strcmp(curr->username, target_user) == 0) {
             if (prev) prev->next = curr->next;
-            else file->pending_requests = curr->next;
-            free(curr);
+            else file->cold->pending_requests = curr->next;
+            slab_free(&request_pool, curr);
             return;
         }
         prev = curr;
@@ -1249,143 +1752,471 @@ void remove_request(FileMetadata* file, const char* target_user) {
 }
 
 void handle_approve_req(int sock, const char* filename, const char* target_user, const char* current_user) {
-    char response[MAX_BUFFER_SIZE];
-    pthread_mutex_lock(&data_mutex);
-    
-    FileMetadata* file = find_file(filename);
+    Response r;
+    resp_init(&r, sock);
+    FileMetadata* file = acquire_file(filename, 1);
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
+        resp_end(&r);
+        return;
+    }
+
+    if (strcmp(file_owner(file), current_user) != 0) {
+        release_file(file);
+        resp_printf(&r, "%s;%d;Only owner can approve requests.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
+        resp_end(&r);
         return;
     }
 
-    if (strcmp(file->owner, current_user) != 0) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Only owner can approve requests.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
-        send(sock, response, strlen(response), 0);
+    // Only registered users get an ID, so junk names cannot fill the table.
+    if (!user_exists(target_user)) {
+        release_file(file);
+        resp_printf(&r, "%s;%d;User '%s' is not registered in the system.\n", ERROR_PREFIX, ERR_USER_NOT_FOUND, target_user);
+        resp_end(&r);
         return;
     }
+    uint32_t target_id = user_id_intern(target_user);
     
     // Add Access (Default to 'R' for approval)
-    int access_exists = 0;
-    AccessNode* curr = file->access_list;
-    while(curr) {
-        if (strcmp(curr->username, target_user) == 0) { access_exists = 1; break; }
-        curr = curr->next;
-    }
-    if (!access_exists) {
-        AccessNode* new_node = (AccessNode*)malloc(sizeof(AccessNode));
-        strcpy(new_node->username, target_user);
-        new_node->permission = 'R'; // Default Read Access
-        new_node->next = file->access_list;
-        file->access_list = new_node;
+    uint64_t lsn = 0;
+    if (!acl_lookup(file->acl, target_id)) {
+        AccessList* acl = target_id != USER_ID_NONE ? acl_with(file->acl, target_id, 'R') : NULL;
+        if (!acl) {
+            release_file(file);
+            resp_printf(&r, "%s;%d;Name Server out of memory.\n", ERROR_PREFIX, ERR_SERVER_MISC);
+            resp_end(&r);
+            return;
+        }
+        acl_publish(file, acl);
+        lsn = meta_log_set_access(filename, target_user, 'R');
     }
     
-    // Remove from pending list
+    // Remove from pending list (pending requests are not persisted)
     remove_request(file, target_user);
     
-    save_metadata();
-    pthread_mutex_unlock(&data_mutex);
+    release_file(file);
+    wal_commit(lsn);
     
-    snprintf(response, sizeof(response), "Access GRANTED to '%s'.\n__END__\n", target_user);
-    send(sock, response, strlen(response), 0);
+    resp_printf(&r, "Access GRANTED to '%s'.\n", target_user);
+    resp_end(&r);
 }
 
 void handle_reject_req(int sock, const char* filename, const char* target_user, const char* current_user) {
-    char response[MAX_BUFFER_SIZE];
-    pthread_mutex_lock(&data_mutex);
-    
-    FileMetadata* file = find_file(filename);
+    Response r;
+    resp_init(&r, sock);
+    FileMetadata* file = acquire_file(filename, 1);
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
+        resp_end(&r);
         return;
     }
 
-    if (strcmp(file->owner, current_user) != 0) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Only owner can reject requests.\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
-        send(sock, response, strlen(response), 0);
+    if (strcmp(file_owner(file), current_user) != 0) {
+        release_file(file);
+        resp_printf(&r, "%s;%d;Only owner can reject requests.\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
+        resp_end(&r);
         return;
     }
     
     remove_request(file, target_user);
     
-    pthread_mutex_unlock(&data_mutex);
-    snprintf(response, sizeof(response), "Request from '%s' REJECTED.\n__END__\n", target_user);
-    send(sock, response, strlen(response), 0);
+    release_file(file);
+    resp_printf(&r, "Request from '%s' REJECTED.\n", target_user);
+    resp_end(&r);
 }
-void save_metadata() {
-    // Note: This function assumes the data_mutex is already locked by the caller.
-    
-    // 1. Save Users
-    FILE* user_file = fopen("user_data.dat", "w");
-    if (!user_file) {
-        log_message(LOG_ERROR, "Persistence", "Failed to open user_data.dat for writing.");
-        return;
+// --- Persistence: checkpoints and recovery ---
+
+// Records from the boot image are turned into FileMetadata the first time
+// they are looked up. image_state[i] is 1 once record i has been
+// materialized (after that the normal structures own it, even if the file
+// is deleted later).
+MetadataImage boot_image;
+StorageServer** image_ss = NULL;   // boot_image SS table -> live entries
+uint8_t* image_state = NULL;
+unsigned long image_pending = 0;   // Records not materialized yet
+int image_counts_known = 1;        // UserRecord.image_files is filled in
+pthread_mutex_t image_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Builds the FileMetadata for image record 'idx' and links it in.
+// Caller holds ns_lock (either mode) and image_mutex; other inserters are
+// excluded by image_mutex or by holding ns_lock exclusively.
+static FileMetadata* image_materialize(long idx) {
+    const ImageFileRecord* rec = &boot_image.files[idx];
+    image_state[idx] = 1;
+    __atomic_fetch_sub(&image_pending, 1, __ATOMIC_RELEASE);
+
+    // The owner's count moves over to owned_files when file_link() runs
+    uint32_t owner_id = user_id_lookup(image_str(&boot_image, rec->owner));
+    if (owner_id != USER_ID_NONE) {
+        UserRecord* owner = user_record(owner_id);
+        if (__atomic_load_n(&owner->image_files, __ATOMIC_RELAXED) > 0) {
+            __atomic_fetch_sub(&owner->image_files, 1, __ATOMIC_RELAXED);
+        }
+    }
+
+    StorageServer* ss = rec->ss < boot_image.header->ss_count ? image_ss[rec->ss] : NULL;
+    if (!ss) return NULL;
+
+    uint32_t access_count = 0;
+    uint32_t* entries = NULL;
+    if ((uint64_t)rec->access_first + rec->access_count <= boot_image.header->access_count) {
+        entries = (uint32_t*)malloc((rec->access_count + 1) * sizeof(uint32_t));
+        for (uint32_t i = 0; entries && i < rec->access_count; i++) {
+            const ImageAccessRecord* acc = &boot_image.access[rec->access_first + i];
+            uint32_t user = user_id_intern(image_str(&boot_image, acc->username));
+            if (user != USER_ID_NONE) entries[access_count++] = ACL_ENTRY(user, (char)acc->permission);
+        }
+    }
+    FileMetadata* file = file_metadata_create_acl(image_str(&boot_image, rec->name), image_str(&boot_image, rec->owner),
+                                                  ss, rec->is_directory, entries, access_count);
+    free(entries);
+    if (!file) return NULL;
+    file_set_annotation(file, image_str(&boot_image, rec->annotation));
+    if (!file_link(file)) {
+        file_metadata_free(file);
+        return NULL;
+    }
+    return file;
+}
+
+// Returns the metadata for 'filename' from the boot image, materializing
+// it on first touch, or NULL if the image does not hold it (or it was
+// already materialized and is in file_hash_table, or deleted since).
+// Caller holds ns_lock (shared is enough).
+FileMetadata* image_fault_in(const char* filename) {
+    if (__atomic_load_n(&image_pending, __ATOMIC_ACQUIRE) == 0) return NULL;
+    long idx = image_find(&boot_image, filename);
+    if (idx < 0) return NULL;
+
+    FileMetadata* file = NULL;
+    pthread_mutex_lock(&image_mutex);
+    if (!image_state[idx]) {
+        file = image_materialize(idx);
+    } else {
+        file = file_lookup(filename); // Raced with another fault
     }
-    for (User* current = user_list_head; current != NULL; current = current->next) {
-        fprintf(user_file, "%s\n", current->username);
+    pthread_mutex_unlock(&image_mutex);
+    return file;
+}
+
+// Materializes every remaining record, for handlers that walk the whole
+// directory tree. Caller holds ns_lock (shared is enough).
+void image_fault_in_all() {
+    if (__atomic_load_n(&image_pending, __ATOMIC_ACQUIRE) == 0) return;
+    pthread_mutex_lock(&image_mutex);
+    for (uint64_t i = 0; i < boot_image.header->file_count; i++) {
+        if (!image_state[i]) image_materialize(i);
     }
-    fclose(user_file);
+    pthread_mutex_unlock(&image_mutex);
+}
 
-    // 2. Save File Metadata
-    FILE* meta_file = fopen("file_metadata.dat", "w");
-    if (!meta_file) {
-        log_message(LOG_ERROR, "Persistence", "Failed to open file_metadata.dat for writing.");
+// Materializes the records under 'folder', which sit next to each other in
+// a sorted image. Caller holds ns_lock (shared is enough).
+void image_fault_in_tree(const char* folder) {
+    if (__atomic_load_n(&image_pending, __ATOMIC_ACQUIRE) == 0) return;
+    char prefix[DIR_PATH_MAX];
+    int len = snprintf(prefix, sizeof(prefix), "%s/", folder);
+    if (!image_sorted(&boot_image) || len >= (int)sizeof(prefix)) {
+        image_fault_in_all();
         return;
     }
-    for (FileMetadata* current = file_list_head; current != NULL; current = current->next) {
-        // Format: filename;owner;ss_ip;ss_port
-        fprintf(meta_file, "%s;%s;%s;%d", current->filename, current->owner, current->ss->ip_addr, current->ss->port);
-        
-        // Append access list: ;user1,R;user2,W
-        for (AccessNode* acc = current->access_list; acc != NULL; acc = acc->next) {
-            // We don't need to save the owner's permission, it's implicit
-            if (strcmp(acc->username, current->owner) != 0) {
-                 fprintf(meta_file, ";%s,%c", acc->username, acc->permission);
-            }
+    pthread_mutex_lock(&image_mutex);
+    for (uint64_t i = image_lower_bound(&boot_image, prefix); i < boot_image.header->file_count &&
+         strncmp(image_str(&boot_image, boot_image.files[i].name), prefix, len) == 0; i++) {
+        if (!image_state[i]) image_materialize(i);
+    }
+    pthread_mutex_unlock(&image_mutex);
+}
+
+// For the lock-free redirect handlers: makes sure 'filename' is in
+// file_hash_table before they look it up. Call outside any lock or epoch
+// section. A no-op once the whole image has been touched.
+void image_prefault(const char* filename) {
+    if (__atomic_load_n(&image_pending, __ATOMIC_ACQUIRE) == 0) return;
+    pthread_rwlock_rdlock(&ns_lock);
+    if (!file_lookup(filename)) image_fault_in(filename);
+    pthread_rwlock_unlock(&ns_lock);
+}
+
+// dir_index_walk() callback for snapshot_metadata()
+static int snapshot_file(FileMetadata* file, const char* folder, void* arg) {
+    ImageBuilder* b = (ImageBuilder*)arg;
+    char path[DIR_PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", folder, dir_key_name(file->key));
+    pthread_rwlock_rdlock(&file->cold->lock);
+    image_add_file(b, path, file_owner(file), file->ss->ip_addr, file->ss->port,
+                   file->is_directory, file_annotation(file));
+    uint32_t pos = 0, user;
+    char perm;
+    while (acl_next(file->acl, &pos, &user, &perm)) {
+        // We don't need to save the owner's permission, it's implicit
+        if (user != file->owner_id) {
+            image_add_access(b, user_id_name(user), perm);
         }
-        fprintf(meta_file, "\n");
-    }
-    fclose(meta_file);
-    log_message(LOG_DEBUG, "Persistence", "Metadata saved to disk.");
-    // ... existing save code for users and file_metadata.dat ...
-
-    // 3. Save Annotations (New File)
-    FILE* note_file = fopen("annotations.dat", "w");
-    if (note_file) {
-        for (FileMetadata* current = file_list_head; current != NULL; current = current->next) {
-            if (strlen(current->annotation) > 0) {
-                // Format: filename;note
-                fprintf(note_file, "%s;%s\n", current->filename, current->annotation);
-            }
+    }
+    pthread_rwlock_unlock(&file->cold->lock);
+    return 1;
+}
+
+// Adds a full snapshot of users and files to 'b'. Records still sitting in
+// the boot image are copied across without being materialized.
+// Caller holds ns_lock (read or write) and no file lock.
+void snapshot_metadata(ImageBuilder* b) {
+    // 1. Users
+    pthread_rwlock_rdlock(&user_lock);
+    uint32_t user_count = user_id_count();
+    for (uint32_t id = 0; id < user_count; id++) {
+        UserRecord* record = user_record(id);
+        if (record->registered) {
+            image_add_user(b, record->name, __atomic_load_n(&record->owned_files, __ATOMIC_RELAXED) +
+                                            __atomic_load_n(&record->image_files, __ATOMIC_RELAXED));
         }
-        fclose(note_file);
     }
-    
+    pthread_rwlock_unlock(&user_lock);
+
+    // 2. Live files. image_mutex keeps faults out so nothing is added twice.
+    pthread_mutex_lock(&image_mutex);
+    dir_index_walk("", snapshot_file, b);
+
+    // 3. Files never touched since boot
+    for (uint64_t i = 0; image_pending > 0 && i < boot_image.header->file_count; i++) {
+        if (image_state[i]) continue;
+        const ImageFileRecord* rec = &boot_image.files[i];
+        const ImageSSRecord* ss = &boot_image.ss[rec->ss < boot_image.header->ss_count ? rec->ss : 0];
+        image_add_file(b, image_str(&boot_image, rec->name), image_str(&boot_image, rec->owner),
+                       image_str(&boot_image, ss->ip), ss->port, rec->is_directory,
+                       image_str(&boot_image, rec->annotation));
+        if ((uint64_t)rec->access_first + rec->access_count > boot_image.header->access_count) continue;
+        for (uint32_t k = 0; k < rec->access_count; k++) {
+            const ImageAccessRecord* acc = &boot_image.access[rec->access_first + k];
+            image_add_access(b, image_str(&boot_image, acc->username), (char)acc->permission);
+        }
+    }
+    pthread_mutex_unlock(&image_mutex);
 }
 
+// Folds the log into a fresh image so it stays short.
+//
+// Every record appended before the rotation describes a change that
+// happened before it, so the snapshot taken afterwards already contains it
+// and the old segment can go. Records in the new segment may also be in
+// the snapshot; replaying them again is harmless because each one sets a
+// value rather than adjusting it.
+void checkpoint_metadata() {
+    // If an earlier checkpoint failed, its old segment is still waiting to
+    // be covered; this snapshot covers it, so keep using it.
+    if (access(METADATA_WAL_OLD, F_OK) != 0 && wal_rotate(METADATA_WAL_OLD) < 0) return;
+
+    ImageBuilder builder;
+    image_builder_init(&builder);
+    uint64_t lsn = 0;
+    pthread_rwlock_rdlock(&ns_lock);
+    snapshot_metadata(&builder);
+    // Intents still open were logged in the old segment; log them again,
+    // as they must outlive it (intents.h).
+    for (NsIntent* in = ns_intents; in; in = in->next) lsn = meta_log_intent(in);
+    pthread_rwlock_unlock(&ns_lock);
+    wal_commit(lsn);
+
+    // The slow part (write + fsync) runs without any lock.
+    int written = image_write(&builder, METADATA_IMAGE);
+    image_builder_free(&builder);
+    if (written < 0) {
+        log_message(LOG_ERROR, "Persistence", "Checkpoint failed; keeping the metadata log.");
+        return;
+    }
+    wal_sync_dir();
+    unlink(METADATA_WAL_OLD);
+    wal_sync_dir();
+    log_message(LOG_DEBUG, "Persistence", "Checkpoint written; metadata log compacted.");
+}
 
-// Loads all user and file metadata from disk on startup.
-void load_metadata() {
-    pthread_mutex_lock(&data_mutex);
-    
+// Checkpoints every CHECKPOINT_INTERVAL seconds, or sooner once the log
+// passes CHECKPOINT_WAL_BYTES.
+static void* checkpoint_thread_main(void* arg) {
+    (void)arg;
+    int elapsed = 0;
+    while (1) {
+        sleep(1);
+        elapsed++;
+        unsigned long bytes = wal_segment_bytes();
+        if (bytes >= CHECKPOINT_WAL_BYTES || (bytes > 0 && elapsed >= CHECKPOINT_INTERVAL)) {
+            checkpoint_metadata();
+            elapsed = 0;
+        }
+    }
+    return NULL;
+}
+
+// Returns the SS registered at ip:port, adding an entry for it if needed.
+// Recovered files keep their SS even if it has not re-registered yet.
+// Caller holds ns_lock exclusively.
+StorageServer* find_or_add_storage_server(const char* ip, int port) {
+    for (StorageServer* ss = ss_list_head; ss; ss = ss->next) {
+        if (strcmp(ss->ip_addr, ip) == 0 && ss->port == port) return ss;
+    }
+    StorageServer* ss = (StorageServer*)calloc(1, sizeof(StorageServer));
+    if (!ss) return NULL;
+    strncpy(ss->ip_addr, ip, sizeof(ss->ip_addr) - 1);
+    ss->port = port;
+    ss_pool_init(&ss->pool);
+    ss->load.down = 1; // Until it registers (ss_health.h)
+    ss->next = ss_list_head;
+    ss_list_head = ss;
+    return ss;
+}
+
+// Drops recovered intent 'in'. Caller holds ns_lock exclusively.
+static void intent_free_recovered(NsIntent* in) {
+    intent_remove(in);
+    free((char*)in->path);
+    free((char*)in->new_path);
+    free(in);
+}
+
+// Reads back a META_INTENT record for 'filename', which has been read
+// already, and records the intent as recovered until the log shows how it
+// ended. Caller holds ns_lock exclusively.
+static void intent_recover(const char* filename, WalReader* reader) {
+    char new_path[100], ss_ip[20];
+    int32_t op, port, tree;
+    if (wal_get_int(reader, &op) < 0 || wal_get_str(reader, new_path, sizeof(new_path)) < 0 ||
+        wal_get_str(reader, ss_ip, sizeof(ss_ip)) < 0 || wal_get_int(reader, &port) < 0 ||
+        wal_get_int(reader, &tree) < 0) return;
+    if (intent_find(filename)) return; // Logged again by a checkpoint
+    StorageServer* ss = find_or_add_storage_server(ss_ip, port);
+    NsIntent* in = (NsIntent*)malloc(sizeof(NsIntent));
+    char* path = strdup(filename);
+    char* dest = new_path[0] ? strdup(new_path) : NULL;
+    if (!ss || !in || !path || (new_path[0] && !dest)) {
+        free(in);
+        free(path);
+        free(dest);
+        return;
+    }
+    intent_add(in, (char)op, path, tree, dest, ss);
+    in->recovered = 1;
+}
+
+// Applies one metadata log record during recovery. Runs single-threaded
+// inside load_metadata(), which holds ns_lock exclusively.
+static void apply_meta_record(uint8_t type, WalReader* reader) {
+    char filename[100], name[50], ss_ip[20], value[256];
+    int32_t port, is_directory;
+
+    if (type == META_ADD_USER) {
+        int was_new;
+        if (wal_get_str(reader, name, sizeof(name)) < 0 || user_exists(name)) return;
+        user_set_registered(name, "0.0.0.0", &was_new); // IP will be updated on re-register
+        return;
+    }
+
+    if (wal_get_str(reader, filename, sizeof(filename)) < 0) return;
+    if (type == META_INTENT) {
+        intent_recover(filename, reader);
+        return;
+    }
+    if (type == META_CREATE_FILE || type == META_DELETE_FILE || type == META_RENAME || type == META_INTENT_DONE) {
+        // How the intent on 'filename' ended, if there was one
+        NsIntent* in = intent_find(filename);
+        if (in && in->recovered) intent_free_recovered(in);
+        if (type == META_INTENT_DONE) return;
+    }
+    FileMetadata* file = file_lookup(filename);
+    if (!file) file = image_fault_in(filename);
+
+    if (type == META_CREATE_FILE) {
+        if (file) return; // Already in the snapshot
+        if (wal_get_str(reader, name, sizeof(name)) < 0 || wal_get_str(reader, ss_ip, sizeof(ss_ip)) < 0 ||
+            wal_get_int(reader, &port) < 0 || wal_get_int(reader, &is_directory) < 0) return;
+        StorageServer* ss = find_or_add_storage_server(ss_ip, port);
+        FileMetadata* newFile = ss ? file_metadata_create(filename, name, ss, is_directory) : NULL;
+        if (newFile && !file_link(newFile)) file_metadata_free(newFile);
+        return;
+    }
+    if (!file) return; // Deleted later in the log
+
+    if (type == META_DELETE_FILE) {
+        file_unlink(file);
+        file_metadata_free(file); // No readers exist yet
+    } else if (type == META_SET_ACCESS || type == META_REMOVE_ACCESS) {
+        if (wal_get_str(reader, name, sizeof(name)) < 0) return;
+        if (type == META_SET_ACCESS && wal_get_str(reader, value, sizeof(value)) < 0) return;
+        uint32_t user = user_id_intern(name);
+        if (user == USER_ID_NONE) return;
+        AccessList* acl = type == META_SET_ACCESS ? acl_with(file->acl, user, value[0]) : acl_without(file->acl, user);
+        if (!acl) return;
+        user_files_acl_changed(file, file->acl, acl);
+        acl_free(file->acl); // No readers exist yet
+        file->acl = acl;
+    } else if (type == META_ANNOTATE) {
+        if (wal_get_str(reader, value, sizeof(value)) < 0) return;
+        file_set_annotation(file, value);
+    } else if (type == META_RENAME) {
+        if (wal_get_str(reader, value, sizeof(value)) < 0) return;
+        const char* why;
+        image_fault_in_all(); // Image records are keyed by their old paths
+        if (file_move_check(file, filename, value, &why) == 0) file_move(file, filename, value);
+    }
+}
+
+// Sets aside one contiguous run of file and index-entry objects for a bulk
+// load of 'files' files, so they end up next to each other (slab.h).
+static void reserve_for_load(unsigned long files) {
+    if (files == 0) return;
+    slab_reserve(&file_pool, files);
+    slab_reserve(&file_cold_pool, files);
+    slab_reserve(&ht_entry_pool, files);
+}
+
+// Maps metadata.img and loads only what has to be live up front: users
+// and Storage Server entries. Files stay in the image until touched.
+// Caller holds ns_lock exclusively.
+static int load_metadata_image() {
+    if (image_open(&boot_image, METADATA_IMAGE) < 0) return -1;
+    const ImageHeader* h = boot_image.header;
+
+    image_state = (uint8_t*)calloc(h->file_count ? h->file_count : 1, 1);
+    image_ss = (StorageServer**)calloc(h->ss_count ? h->ss_count : 1, sizeof(StorageServer*));
+    if (!image_state || !image_ss) return -1;
+    for (uint64_t i = 0; i < h->ss_count; i++) {
+        image_ss[i] = find_or_add_storage_server(image_str(&boot_image, boot_image.ss[i].ip), boot_image.ss[i].port);
+    }
+
+    image_counts_known = h->version >= 2;
+    for (uint64_t i = 0; i < h->user_count; i++) {
+        int was_new;
+        char name[50] = "";
+        strncpy(name, image_user_name(&boot_image, i), sizeof(name) - 1);
+        if (!user_set_registered(name, "0.0.0.0", &was_new)) break; // IP will be updated on re-register
+        uint32_t id = user_id_lookup(name);
+        if (id != USER_ID_NONE && image_counts_known) user_record(id)->image_files = image_user_owned(&boot_image, i);
+    }
+
+    image_pending = h->file_count;
+    reserve_for_load(h->file_count); // Untouched pages cost nothing until faulted in
+    char log_buf[150];
+    snprintf(log_buf, sizeof(log_buf), "Mapped metadata image: %lu files, %lu users.",
+             (unsigned long)h->file_count, (unsigned long)h->user_count);
+    log_message(LOG_INFO, "Persistence", log_buf);
+    return 0;
+}
+
+// Loads the older text format (user_data.dat, file_metadata.dat,
+// annotations.dat), parsing and allocating every file up front.
+// Caller holds ns_lock exclusively.
+static void load_metadata_text() {
     char line_buffer[MAX_BUFFER_SIZE * 2];
 
     // 1. Load Users
-    FILE* user_file = fopen("user_data.dat", "r");
+    FILE* user_file = fopen(USER_DATA_FILE, "r");
     if (user_file) {
         while (fgets(line_buffer, sizeof(line_buffer), user_file)) {
             line_buffer[strcspn(line_buffer, "\n")] = 0; // Remove newline
+            line_buffer[49] = '\0'; // Usernames are at most 49 characters
             if (strlen(line_buffer) > 0) {
-                User* newUser = (User*)malloc(sizeof(User));
-                strcpy(newUser->username, line_buffer);
-                strcpy(newUser->ip_addr, "0.0.0.0"); // IP will be updated on re-register
-                newUser->next = user_list_head;
-                user_list_head = newUser;
+                int was_new;
+                user_set_registered(line_buffer, "0.0.0.0", &was_new); // IP will be updated on re-register
             }
         }
         fclose(user_file);
@@ -1393,8 +2224,17 @@ void load_metadata() {
     }
 
     // 2. Load File Metadata
-    FILE* meta_file = fopen("file_metadata.dat", "r");
+    FILE* meta_file = fopen(FILE_METADATA_FILE, "r");
     if (meta_file) {
+        // One line per file: count them so the objects can be reserved together.
+        unsigned long lines = 0;
+        size_t n;
+        while ((n = fread(line_buffer, 1, sizeof(line_buffer), meta_file)) > 0) {
+            for (char* p = line_buffer; (p = memchr(p, '\n', line_buffer + n - p)) != NULL; p++) lines++;
+        }
+        rewind(meta_file);
+        reserve_for_load(lines);
+
         while (fgets(line_buffer, sizeof(line_buffer), meta_file)) {
             line_buffer[strcspn(line_buffer, "\n")] = 0;
             
@@ -1405,56 +2245,36 @@ void load_metadata() {
 
             if (!filename || !owner || !ss_ip || !ss_port_str) continue;
 
-            // Find the storage server (must have registered before loading)
-            StorageServer* ss = ss_list_head;
-            while(ss) {
-                if (strcmp(ss->ip_addr, ss_ip) == 0 && ss->port == atoi(ss_port_str)) break;
-                ss = ss->next;
-            }
-            if (!ss) {
-                // This can happen if an SS hasn't re-registered yet. We skip the file.
-                // A more robust system might hold this metadata pending SS registration.
-                continue;
+            // No SS has registered yet at startup, so remember its address;
+            // the entry is reused when that SS registers.
+            StorageServer* ss = find_or_add_storage_server(ss_ip, atoi(ss_port_str));
+            if (!ss) continue;
+
+            // Parse the other users' access entries. Each "user,perm"
+            // token is split in place, so find the next one first.
+            uint32_t entries[MAX_BUFFER_SIZE / 2]; // Each token is at least "u,R;"
+            uint32_t access_count = 0;
+            char* rest = strtok(NULL, "");
+            while (rest && *rest && access_count < sizeof(entries) / sizeof(entries[0])) {
+                char* token = rest;
+                rest = strchr(rest, ';');
+                if (rest) *rest++ = '\0';
+                char* comma = strchr(token, ',');
+                if (!comma || comma == token || !comma[1]) continue;
+                *comma = '\0';
+                uint32_t user = user_id_intern(token);
+                if (user != USER_ID_NONE) entries[access_count++] = ACL_ENTRY(user, comma[1]);
             }
 
-            FileMetadata* newFile = (FileMetadata*)malloc(sizeof(FileMetadata));
-            strcpy(newFile->filename, filename);
-            strcpy(newFile->owner, owner);
-            newFile->ss = ss; // Link to the found SS
-            newFile->word_count = 0; // Will be updated
-            newFile->char_count = 0; // Will be updated
-            newFile->last_access = time(NULL);
-            newFile->access_list = NULL;
-
-            // Add owner to access list implicitly
-            AccessNode* ownerAccess = (AccessNode*)malloc(sizeof(AccessNode));
-            strcpy(ownerAccess->username, owner);
-            ownerAccess->permission = 'W';
-            ownerAccess->next = NULL;
-            newFile->access_list = ownerAccess;
-
-            // Parse and add other users to access list
-            char* access_token;
-            while ((access_token = strtok(NULL, ";"))) {
-                char* user = strtok(access_token, ",");
-                char* perm = strtok(NULL, ",");
-                if (user && perm) {
-                    AccessNode* newAccess = (AccessNode*)malloc(sizeof(AccessNode));
-                    strcpy(newAccess->username, user);
-                    newAccess->permission = perm[0];
-                    newAccess->next = newFile->access_list;
-                    newFile->access_list = newAccess;
-                }
-            }
-
-            newFile->next = file_list_head;
-            file_list_head = newFile;
-            ht_insert(file_hash_table,newFile->filename, newFile);
+            // Word and char counts start at 0 and are updated later.
+            // The owner is added to the access list implicitly.
+            FileMetadata* newFile = file_metadata_create_acl(filename, owner, ss, 0, entries, access_count);
+            if (newFile && !file_link(newFile)) file_metadata_free(newFile);
         }
         fclose(meta_file);
         log_message(LOG_INFO, "Persistence", "Loaded file metadata from disk.");
         // 3. Load Annotations
-        FILE* note_file = fopen("annotations.dat", "r");
+        FILE* note_file = fopen(ANNOTATIONS_FILE, "r");
         if (note_file) {
             while (fgets(line_buffer, sizeof(line_buffer), note_file)) {
                 line_buffer[strcspn(line_buffer, "\n")] = 0;
@@ -1464,9 +2284,9 @@ void load_metadata() {
                 if (fname && note) {
                     // We have to search for the file again to attach the note
                     // Since this runs at startup, using hash table is safe
-                    FileMetadata* file = (FileMetadata*)ht_search(file_hash_table, fname);
+                    FileMetadata* file = file_lookup(fname);
                     if (file) {
-                        strcpy(file->annotation, note);
+                        file_set_annotation(file, note);
                     }
                 }
             }
@@ -1474,59 +2294,204 @@ void load_metadata() {
             printf("[Persistence] Loaded annotations.\n");
         }
     }
-    pthread_mutex_unlock(&data_mutex);
+}
+
+// Settles recovered intent 'in' with its Storage Server(s) and brings the
+// metadata in line (intents.h). Returns 0 if a server could not be
+// reached, to be tried again later. Only intent_recovery_main() calls
+// this, so 'in' stays put while no lock is held.
+static int intent_settle(NsIntent* in) {
+    char ss_command[MAX_BUFFER_SIZE];
+    char ss_response[SS_RESPONSE_LEN];
+    int result;
+    if (in->op == INTENT_MOVE) {
+        // Not moved in the metadata yet, so its holders are found as before.
+        pthread_rwlock_wrlock(&ns_lock);
+        image_fault_in_all();
+        FileMetadata* moving = find_file(in->path);
+        StorageServer** servers = moving ? move_holders(moving, in->path) : NULL;
+        pthread_rwlock_unlock(&ns_lock);
+        if (moving && !servers) return 0;
+        StorageServer* only[2] = { in->ss, NULL };
+        result = ss_rename(servers ? servers : only, in->path, in->new_path, ss_response);
+        free(servers);
+    } else {
+        // Undo a CREATE, redo a DELETE: the same SS_DELETE, which is also
+        // acknowledged if the file is gone already.
+        snprintf(ss_command, sizeof(ss_command), "SS_DELETE;%s\n", in->path);
+        if (!connect_and_send_to_ss(in->ss, ss_command, ss_response)) return 0;
+        result = strstr(ss_response, "ACK_DELETE") != NULL;
+    }
+    if (result < 0) return 0;
+
+    char log_buf[300];
+    uint64_t lsn;
+    const char* why;
+    pthread_rwlock_wrlock(&ns_lock);
+    if (in->op == INTENT_MOVE) image_fault_in_all(); // Image records are keyed by their old paths
+    FileMetadata* file = in->op == INTENT_CREATE ? NULL : find_file(in->path);
+    if (result == 1 && file && in->op == INTENT_DELETE) {
+        file_unlink(file);
+        epoch_retire(file, file_metadata_free_deferred);
+        lsn = meta_log_delete_file(in->path);
+        snprintf(log_buf, sizeof(log_buf), "Finished an interrupted DELETE of '%s'.", in->path);
+    } else if (result == 1 && file && in->op == INTENT_MOVE &&
+               file_move_check(file, in->path, in->new_path, &why) == 0 && file_move(file, in->path, in->new_path)) {
+        lsn = meta_log_rename(in->path, in->new_path);
+        snprintf(log_buf, sizeof(log_buf), "Finished an interrupted MOVE of '%s' to '%s'.", in->path, in->new_path);
+    } else {
+        lsn = meta_log_intent_done(in->path);
+        if (in->op == INTENT_CREATE && result == 1) {
+            snprintf(log_buf, sizeof(log_buf), "Undid an interrupted CREATE of '%s'.", in->path);
+        } else {
+            snprintf(log_buf, sizeof(log_buf), "Could not settle an interrupted %s of '%s' (%.100s); left as it was.",
+                     in->op == INTENT_CREATE ? "CREATE" : in->op == INTENT_DELETE ? "DELETE" : "MOVE", in->path,
+                     result == 1 ? "not in the metadata" : ss_response);
+        }
+    }
+    intent_free_recovered(in);
+    pthread_rwlock_unlock(&ns_lock);
+    wal_commit(lsn);
+    log_message(LOG_INFO, "Persistence", log_buf);
+    return 1;
+}
+
+// Settles the intents recovered from the log, each once its Storage Server
+// is up again (it re-registers after a Name Server restart), then exits.
+static void* intent_recovery_main(void* arg) {
+    (void)arg;
+    int settled = 0;
+    while (1) {
+        if (!settled) sleep(1);
+        NsIntent* ready = NULL;
+        int left = 0;
+        pthread_rwlock_rdlock(&ns_lock);
+        for (NsIntent* in = ns_intents; in; in = in->next) {
+            if (!in->recovered) continue;
+            left++;
+            if (!ready && ss_is_up(in->ss)) ready = in;
+        }
+        pthread_rwlock_unlock(&ns_lock);
+        if (!left) break;
+        settled = ready && intent_settle(ready);
+    }
+    log_message(LOG_INFO, "Persistence", "Interrupted CREATE, DELETE and MOVE requests settled.");
+    return NULL;
+}
+
+// Loads all user and file metadata from disk on startup.
+// Maps the last checkpoint image (or reads the older text files if there is
+// none), replays the metadata log on top, then opens the log for new
+// records and starts the checkpointer.
+void load_metadata() {
+    pthread_rwlock_wrlock(&ns_lock);
+    if (load_metadata_image() < 0) {
+        load_metadata_text();
+    }
+
+    // Replay a segment left by an interrupted checkpoint, then the current
+    // one. Both stay on disk until the next checkpoint covers them.
+    int replayed = 0, count;
+    if ((count = wal_replay(METADATA_WAL_OLD, 0, apply_meta_record)) > 0) replayed += count;
+    if ((count = wal_replay(METADATA_WAL, 1, apply_meta_record)) > 0) replayed += count;
+    if (replayed > 0) {
+        char log_buf[100];
+        snprintf(log_buf, sizeof(log_buf), "Replayed %d metadata log records.", replayed);
+        log_message(LOG_INFO, "Persistence", log_buf);
+    }
+    int interrupted = 0;
+    for (NsIntent* in = ns_intents; in; in = in->next) interrupted++;
+    pthread_rwlock_unlock(&ns_lock);
+
+    if (wal_open(METADATA_WAL) < 0) {
+        log_message(LOG_ERROR, "Persistence", "Metadata changes will not be saved.");
+        return;
+    }
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, checkpoint_thread_main, NULL) == 0) pthread_detach(tid);
+    if (interrupted > 0) {
+        char log_buf[150];
+        snprintf(log_buf, sizeof(log_buf), "%d CREATE, DELETE or MOVE requests were interrupted; settling them "
+                 "as their Storage Servers return.", interrupted);
+        log_message(LOG_WARN, "Persistence", log_buf);
+        if (pthread_create(&tid, NULL, intent_recovery_main, NULL) == 0) pthread_detach(tid);
+    }
+}
+
+// Offline converter: reads the text files in the current directory and
+// writes metadata.img. Used by 'name_server --convert-metadata'.
+// Returns 0 on success.
+int convert_text_metadata() {
+    pthread_rwlock_wrlock(&ns_lock);
+    load_metadata_text();
+    ImageBuilder builder;
+    image_builder_init(&builder);
+    snapshot_metadata(&builder);
+    pthread_rwlock_unlock(&ns_lock);
+
+    int result = image_write(&builder, METADATA_IMAGE);
+    if (result == 0) {
+        wal_sync_dir();
+        printf("[Persistence] Wrote %s: %lu files, %lu users.\n", METADATA_IMAGE,
+               (unsigned long)builder.file_count, (unsigned long)builder.user_count);
+    } else {
+        printf("[Persistence] Could not write %s.\n", METADATA_IMAGE);
+    }
+    image_builder_free(&builder);
+    return result;
 }
 // --- UNIQUE FEATURE: File Annotations ---
 
 void handle_annotate(int sock, const char* filename, const char* note, const char* username) {
-    char response[MAX_BUFFER_SIZE];
-    pthread_mutex_lock(&data_mutex);
-
-    FileMetadata* file = find_file(filename);
+    Response r;
+    resp_init(&r, sock);
+    FileMetadata* file = acquire_file(filename, 1);
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
+        resp_end(&r);
         return;
     }
 
     // Only allow people with WRITE access to annotate
     if (!check_permission(file, username, 'W')) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;Permission denied (Need Write Access).\n__END__\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
-        send(sock, response, strlen(response), 0);
+        release_file(file);
+        resp_printf(&r, "%s;%d;Permission denied (Need Write Access).\n", ERROR_PREFIX, ERR_PERMISSION_DENIED);
+        resp_end(&r);
         return;
     }
 
     // Update the annotation
-    strncpy(file->annotation, note, 255);
-    file->annotation[255] = '\0'; // Safety null-terminator
+    if (!file_set_annotation(file, note)) {
+        release_file(file);
+        resp_printf(&r, "%s;%d;Name Server out of memory.\n", ERROR_PREFIX, ERR_SERVER_MISC);
+        resp_end(&r);
+        return;
+    }
 
-    save_metadata(); // Save to disk
-    pthread_mutex_unlock(&data_mutex);
+    uint64_t lsn = meta_log_annotate(filename, file_annotation(file));
+    release_file(file);
+    wal_commit(lsn);
 
-    snprintf(response, sizeof(response), "Annotation added to '%s'.\n__END__\n", filename);
-    send(sock, response, strlen(response), 0);
+    resp_printf(&r, "Annotation added to '%s'.\n", filename);
+    resp_end(&r);
 }
 
 void handle_show_annotation(int sock, const char* filename) {
-    char response[MAX_BUFFER_SIZE];
-    pthread_mutex_lock(&data_mutex);
-
-    FileMetadata* file = find_file(filename);
+    Response r;
+    resp_init(&r, sock);
+    FileMetadata* file = acquire_file(filename, 0);
     if (!file) {
-        pthread_mutex_unlock(&data_mutex);
-        snprintf(response, sizeof(response), "%s;%d;File not found.\n__END__\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
-        send(sock, response, strlen(response), 0);
+        resp_printf(&r, "%s;%d;File not found.\n", ERROR_PREFIX, ERR_FILE_NOT_FOUND);
+        resp_end(&r);
         return;
     }
 
-    if (strlen(file->annotation) == 0) {
-        snprintf(response, sizeof(response), "File '%s' has no annotations.\n__END__\n", filename);
+    if (!file->cold->annotation) {
+        resp_printf(&r, "File '%s' has no annotations.\n", filename);
     } else {
-        snprintf(response, sizeof(response), "Annotation for '%s':\n%s\n__END__\n", filename, file->annotation);
+        resp_printf(&r, "Annotation for '%s':\n%s\n", filename, file->cold->annotation);
     }
 
-    pthread_mutex_unlock(&data_mutex);
-    send(sock, response, strlen(response), 0);
+    release_file(file);
+    resp_end(&r);
 }
\ No newline at end of file
@@ -0,0 +1,190 @@
+#ifndef ACCESS_LIST_H
+#define ACCESS_LIST_H
+
+/*
+ * access_list.h
+ *
+ * Compact per-file ACLs keyed by interned user ID (user_ids.h).
+ *
+ * An AccessList is one allocation in one of two forms:
+ *   - a sorted array of 32-bit entries, (user_id << 1) | is_write, for the
+ *     usual handful of users; a lookup is a binary search.
+ *   - two bitmaps indexed by user ID (has access, has write), once a file
+ *     is shared with enough of the user base that they are no larger than
+ *     the array would be; a lookup is a bit test.
+ *
+ * A list is never modified after it is built. Changing an ACL builds a new
+ * list and publishes it in FileMetadata->acl, so readers need no lock: they
+ * hold the file lock or an epoch read section, and replaced lists go
+ * through epoch_retire(). Free lists with acl_free(), never free(): most
+ * come from per-size pools (slab.h).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "types.h"
+#include "slab.h"
+
+#define ACL_BITMAP_MIN_ENTRIES 64   // Smaller lists always stay arrays
+
+#define ACL_ENTRY(user, perm) (((uint32_t)(user) << 1) | ((perm) == 'W'))
+#define ACL_ENTRY_USER(entry) ((entry) >> 1)
+#define ACL_ENTRY_PERM(entry) (((entry) & 1) ? 'W' : 'R')
+
+// Size classes for small lists: up to 2, 6 and 14 entries. Bigger lists
+// are rare enough to come from malloc().
+#define ACL_POOL_CLASSES 3
+SlabPool acl_pools[ACL_POOL_CLASSES] = {
+    SLAB_POOL("acl_16", 16, 8),
+    SLAB_POOL("acl_32", 32, 8),
+    SLAB_POOL("acl_64", 64, 8),
+};
+
+static size_t acl_bytes(uint32_t slots) {
+    return sizeof(AccessList) + slots * sizeof(uint32_t);
+}
+
+// The pool for a list with 'slots' data words, or NULL for malloc().
+static SlabPool* acl_pool_for(uint32_t slots) {
+    for (int i = 0; i < ACL_POOL_CLASSES; i++) {
+        if (acl_bytes(slots) <= acl_pools[i].size) return &acl_pools[i];
+    }
+    return NULL;
+}
+
+// Frees a list built here. Also usable as an epoch_retire() callback.
+void acl_free(void* ptr) {
+    AccessList* acl = (AccessList*)ptr;
+    if (!acl) return;
+    SlabPool* pool = acl_pool_for(acl->words ? 2 * acl->words : acl->count);
+    if (pool) slab_free(pool, acl);
+    else free(acl);
+}
+
+static int acl_cmp_entry(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Builds a list from 'entries' (any order; sorted in place). If a user
+// appears twice, the stronger permission wins. Returns NULL if out of memory.
+AccessList* acl_build(uint32_t* entries, uint32_t count) {
+    qsort(entries, count, sizeof(uint32_t), acl_cmp_entry);
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        if (unique > 0 && ACL_ENTRY_USER(entries[unique - 1]) == ACL_ENTRY_USER(entries[i])) {
+            entries[unique - 1] = entries[i]; // Sorted, so this one is 'W' if either is
+        } else {
+            entries[unique++] = entries[i];
+        }
+    }
+
+    uint32_t words = unique ? ACL_ENTRY_USER(entries[unique - 1]) / 32 + 1 : 0;
+    int bitmap = unique >= ACL_BITMAP_MIN_ENTRIES && 2 * words <= unique;
+    uint32_t slots = bitmap ? 2 * words : unique;
+
+    SlabPool* pool = acl_pool_for(slots);
+    AccessList* acl = (AccessList*)(pool ? slab_alloc(pool) : malloc(acl_bytes(slots)));
+    if (!acl) return NULL;
+    memset(acl, 0, acl_bytes(slots));
+    acl->count = unique;
+    if (!bitmap) {
+        memcpy(acl->data, entries, unique * sizeof(uint32_t));
+        return acl;
+    }
+    acl->words = words;
+    for (uint32_t i = 0; i < unique; i++) {
+        uint32_t user = ACL_ENTRY_USER(entries[i]);
+        acl->data[user / 32] |= 1u << (user % 32);
+        if (entries[i] & 1) acl->data[words + user / 32] |= 1u << (user % 32);
+    }
+    return acl;
+}
+
+// Returns 'R' or 'W' if 'user' has an entry, else 0.
+char acl_lookup(const AccessList* acl, uint32_t user) {
+    if (!acl) return 0;
+    if (acl->words) {
+        uint32_t word = user / 32, bit = 1u << (user % 32);
+        if (word >= acl->words || !(acl->data[word] & bit)) return 0;
+        return (acl->data[acl->words + word] & bit) ? 'W' : 'R';
+    }
+    uint32_t lo = 0, hi = acl->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        uint32_t mid_user = ACL_ENTRY_USER(acl->data[mid]);
+        if (mid_user == user) return ACL_ENTRY_PERM(acl->data[mid]);
+        if (mid_user < user) lo = mid + 1;
+        else hi = mid;
+    }
+    return 0;
+}
+
+// Iterates entries in user ID order. Start with *pos = 0; returns 0 once
+// there are no more.
+int acl_next(const AccessList* acl, uint32_t* pos, uint32_t* user, char* perm) {
+    if (!acl) return 0;
+    if (!acl->words) {
+        if (*pos >= acl->count) return 0;
+        *user = ACL_ENTRY_USER(acl->data[*pos]);
+        *perm = ACL_ENTRY_PERM(acl->data[*pos]);
+        (*pos)++;
+        return 1;
+    }
+    // Bitmap form: *pos is the next user ID to examine.
+    for (uint32_t id = *pos; id / 32 < acl->words; id++) {
+        uint32_t word = acl->data[id / 32] >> (id % 32);
+        if (!word) {
+            id |= 31; // Rest of this word is empty
+            continue;
+        }
+        id += __builtin_ctz(word);
+        *user = id;
+        *perm = (acl->data[acl->words + id / 32] & (1u << (id % 32))) ? 'W' : 'R';
+        *pos = id + 1;
+        return 1;
+    }
+    *pos = acl->words * 32;
+    return 0;
+}
+
+// Copies every entry of 'acl' into 'out' (room for acl->count entries).
+// Returns the number copied.
+static uint32_t acl_entries(const AccessList* acl, uint32_t* out) {
+    uint32_t pos = 0, user, n = 0;
+    char perm;
+    while (acl_next(acl, &pos, &user, &perm)) out[n++] = ACL_ENTRY(user, perm);
+    return n;
+}
+
+// Returns a new list with 'user' set to 'perm'. 'acl' is left untouched.
+AccessList* acl_with(const AccessList* acl, uint32_t user, char perm) {
+    uint32_t count = acl ? acl->count : 0;
+    uint32_t* entries = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+    if (!entries) return NULL;
+    uint32_t n = acl_entries(acl, entries), kept = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (ACL_ENTRY_USER(entries[i]) != user) entries[kept++] = entries[i];
+    }
+    entries[kept++] = ACL_ENTRY(user, perm);
+    AccessList* result = acl_build(entries, kept);
+    free(entries);
+    return result;
+}
+
+// Returns a new list without 'user'. 'acl' is left untouched.
+AccessList* acl_without(const AccessList* acl, uint32_t user) {
+    uint32_t count = acl ? acl->count : 0;
+    uint32_t* entries = (uint32_t*)malloc((count + 1) * sizeof(uint32_t));
+    if (!entries) return NULL;
+    uint32_t n = acl_entries(acl, entries), kept = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if (ACL_ENTRY_USER(entries[i]) != user) entries[kept++] = entries[i];
+    }
+    AccessList* result = acl_build(entries, kept);
+    free(entries);
+    return result;
+}
+
+#endif // ACCESS_LIST_H
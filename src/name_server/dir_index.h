@@ -0,0 +1,393 @@
+#ifndef DIR_INDEX_H
+#define DIR_INDEX_H
+
+/*
+ * dir_index.h
+ *
+ * The namespace as a tree of directory inodes.
+ *
+ * Every path that has entries under it is a DirNode with a permanent inode
+ * number: the root is 0, "d" for d/x.txt, "d/e" for d/e/y.txt, whether or
+ * not a folder entry was created for it with CREATEFOLDER. Nothing stores a
+ * full path. An entry is keyed by its parent's inode number and its own
+ * name, "<ino>:<name>", both in file_hash_table (files and folder entries)
+ * and in dir_index.table (child DirNodes). Moving a folder therefore
+ * re-keys one entry and one node however much sits below it, and full
+ * paths are rebuilt from the parent chain when they are printed.
+ *
+ * A node also holds arrays of the entries directly inside it and of its
+ * child nodes, in the order they were added. Each file remembers its slot
+ * in its node's array (FileMetadata->dir_slot), so adding an entry is O(1).
+ * Removing one shifts the entries after it down a slot, which costs
+ * O(entries in its folder) but keeps the order, so a listing that resumes
+ * after an entry's slot neither repeats nor skips the entries that were
+ * there all along. A node is dropped once it has nothing left under it.
+ * Listing a folder costs O(entries under it).
+ *
+ * dir_index.lock guards the arrays and every node's name and parent; it
+ * nests inside ns_lock and image_mutex, the locks file_link()/file_unlink()
+ * callers already hold. Resolving a path takes no lock: dir_index.table is
+ * an RCU table, nodes and old keys are freed through epoch_retire(), and
+ * the one field a lookup reads from a node (ino) never changes. Only a
+ * rename (ns_lock exclusive) changes a node's name or parent, so anyone
+ * holding ns_lock may follow the parent chain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "types.h"
+#include "hash_table.h"
+#include "epoch.h"
+#include "slab.h"
+
+#define DIR_SLOT_NONE UINT32_MAX   // FileMetadata->dir_slot when not indexed
+#define DIR_KEY_MAX 112            // "<ino>:<name>"; names are under 100 characters
+#define DIR_PATH_MAX 128           // Full paths are under 100 characters
+
+typedef struct DirNode {
+    uint32_t ino;               // Never reused; the root is 0
+    char* key;                  // "<parent ino>:<name>" in dir_index.table; NULL for the root
+    const char* name;           // Points into 'key'; "" for the root
+    struct DirNode* parent;     // NULL for the root
+    uint32_t parent_slot;       // Position in parent->subdirs
+    FileMetadata** files;       // Entries directly inside, oldest first
+    uint32_t file_count, file_cap;
+    struct DirNode** subdirs;   // Child directories with entries of their own
+    uint32_t subdir_count, subdir_cap;
+} DirNode;
+
+typedef struct DirIndex {
+    pthread_rwlock_t lock;
+    HashTable* table;           // "<parent ino>:<name>" -> DirNode
+    DirNode root;
+    uint32_t next_ino;
+} DirIndex;
+
+DirIndex dir_index = { PTHREAD_RWLOCK_INITIALIZER, NULL, { .name = "" }, 1 };
+
+// Writes the key of entry 'name' (its first 'len' characters) in directory
+// 'ino' to 'key', which holds DIR_KEY_MAX bytes.
+static void dir_entry_key(char* key, uint32_t ino, const char* name, size_t len) {
+    snprintf(key, DIR_KEY_MAX, "%x:%.*s", ino, (int)len, name);
+}
+
+// The name part of a key made by dir_entry_key()
+static inline const char* dir_key_name(const char* key) {
+    return strchr(key, ':') + 1;
+}
+
+// Makes room for one more element. Returns the (possibly moved) array, or
+// NULL if out of memory, in which case the old one is untouched.
+static void* dir_grow(void* array, uint32_t* cap, uint32_t count, size_t elem) {
+    if (count < *cap) return array;
+    uint32_t new_cap = *cap ? *cap * 2 : 4;
+    void* grown = realloc(array, new_cap * elem);
+    if (grown) *cap = new_cap;
+    return grown;
+}
+
+// epoch_retire() callback for a dropped node
+static void dir_node_free(void* ptr) {
+    DirNode* node = (DirNode*)ptr;
+    free(node->files);
+    free(node->subdirs);
+    free(node->key);
+    free(node);
+}
+
+// Takes 'node' out of its parent's subdirs, keeping the others in order.
+static void dir_detach(DirNode* node) {
+    DirNode* parent = node->parent;
+    uint32_t slot = node->parent_slot;
+    parent->subdir_count--;
+    memmove(&parent->subdirs[slot], &parent->subdirs[slot + 1], (parent->subdir_count - slot) * sizeof(DirNode*));
+    for (uint32_t i = slot; i < parent->subdir_count; i++) parent->subdirs[i]->parent_slot = i;
+}
+
+// Takes 'file' out of its node's files, keeping the others in order.
+static void dir_unlist(FileMetadata* file) {
+    DirNode* dir = file->parent;
+    uint32_t slot = file->dir_slot;
+    dir->file_count--;
+    memmove(&dir->files[slot], &dir->files[slot + 1], (dir->file_count - slot) * sizeof(FileMetadata*));
+    for (uint32_t i = slot; i < dir->file_count; i++) dir->files[i]->dir_slot = i;
+}
+
+// Adds 'node' to parent's subdirs, which must have room (dir_grow()).
+static void dir_attach(DirNode* parent, DirNode* node) {
+    node->parent = parent;
+    node->parent_slot = parent->subdir_count;
+    parent->subdirs[parent->subdir_count++] = node;
+}
+
+// Drops 'node' and then each ancestor that is left with nothing under it.
+// The root is kept. Caller holds the lock exclusively and is not inside an
+// epoch read section.
+static void dir_prune(DirNode* node) {
+    while (node->parent && node->file_count == 0 && node->subdir_count == 0) {
+        DirNode* parent = node->parent;
+        dir_detach(node);
+        ht_delete(dir_index.table, node->key);
+        epoch_retire(node, dir_node_free); // Lock-free lookups may be passing through
+        node = parent;
+    }
+}
+
+// Returns the child directory of 'dir' named by the first 'len' characters
+// of 'name', creating it if 'create' (lock held exclusively). A lookup
+// needs no lock; see the header comment.
+static DirNode* dir_child(DirNode* dir, const char* name, size_t len, int create) {
+    char key[DIR_KEY_MAX];
+    dir_entry_key(key, dir->ino, name, len);
+    HashTable* table = __atomic_load_n(&dir_index.table, __ATOMIC_ACQUIRE);
+    DirNode* node = table ? (DirNode*)ht_search(table, key) : NULL;
+    if (node || !create) return node;
+    if (!table) {
+        if (!(table = ht_create_rcu())) return NULL;
+        __atomic_store_n(&dir_index.table, table, __ATOMIC_RELEASE);
+    }
+
+    DirNode** subdirs = (DirNode**)dir_grow(dir->subdirs, &dir->subdir_cap, dir->subdir_count, sizeof(DirNode*));
+    if (!subdirs) return NULL;
+    dir->subdirs = subdirs;
+    node = (DirNode*)calloc(1, sizeof(DirNode));
+    if (!node || !(node->key = strdup(key))) {
+        free(node);
+        return NULL;
+    }
+    node->name = dir_key_name(node->key);
+    if (!ht_insert(table, node->key, node)) {
+        dir_node_free(node); // Not reachable yet
+        return NULL;
+    }
+    node->ino = dir_index.next_ino++;
+    dir_attach(dir, node);
+    return node;
+}
+
+// Walks the directories along 'path' and returns the one holding its last
+// component, pointing *leaf at that component. A missing directory is
+// created if 'create' (lock held exclusively); otherwise NULL is returned.
+// Lookups take no lock: call with ns_lock held or inside an epoch read
+// section.
+DirNode* dir_resolve(const char* path, const char** leaf, int create) {
+    DirNode* dir = &dir_index.root;
+    const char* slash;
+    while ((slash = strchr(path, '/')) != NULL) {
+        DirNode* child = dir_child(dir, path, slash - path, create);
+        if (!child) {
+            if (create) dir_prune(dir); // In case it was made just for this
+            return NULL;
+        }
+        dir = child;
+        path = slash + 1;
+    }
+    *leaf = path;
+    return dir;
+}
+
+// The node for directory 'path', or NULL if nothing is under it. Same
+// locking as dir_resolve() without 'create'.
+DirNode* dir_lookup(const char* path) {
+    const char* leaf;
+    DirNode* dir = dir_resolve(path, &leaf, 0);
+    return dir ? dir_child(dir, leaf, strlen(leaf), 0) : NULL;
+}
+
+// Writes the full path of entry 'name' in 'dir' to 'buf' (DIR_PATH_MAX
+// bytes) and returns it. Caller holds ns_lock, which keeps renames out.
+const char* dir_path(const DirNode* dir, const char* name, char* buf) {
+    const DirNode* chain[DIR_PATH_MAX / 2];
+    int depth = 0;
+    for (; dir->parent && depth < (int)(sizeof(chain) / sizeof(chain[0])); dir = dir->parent) chain[depth++] = dir;
+
+    size_t len = 0;
+    buf[0] = '\0';
+    while (depth-- > 0 && len < DIR_PATH_MAX) {
+        len += snprintf(buf + len, DIR_PATH_MAX - len, "%s/", chain[depth]->name);
+    }
+    if (len < DIR_PATH_MAX) snprintf(buf + len, DIR_PATH_MAX - len, "%s", name);
+    return buf;
+}
+
+// Links 'file' into the directory named by its key, which holds its full
+// path until then, and switches the key to "<parent ino>:<name>" for
+// file_hash_table. Called by file_link(). Returns 0 if out of memory,
+// leaving the file unlinked.
+int dir_index_add(FileMetadata* file) {
+    pthread_rwlock_wrlock(&dir_index.lock);
+    const char* leaf;
+    DirNode* dir = dir_resolve(file->key, &leaf, 1);
+    char key[DIR_KEY_MAX];
+    if (dir) dir_entry_key(key, dir->ino, leaf, strlen(leaf));
+    char* entry_key = dir ? slab_strdup(key) : NULL;
+    FileMetadata** files = entry_key ? (FileMetadata**)dir_grow(dir->files, &dir->file_cap, dir->file_count, sizeof(FileMetadata*)) : NULL;
+    if (!files) {
+        slab_strfree(entry_key);
+        if (dir) dir_prune(dir);
+        pthread_rwlock_unlock(&dir_index.lock);
+        return 0;
+    }
+    dir->files = files;
+    file->parent = dir;
+    file->dir_slot = dir->file_count;
+    files[dir->file_count++] = file;
+    slab_strfree((char*)file->key); // Nobody has seen the path key yet
+    file->key = entry_key;
+    pthread_rwlock_unlock(&dir_index.lock);
+    return 1;
+}
+
+// Takes 'file' out of its directory. Called by file_unlink(); the key
+// stays, so file_hash_table can still be cleaned up.
+void dir_index_remove(FileMetadata* file) {
+    if (file->dir_slot == DIR_SLOT_NONE) return;
+    pthread_rwlock_wrlock(&dir_index.lock);
+    DirNode* dir = file->parent;
+    dir_unlist(file);
+    file->dir_slot = DIR_SLOT_NONE;
+    file->parent = NULL;
+    dir_prune(dir);
+    pthread_rwlock_unlock(&dir_index.lock);
+}
+
+// Moves 'file' to 'new_path' and, if it is a folder with contents,
+// 'subtree' (its node) along with it, and indexes the file under its new
+// key in 'file_table'. Sets *old_key to the file's previous key, which the
+// caller takes out of 'file_table' and retires. Caller
+// holds ns_lock exclusively, has checked that nothing is at 'new_path' and
+// that 'new_path' is not inside 'subtree', and is not inside an epoch read
+// section. Returns 0 if out of memory, changing nothing.
+int dir_index_move(FileMetadata* file, DirNode* subtree, const char* new_path, HashTable* file_table,
+                   const char** old_key) {
+    pthread_rwlock_wrlock(&dir_index.lock);
+    const char* leaf;
+    DirNode* dir = dir_resolve(new_path, &leaf, 1);
+    char key[DIR_KEY_MAX];
+    if (dir) dir_entry_key(key, dir->ino, leaf, strlen(leaf));
+    char* entry_key = dir ? slab_strdup(key) : NULL;
+    char* node_key = subtree && entry_key ? strdup(key) : NULL;
+    FileMetadata** files = entry_key ? (FileMetadata**)dir_grow(dir->files, &dir->file_cap, dir->file_count, sizeof(FileMetadata*)) : NULL;
+    if (files) dir->files = files;
+    DirNode** subdirs = files && node_key ? (DirNode**)dir_grow(dir->subdirs, &dir->subdir_cap, dir->subdir_count, sizeof(DirNode*)) : NULL;
+    if (subdirs) dir->subdirs = subdirs;
+    // The new keys are indexed before anything moves, so a failure changes
+    // nothing, and lock-free lookups find the entry under one name or the
+    // other throughout.
+    int indexed = files && (!subtree || (subdirs && ht_insert(dir_index.table, node_key, subtree)));
+    if (indexed && !ht_insert(file_table, entry_key, file)) {
+        if (subtree) {
+            ht_delete(dir_index.table, node_key);
+            epoch_retire(node_key, free);
+            node_key = NULL;
+        }
+        indexed = 0;
+    }
+    if (!indexed) {
+        slab_strfree(entry_key);
+        free(node_key);
+        if (dir) dir_prune(dir);
+        pthread_rwlock_unlock(&dir_index.lock);
+        return 0;
+    }
+
+    DirNode* old_parent = file->parent;
+    dir_unlist(file);
+    file->parent = dir;
+    file->dir_slot = dir->file_count;
+    dir->files[dir->file_count++] = file;
+    *old_key = file->key;
+    file->key = entry_key;
+
+    if (subtree) {
+        char* old_node_key = subtree->key;
+        dir_detach(subtree);
+        dir_attach(dir, subtree);
+        subtree->key = node_key;
+        subtree->name = dir_key_name(node_key);
+        ht_delete(dir_index.table, old_node_key);
+        epoch_retire(old_node_key, free);
+    }
+    dir_prune(old_parent);
+    pthread_rwlock_unlock(&dir_index.lock);
+    return 1;
+}
+
+// Visits node's entries from slot 'file_from' on, then its subfolders from
+// slot 'subdir_from' on, each in full.
+static int dir_walk_node(DirNode* node, uint32_t file_from, uint32_t subdir_from, char* prefix, size_t len,
+                         int (*visit)(FileMetadata*, const char*, void*), void* arg) {
+    for (uint32_t i = file_from; i < node->file_count; i++) {
+        if (!visit(node->files[i], prefix, arg)) return 0;
+    }
+    for (uint32_t i = subdir_from; i < node->subdir_count; i++) {
+        DirNode* sub = node->subdirs[i];
+        size_t sub_len = len + snprintf(prefix + len, DIR_PATH_MAX - len, "%s/", sub->name);
+        if (sub_len >= DIR_PATH_MAX) sub_len = DIR_PATH_MAX - 1;
+        if (!dir_walk_node(sub, 0, 0, prefix, sub_len, visit, arg)) return 0;
+        prefix[len] = '\0';
+    }
+    return 1;
+}
+
+// Writes the path of 'node' with a trailing '/' ("" for the root) to
+// 'prefix' and returns its length.
+static size_t dir_prefix(const DirNode* node, char* prefix) {
+    dir_path(node, "", prefix);
+    return strlen(prefix);
+}
+
+// Like dir_index_walk(), but starts right after entry 'after' (NULL for
+// the beginning), which is how listings resume from a cursor. The walk
+// order only depends on the entries' slots, so resuming costs nothing for
+// the entries already listed. Entries added since the first walk come
+// after every older one, and removing an entry keeps the others in order,
+// so each entry present throughout is visited exactly once. Returns 0, visiting nothing, if
+// 'path' does not exist or 'after' is not under it.
+int dir_index_walk_after(const char* path, const FileMetadata* after,
+                         int (*visit)(FileMetadata*, const char*, void*), void* arg) {
+    char prefix[DIR_PATH_MAX];
+    pthread_rwlock_rdlock(&dir_index.lock);
+    DirNode* top = path[0] ? dir_lookup(path) : &dir_index.root;
+    DirNode* node = top;
+    if (top && after) {
+        node = after->parent;
+        const DirNode* up = node;
+        while (up && up != top) up = up->parent;
+        if (!up || after->dir_slot == DIR_SLOT_NONE) top = NULL;
+    }
+    if (!top) {
+        pthread_rwlock_unlock(&dir_index.lock);
+        return 0;
+    }
+    size_t len = dir_prefix(node, prefix);
+    if (!after) {
+        dir_walk_node(node, 0, 0, prefix, len, visit, arg);
+    } else if (dir_walk_node(node, after->dir_slot + 1, 0, prefix, len, visit, arg)) {
+        // Then the rest of each enclosing folder, up to 'path'
+        while (node != top) {
+            uint32_t next = node->parent_slot + 1;
+            node = node->parent;
+            len = dir_prefix(node, prefix);
+            if (!dir_walk_node(node, node->file_count, next, prefix, len, visit, arg)) break;
+        }
+    }
+    pthread_rwlock_unlock(&dir_index.lock);
+    return 1;
+}
+
+// Calls 'visit' with every entry anywhere under directory 'path' ("" for
+// the whole namespace) and the path of the folder it is in, with a
+// trailing '/' ("" at the top). The entry's own name is dir_key_name() of
+// its key; paths are left to the visitor so entries it skips cost nothing.
+// A folder's own entries come first, then each subfolder's. Stops early if
+// 'visit' returns 0. Caller holds ns_lock (shared is enough), which keeps
+// the entries alive; 'visit' must not link, unlink or move files.
+void dir_index_walk(const char* path, int (*visit)(FileMetadata*, const char*, void*), void* arg) {
+    dir_index_walk_after(path, NULL, visit, arg);
+}
+
+#endif // DIR_INDEX_H
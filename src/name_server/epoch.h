@@ -0,0 +1,185 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+/*
+ * epoch.h
+ *
+ * Epoch-based reclamation (EBR) for Name Server data that is read without
+ * locks. A reader brackets its lookup with epoch_enter()/epoch_exit(); a
+ * writer that unlinks a node hands it to epoch_retire() instead of free().
+ * The node is freed only once every thread that could still be looking at
+ * it has left its read section.
+ *
+ * The global epoch only moves forward when every active reader has seen the
+ * current value, so a node retired in epoch E is safe to free once the
+ * global epoch reaches E + 2.
+ *
+ * Writers still serialize among themselves (ns_lock); this only removes
+ * readers from the picture. Reclamation is lazy and batched: every
+ * EPOCH_RECLAIM_BATCH retires try to advance the epoch, and each advance
+ * frees the nodes retired two epochs back in one step. So a retire costs
+ * O(1) however many nodes a slow reader holds back, and the last few
+ * retired nodes may linger until later retires.
+ */
+
+#include <stdlib.h>
+#include <sched.h>
+#include <pthread.h>
+#include "slab.h"
+
+#define EPOCH_RECLAIM_BATCH 32 // Retires between attempts to advance the epoch
+
+// One per thread that has ever entered a read section. Records are never
+// freed; a thread that exits gives its record back for reuse.
+typedef struct EpochRecord {
+    unsigned long epoch; // Global epoch seen on entry
+    int active;          // Inside a read section
+    int in_use;          // Owned by a live thread
+    int depth;           // Nesting, only touched by the owning thread
+    struct EpochRecord* next;
+} EpochRecord;
+
+typedef struct RetiredNode {
+    void* ptr;
+    void (*free_fn)(void*);
+    unsigned long epoch; // Global epoch when it was unlinked
+    struct RetiredNode* next;
+} RetiredNode;
+
+unsigned long global_epoch = 1;
+EpochRecord* epoch_records = NULL;
+
+// Retired nodes, listed by the epoch they were retired in modulo 3. Each
+// advance to epoch E frees the list of E - 2, so only the lists of E and
+// E - 1 ever hold nodes. All guarded by retire_mutex.
+pthread_mutex_t retire_mutex = PTHREAD_MUTEX_INITIALIZER;
+RetiredNode* retired_lists[3] = { NULL, NULL, NULL };
+int retired_count = 0;
+static int retired_since_reclaim = 0;
+SlabPool retired_pool = SLAB_POOL("retired", sizeof(RetiredNode), 8);
+
+static __thread EpochRecord* thread_record = NULL;
+static pthread_key_t epoch_key;
+static pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+
+static void epoch_thread_exit(void* arg) {
+    EpochRecord* rec = (EpochRecord*)arg;
+    __atomic_store_n(&rec->active, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&rec->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void epoch_make_key() {
+    pthread_key_create(&epoch_key, epoch_thread_exit);
+}
+
+// Finds (or creates) this thread's record.
+static EpochRecord* epoch_self() {
+    if (thread_record) return thread_record;
+    pthread_once(&epoch_key_once, epoch_make_key);
+
+    // Reuse a record left behind by an exited thread.
+    EpochRecord* rec = __atomic_load_n(&epoch_records, __ATOMIC_ACQUIRE);
+    for (; rec; rec = rec->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&rec->in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+    }
+
+    if (!rec) {
+        rec = (EpochRecord*)calloc(1, sizeof(EpochRecord));
+        if (!rec) abort(); // Readers cannot proceed safely without a record
+        rec->in_use = 1;
+        EpochRecord* head = __atomic_load_n(&epoch_records, __ATOMIC_RELAXED);
+        do {
+            rec->next = head;
+        } while (!__atomic_compare_exchange_n(&epoch_records, &head, rec, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    rec->depth = 0;
+    thread_record = rec;
+    pthread_setspecific(epoch_key, rec);
+    return rec;
+}
+
+// Starts a read section. Pointers loaded from RCU-published structures stay
+// valid until the matching epoch_exit(). Sections may nest.
+void epoch_enter() {
+    EpochRecord* rec = epoch_self();
+    if (rec->depth++ > 0) return;
+    __atomic_store_n(&rec->epoch, __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    __atomic_store_n(&rec->active, 1, __ATOMIC_RELAXED);
+    // The announcement must be visible before we load any shared pointer.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+void epoch_exit() {
+    EpochRecord* rec = thread_record;
+    if (--rec->depth > 0) return;
+    __atomic_store_n(&rec->active, 0, __ATOMIC_RELEASE);
+}
+
+// Moves the global epoch forward if every active reader has caught up with
+// it. Returns 1 if it moved. Caller holds retire_mutex.
+static int epoch_try_advance() {
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    unsigned long current = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    for (EpochRecord* rec = __atomic_load_n(&epoch_records, __ATOMIC_ACQUIRE); rec; rec = rec->next) {
+        if (__atomic_load_n(&rec->active, __ATOMIC_ACQUIRE) &&
+            __atomic_load_n(&rec->epoch, __ATOMIC_RELAXED) != current) {
+            return 0; // Someone is still reading in an older epoch
+        }
+    }
+    __atomic_store_n(&global_epoch, current + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+// Advances the global epoch if the readers allow it, and then frees every
+// retired node that no reader can still reach: the whole list of the
+// epoch two back. Caller holds retire_mutex.
+static void epoch_reclaim() {
+    retired_since_reclaim = 0;
+    if (!epoch_try_advance()) return;
+    unsigned long current = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    RetiredNode* node = retired_lists[(current - 2) % 3];
+    retired_lists[(current - 2) % 3] = NULL;
+    while (node) {
+        RetiredNode* next = node->next;
+        node->free_fn(node->ptr);
+        slab_free(&retired_pool, node);
+        retired_count--;
+        node = next;
+    }
+}
+
+// Schedules 'ptr' to be released with 'free_fn' once no reader can hold it.
+// Must be called after the node has been unlinked from every shared
+// structure. Must not be called from inside a read section.
+void epoch_retire(void* ptr, void (*free_fn)(void*)) {
+    RetiredNode* node = (RetiredNode*)slab_alloc(&retired_pool);
+    if (!node) {
+        // Out of memory: wait out the readers right here instead.
+        unsigned long target = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE) + 2;
+        while (1) {
+            pthread_mutex_lock(&retire_mutex);
+            epoch_reclaim();
+            int done = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE) >= target;
+            pthread_mutex_unlock(&retire_mutex);
+            if (done) break;
+            sched_yield();
+        }
+        free_fn(ptr);
+        return;
+    }
+    node->ptr = ptr;
+    node->free_fn = free_fn;
+
+    pthread_mutex_lock(&retire_mutex);
+    node->epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+    node->next = retired_lists[node->epoch % 3];
+    retired_lists[node->epoch % 3] = node;
+    retired_count++;
+    // Advancing reads every thread's record, so it is only tried per batch.
+    if (++retired_since_reclaim >= EPOCH_RECLAIM_BATCH) epoch_reclaim();
+    pthread_mutex_unlock(&retire_mutex);
+}
+
+#endif // EPOCH_H
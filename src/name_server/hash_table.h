@@ -1,92 +1,429 @@
 #ifndef HASH_TABLE_H
 #define HASH_TABLE_H
 
+/*
+ * hash_table.h
+ *
+ * Open-addressing hash table (Swiss-table layout) used for file_hash_table
+ * and the metadata cache's per-shard indexes.
+ *
+ * Slots are grouped 16 at a time. Each slot has one control byte: EMPTY,
+ * DELETED, or a 7-bit fingerprint of the key's hash. A probe loads a whole
+ * group of control bytes and compares all 16 against the fingerprint at
+ * once (SSE2 when available), so most misses and most hits touch a single
+ * cache line of metadata and do at most one strcmp.
+ *
+ * Each full slot points to an immutable HT_Entry {hash, key, value}. The
+ * key is not copied: it must point at storage that lives as long as the
+ * entry, which in practice is the FileMetadata's or DirNode's own key.
+ * Entries come from ht_entry_pool (slab.h).
+ */
+
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "types.h" // Include our new types file for the FileMetadata definition
+#include "epoch.h"
+#include "slab.h"
+
+#define HT_INITIAL_SIZE 1024 // Slots. Power of 2, multiple of HT_GROUP
+#define HT_MIN_SIZE 1024     // Never shrink below this
+#define HT_GROUP 16          // Slots compared per probe step
+#define HT_MIGRATE_STEP 2    // Old groups moved per insert/delete while resizing
 
-#define HT_SIZE 1024 // Power of 2 is good practice
+#define HT_CTRL_EMPTY ((uint8_t)0x80)
+#define HT_CTRL_DELETED ((uint8_t)0xFE)
 
-// Hash Table item (a node in a collision chain)
-typedef struct HT_Item {
-    char key[100];
+// One key/value pair. Never modified once published, so a slot can be
+// read with a single pointer load, and two arrays can share an entry
+// while a resize is copying slots across.
+typedef struct HT_Entry {
+    uint64_t hash;
+    const char* key;
     void* value;
-    struct HT_Item* next;
-} HT_Item;
+} HT_Entry;
+
+SlabPool ht_entry_pool = SLAB_POOL("ht_entry", sizeof(HT_Entry), 8);
+
+// A slot array with its control bytes, in one allocation.
+typedef struct HT_Array {
+    unsigned long capacity; // Power of 2, multiple of HT_GROUP
+    unsigned long used;     // Slots that are not EMPTY (full + deleted)
+    uint8_t* ctrl;
+    HT_Entry** slots;
+} HT_Array;
+
+// The arrays a reader should look in. A view is never modified once
+// published; a resize swaps in a new one, so readers always see a matching
+// pair.
+typedef struct HT_View {
+    HT_Array* cur; // Inserts go here
+    HT_Array* old; // Being copied into 'cur' during a resize, else NULL
+} HT_View;
 
 // The Hash Table itself
+// Entries and control bytes are published with release stores, so
+// ht_search() may run without a lock alongside one writer. Writers must
+// still be serialized by the caller. In an 'rcu' table, removed entries and
+// old arrays are freed through epoch_retire(), so lock-free readers must
+// search inside epoch_enter()/epoch_exit().
+//
+// A control byte only ever goes EMPTY -> full -> DELETED -> full, never back
+// to EMPTY, so a reader can stop probing at the first EMPTY it sees.
+// Tombstones are cleared by rebuilding into a fresh array.
+//
+// Resizing is incremental. When the table gets too full (or too empty), a
+// new array becomes 'cur' and every later insert/delete copies
+// HT_MIGRATE_STEP old groups into it. The old array stays intact until the
+// copy finishes, so a reader holding either view finds every entry.
 typedef struct HashTable {
-    HT_Item** buckets; // An array of pointers to HT_Items
+    HT_View* view;
+    unsigned long count;       // Live entries (each counted once)
+    unsigned long migrate_pos; // Next old group to copy
+    int rcu;
 } HashTable;
 
-// --- Hash Function (a good, simple one called djb2) ---
-static unsigned long hash_function(const char* str) {
-    unsigned long hash = 5381;
-    int c;
-    while ((c = *str++)) {
-        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+// --- Hash Function (64-bit MurmurHash2, MurmurHash64A variant) ---
+// The low 7 bits become the slot fingerprint and the rest pick the group,
+// so every bit needs to be well mixed; djb2 is not.
+static uint64_t hash_function(const char* str) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    size_t len = strlen(str);
+    uint64_t h = 0x8445d61a4e774912ULL ^ (len * m);
+
+    const unsigned char* data = (const unsigned char*)str;
+    const unsigned char* end = data + (len & ~(size_t)7);
+    while (data != end) {
+        uint64_t k;
+        memcpy(&k, data, 8);
+        data += 8;
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    switch (len & 7) {
+    case 7: h ^= (uint64_t)data[6] << 48; // fall through
+    case 6: h ^= (uint64_t)data[5] << 40; // fall through
+    case 5: h ^= (uint64_t)data[4] << 32; // fall through
+    case 4: h ^= (uint64_t)data[3] << 24; // fall through
+    case 3: h ^= (uint64_t)data[2] << 16; // fall through
+    case 2: h ^= (uint64_t)data[1] << 8;  // fall through
+    case 1: h ^= (uint64_t)data[0];
+            h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+static inline uint8_t ht_fingerprint(uint64_t hash) {
+    return (uint8_t)(hash & 0x7F);
+}
+
+// Reads one group of control bytes and returns three bitmasks (bit i set
+// for slot i): slots matching 'fp', EMPTY slots, and EMPTY-or-DELETED slots.
+static inline void ht_group_scan(const uint8_t* ctrl, uint8_t fp, unsigned* match, unsigned* empty, unsigned* free_slots) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    *match = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)fp)));
+    *empty = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)HT_CTRL_EMPTY)));
+    *free_slots = (unsigned)_mm_movemask_epi8(group); // High bit: EMPTY or DELETED
+#else
+    *match = *empty = *free_slots = 0;
+    for (int i = 0; i < HT_GROUP; i++) {
+        uint8_t c = __atomic_load_n(&ctrl[i], __ATOMIC_RELAXED);
+        if (c == fp) *match |= 1u << i;
+        if (c == HT_CTRL_EMPTY) *empty |= 1u << i;
+        if (c & 0x80) *free_slots |= 1u << i;
+    }
+#endif
+    // Slot pointers read after this must be at least as new as the bytes.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+}
+
+static HT_Array* ht_array_create(unsigned long capacity) {
+    HT_Array* array = (HT_Array*)malloc(sizeof(HT_Array) + capacity + capacity * sizeof(HT_Entry*));
+    if (!array) return NULL;
+    array->capacity = capacity;
+    array->used = 0;
+    array->ctrl = (uint8_t*)(array + 1);
+    array->slots = (HT_Entry**)(array->ctrl + capacity); // capacity is a multiple of 16: aligned
+    memset(array->ctrl, HT_CTRL_EMPTY, capacity);
+    memset(array->slots, 0, capacity * sizeof(HT_Entry*));
+    return array;
+}
+
+static void ht_entry_free(void* entry) {
+    slab_free(&ht_entry_pool, entry);
+}
+
+// Frees now, or once lock-free readers are done with it
+static void ht_release(HashTable* table, void* ptr, void (*free_fn)(void*)) {
+    if (table->rcu) epoch_retire(ptr, free_fn);
+    else free_fn(ptr);
+}
+
+static void ht_publish_view(HashTable* table, HT_Array* cur, HT_Array* old) {
+    HT_View* view = (HT_View*)malloc(sizeof(HT_View));
+    if (!view) return; // Keep the current view; the resize simply waits
+    view->cur = cur;
+    view->old = old;
+    HT_View* previous = table->view;
+    __atomic_store_n(&table->view, view, __ATOMIC_RELEASE);
+    ht_release(table, previous, free);
+}
+
+// Finds 'key' in one array. Returns the entry and its slot, or NULL.
+// Probes groups in triangular order, which visits every group once.
+static HT_Entry* ht_array_find(HT_Array* array, const char* key, uint64_t hash, unsigned long* slot_out) {
+    unsigned long groups = array->capacity / HT_GROUP;
+    unsigned long g = (hash >> 7) & (groups - 1);
+    uint8_t fp = ht_fingerprint(hash);
+
+    for (unsigned long step = 1; step <= groups; step++) {
+        unsigned match, empty, free_slots;
+        ht_group_scan(array->ctrl + g * HT_GROUP, fp, &match, &empty, &free_slots);
+        while (match) {
+            unsigned long slot = g * HT_GROUP + __builtin_ctz(match);
+            HT_Entry* entry = __atomic_load_n(&array->slots[slot], __ATOMIC_ACQUIRE);
+            if (entry && entry->hash == hash && strcmp(entry->key, key) == 0) {
+                if (slot_out) *slot_out = slot;
+                return entry;
+            }
+            match &= match - 1;
+        }
+        if (empty) return NULL; // The key would have been placed here
+        g = (g + step) & (groups - 1);
+    }
+    return NULL;
+}
+
+// Places an entry in the first EMPTY or DELETED slot on its probe path.
+// The caller has made sure the key is not already present.
+// Returns 0 only if the array is completely full.
+static int ht_array_put(HT_Array* array, HT_Entry* entry) {
+    unsigned long groups = array->capacity / HT_GROUP;
+    unsigned long g = (entry->hash >> 7) & (groups - 1);
+
+    for (unsigned long step = 1; step <= groups; step++) {
+        unsigned match, empty, free_slots;
+        ht_group_scan(array->ctrl + g * HT_GROUP, 0, &match, &empty, &free_slots);
+        if (free_slots) {
+            unsigned long slot = g * HT_GROUP + __builtin_ctz(free_slots);
+            if (array->ctrl[slot] == HT_CTRL_EMPTY) array->used++;
+            // The entry must be reachable before its fingerprint appears.
+            __atomic_store_n(&array->slots[slot], entry, __ATOMIC_RELEASE);
+            __atomic_store_n(&array->ctrl[slot], ht_fingerprint(entry->hash), __ATOMIC_RELEASE);
+            return 1;
+        }
+        g = (g + step) & (groups - 1);
+    }
+    return 0;
+}
+
+// Most slots an array may use (full + deleted) before it must be rebuilt
+static inline unsigned long ht_array_limit(HT_Array* array) {
+    return array->capacity / 8 * 7;
+}
+
+// Copies up to HT_MIGRATE_STEP old groups into 'cur'. Entries are shared,
+// not duplicated. Once every group is copied, drops the old array.
+static void ht_migrate_step(HashTable* table, int groups_to_copy) {
+    HT_View* view = table->view;
+    if (!view->old) return;
+    HT_Array* old = view->old;
+    unsigned long groups = old->capacity / HT_GROUP;
+
+    for (int n = 0; n < groups_to_copy && table->migrate_pos < groups; n++) {
+        // Never copy half a group: a retry would link its entries twice.
+        if (view->cur->used + HT_GROUP > view->cur->capacity) return;
+        unsigned long base = table->migrate_pos * HT_GROUP;
+        for (int i = 0; i < HT_GROUP; i++) {
+            if (old->ctrl[base + i] & 0x80) continue; // EMPTY or DELETED
+            ht_array_put(view->cur, old->slots[base + i]);
+        }
+        table->migrate_pos++;
+    }
+
+    if (table->migrate_pos == groups) {
+        ht_publish_view(table, view->cur, NULL);
+        if (table->view->old == NULL) ht_release(table, old, free);
+    }
+}
+
+// Starts a resize if the current array is too full, full of tombstones,
+// or mostly empty, and none is running.
+static void ht_maybe_resize(HashTable* table) {
+    HT_View* view = table->view;
+    if (view->old) return;
+
+    HT_Array* cur = view->cur;
+    unsigned long capacity = cur->capacity;
+    unsigned long new_capacity = capacity;
+    if (cur->used > capacity / 4 * 3) {
+        // Grow if it is really full; otherwise just rebuild without tombstones.
+        new_capacity = table->count > capacity / 8 * 3 ? capacity * 2 : capacity;
+    } else if (capacity > HT_MIN_SIZE && table->count < capacity / 8) {
+        new_capacity = capacity / 2;
+    } else {
+        return;
+    }
+
+    HT_Array* fresh = ht_array_create(new_capacity);
+    if (!fresh) return; // Keep running at the higher load factor
+    table->migrate_pos = 0;
+    ht_publish_view(table, fresh, cur);
+    if (table->view->cur != fresh) free(fresh);
+}
+
+// Finds 'key' in each array of the current view: found[0] and slots[0] for
+// 'cur', found[1] and slots[1] for 'old'. Returns 1 if it is in either.
+static int ht_locate(HashTable* table, const char* key, uint64_t hash, HT_Entry* found[2], unsigned long slots[2]) {
+    HT_View* view = table->view;
+    found[0] = ht_array_find(view->cur, key, hash, &slots[0]);
+    found[1] = view->old ? ht_array_find(view->old, key, hash, &slots[1]) : NULL;
+    return found[0] || found[1];
+}
+
+// Marks the slots ht_locate() found DELETED and releases their entry. The
+// view must not have changed in between.
+static void ht_unpublish(HashTable* table, HT_Entry* found[2], unsigned long slots[2]) {
+    HT_View* view = table->view;
+    if (found[0]) __atomic_store_n(&view->cur->ctrl[slots[0]], HT_CTRL_DELETED, __ATOMIC_RELEASE);
+    if (found[1]) __atomic_store_n(&view->old->ctrl[slots[1]], HT_CTRL_DELETED, __ATOMIC_RELEASE);
+
+    // A copied entry is shared by both arrays: release it once.
+    if (found[1] == found[0]) found[1] = NULL;
+    for (int i = 0; i < 2; i++) {
+        if (found[i]) ht_release(table, found[i], ht_entry_free);
+    }
+}
+
+// Marks 'key' deleted in every array that holds it and releases its entry.
+// Returns 1 if it was present.
+static int ht_remove_key(HashTable* table, const char* key, uint64_t hash) {
+    HT_Entry* found[2];
+    unsigned long slots[2];
+    if (!ht_locate(table, key, hash, found, slots)) return 0;
+    ht_unpublish(table, found, slots);
+    return 1;
+}
+
+static HashTable* ht_create_sized(unsigned long capacity, int rcu) {
+    HashTable* table = (HashTable*)calloc(1, sizeof(HashTable));
+    if (!table) return NULL;
+    table->rcu = rcu;
+    table->view = (HT_View*)malloc(sizeof(HT_View));
+    if (!table->view) {
+        free(table);
+        return NULL;
+    }
+    table->view->cur = ht_array_create(capacity);
+    table->view->old = NULL;
+    if (!table->view->cur) {
+        free(table->view);
+        free(table);
+        return NULL;
     }
-    return hash % HT_SIZE;
+    return table;
 }
 
 // Creates an empty hash table
 HashTable* ht_create() {
-    HashTable* table = (HashTable*)malloc(sizeof(HashTable));
-    table->buckets = (HT_Item**)calloc(HT_SIZE, sizeof(HT_Item*));
-    return table;
+    return ht_create_sized(HT_INITIAL_SIZE, 0);
 }
 
-// Inserts a file into the hash table
-void ht_insert(HashTable* table, const char* key, void* value) {
-    if (!table || !key) return;
-    unsigned long index = hash_function(key);
-    
-    HT_Item* new_item = (HT_Item*)malloc(sizeof(HT_Item));
-    strcpy(new_item->key, key);
-    new_item->value=value;
-    
-    // Insert at the beginning of the chain at this index
-    new_item->next = table->buckets[index];
-    table->buckets[index] = new_item;
+// Creates a table whose readers may skip the writers' lock (see above)
+HashTable* ht_create_rcu() {
+    return ht_create_sized(HT_INITIAL_SIZE, 1);
+}
+
+// Inserts a file into the hash table, replacing any entry with the same key.
+// 'key' is stored by pointer and must stay valid while the entry exists.
+// A replaced entry is only marked deleted once the new one is in place, so
+// lock-free readers find one or the other throughout. Returns 0 if out of
+// memory, leaving any old entry in place.
+int ht_insert(HashTable* table, const char* key, void* value) {
+    if (!table || !key) return 0;
+    uint64_t hash = hash_function(key);
+
+    HT_Entry* entry = (HT_Entry*)slab_alloc(&ht_entry_pool);
+    if (!entry) return 0;
+    entry->hash = hash;
+    entry->key = key;
+    entry->value=value;
+
+    // A resize normally finishes long before 'cur' fills up. If it has not
+    // (e.g. an allocation failed), finish it now rather than overfill.
+    if (table->view->cur->used >= ht_array_limit(table->view->cur)) {
+        ht_migrate_step(table, (int)(table->view->old ? table->view->old->capacity / HT_GROUP : 0));
+        ht_maybe_resize(table);
+    }
+    // Found before the put: the new entry may land earlier on the same
+    // probe path, in a DELETED slot, and would then be found instead.
+    HT_Entry* replaced[2];
+    unsigned long slots[2];
+    int found = ht_locate(table, key, hash, replaced, slots);
+    if (!ht_array_put(table->view->cur, entry)) {
+        slab_free(&ht_entry_pool, entry);
+        return 0;
+    }
+    if (found) ht_unpublish(table, replaced, slots);
+    else table->count++;
+
+    ht_migrate_step(table, HT_MIGRATE_STEP);
+    ht_maybe_resize(table);
+    return 1;
 }
 
 // Searches for a file by its key (filename)
 void* ht_search(HashTable* table, const char* key) { // Return void*
     if (!table || !key) return NULL;
-    unsigned long index = hash_function(key);
-    
-    HT_Item* current = table->buckets[index];
-    while (current) {
-        if (strcmp(current->key, key) == 0) {
-            return current->value; // Return the generic value
-        }
-        current = current->next;
+    uint64_t hash = hash_function(key);
+    HT_View* view = __atomic_load_n(&table->view, __ATOMIC_ACQUIRE);
+
+    HT_Entry* entry = ht_array_find(view->cur, key, hash, NULL);
+    if (!entry && view->old) {
+        entry = ht_array_find(view->old, key, hash, NULL); // Not copied over yet
     }
-    return NULL;
+    return entry ? entry->value : NULL; // Return the generic value
 }
 
 // Deletes a file from the hash table
 void ht_delete(HashTable* table, const char* key) {
     if (!table || !key) return;
-    unsigned long index = hash_function(key);
-    
-    HT_Item* current = table->buckets[index];
-    HT_Item* prev = NULL;
-
-    while (current) {
-        if (strcmp(current->key, key) == 0) {
-            if (prev) {
-                prev->next = current->next;
-            } else {
-                table->buckets[index] = current->next;
-            }
-            // The caller is responsible for freeing the actual value if needed.
-            free(current);
-            return;
-        }
-        prev = current;
-        current = current->next;
+    // The caller is responsible for freeing the actual value if needed.
+    if (ht_remove_key(table, key, hash_function(key))) table->count--;
+
+    ht_migrate_step(table, HT_MIGRATE_STEP);
+    ht_maybe_resize(table);
+}
+
+// Number of items currently stored
+unsigned long ht_count(HashTable* table) {
+    return table ? table->count : 0;
+}
+
+// Bytes held by the slot arrays; entries are counted in ht_entry_pool.
+// For an 'rcu' table, call inside an epoch read section.
+unsigned long ht_array_bytes(HashTable* table) {
+    if (!table) return 0;
+    HT_View* view = __atomic_load_n(&table->view, __ATOMIC_ACQUIRE);
+    unsigned long bytes = 0;
+    HT_Array* arrays[2] = { view->cur, view->old };
+    for (int i = 0; i < 2; i++) {
+        if (arrays[i]) bytes += sizeof(HT_Array) + arrays[i]->capacity * (1 + sizeof(HT_Entry*));
     }
+    return bytes;
 }
 
-#endif // HASH_TABLE_H
\ No newline at end of file
+#endif // HASH_TABLE_H
@@ -0,0 +1,113 @@
+#ifndef INTENTS_H
+#define INTENTS_H
+
+/*
+ * intents.h
+ *
+ * Namespace paths with a CREATE, DELETE or MOVE in flight.
+ *
+ * Those commands change the namespace in two phases, so that ns_lock is
+ * never held while a Storage Server is working:
+ *   1. Under ns_lock: check the request and record an intent on the path
+ *      it touches, and log the intent (META_INTENT, CRWD.c). Once the log
+ *      record is on disk:
+ *   2. Unlocked: send the command to the Storage Server(s).
+ *   3. Under ns_lock again: apply the metadata change and log it if the SS
+ *      succeeded (or roll back the SS side if that is no longer possible),
+ *      or log that nothing changed (META_INTENT_DONE), then drop the intent.
+ * The metadata changes only in step 3, so nothing is left behind when an
+ * SS fails or times out, and other commands never see a half-done change.
+ *
+ * If the Name Server dies between steps 1 and 3, the SS may have done the
+ * command without the metadata following. Replaying the log recovers the
+ * intents that were never finished, and intent_recovery_main() (CRWD.c)
+ * settles each one once its Storage Server is back: a CREATE is undone
+ * (its client never heard that it worked), a DELETE or MOVE is sent again,
+ * which is harmless if the SS already did it, and the metadata follows.
+ * Until then the recovered intent keeps its paths busy.
+ *
+ * While an intent is recorded, any other namespace change whose paths
+ * overlap it is refused as busy: the same path, or for a folder (a "tree"
+ * intent) anything under it; for a MOVE also its destination and anything
+ * under that. Other commands, reads included, carry on against the
+ * metadata as it was.
+ *
+ * Intents live on the stack of the handler that records them (recovered
+ * ones on the heap) and are kept in one list, guarded by ns_lock (shared
+ * to check, exclusive to change). A command records one, so the list stays
+ * short.
+ */
+
+#include <string.h>
+#include "types.h"
+
+// What an intent asks of the Storage Servers. Logged: never renumber.
+enum {
+    INTENT_CREATE = 'C',
+    INTENT_DELETE = 'D',
+    INTENT_MOVE = 'M'
+};
+
+typedef struct NsIntent {
+    const char* path;     // Must stay valid until intent_remove()
+    int tree;             // Also covers everything under 'path'
+    char op;              // INTENT_*
+    const char* new_path; // MOVE: the destination, reserved as a tree
+    StorageServer* ss;    // Where the command goes; a folder MOVE also goes
+                          // to the servers of its contents (move_holders())
+    int recovered;        // Read back from the log; owns its strings
+    struct NsIntent* next;
+} NsIntent;
+
+NsIntent* ns_intents = NULL;
+
+// 1 if 'inner' is 'outer' or, for a tree, somewhere under it.
+static int intent_covers(const char* outer, int tree, const char* inner) {
+    size_t len = strlen(outer);
+    if (strncmp(outer, inner, len) != 0) return 0;
+    return inner[len] == '\0' || (tree && inner[len] == '/');
+}
+
+// 1 if a change to 'path' (and everything under it, with 'tree') would
+// overlap one in flight. Caller holds ns_lock.
+int intent_conflicts(const char* path, int tree) {
+    for (NsIntent* in = ns_intents; in; in = in->next) {
+        if (intent_covers(in->path, in->tree, path) || intent_covers(path, tree, in->path)) return 1;
+        if (in->new_path && (intent_covers(in->new_path, 1, path) || intent_covers(path, tree, in->new_path))) return 1;
+    }
+    return 0;
+}
+
+// Records 'in', an 'op' on 'path' at 'ss', and for a MOVE 'new_path'
+// (else NULL). Caller holds ns_lock exclusively, has checked
+// intent_conflicts() for both paths, and logs the intent before step 2.
+void intent_add(NsIntent* in, char op, const char* path, int tree, const char* new_path, StorageServer* ss) {
+    in->path = path;
+    in->tree = tree;
+    in->op = op;
+    in->new_path = new_path;
+    in->ss = ss;
+    in->recovered = 0;
+    in->next = ns_intents;
+    ns_intents = in;
+}
+
+// The intent recorded for exactly 'path', or NULL. Caller holds ns_lock.
+NsIntent* intent_find(const char* path) {
+    for (NsIntent* in = ns_intents; in; in = in->next) {
+        if (strcmp(in->path, path) == 0) return in;
+    }
+    return NULL;
+}
+
+// Caller holds ns_lock exclusively.
+void intent_remove(NsIntent* in) {
+    for (NsIntent** link = &ns_intents; *link; link = &(*link)->next) {
+        if (*link == in) {
+            *link = in->next;
+            return;
+        }
+    }
+}
+
+#endif // INTENTS_H
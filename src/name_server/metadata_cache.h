@@ -0,0 +1,292 @@
+#ifndef METADATA_CACHE_H
+#define METADATA_CACHE_H
+
+/*
+ * metadata_cache.h
+ *
+ * Sharded cache of recently used FileMetadata pointers in front of
+ * file_hash_table. It replaces the old 16-entry LRU list.
+ *
+ * Eviction is CLOCK: a hit only sets the entry's reference bit, so it needs
+ * a shared shard lock and one relaxed store. The clock hand clears bits as
+ * it sweeps and evicts the first entry whose bit is already clear.
+ *
+ * Admission is TinyLFU. Every lookup bumps the key in a small count-min
+ * frequency sketch, and when the shard is full a new key only replaces the
+ * clock's victim if it has been seen more often. A one-off sweep (VIEW -a,
+ * an SS registering thousands of files) touches each key once and so cannot
+ * push out the hot set. The sketch halves its counters periodically so old
+ * popularity fades.
+ *
+ * The cache holds no references: delete must call cache_remove() while it
+ * holds ns_lock exclusively, before the metadata is retired. Entries are
+ * keyed by full path, which files no longer store (dir_index.h), so each
+ * entry keeps its own copy; a rename drops the old path, or calls
+ * cache_clear() when a whole folder moves.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "types.h"
+#include "hash_table.h"
+#include "slab.h"
+#include "../logger.h"
+
+#define CACHE_SHARDS 16                // Power of 2
+#define CACHE_DEFAULT_CAPACITY 4096    // Total entries across all shards
+#define CACHE_SKETCH_ROWS 4
+#define CACHE_SKETCH_MAX 15            // Counters saturate here (4-bit range)
+#define CACHE_SKETCH_SAMPLE 10         // Age after capacity * this many bumps
+
+typedef struct CacheEntry {
+    FileMetadata* file;   // NULL if the slot is free
+    char* key;            // Full path (slab string), the index key
+    uint8_t referenced;   // CLOCK bit, set on every hit
+} CacheEntry;
+
+typedef struct CacheShard {
+    pthread_rwlock_t lock; // Shared for hits; exclusive to admit/evict/remove
+    HashTable* index;      // filename -> CacheEntry*
+    CacheEntry* entries;
+    int capacity;
+    int used;
+    int hand;              // CLOCK hand
+
+    uint8_t* sketch;       // CACHE_SKETCH_ROWS rows of sketch_width counters
+    unsigned long sketch_width; // Power of 2
+    unsigned long sketch_bumps; // Since the last aging pass
+
+    // Statistics, updated with relaxed atomics
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long rejections; // Misses the admission filter kept out
+} __attribute__((aligned(64))) CacheShard;
+
+typedef struct CacheStats {
+    unsigned long hits, misses, evictions, rejections;
+    int capacity, used;
+} CacheStats;
+
+CacheShard cache_shards[CACHE_SHARDS];
+int cache_ready = 0;
+
+static CacheShard* cache_shard_for(uint64_t hash) {
+    // hash_table.h uses the low bits, so shard on the high ones.
+    return &cache_shards[(hash >> 58) & (CACHE_SHARDS - 1)];
+}
+
+// --- Frequency sketch ---
+
+static uint8_t* cache_sketch_counter(CacheShard* shard, uint64_t hash, int row) {
+    // Each row indexes with a different 16-bit slice of the hash.
+    unsigned long index = (hash >> (row * 16)) & (shard->sketch_width - 1);
+    return &shard->sketch[row * shard->sketch_width + index];
+}
+
+// Records one access. Runs under either lock mode, so counters are bumped
+// atomically; a lost race only undercounts by one.
+static void cache_sketch_bump(CacheShard* shard, uint64_t hash) {
+    for (int row = 0; row < CACHE_SKETCH_ROWS; row++) {
+        uint8_t* counter = cache_sketch_counter(shard, hash, row);
+        if (__atomic_load_n(counter, __ATOMIC_RELAXED) < CACHE_SKETCH_MAX) {
+            __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_fetch_add(&shard->sketch_bumps, 1, __ATOMIC_RELAXED);
+}
+
+static int cache_sketch_estimate(CacheShard* shard, uint64_t hash) {
+    int estimate = CACHE_SKETCH_MAX;
+    for (int row = 0; row < CACHE_SKETCH_ROWS; row++) {
+        int count = __atomic_load_n(cache_sketch_counter(shard, hash, row), __ATOMIC_RELAXED);
+        if (count < estimate) estimate = count;
+    }
+    return estimate;
+}
+
+// Halves every counter once enough accesses have been recorded.
+// Caller holds the shard lock exclusively.
+static void cache_sketch_age(CacheShard* shard) {
+    unsigned long bumps = __atomic_load_n(&shard->sketch_bumps, __ATOMIC_RELAXED);
+    if (bumps < (unsigned long)shard->capacity * CACHE_SKETCH_SAMPLE) return;
+    unsigned long total = shard->sketch_width * CACHE_SKETCH_ROWS;
+    for (unsigned long i = 0; i < total; i++) {
+        __atomic_store_n(&shard->sketch[i], __atomic_load_n(&shard->sketch[i], __ATOMIC_RELAXED) >> 1, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&shard->sketch_bumps, 0, __ATOMIC_RELAXED);
+}
+
+// --- Public interface ---
+
+// Sets up every shard. 'capacity' is the total number of cached files.
+void cache_init(int capacity) {
+    if (capacity < CACHE_SHARDS) capacity = CACHE_SHARDS;
+    int per_shard = (capacity + CACHE_SHARDS - 1) / CACHE_SHARDS;
+
+    unsigned long width = 64;
+    while (width < (unsigned long)per_shard * 4) width <<= 1;
+
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard* shard = &cache_shards[i];
+        memset(shard, 0, sizeof(*shard));
+        pthread_rwlock_init(&shard->lock, NULL);
+        shard->index = ht_create();
+        shard->entries = (CacheEntry*)calloc(per_shard, sizeof(CacheEntry));
+        shard->sketch = (uint8_t*)calloc(width * CACHE_SKETCH_ROWS, 1);
+        if (!shard->index || !shard->entries || !shard->sketch) {
+            log_message(LOG_ERROR, "Cache", "Out of memory. Metadata cache disabled.");
+            return;
+        }
+        shard->capacity = per_shard;
+        shard->sketch_width = width;
+    }
+    cache_ready = 1;
+
+    char log_buf[100];
+    snprintf(log_buf, sizeof(log_buf), "Metadata cache: %d entries in %d shards.", per_shard * CACHE_SHARDS, CACHE_SHARDS);
+    log_message(LOG_INFO, "Cache", log_buf);
+}
+
+// Returns the cached metadata for 'filename', or NULL on a miss.
+// Caller holds ns_lock (shared is enough).
+FileMetadata* cache_lookup(const char* filename) {
+    if (!cache_ready) return NULL;
+    uint64_t hash = hash_function(filename);
+    CacheShard* shard = cache_shard_for(hash);
+    cache_sketch_bump(shard, hash);
+
+    pthread_rwlock_rdlock(&shard->lock);
+    CacheEntry* entry = (CacheEntry*)ht_search(shard->index, filename);
+    FileMetadata* file = NULL;
+    if (entry) {
+        __atomic_store_n(&entry->referenced, 1, __ATOMIC_RELAXED);
+        file = entry->file;
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    __atomic_fetch_add(file ? &shard->hits : &shard->misses, 1, __ATOMIC_RELAXED);
+    return file;
+}
+
+// Offers 'file', found at 'path', to the cache after a miss. It is stored
+// if there is room or if it is used more often than the entry CLOCK would
+// evict. Caller holds ns_lock (shared is enough).
+void cache_admit(const char* path, FileMetadata* file) {
+    if (!cache_ready || !file) return;
+    uint64_t hash = hash_function(path);
+    CacheShard* shard = cache_shard_for(hash);
+
+    pthread_rwlock_wrlock(&shard->lock);
+    cache_sketch_age(shard);
+    if (ht_search(shard->index, path)) {
+        pthread_rwlock_unlock(&shard->lock); // Another miss got here first
+        return;
+    }
+    char* key = slab_strdup(path);
+    if (!key) {
+        pthread_rwlock_unlock(&shard->lock);
+        return;
+    }
+
+    CacheEntry* slot = NULL;
+    if (shard->used < shard->capacity) {
+        // Free slots exist; the hand will find one.
+        while (shard->entries[shard->hand].file) {
+            shard->hand = (shard->hand + 1) % shard->capacity;
+        }
+        slot = &shard->entries[shard->hand];
+        shard->used++;
+    } else {
+        // Sweep: give referenced entries a second chance.
+        while (shard->entries[shard->hand].referenced) {
+            shard->entries[shard->hand].referenced = 0;
+            shard->hand = (shard->hand + 1) % shard->capacity;
+        }
+        CacheEntry* victim = &shard->entries[shard->hand];
+        uint64_t victim_hash = hash_function(victim->key);
+        if (cache_sketch_estimate(shard, hash) <= cache_sketch_estimate(shard, victim_hash)) {
+            pthread_rwlock_unlock(&shard->lock);
+            slab_strfree(key);
+            __atomic_fetch_add(&shard->rejections, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        ht_delete(shard->index, victim->key);
+        slab_strfree(victim->key);
+        slot = victim;
+        __atomic_fetch_add(&shard->evictions, 1, __ATOMIC_RELAXED);
+    }
+
+    slot->file = file;
+    slot->key = key;
+    slot->referenced = 0;
+    if (!ht_insert(shard->index, key, slot)) {
+        slot->file = NULL; // Out of memory: leave the slot free
+        slot->key = NULL;
+        shard->used--;
+        slab_strfree(key);
+    }
+    shard->hand = (shard->hand + 1) % shard->capacity;
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+// Drops a file from the cache. Must be called before its metadata is freed.
+void cache_remove(const char* filename) {
+    if (!cache_ready) return;
+    CacheShard* shard = cache_shard_for(hash_function(filename));
+
+    pthread_rwlock_wrlock(&shard->lock);
+    CacheEntry* entry = (CacheEntry*)ht_search(shard->index, filename);
+    if (entry) {
+        ht_delete(shard->index, filename);
+        slab_strfree(entry->key);
+        entry->file = NULL;
+        entry->key = NULL;
+        entry->referenced = 0;
+        shard->used--;
+    }
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+// Drops every entry, for a folder move that changes many paths at once.
+// Caller holds ns_lock exclusively.
+void cache_clear() {
+    if (!cache_ready) return;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard* shard = &cache_shards[i];
+        pthread_rwlock_wrlock(&shard->lock);
+        for (int slot = 0; slot < shard->capacity; slot++) {
+            CacheEntry* entry = &shard->entries[slot];
+            if (!entry->file) continue;
+            ht_delete(shard->index, entry->key);
+            slab_strfree(entry->key);
+            entry->file = NULL;
+            entry->key = NULL;
+            entry->referenced = 0;
+        }
+        shard->used = 0;
+        pthread_rwlock_unlock(&shard->lock);
+    }
+}
+
+// Sums the counters of every shard. Counters are read without locks, so
+// the totals are approximate while the server is busy.
+CacheStats cache_stats() {
+    CacheStats stats;
+    memset(&stats, 0, sizeof(stats));
+    if (!cache_ready) return stats;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard* shard = &cache_shards[i];
+        stats.hits += __atomic_load_n(&shard->hits, __ATOMIC_RELAXED);
+        stats.misses += __atomic_load_n(&shard->misses, __ATOMIC_RELAXED);
+        stats.evictions += __atomic_load_n(&shard->evictions, __ATOMIC_RELAXED);
+        stats.rejections += __atomic_load_n(&shard->rejections, __ATOMIC_RELAXED);
+        stats.capacity += shard->capacity;
+        stats.used += __atomic_load_n(&shard->used, __ATOMIC_RELAXED);
+    }
+    return stats;
+}
+
+#endif // METADATA_CACHE_H
@@ -0,0 +1,425 @@
+#ifndef METADATA_IMAGE_H
+#define METADATA_IMAGE_H
+
+/*
+ * metadata_image.h
+ *
+ * Binary checkpoint of the Name Server namespace (metadata.img). It is
+ * laid out so the NS can mmap() it at boot and use it in place, instead of
+ * parsing text and allocating every file up front:
+ *
+ *   ImageHeader
+ *   string table       NUL-terminated strings; offset 0 is ""
+ *   SS table           ImageSSRecord[ss_count]
+ *   file records       ImageFileRecord[file_count], fixed width, sorted
+ *                      by filename
+ *   access records     ImageAccessRecord[access_count], grouped per file
+ *   user table         ImageUserRecord[user_count]
+ *   index              uint32_t[index_slots]: record number + 1, 0 = empty
+ *
+ * The index is an open-addressing table keyed by hash_function(filename)
+ * with linear probing, so a lookup touches one or two pages of the file.
+ * Since records are sorted, everything under a folder is one run of them
+ * (image_lower_bound()), and the user table's owned-file counts answer
+ * LIST, so neither has to load the whole image.
+ *
+ * Integers are in host byte order. Bump IMAGE_VERSION whenever the layout
+ * or hash_function() changes; older images are then ignored and the NS
+ * falls back to the text files. Version 1 images (unsorted, with bare
+ * string offsets as the user table) are still read.
+ *
+ * Writing goes through an ImageBuilder, which deduplicates strings (owners
+ * and user names repeat a lot) and writes to a .tmp file that is synced
+ * and renamed into place.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "hash_table.h"
+
+#define IMAGE_MAGIC 0x474D4953U // "SIMG"
+#define IMAGE_VERSION 2
+
+typedef struct ImageHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t strings_offset, strings_size;
+    uint64_t ss_offset, ss_count;
+    uint64_t files_offset, file_count;
+    uint64_t access_offset, access_count;
+    uint64_t users_offset, user_count;
+    uint64_t index_offset, index_slots; // index_slots is a power of 2
+} ImageHeader;
+
+typedef struct ImageSSRecord {
+    uint32_t ip;   // String offset
+    int32_t port;
+} ImageSSRecord;
+
+typedef struct ImageFileRecord {
+    uint32_t name;          // String offsets
+    uint32_t owner;
+    uint32_t annotation;
+    uint32_t ss;            // Index into the SS table
+    uint32_t access_first;  // Index into the access records
+    uint32_t access_count;
+    uint32_t is_directory;
+} ImageFileRecord;
+
+typedef struct ImageAccessRecord {
+    uint32_t username;      // String offset
+    uint32_t permission;    // 'R' or 'W'
+} ImageAccessRecord;
+
+typedef struct ImageUserRecord {
+    uint32_t name;          // String offset
+    uint32_t owned_files;   // Records in this image it owns
+} ImageUserRecord;
+
+// --- Reader ---
+
+typedef struct MetadataImage {
+    const char* base;       // The whole mapping, or NULL if none
+    size_t size;
+    const ImageHeader* header;
+    const char* strings;
+    const ImageSSRecord* ss;
+    const ImageFileRecord* files;
+    const ImageAccessRecord* access;
+    const uint32_t* users;  // ImageUserRecord, or a bare offset in version 1
+    const uint32_t* index;
+} MetadataImage;
+
+// Returns the string at 'offset', or "" if it is out of range.
+const char* image_str(const MetadataImage* img, uint32_t offset) {
+    return offset < img->header->strings_size ? img->strings + offset : "";
+}
+
+// uint32_t words per user table entry
+static inline uint64_t image_user_words(const MetadataImage* img) {
+    return img->header->version == 1 ? 1 : sizeof(ImageUserRecord) / sizeof(uint32_t);
+}
+
+// Name of user 'i' of the user table
+const char* image_user_name(const MetadataImage* img, uint64_t i) {
+    return image_str(img, img->users[i * image_user_words(img)]);
+}
+
+// Files user 'i' owns in the image, or -1 if the image does not say.
+long image_user_owned(const MetadataImage* img, uint64_t i) {
+    return img->header->version == 1 ? -1 : (long)((const ImageUserRecord*)img->users)[i].owned_files;
+}
+
+// Records are sorted by filename from version 2 on.
+static inline int image_sorted(const MetadataImage* img) {
+    return img->base && img->header->version >= 2;
+}
+
+static int image_section_ok(const MetadataImage* img, uint64_t offset, uint64_t count, size_t item) {
+    return offset <= img->size && count <= (img->size - offset) / item;
+}
+
+// Maps 'path' read-only and checks its header. Only the header and section
+// bounds are read here, so this is O(1) no matter how large the image is.
+// Returns 0 on success, -1 if the file is missing or unusable.
+int image_open(MetadataImage* img, const char* path) {
+    memset(img, 0, sizeof(*img));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ImageHeader)) {
+        close(fd);
+        return -1;
+    }
+    void* base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file alive
+    if (base == MAP_FAILED) return -1;
+
+    img->base = (const char*)base;
+    img->size = st.st_size;
+    img->header = (const ImageHeader*)base;
+    const ImageHeader* h = img->header;
+    if (h->magic != IMAGE_MAGIC || (h->version != IMAGE_VERSION && h->version != 1) || h->strings_size == 0 ||
+        !image_section_ok(img, h->strings_offset, h->strings_size, 1) ||
+        img->base[h->strings_offset + h->strings_size - 1] != '\0' ||
+        !image_section_ok(img, h->ss_offset, h->ss_count, sizeof(ImageSSRecord)) ||
+        !image_section_ok(img, h->files_offset, h->file_count, sizeof(ImageFileRecord)) ||
+        !image_section_ok(img, h->access_offset, h->access_count, sizeof(ImageAccessRecord)) ||
+        !image_section_ok(img, h->users_offset, h->user_count, h->version == 1 ? sizeof(uint32_t) : sizeof(ImageUserRecord)) ||
+        !image_section_ok(img, h->index_offset, h->index_slots, sizeof(uint32_t)) ||
+        (h->index_slots & (h->index_slots - 1)) != 0 || h->index_slots < h->file_count ||
+        h->file_count >= UINT32_MAX) {
+        munmap(base, st.st_size);
+        memset(img, 0, sizeof(*img));
+        return -1;
+    }
+    img->strings = img->base + h->strings_offset;
+    img->ss = (const ImageSSRecord*)(img->base + h->ss_offset);
+    img->files = (const ImageFileRecord*)(img->base + h->files_offset);
+    img->access = (const ImageAccessRecord*)(img->base + h->access_offset);
+    img->users = (const uint32_t*)(img->base + h->users_offset);
+    img->index = (const uint32_t*)(img->base + h->index_offset);
+    return 0;
+}
+
+// Returns the record number for 'filename', or -1 if the image has none.
+long image_find(const MetadataImage* img, const char* filename) {
+    if (!img->base || img->header->index_slots == 0) return -1;
+    uint64_t mask = img->header->index_slots - 1;
+    for (uint64_t slot = hash_function(filename) & mask, probes = 0; probes <= mask; slot = (slot + 1) & mask, probes++) {
+        uint32_t entry = img->index[slot];
+        if (entry == 0) return -1;
+        if (entry > img->header->file_count) return -1; // Corrupt index
+        if (strcmp(image_str(img, img->files[entry - 1].name), filename) == 0) return entry - 1;
+    }
+    return -1;
+}
+
+// Returns the first record whose filename is not below 'name' (file_count
+// if none). Only meaningful if image_sorted().
+long image_lower_bound(const MetadataImage* img, const char* name) {
+    long low = 0, high = (long)img->header->file_count;
+    while (low < high) {
+        long mid = low + (high - low) / 2;
+        if (strcmp(image_str(img, img->files[mid].name), name) < 0) low = mid + 1;
+        else high = mid;
+    }
+    return low;
+}
+
+// --- Writer ---
+
+typedef struct ImageBuilder {
+    char* strings;
+    size_t strings_len, strings_cap;
+    uint32_t* dedup;        // Open addressing: string offset + 1, 0 = empty
+    size_t dedup_slots, dedup_used;
+
+    ImageSSRecord* ss;
+    size_t ss_count, ss_cap;
+    ImageFileRecord* files;
+    size_t file_count, file_cap;
+    ImageAccessRecord* access;
+    size_t access_count, access_cap;
+    ImageUserRecord* users;
+    size_t user_count, user_cap;
+    int failed;             // Out of memory at some point
+} ImageBuilder;
+
+// Grows '*array' to hold at least 'need' items of 'item' bytes.
+static int image_reserve(void** array, size_t* cap, size_t need, size_t item) {
+    if (need <= *cap) return 0;
+    size_t new_cap = *cap ? *cap * 2 : 256;
+    while (new_cap < need) new_cap *= 2;
+    void* grown = realloc(*array, new_cap * item);
+    if (!grown) return -1;
+    *array = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+static int image_dedup_grow(ImageBuilder* b) {
+    size_t slots = b->dedup_slots ? b->dedup_slots * 2 : 1024;
+    uint32_t* table = (uint32_t*)calloc(slots, sizeof(uint32_t));
+    if (!table) return -1;
+    for (size_t i = 0; i < b->dedup_slots; i++) {
+        uint32_t entry = b->dedup[i];
+        if (!entry) continue;
+        size_t slot = hash_function(b->strings + entry - 1) & (slots - 1);
+        while (table[slot]) slot = (slot + 1) & (slots - 1);
+        table[slot] = entry;
+    }
+    free(b->dedup);
+    b->dedup = table;
+    b->dedup_slots = slots;
+    return 0;
+}
+
+// Returns the offset of 'str' in the string table, adding it if needed.
+uint32_t image_intern(ImageBuilder* b, const char* str) {
+    if (str[0] == '\0' || b->failed) return 0;
+    if (b->dedup_used * 2 >= b->dedup_slots && image_dedup_grow(b) < 0) {
+        b->failed = 1;
+        return 0;
+    }
+    size_t mask = b->dedup_slots - 1;
+    size_t slot = hash_function(str) & mask;
+    for (; b->dedup[slot]; slot = (slot + 1) & mask) {
+        if (strcmp(b->strings + b->dedup[slot] - 1, str) == 0) return b->dedup[slot] - 1;
+    }
+    size_t len = strlen(str) + 1;
+    if (b->strings_len + len >= UINT32_MAX ||
+        image_reserve((void**)&b->strings, &b->strings_cap, b->strings_len + len, 1) < 0) {
+        b->failed = 1;
+        return 0;
+    }
+    uint32_t offset = (uint32_t)b->strings_len;
+    memcpy(b->strings + offset, str, len);
+    b->strings_len += len;
+    b->dedup[slot] = offset + 1;
+    b->dedup_used++;
+    return offset;
+}
+
+void image_builder_init(ImageBuilder* b) {
+    memset(b, 0, sizeof(*b));
+    // Offset 0 is the empty string.
+    if (image_reserve((void**)&b->strings, &b->strings_cap, 1, 1) < 0) {
+        b->failed = 1;
+        return;
+    }
+    b->strings[0] = '\0';
+    b->strings_len = 1;
+}
+
+void image_builder_free(ImageBuilder* b) {
+    free(b->strings);
+    free(b->dedup);
+    free(b->ss);
+    free(b->files);
+    free(b->access);
+    free(b->users);
+    memset(b, 0, sizeof(*b));
+}
+
+// Adds a user, who owns 'owned_files' of the files in the image.
+void image_add_user(ImageBuilder* b, const char* username, long owned_files) {
+    uint32_t name = image_intern(b, username);
+    if (b->failed || image_reserve((void**)&b->users, &b->user_cap, b->user_count + 1, sizeof(ImageUserRecord)) < 0) {
+        b->failed = 1;
+        return;
+    }
+    b->users[b->user_count].name = name;
+    b->users[b->user_count].owned_files = owned_files > 0 ? (uint32_t)owned_files : 0;
+    b->user_count++;
+}
+
+// Adds a file record. Follow it with image_add_access() for its ACL.
+void image_add_file(ImageBuilder* b, const char* filename, const char* owner, const char* ss_ip, int ss_port,
+                    int is_directory, const char* annotation) {
+    ImageFileRecord rec;
+    rec.name = image_intern(b, filename);
+    rec.owner = image_intern(b, owner);
+    rec.annotation = image_intern(b, annotation);
+    rec.access_first = (uint32_t)b->access_count;
+    rec.access_count = 0;
+    rec.is_directory = is_directory;
+
+    // There are only a handful of Storage Servers, so a scan is fine.
+    uint32_t ip = image_intern(b, ss_ip);
+    size_t i = 0;
+    while (i < b->ss_count && !(b->ss[i].ip == ip && b->ss[i].port == ss_port)) i++;
+    if (i == b->ss_count) {
+        if (image_reserve((void**)&b->ss, &b->ss_cap, b->ss_count + 1, sizeof(ImageSSRecord)) < 0) {
+            b->failed = 1;
+            return;
+        }
+        b->ss[b->ss_count].ip = ip;
+        b->ss[b->ss_count].port = ss_port;
+        b->ss_count++;
+    }
+    rec.ss = (uint32_t)i;
+
+    if (b->failed || image_reserve((void**)&b->files, &b->file_cap, b->file_count + 1, sizeof(ImageFileRecord)) < 0) {
+        b->failed = 1;
+        return;
+    }
+    b->files[b->file_count++] = rec;
+}
+
+// Adds an ACL entry to the file added last.
+void image_add_access(ImageBuilder* b, const char* username, char permission) {
+    if (b->file_count == 0) return;
+    uint32_t name = image_intern(b, username);
+    if (b->failed || image_reserve((void**)&b->access, &b->access_cap, b->access_count + 1, sizeof(ImageAccessRecord)) < 0) {
+        b->failed = 1;
+        return;
+    }
+    b->access[b->access_count].username = name;
+    b->access[b->access_count].permission = (uint32_t)permission;
+    b->access_count++;
+    b->files[b->file_count - 1].access_count++;
+}
+
+// Appends one section, starting it on an 8-byte boundary so the records
+// can be read in place.
+static int image_write_section(FILE* out, const void* data, size_t bytes, uint64_t* offset) {
+    static const char padding[8] = { 0 };
+    long pos = ftell(out);
+    if (pos < 0 || (pos % 8 && fwrite(padding, 1, 8 - pos % 8, out) != (size_t)(8 - pos % 8))) return -1;
+    *offset = (uint64_t)ftell(out);
+    return bytes == 0 || fwrite(data, 1, bytes, out) == bytes ? 0 : -1;
+}
+
+// qsort() comparator for image_write(); image_sort_strings is the string
+// table of the builder being written (checkpoints never overlap).
+static const char* image_sort_strings;
+static int image_record_cmp(const void* a, const void* b) {
+    return strcmp(image_sort_strings + ((const ImageFileRecord*)a)->name,
+                  image_sort_strings + ((const ImageFileRecord*)b)->name);
+}
+
+// Writes the image to 'path' atomically (via 'path'.tmp, fsync, rename).
+// Returns 0 on success, -1 on failure with the old image left in place.
+int image_write(ImageBuilder* b, const char* path) {
+    if (b->failed) return -1;
+
+    // Sorted by filename; each record keeps its own run of access records.
+    image_sort_strings = b->strings;
+    qsort(b->files, b->file_count, sizeof(ImageFileRecord), image_record_cmp);
+
+    // Build the index at most half full.
+    ImageHeader h;
+    memset(&h, 0, sizeof(h));
+    h.index_slots = 16;
+    while (h.index_slots < b->file_count * 2) h.index_slots <<= 1;
+    uint32_t* index = (uint32_t*)calloc(h.index_slots, sizeof(uint32_t));
+    if (!index) return -1;
+    for (size_t i = 0; i < b->file_count; i++) {
+        uint64_t slot = hash_function(b->strings + b->files[i].name) & (h.index_slots - 1);
+        while (index[slot]) slot = (slot + 1) & (h.index_slots - 1);
+        index[slot] = (uint32_t)(i + 1);
+    }
+
+    char tmp_path[256];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* out = fopen(tmp_path, "wb");
+    if (!out) {
+        free(index);
+        return -1;
+    }
+    h.magic = IMAGE_MAGIC;
+    h.version = IMAGE_VERSION;
+    h.strings_size = b->strings_len;
+    h.ss_count = b->ss_count;
+    h.file_count = b->file_count;
+    h.access_count = b->access_count;
+    h.user_count = b->user_count;
+
+    int failed = fwrite(&h, sizeof(h), 1, out) != 1;
+    failed |= image_write_section(out, b->strings, b->strings_len, &h.strings_offset);
+    failed |= image_write_section(out, b->ss, b->ss_count * sizeof(ImageSSRecord), &h.ss_offset);
+    failed |= image_write_section(out, b->files, b->file_count * sizeof(ImageFileRecord), &h.files_offset);
+    failed |= image_write_section(out, b->access, b->access_count * sizeof(ImageAccessRecord), &h.access_offset);
+    failed |= image_write_section(out, b->users, b->user_count * sizeof(ImageUserRecord), &h.users_offset);
+    failed |= image_write_section(out, index, h.index_slots * sizeof(uint32_t), &h.index_offset);
+    free(index);
+
+    // Now that the offsets are known, write the real header.
+    failed |= fseek(out, 0, SEEK_SET) != 0 || fwrite(&h, sizeof(h), 1, out) != 1;
+    failed |= fflush(out) != 0 || fsync(fileno(out)) != 0;
+    failed |= fclose(out) != 0;
+    if (failed || rename(tmp_path, path) < 0) {
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+#endif // METADATA_IMAGE_H
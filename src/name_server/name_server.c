@@ -7,13 +7,18 @@
 #include <arpa/inet.h>
 #include <pthread.h>
 #include <time.h>
+#include <signal.h>
+#include <sys/resource.h>
 #include "CRWD.c" // CRWD.c is modified to include new helper functions
 #include "../logger.h"
+#include "../command_table.h"
 #include "hash_table.h"
+#include "reactor.h"
 
 
 #define MAX_BUFFER_SIZE 1024
 #define NAME_SERVER_PORT 8080
+#define LIST_USERS_DEFAULT_LIMIT 20
 
 void handle_create(int sock, const char* filename, const char* username);
 void handle_read(int sock, const char* filename, const char* username);
@@ -24,416 +29,630 @@ void handle_undo(int sock, const char* filename, const char* current_user);
 void handle_exec(int sock, const char* filename, const char* current_user);
 void handle_update_meta(int sock, const char* filename);
 void register_user(const char* username, const char* ip_addr);
-void register_storage_server(const char* ip, int port, const char* file_list_str);
-void handle_list_users(int sock);
-void handle_view(int sock, const char* flags, const char* username);
+StorageServer* register_storage_server(const char* ip, int port, const char* file_list_str, int framed);
+void handle_list_users(int sock, const char* limit_str, const char* after);
+void handle_view(int sock, const char* flags, const char* limit_str, const char* after, const char* username);
 void handle_info(int sock, const char* filename, const char* username);
 void handle_add_access(int sock, const char* filename, const char* target_user, const char* perm, const char* current_user);
 void handle_rem_access(int sock, const char* filename, const char* target_user, const char* current_user);
-void lru_int();
-
-// MODIFIED: This function now handles a persistent session
-void* handle_connection(void* client_info_p) {
-    client_info_t* client_info = (client_info_t*)client_info_p;
-    int sock = client_info->client_socket;
-    char* client_ip = inet_ntoa(client_info->client_addr.sin_addr);
-    
-    char buffer[MAX_BUFFER_SIZE];
+void handle_move(int sock, const char* filename, const char* new_filename, const char* username);
+void handle_cache_stats(int sock);
+void handle_mem_stats(int sock);
+void handle_command_stats(int sock);
+void handle_storage_stats(int sock);
+void handle_ss_heartbeat(int sock, StorageServer* ss, char** args);
+
+// --- Command table ---
+// One adapter per command, from the parsed arguments to its handler.
+// 'session' is the client's Connection.
+
+#define CONN(session) ((Connection*)(session))
+
+static void cmd_list_users(void* s, char** a) { handle_list_users(CONN(s)->sock, a[0], a[1]); }
+static void cmd_cache_stats(void* s, char** a) { (void)a; handle_cache_stats(CONN(s)->sock); }
+static void cmd_mem_stats(void* s, char** a) { (void)a; handle_mem_stats(CONN(s)->sock); }
+static void cmd_command_stats(void* s, char** a) { (void)a; handle_command_stats(CONN(s)->sock); }
+static void cmd_storage_stats(void* s, char** a) { (void)a; handle_storage_stats(CONN(s)->sock); }
+static void cmd_view(void* s, char** a) { handle_view(CONN(s)->sock, a[0], a[1], a[2], CONN(s)->username); }
+static void cmd_info(void* s, char** a) { handle_info(CONN(s)->sock, a[0], CONN(s)->username); }
+static void cmd_add_access(void* s, char** a) { handle_add_access(CONN(s)->sock, a[0], a[1], a[2], CONN(s)->username); }
+static void cmd_rem_access(void* s, char** a) { handle_rem_access(CONN(s)->sock, a[0], a[1], CONN(s)->username); }
+static void cmd_create(void* s, char** a) { handle_create(CONN(s)->sock, a[0], CONN(s)->username); }
+static void cmd_read(void* s, char** a) { handle_read(CONN(s)->sock, a[0], CONN(s)->username); }
+static void cmd_write(void* s, char** a) { handle_write(CONN(s)->sock, a[0], atoi(a[1]), CONN(s)->username); }
+static void cmd_delete(void* s, char** a) { handle_delete(CONN(s)->sock, a[0], CONN(s)->username); }
+static void cmd_stream(void* s, char** a) { handle_stream(CONN(s)->sock, a[0], CONN(s)->username); }
+static void cmd_undo(void* s, char** a) { handle_undo(CONN(s)->sock, a[0], CONN(s)->username); }
+static void cmd_update_meta(void* s, char** a) { handle_update_meta(CONN(s)->sock, a[0]); }
+static void cmd_exec(void* s, char** a) { handle_exec(CONN(s)->sock, a[0], CONN(s)->username); }
+static void cmd_create_folder(void* s, char** a) { handle_create_folder(CONN(s)->sock, a[0], CONN(s)->username); }
+static void cmd_view_folder(void* s, char** a) { handle_view_folder(CONN(s)->sock, a[0], a[1], a[2]); }
+static void cmd_move(void* s, char** a) { handle_move(CONN(s)->sock, a[0], a[1], CONN(s)->username); }
+static void cmd_checkpoint(void* s, char** a) { handle_checkpoint(CONN(s)->sock, a[0], a[1], CONN(s)->username); }
+static void cmd_revert(void* s, char** a) { handle_revert(CONN(s)->sock, a[0], a[1], CONN(s)->username); }
+static void cmd_view_checkpoint(void* s, char** a) { handle_view_checkpoint(CONN(s)->sock, a[0], a[1], CONN(s)->username); }
+static void cmd_req_access(void* s, char** a) { handle_req_access(CONN(s)->sock, a[0], CONN(s)->username); }
+static void cmd_view_reqs(void* s, char** a) { handle_view_reqs(CONN(s)->sock, a[0], CONN(s)->username); }
+static void cmd_approve(void* s, char** a) { handle_approve_req(CONN(s)->sock, a[0], a[1], CONN(s)->username); }
+static void cmd_reject(void* s, char** a) { handle_reject_req(CONN(s)->sock, a[0], a[1], CONN(s)->username); }
+static void cmd_annotate(void* s, char** a) { handle_annotate(CONN(s)->sock, a[0], a[1], CONN(s)->username); }
+static void cmd_show_annotation(void* s, char** a) { handle_show_annotation(CONN(s)->sock, a[0]); }
+
+// Commands a registered client may send. Schemas and permissions are
+// described in command_table.h.
+CommandSpec ns_commands[] = {
+    { "LIST_USERS",      "|SS",  PERM_NONE,  cmd_list_users },
+    { "CACHE_STATS",     "",     PERM_NONE,  cmd_cache_stats },
+    { "MEM_STATS",       "",     PERM_NONE,  cmd_mem_stats },
+    { "COMMAND_STATS",   "",     PERM_NONE,  cmd_command_stats },
+    { "STORAGE_STATS",   "",     PERM_NONE,  cmd_storage_stats },
+    { "VIEW",            "|SSS", PERM_NONE,  cmd_view },
+    { "INFO",            "F",    PERM_READ,  cmd_info },
+    { "ADDACCESS",       "FUP",  PERM_OWNER, cmd_add_access },
+    { "REMACCESS",       "FU",   PERM_OWNER, cmd_rem_access },
+    { "CREATE",          "F",    PERM_NONE,  cmd_create },
+    { "READ",            "F",    PERM_READ,  cmd_read },
+    { "WRITE",           "FN",   PERM_WRITE, cmd_write },
+    { "DELETE",          "F",    PERM_OWNER, cmd_delete },
+    { "STREAM",          "F",    PERM_READ,  cmd_stream },
+    { "UNDO",            "F",    PERM_WRITE, cmd_undo },
+    { "UPDATE_META",     "F",    PERM_NONE,  cmd_update_meta },
+    { "EXEC",            "F",    PERM_READ,  cmd_exec },
+    { "CREATEFOLDER",    "F",    PERM_NONE,  cmd_create_folder },
+    { "VIEWFOLDER",      "F|SS", PERM_NONE,  cmd_view_folder },
+    { "MOVE",            "FF",   PERM_OWNER, cmd_move },
+    { "CHECKPOINT",      "FS",   PERM_READ,  cmd_checkpoint },
+    { "REVERT",          "FS",   PERM_WRITE, cmd_revert },
+    { "VIEWCHECKPOINT",  "FS",   PERM_READ,  cmd_view_checkpoint },
+    { "REQUESTACCESS",   "F",    PERM_NONE,  cmd_req_access },
+    { "VIEWREQUESTS",    "F",    PERM_OWNER, cmd_view_reqs },
+    { "APPROVE",         "FU",   PERM_OWNER, cmd_approve },
+    { "REJECT",          "FU",   PERM_OWNER, cmd_reject },
+    { "ANNOTATE",        "FR",   PERM_WRITE, cmd_annotate },
+    { "SHOW_ANNOTATION", "F",    PERM_NONE,  cmd_show_annotation },
+};
+
+CommandTable ns_command_table = COMMAND_TABLE(ns_commands);
+
+static void cmd_ss_heartbeat(void* s, char** a) { handle_ss_heartbeat(CONN(s)->sock, CONN(s)->ss, a); }
+
+// Commands a registered Storage Server may send on its session.
+CommandSpec ns_storage_commands[] = {
+    { "SS_HEARTBEAT",    "NNNNNNNN", PERM_NONE, cmd_ss_heartbeat },
+};
+
+CommandTable ns_storage_command_table = COMMAND_TABLE(ns_storage_commands);
+
+// Runs one complete command line for a session. Called by a worker thread
+// (or the session's own thread in the thread-per-connection build), so the
+// handlers below may block without stalling other sessions.
+void dispatch_command(Connection* conn, char* line) {
+    int sock = conn->sock;
+    char* current_user = conn->username;
     char log_buf[MAX_BUFFER_SIZE + 200]; // Buffer for log messages
-    int read_size;
-    char current_user[50] = "anonymous"; // User for this session
+    char* saveptr; // strtok_r state: workers run commands concurrently
 
     // --- 1. Handle Initial Registration ---
     // A persistent session MUST register first.
-    if ((read_size = recv(sock, buffer, MAX_BUFFER_SIZE - 1, 0)) > 0) {
-        buffer[read_size] = '\0';
-        char* command = strtok(buffer, ";\n");
+    if (conn->state == CONN_AWAIT_REGISTER) {
+        char* command = strtok_r(line, ";\n", &saveptr);
 
         if (command != NULL && strcmp(command, "REGISTER_CLIENT") == 0) {
-            char* username = strtok(NULL, ";\n");
+            char* username = strtok_r(NULL, ";\n", &saveptr);
+            char* capability = strtok_r(NULL, ";\n", &saveptr);
+            int framed = capability && strcmp(capability, FRAME_CAPABILITY) == 0;
+            if (username && strlen(username) > COMMAND_USER_MAX) {
+                // Refused whole: a cut-down name would be a different user,
+                // and commands could not name the full one.
+                Response r;
+                resp_init(&r, sock);
+                resp_printf(&r, "%s;%d;User name is longer than %d characters.\n", ERROR_PREFIX, ERR_INVALID_ARGS,
+                            COMMAND_USER_MAX);
+                resp_end(&r);
+                conn->state = CONN_CLOSING;
+                return;
+            }
             if (username) {
-                register_user(username, client_ip);
-                strcpy(current_user, username); // Set user for this session
-                snprintf(log_buf, sizeof(log_buf), "Registered client '%s' from IP %s", current_user, client_ip);
+                register_user(username, conn->ip_addr);
+                strncpy(conn->username, username, sizeof(conn->username) - 1); // Set user for this session
+                conn->username[sizeof(conn->username) - 1] = '\0';
+                snprintf(log_buf, sizeof(log_buf), "Registered client '%s' from IP %s", current_user, conn->ip_addr);
                 log_message(LOG_INFO, "NameServer", log_buf);
             }
-            char response[] = "ACK_CLIENT_REG\n__END__\n";
-            send(sock, response, strlen(response), 0);
+            conn->state = CONN_CLIENT;
+            // The ACK is still text; the session is framed from here on.
+            Response r;
+            resp_init(&r, sock);
+            resp_puts(&r, framed ? "ACK_CLIENT_REG;" FRAME_CAPABILITY "\n" : "ACK_CLIENT_REG\n");
+            resp_end(&r);
+            conn->framed = framed;
         } else if (command != NULL && strcmp(command, "REGISTER_SS") == 0) {
              // --- Handle SS Registration ---
-            char* ip = strtok(NULL, ";\n");
-            char* port_str = strtok(NULL, ";\n");
+            char* ip = strtok_r(NULL, ";\n", &saveptr);
+            char* port_str = strtok_r(NULL, ";\n", &saveptr);
             // MODIFIED: Now parses the file list string
-            char* file_list_str = strtok(NULL, "\n"); // Get rest of the line
+            char* file_list_str = strtok_r(NULL, "\n", &saveptr); // Get rest of the line
+            // A framing-capable SS appends ";FRAMED/1" after the list.
+            int framed = 0;
+            char* capability = file_list_str ? strrchr(file_list_str, ';') : NULL;
+            if (capability && strcmp(capability + 1, FRAME_CAPABILITY) == 0) {
+                *capability = '\0';
+                framed = 1;
+            }
 
             if (ip && port_str) {
                 // MODIFIED: Pass file list to registration function
-                register_storage_server(ip, atoi(port_str), file_list_str ? file_list_str : "");
+                conn->ss = register_storage_server(ip, atoi(port_str), file_list_str ? file_list_str : "", framed);
             }
-            char response[] = "ACK_SS_REG\n__END__\n";
-            send(sock, response, strlen(response), 0);
-            
-            // This is an SS connection, not a client. Close it.
-            free(client_info);
-            close(sock);
-            return NULL;
-
+            Response r;
+            resp_init(&r, sock);
+            resp_puts(&r, "ACK_SS_REG\n");
+            resp_end(&r);
+
+            // Kept open for the SS's heartbeats (ss_health.h); an older SS
+            // just closes it.
+            conn->state = conn->ss ? CONN_STORAGE : CONN_CLOSING;
         } else {
             // Not a valid first command
             printf("[Name Server] Invalid initial command. Closing connection.\n");
-            free(client_info);
-            close(sock);
-            return NULL;
+            conn->state = CONN_CLOSING;
         }
-    } else {
-        // Client connected and immediately disconnected
-        free(client_info);
-        close(sock);
-        return NULL;
+        return;
     }
 
-    // --- 2. Handle Command Loop for Registered Client ---
-    while ((read_size = recv(sock, buffer, MAX_BUFFER_SIZE - 1, 0)) > 0) {
-        buffer[read_size] = '\0';
-        char command_line[MAX_BUFFER_SIZE];
-        strncpy(command_line, buffer, MAX_BUFFER_SIZE);
-        char* command = strtok(buffer, ";\n");
+    // --- 2. Handle Command for Registered Client (or Storage Server) ---
+    char* command = strtok_r(line, ";\n", &saveptr);
+
+    if (command == NULL) return;
 
-        if (command == NULL) continue;
-        
-        snprintf(log_buf, sizeof(log_buf), "Request from user '%s' (IP: %s): %s", current_user, client_ip, command);
+    CommandTable* table = &ns_command_table;
+    if (conn->state == CONN_STORAGE) {
+        table = &ns_storage_command_table; // Heartbeats are too frequent to log
+    } else {
+        snprintf(log_buf, sizeof(log_buf), "Request from user '%s' (IP: %s): %s", current_user, conn->ip_addr, command);
         log_message(LOG_INFO, "NameServer", log_buf);
+    }
 
-        if (strcmp(command, "LIST_USERS") == 0) {
-            handle_list_users(sock);
-        }
-        else if (strcmp(command, "VIEW") == 0) {
-            char* flags = strtok(NULL, ";\n");
-            handle_view(sock, flags, current_user);
-        }
-        else if (strcmp(command, "INFO") == 0) {
-            char* filename = strtok(NULL, ";\n");
-            if (filename)
-                handle_info(sock, filename, current_user);
-        }
-        else if (strcmp(command, "ADDACCESS") == 0) {
-            char* filename = strtok(NULL, ";\n");
-            char* user = strtok(NULL, ";\n");
-            char* perm = strtok(NULL, ";\n");
-            if (filename && user && perm) {
-            char filename_copy[100];
-            char user_copy[50];
-            char perm_copy[2];
-            strncpy(filename_copy, filename, 99);
-            filename_copy[99] = '\0';
-            strncpy(user_copy, user, 49);
-            user_copy[49] = '\0';
-            strncpy(perm_copy, perm, 1);
-            perm_copy[1] = '\0';
-            handle_add_access(sock, filename_copy, user_copy, perm_copy, current_user);
-        }
-        }
-        else if (strcmp(command, "REMACCESS") == 0) {
-            char* filename = strtok(NULL, ";\n");
-            char* user = strtok(NULL, ";\n");
-            if (filename && user)
-                handle_rem_access(sock, filename, user, current_user);
-        }
-        else if (strcmp(command, "CREATE") == 0) {
-            char* filename = strtok(NULL, ";\n");
-            if (filename) {
-                char filename_copy[100];
-                strncpy(filename_copy, filename, 99);
-                filename_copy[99] = '\0';
-                handle_create(sock, filename_copy, current_user);
-            }
-        }
-        else if (strcmp(command, "READ") == 0) {
-            char* filename = strtok(NULL, ";\n");
-            if (filename) {
-            char filename_copy[100];
-            strncpy(filename_copy, filename, 99);
-            filename_copy[99] = '\0';
-            handle_read(sock, filename_copy, current_user);
-        }
-        }
-        else if (strcmp(command, "WRITE") == 0) {
-            char* filename = strtok(NULL, ";\n");
-            char* sent_num_str = strtok(NULL, ";\n");
-            if (filename && sent_num_str) {
-            char filename_copy[100];
-            strncpy(filename_copy, filename, 99);
-            filename_copy[99] = '\0';
-            handle_write(sock, filename_copy, atoi(sent_num_str), current_user);
-        }
-        }
-        else if (strcmp(command, "DELETE") == 0) {
-            char* filename = strtok(NULL, ";\n");
-            if (filename)
-                handle_delete(sock, filename, current_user);
-        }
-        else if (strcmp(command, "STREAM") == 0) {
-            char* filename = strtok(NULL, ";\n");
-            if (filename)
-                handle_stream(sock, filename, current_user);
-        }
-        else if (strcmp(command, "UNDO") == 0)
-        {
-            char* filename = strtok(NULL, ";\n");
-            if (filename)
-                handle_undo(sock, filename, current_user);
-        }
-        else if (strcmp(command, "UPDATE_META") == 0)
-        {
-            char* filename = strtok(NULL, ";\n");
-            if(filename)
-                handle_update_meta(sock, filename);
-        }
-        else if (strcmp(command, "EXEC") == 0)
-        {
-            char* filename = strtok(NULL, ";\n");
-            if(filename)
-                handle_exec(sock, filename, current_user);
-        }
-        else if (strcmp(command, "CREATEFOLDER") == 0) {
-            char* fname = strtok(NULL, ";\n");
-            if (fname) handle_create_folder(sock, fname, current_user);
-        }
-        else if (strcmp(command, "VIEWFOLDER") == 0) {
-            char* fname = strtok(NULL, ";\n");
-            if (fname) handle_view_folder(sock, fname);
-        }
-        else if (strcmp(command, "CHECKPOINT") == 0) {
-            char* fname = strtok(NULL, ";\n");
-            char* tag = strtok(NULL, ";\n");
-            if(fname && tag) handle_checkpoint(sock, fname, tag, current_user);
-        }
-        else if (strcmp(command, "REVERT") == 0) {
-            char* fname = strtok(NULL, ";\n");
-            char* tag = strtok(NULL, ";\n");
-            if(fname && tag) handle_revert(sock, fname, tag, current_user);
-        }
-        else if (strcmp(command, "VIEWCHECKPOINT") == 0) {
-            char* fname = strtok(NULL, ";\n");
-            char* tag = strtok(NULL, ";\n");
-            if(fname && tag) handle_view_checkpoint(sock, fname, tag, current_user);
-        }
-        else if (strcmp(command, "REQUESTACCESS") == 0) {
-            char* fname = strtok(NULL, ";\n");
-            if(fname) handle_req_access(sock, fname, current_user);
-        }
-        else if (strcmp(command, "VIEWREQUESTS") == 0) {
-            char* fname = strtok(NULL, ";\n");
-            if(fname) handle_view_reqs(sock, fname, current_user);
-        }
-        else if (strcmp(command, "APPROVE") == 0) {
-            char* fname = strtok(NULL, ";\n");
-            char* target = strtok(NULL, ";\n");
-            if(fname && target) handle_approve_req(sock, fname, target, current_user);
-        }
-        else if (strcmp(command, "REJECT") == 0) {
-            char* fname = strtok(NULL, ";\n");
-            char* target = strtok(NULL, ";\n");
-            if(fname && target) handle_reject_req(sock, fname, target, current_user);
-        }
-        else if (strcmp(command, "ANNOTATE") == 0) {
-            char* fname = strtok(NULL, ";\n");
-            char* note = strtok(NULL, "\n"); // Get rest of line
-            if(fname && note) handle_annotate(sock, fname, note, current_user);
-        }
-        else if (strcmp(command, "SHOW_ANNOTATION") == 0) {
-            char* fname = strtok(NULL, ";\n");
-            if(fname) handle_show_annotation(sock, fname);
-        }
-        else {
-            char response[] = "ERROR: Unknown command.\n__END__\n";
-            send(sock, response, strlen(response), 0);
-        }
+    CommandSpec* spec = command_lookup(table, command);
+    if (!spec) {
+        Response r;
+        resp_init(&r, sock);
+        resp_puts(&r, "ERROR: Unknown command.\n");
+        resp_end(&r);
+        return;
     }
-    
-    // Client disconnected
-    snprintf(log_buf, sizeof(log_buf), "Client '%s' (IP: %s) disconnected.", current_user, client_ip);
-    log_message(LOG_INFO, "NameServer", log_buf);
-    
-    free(client_info);
-    close(sock);
-    return NULL;
+
+    unsigned long long started = command_clock();
+    char* args[COMMAND_MAX_ARGS];
+    int bad;
+    int parsed = command_parse_args(spec, &saveptr, args, &bad);
+    if (parsed != CMD_ARGS_OK) {
+        char reason[200];
+        command_args_error(spec, parsed, bad, reason, sizeof(reason));
+        Response r;
+        resp_init(&r, sock);
+        resp_printf(&r, "%s;%d;%s\n", ERROR_PREFIX, ERR_INVALID_ARGS, reason);
+        resp_end(&r);
+    } else {
+        spec->run(conn, args);
+    }
+    command_record(spec, resp_last_status(), started);
 }
 
 // --- HELPER FUNCTIONS FOR REGISTRATION ---
 
 void register_user(const char* username, const char* ip_addr) {
-    pthread_mutex_lock(&data_mutex);
-
-    User* current = user_list_head; 
-    while(current) {
-        if(strcmp(current->username, username) == 0) {
-            strcpy(current->ip_addr, ip_addr);
-            printf("[Data] Re-registered user '%s' from IP %s\n", username, ip_addr);
-            pthread_mutex_unlock(&data_mutex);
-            return;
-        }
-        current = current->next;
+    int was_new;
+    UserRecord* record = user_set_registered(username, ip_addr, &was_new);
+    if (!record) return;
+    __atomic_fetch_add(&record->sessions, 1, __ATOMIC_RELAXED);
+
+    if (!was_new) {
+        printf("[Data] Re-registered user '%s' from IP %s\n", username, ip_addr);
+        return;
     }
-
-    User* newUser = (User*)malloc(sizeof(User));
-    strcpy(newUser->username, username);
-    strcpy(newUser->ip_addr, ip_addr);
-    newUser->next = user_list_head;
-    user_list_head = newUser;
-
+    // Not waited for: losing a registration in a crash only means the
+    // user registers again.
+    meta_log_add_user(username);
     printf("[Data] Registered user '%s' from IP %s\n", username, ip_addr);
-    pthread_mutex_unlock(&data_mutex);
 }
 
 
 // MODIFIED: Signature changed to accept file list
-void register_storage_server(const char* ip, int port, const char* file_list_str) {
-    pthread_mutex_lock(&data_mutex);
+// Returns the SS's entry, or NULL if out of memory.
+StorageServer* register_storage_server(const char* ip, int port, const char* file_list_str, int framed) {
+    pthread_rwlock_wrlock(&ns_lock);
     
-    StorageServer* current = ss_list_head;
-    while(current) {
-        if(strcmp(current->ip_addr, ip) == 0 && current->port == port) {
-            printf("[Data] Re-registered SS at %s:%d\n", ip, port);
-            pthread_mutex_unlock(&data_mutex);
-            return;
-        }
-        current = current->next;
+    // Recovered metadata may already have an entry for this SS.
+    StorageServer* newSS = find_or_add_storage_server(ip, port);
+    if (!newSS) {
+        pthread_rwlock_unlock(&ns_lock);
+        return NULL;
     }
-    
-    // Add new SS
-    StorageServer* newSS = (StorageServer*)malloc(sizeof(StorageServer));
-    strcpy(newSS->ip_addr, ip);
-    newSS->port = port;
-    newSS->next = ss_list_head;
-    ss_list_head = newSS;
-    printf("[Data] Registered new SS at %s:%d\n", ip, port);
+    __atomic_store_n(&newSS->framed, framed, __ATOMIC_RELAXED);
+    ss_pool_flush(&newSS->pool); // A restarted SS has closed its old connections
+    ss_mark_up(newSS);
+    printf("[Data] Registered SS at %s:%d%s\n", ip, port, framed ? " (framed)" : "");
     
     // MODIFIED: Parse the file list and add metadata
     // This is a simple parser. A robust one would handle the "stream of packets" from Q&A
     if (file_list_str && strlen(file_list_str) > 0) {
         printf("[Data] Registering files from SS: %s\n", file_list_str);
         char* files_copy = strdup(file_list_str);
-        char* filename = strtok(files_copy, ",");
+        char* list_saveptr;
+        char* filename = strtok_r(files_copy, ",", &list_saveptr);
         while (filename) {
-            if (find_file(filename) == NULL) {
+            if (find_file(filename) == NULL && !intent_conflicts(filename, 0)) { // A CREATE may be adding it
                 // File not known, add it. Assume "admin" owner? Or SS owner?
-                // For now, just add it with the SS.
-                FileMetadata* newFile = (FileMetadata*)malloc(sizeof(FileMetadata));
-                strcpy(newFile->filename, filename);
-                strcpy(newFile->owner, "ss_owner"); // Placeholder owner
-                newFile->word_count = 0; // Unknown
-                newFile->char_count = 0; // Unknown
-                newFile->last_access = time(NULL);
-                newFile->ss = newSS;
-                newFile->access_list = NULL; // No access list
-                newFile->next = file_list_head;
-                file_list_head = newFile;
-                ht_insert(file_hash_table, newFile->filename, newFile); // Index in hash table
+                // For now, just add it with the SS. Word and char counts are unknown.
+                FileMetadata* newFile = file_metadata_create(filename, "ss_owner", newSS, 0); // Placeholder owner
+                if (!newFile) break;
+                if (!file_link(newFile)) { // Add to the directory tree and the hash table index
+                    file_metadata_free(newFile);
+                    break;
+                }
                 printf("[Data] Registered existing file '%s' from SS.\n", filename);
             }
-            filename = strtok(NULL, ",");
+            filename = strtok_r(NULL, ",", &list_saveptr);
         }
         free(files_copy);
     }
 
-    pthread_mutex_unlock(&data_mutex);
+    pthread_rwlock_unlock(&ns_lock);
+    return newSS;
 }
 
+// SS_HEARTBEAT from a registered Storage Server (ss_health.h).
+void handle_ss_heartbeat(int sock, StorageServer* ss, char** args) {
+    ss_heartbeat_apply(ss, args);
+    Response r;
+    resp_init(&r, sock);
+    resp_puts(&r, "ACK_HEARTBEAT\n");
+    resp_end(&r);
+}
 
-void handle_list_users(int sock) {
-    // (No change to this function's logic)
-    char response[MAX_BUFFER_SIZE * 2] = ""; 
-    
-    pthread_mutex_lock(&data_mutex);
-    strcat(response, "Registered Users:\n");
-    strcat(response, "-----------------\n");
-    for (User* current = user_list_head; current != NULL; current = current->next) {
-        strcat(response, "-> ");
-        strcat(response, current->username);
-        strcat(response, "\n");
+
+// LIST_USERS[;<limit>[;<after>]]: one page of registered users, oldest
+// first, starting after user 'after'. The page is a ListingPage (CRWD.c),
+// so it also ends early when the buffer is full; either way the last line
+// says how to ask for the next one.
+void handle_list_users(int sock, const char* limit_str, const char* after) {
+    ListingPage page;
+    listing_init(&page, sock, limit_str, LIST_USERS_DEFAULT_LIMIT);
+
+    uint32_t start = 0;
+    if (after && *after && strcmp(after, "-") != 0) {
+        uint32_t after_id = user_id_lookup(after);
+        if (after_id == USER_ID_NONE) {
+            resp_printf(&page.resp, "%s;%d;User '%s' is not registered in the system.\n", ERROR_PREFIX, ERR_USER_NOT_FOUND, after);
+            resp_end(&page.resp);
+            return;
+        }
+        start = after_id + 1;
     }
-    pthread_mutex_unlock(&data_mutex);
 
-    strcat(response, "__END__\n");
-    send(sock, response, strlen(response), 0);
+    // Older boot images carry no per-user counts; load them to count.
+    if (!image_counts_known) {
+        pthread_rwlock_rdlock(&ns_lock);
+        image_fault_in_all();
+        pthread_rwlock_unlock(&ns_lock);
+    }
+
+    resp_puts(&page.resp, "Registered Users:\n-----------------\n");
+
+    pthread_rwlock_rdlock(&user_lock);
+    uint32_t count = user_id_count();
+    for (uint32_t id = start; id < count; id++) {
+        UserRecord* record = user_record(id);
+        if (!record->registered) continue;
+        char line[200];
+        int line_len = snprintf(line, sizeof(line), "-> %s (last IP %s, sessions: %lu, files: %ld)\n",
+                                record->name, record->ip_addr,
+                                __atomic_load_n(&record->sessions, __ATOMIC_RELAXED),
+                                __atomic_load_n(&record->owned_files, __ATOMIC_RELAXED) +
+                                __atomic_load_n(&record->image_files, __ATOMIC_RELAXED));
+        if (!listing_add(&page, line, line_len, record->name)) break;
+    }
+    pthread_rwlock_unlock(&user_lock);
+
+    if (page.shown == 0) resp_puts(&page.resp, "(No users)\n");
+    listing_end(&page, "LIST");
+}
+
+void handle_cache_stats(int sock) {
+    Response r;
+    resp_init(&r, sock);
+    CacheStats stats = cache_stats();
+    unsigned long lookups = stats.hits + stats.misses;
+
+    resp_printf(&r,
+             "Metadata Cache:\n"
+             "-----------------\n"
+             "Entries:    %d / %d\n"
+             "Hits:       %lu\n"
+             "Misses:     %lu\n"
+             "Hit rate:   %.1f%%\n"
+             "Evictions:  %lu\n"
+             "Rejections: %lu\n",
+             stats.used, stats.capacity, stats.hits, stats.misses,
+             lookups ? 100.0 * stats.hits / lookups : 0.0,
+             stats.evictions, stats.rejections);
+    resp_end(&r);
+}
+
+// Per-pool object memory (slab.h) and the file index, for sizing hosts.
+void handle_mem_stats(int sock) {
+    Response r;
+    resp_init(&r, sock);
+    size_t pooled = 0;
+    char pools[MAX_BUFFER_SIZE * 4];
+    slab_report(pools, sizeof(pools), &pooled);
+    resp_puts(&r, "Name Server Memory:\n-----------------\n");
+    resp_puts(&r, pools);
+
+    pthread_rwlock_rdlock(&ns_lock);
+    epoch_enter();
+    unsigned long files = ht_count(file_hash_table);
+    unsigned long index_bytes = ht_array_bytes(file_hash_table);
+    epoch_exit();
+    unsigned long pending = __atomic_load_n(&image_pending, __ATOMIC_ACQUIRE);
+    pthread_rwlock_unlock(&ns_lock);
+
+    resp_printf(&r, "File index: %.1f MB\n", index_bytes / 1048576.0);
+    resp_printf(&r, "User file index: %.1f MB\n",
+                    __atomic_load_n(&user_files_bytes, __ATOMIC_RELAXED) / 1048576.0);
+    resp_printf(&r, "Files:      %lu loaded, %lu not loaded from the image yet\n",
+                    files, pending);
+    if (files) {
+        resp_printf(&r, "Per file:   %lu bytes pooled + %lu bytes index\n",
+                        (unsigned long)(pooled / files), index_bytes / files);
+    }
+    resp_end(&r);
+}
+
+// Calls, error replies, permission denials and mean time per command since
+// startup, from the command table's counters.
+void handle_command_stats(int sock) {
+    Response r;
+    resp_init(&r, sock);
+    resp_puts(&r, "Name Server Commands:\n-----------------\n" COMMAND_STATS_HEADER);
+    for (int i = 0; i < ns_command_table.count; i++) {
+        char line[128];
+        int len = command_stats_line(&ns_command_table.specs[i], line, sizeof(line));
+        resp_write(&r, line, len);
+    }
+    resp_printf(&r, "Unknown commands: %lu\n", __atomic_load_n(&ns_command_table.unknown, __ATOMIC_RELAXED));
+
+    resp_puts(&r, "\nStorage Server connections:\n-----------------\n");
+    pthread_rwlock_rdlock(&ns_lock);
+    for (StorageServer* ss = ss_list_head; ss; ss = ss->next) {
+        char line[192];
+        int len = ss_pool_stats_line(ss, line, sizeof(line));
+        resp_write(&r, line, len);
+    }
+    pthread_rwlock_unlock(&ns_lock);
+    resp_end(&r);
+}
+
+// Whether each Storage Server is up and the load it last reported
+// (ss_health.h). "seen" is the time since its last heartbeat; a server
+// that never sent one is an older build, or known only from saved
+// metadata and down until it registers.
+void handle_storage_stats(int sock) {
+    Response r;
+    resp_init(&r, sock);
+    resp_printf(&r, "Storage Servers (placement: %s%s):\n-----------------\n" SS_HEALTH_HEADER,
+                placement_policy->name, placement_colocate ? ", co-locating folders" : "");
+    time_t now = time(NULL);
+    pthread_rwlock_rdlock(&ns_lock);
+    for (StorageServer* ss = ss_list_head; ss; ss = ss->next) {
+        char line[192];
+        int len = ss_health_line(ss, line, sizeof(line), now);
+        resp_write(&r, line, len);
+    }
+    pthread_rwlock_unlock(&ns_lock);
+    resp_end(&r);
+}
+
+// One VIEW line for 'file' at 'path', added to 'page' with 'cursor' as
+// its resume point. Returns 0 once the page is full.
+static int view_listing_emit(ListingPage* page, int show_details, FileMetadata* file, const char* path, const char* cursor) {
+    char line[256];
+    int n;
+    if (show_details) {
+        char loc[40] = "N/A";
+        if (file->ss) {
+                snprintf(loc, 40, "%s:%d", file->ss->ip_addr, file->ss->port);
+        }
+        n = snprintf(line, sizeof(line), "| %-20s | %-12s | %-17s |\n",
+                path, file_owner(file), loc);
+    } else {
+        n = snprintf(line, sizeof(line), "%s\n", path);
+    }
+    if (n >= (int)sizeof(line)) n = sizeof(line) - 1;
+    return listing_add(page, line, n, cursor);
+}
+
+// dir_index_walk() state for VIEW -a
+typedef struct ViewWalk {
+    ListingPage* page;
+    int show_details;
+} ViewWalk;
+
+static int view_listing_add(FileMetadata* file, const char* folder, void* arg) {
+    ViewWalk* walk = (ViewWalk*)arg;
+    char path[DIR_PATH_MAX];
+    snprintf(path, sizeof(path), "%s%s", folder, dir_key_name(file->key));
+    return view_listing_emit(walk->page, walk->show_details, file, path, file->key); // Resume by key, like VIEWFOLDER
+}
+
+// One line of a filtered VIEW. Pages are sorted by path.
+typedef struct ViewEntry {
+    FileMetadata* file;
+    char path[DIR_PATH_MAX];
+} ViewEntry;
+
+// The page's candidates so far: a max-heap on path holding the smallest
+// paths after the cursor, one more than the page can show.
+typedef struct ViewSelect {
+    ViewEntry* heap;
+    uint32_t count, cap;
+    const char* after; // NULL on the first page
+} ViewSelect;
+
+static int view_entry_cmp(const void* a, const void* b) {
+    return strcmp(((const ViewEntry*)a)->path, ((const ViewEntry*)b)->path);
 }
 
-void handle_view(int sock, const char* flags, const char* username) {
-    char response[MAX_BUFFER_SIZE * 4] = ""; 
+static void view_heap_sift_down(ViewEntry* heap, uint32_t count, uint32_t i) {
+    for (;;) {
+        uint32_t largest = i, left = 2 * i + 1, right = left + 1;
+        if (left < count && view_entry_cmp(&heap[left], &heap[largest]) > 0) largest = left;
+        if (right < count && view_entry_cmp(&heap[right], &heap[largest]) > 0) largest = right;
+        if (largest == i) return;
+        ViewEntry tmp = heap[i];
+        heap[i] = heap[largest];
+        heap[largest] = tmp;
+        i = largest;
+    }
+}
+
+// user_files_each() visitor: keeps 'file' if it sorts among the first
+// candidates after the cursor.
+static void view_select_add(FileMetadata* file, void* arg) {
+    ViewSelect* sel = (ViewSelect*)arg;
+    char path[DIR_PATH_MAX];
+    file_path(file, path);
+    if (sel->after && strcmp(path, sel->after) <= 0) return;
+    if (sel->count < sel->cap) {
+        uint32_t i = sel->count++;
+        sel->heap[i].file = file;
+        memcpy(sel->heap[i].path, path, sizeof(path));
+        while (i > 0 && view_entry_cmp(&sel->heap[i], &sel->heap[(i - 1) / 2]) > 0) { // Sift up
+            ViewEntry tmp = sel->heap[i];
+            sel->heap[i] = sel->heap[(i - 1) / 2];
+            sel->heap[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+    } else if (strcmp(path, sel->heap[0].path) < 0) {
+        sel->heap[0].file = file;
+        memcpy(sel->heap[0].path, path, sizeof(path));
+        view_heap_sift_down(sel->heap, sel->count, 0);
+    }
+}
+
+// Lists the files 'user' owns or is in the ACL of, from its visible-file
+// set (user_files.h): the cost follows what the user can see, not how many
+// files the system holds, and memory follows the page size. Caller holds
+// ns_lock.
+static void view_listing_user(ListingPage* page, int show_details, uint32_t user, const char* after) {
+    ViewSelect sel = { NULL, 0, (uint32_t)page->limit + 1, after };
+    sel.heap = (ViewEntry*)malloc(sel.cap * sizeof(ViewEntry));
+    if (!sel.heap) {
+        log_message(LOG_ERROR, "View", "Out of memory; listing is empty.");
+        return;
+    }
+    user_files_each(user, view_select_add, &sel);
+    qsort(sel.heap, sel.count, sizeof(ViewEntry), view_entry_cmp);
+    for (uint32_t i = 0; i < sel.count; i++) {
+        if (!view_listing_emit(page, show_details, sel.heap[i].file, sel.heap[i].path, sel.heap[i].path)) break;
+    }
+    free(sel.heap);
+}
+
+// VIEW;<flags>[;<limit>[;<cursor>]]: -a lists every entry in directory
+// tree order, otherwise only the caller's files, sorted by path; -l adds
+// owner and location. One page at a time (ListingPage, CRWD.c).
+void handle_view(int sock, const char* flags, const char* limit_str, const char* after, const char* username) {
+    ListingPage page;
+    listing_init(&page, sock, limit_str, LISTING_DEFAULT_LIMIT);
     
     // MODIFIED: Filled in the TODOs
     int show_details = (flags && (strstr(flags, "l") != NULL));
     int show_all = (flags && (strstr(flags, "a") != NULL));
+    int resuming = after && *after && strcmp(after, "-") != 0;
 
-    pthread_mutex_lock(&data_mutex);
+    pthread_rwlock_rdlock(&ns_lock);
+    image_fault_in_all(); // Files still in the boot image are in nobody's set yet
 
-    if (show_details) {
-            snprintf(response, sizeof(response), "| %-20s | %-12s | %-17s |\n", "Filename", "Owner", "Location (SS)");
-            strcat(response, "---------------------------------------------------------\n");
+    if (show_details && !resuming) {
+            resp_printf(&page.resp, "| %-20s | %-12s | %-17s |\n", "Filename", "Owner", "Location (SS)");
+            resp_puts(&page.resp, "---------------------------------------------------------\n");
     }
 
-    int file_count = 0;
-    for (FileMetadata* current = file_list_head; current != NULL; current = current->next) {
-        
-        // MODIFIED: This is the permission check
-        // If show_all is false AND the user does NOT have permission, skip this file.
-        if (!show_all && !check_permission(current, username, 'R')) {
-            continue; 
-        }
-        
-        // If we are here, we have permission (or show_all is true)
-        file_count++;
-        char line[256];
-        if (show_details) {
-            char loc[40] = "N/A";
-            if (current->ss) {
-                    snprintf(loc, 40, "%s:%d", current->ss->ip_addr, current->ss->port);
-            }
-            snprintf(line, sizeof(line), "| %-20s | %-12s | %-17s |\n", 
-                    current->filename, current->owner, loc);
-        } else {
-            snprintf(line, sizeof(line), "%s\n", current->filename);
-        }
-        
-        // Prevent buffer overflow
-        if (strlen(response) + strlen(line) < sizeof(response) - 100) {
-            strcat(response, line);
-        }
+    int valid = 1;
+    if (show_all) {
+        // Every entry in the directory tree, folder by folder
+        ViewWalk walk = { &page, show_details };
+        FileMetadata* from = resuming ? listing_cursor_entry(after) : NULL;
+        valid = (!resuming || from) && dir_index_walk_after("", from, view_listing_add, &walk);
+    } else {
+        view_listing_user(&page, show_details, user_id_lookup(username), resuming ? after : NULL);
+    }
+    pthread_rwlock_unlock(&ns_lock);
+
+    if (!valid) {
+        resp_printf(&page.resp, "%s;%d;Listing cursor '%.100s' is no longer valid; list again from the start.\n",
+                 ERROR_PREFIX, ERR_INVALID_INPUT, after);
+        resp_end(&page.resp);
+        return;
     }
 
     // Add a footer if no files were found to show
-    if (file_count == 0) {
+    if (page.shown == 0 && !resuming) {
         if (show_all) {
-            strcat(response, "No files found in the system.\n");
+            resp_puts(&page.resp, "No files found in the system.\n");
         } else {
-            strcat(response, "No files accessible to you.\n");
+            resp_puts(&page.resp, "No files accessible to you.\n");
         }
     }
 
-    pthread_mutex_unlock(&data_mutex);
-    
-    strcat(response, "__END__\n");
-    send(sock, response, strlen(response), 0);
+    char command[32];
+    snprintf(command, sizeof(command), "VIEW %.16s", flags && *flags ? flags : "-");
+    listing_end(&page, command);
 }
 
 
-int main() {
-    // (No change to this function's logic)
-    int server_sock, client_sock;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len = sizeof(client_addr);
+int main(int argc, char** argv) {
+    int server_sock;
+    struct sockaddr_in server_addr;
+
+    // Offline conversion of the text .dat files into metadata.img.
+    if (argc > 1 && strcmp(argv[1], "--convert-metadata") == 0) {
+        file_hash_table = ht_create();
+        return convert_text_metadata() == 0 ? 0 : 1;
+    }
 
-    pthread_mutex_init(&data_mutex, NULL);
-    file_hash_table = ht_create();
-    lru_init();
+    // A client that disconnects mid-response must not take the NS down.
+    signal(SIGPIPE, SIG_IGN);
+
+    // Every idle session holds one descriptor, so use all we are allowed.
+    struct rlimit fd_limit;
+    if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur < fd_limit.rlim_max) {
+        fd_limit.rlim_cur = fd_limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &fd_limit);
+    }
+
+    if (!command_table_build(&ns_command_table) || !command_table_build(&ns_storage_command_table)) {
+        fprintf(stderr, "[Name Server] Could not build the command table (duplicate command name?).\n");
+        return 1;
+    }
+    file_hash_table = ht_create_rcu();
+    const char* cache_capacity = getenv("NS_CACHE_CAPACITY");
+    cache_init(cache_capacity ? atoi(cache_capacity) : CACHE_DEFAULT_CAPACITY);
+    ss_pool_configure();
+    placement_configure();
     load_metadata();
+    ss_monitor_start();
     server_sock = socket(AF_INET, SOCK_STREAM, 0);
     if (server_sock == -1) {
         perror("Could not create socket");
         return 1;
     }
 
+    int reuse = 1;
+    setsockopt(server_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
     server_addr.sin_port = htons(NAME_SERVER_PORT);
@@ -444,33 +663,14 @@ int main() {
     }
     printf("[Name Server] Bind successful on port %d.\n", NAME_SERVER_PORT);
 
-    listen(server_sock, 10);
+    listen(server_sock, SOMAXCONN);
     printf("[Name Server] Waiting for incoming connections...\n");
 
-    while ((client_sock = accept(server_sock, (struct sockaddr*)&client_addr, &client_len))) {
-        char log_buf[100];
-        snprintf(log_buf, sizeof(log_buf), "Connection accepted from %s:%d", inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-        log_message(LOG_INFO, "NameServer", log_buf);
-        
-        pthread_t thread_id;
-        client_info_t* client_info = malloc(sizeof(client_info_t));
-        client_info->client_socket = client_sock;
-        client_info->client_addr = client_addr;
-
-        if (pthread_create(&thread_id, NULL, handle_connection, (void*)client_info) < 0) {
-            perror("could not create thread");
-            return 1;
-        }
-        
-        pthread_detach(thread_id);
-    }
-
-    if (client_sock < 0) {
-        perror("accept failed");
-        return 1;
-    }
-    
-    pthread_mutex_destroy(&data_mutex);
+#ifdef NS_THREAD_PER_CONNECTION
+    thread_per_connection_run(server_sock);
+#else
+    reactor_run(server_sock);
+#endif
 
     return 0;
-}
\ No newline at end of file
+}
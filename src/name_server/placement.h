@@ -0,0 +1,156 @@
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+/*
+ * placement.h
+ *
+ * Chooses the Storage Server that gets a new file or folder.
+ *
+ * Policies, picked by name with the NS_PLACEMENT environment variable:
+ *   p2c     (default) power of two choices: draw two servers that are up
+ *           at random and take the one with less work per free byte of
+ *           disk (below).
+ *   first   the first server that is up, as before this file existed.
+ *   random  any server that is up.
+ * Only servers that are up (ss_health.h) are considered. With
+ * NS_PLACEMENT_COLOCATE=1 a new entry goes to its parent folder's server
+ * instead, when that server is up, so a folder's files stay together.
+ *
+ * A server's work estimates the requests it has in flight: the larger of
+ * the count its last heartbeat sent and its request rate times its median
+ * latency (one sample can miss a busy server), plus one per entry placed
+ * on it since that heartbeat (load it has not reported yet), plus one.
+ * Dividing by its free disk space means an idle server gets new files
+ * before a busy or slow one, and a server with twice the free space takes
+ * about twice the files, so disks of different sizes fill at the same
+ * rate. If either server has not reported its disk (it has never sent a
+ * heartbeat), only their work is compared.
+ *
+ * Comparing two random servers rather than all of them keeps the choice
+ * cheap, and keeps a burst of creates between two heartbeats from all
+ * landing on the one server that looked best in the last report.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "types.h"
+#include "ss_health.h"
+#include "../logger.h"
+
+typedef StorageServer* (*PlacementFn)(StorageServer* list, int up);
+
+typedef struct PlacementPolicy {
+    const char* name;
+    PlacementFn choose; // 'up' (> 0) servers in 'list' are up
+} PlacementPolicy;
+
+static __thread unsigned int placement_seed;
+
+static unsigned int placement_random(unsigned int n) {
+    if (!placement_seed) placement_seed = (unsigned int)time(NULL) ^ (unsigned int)(uintptr_t)&placement_seed;
+    return (unsigned int)rand_r(&placement_seed) % n;
+}
+
+// The 'index'th server in 'list' that is up.
+static StorageServer* placement_nth_up(StorageServer* list, int index) {
+    for (StorageServer* ss = list; ss; ss = ss->next) {
+        if (ss_is_up(ss) && index-- == 0) return ss;
+    }
+    return NULL;
+}
+
+// See above.
+double placement_work(StorageServer* ss) {
+    SsLoad* load = &ss->load;
+    double sampled = __atomic_load_n(&load->in_flight, __ATOMIC_RELAXED);
+    double expected = __atomic_load_n(&load->rate_milli, __ATOMIC_RELAXED) / 1000.0 *
+                      __atomic_load_n(&load->p50_us, __ATOMIC_RELAXED) / 1e6;
+    return 1.0 + (sampled > expected ? sampled : expected) + __atomic_load_n(&load->placed, __ATOMIC_RELAXED);
+}
+
+// 1 if 'b' is a better place for a new entry than 'a'.
+static int placement_prefers(StorageServer* a, StorageServer* b) {
+    double work_a = placement_work(a), work_b = placement_work(b);
+    if (!__atomic_load_n(&a->load.total_kb, __ATOMIC_RELAXED) || !__atomic_load_n(&b->load.total_kb, __ATOMIC_RELAXED)) {
+        return work_b < work_a;
+    }
+    // work_b / free_b < work_a / free_a, with a full disk counting as 1 KB free
+    double free_a = __atomic_load_n(&a->load.free_kb, __ATOMIC_RELAXED) + 1.0;
+    double free_b = __atomic_load_n(&b->load.free_kb, __ATOMIC_RELAXED) + 1.0;
+    return work_b * free_a < work_a * free_b;
+}
+
+static StorageServer* place_two_choices(StorageServer* list, int up) {
+    if (up == 1) return placement_nth_up(list, 0);
+    int first = placement_random(up);
+    int second = placement_random(up - 1);
+    if (second >= first) second++;
+    StorageServer* a = placement_nth_up(list, first);
+    StorageServer* b = placement_nth_up(list, second);
+    return placement_prefers(a, b) ? b : a;
+}
+
+static StorageServer* place_first(StorageServer* list, int up) {
+    (void)up;
+    return placement_nth_up(list, 0);
+}
+
+static StorageServer* place_random(StorageServer* list, int up) {
+    return placement_nth_up(list, placement_random(up));
+}
+
+PlacementPolicy placement_policies[] = {
+    { "p2c",    place_two_choices },
+    { "first",  place_first },
+    { "random", place_random },
+};
+
+#define PLACEMENT_POLICY_COUNT (int)(sizeof(placement_policies) / sizeof(placement_policies[0]))
+
+PlacementPolicy* placement_policy = &placement_policies[0];
+int placement_colocate = 0;
+
+// Returns the policy called 'name', or NULL.
+PlacementPolicy* placement_find(const char* name) {
+    for (int i = 0; i < PLACEMENT_POLICY_COUNT; i++) {
+        if (strcmp(placement_policies[i].name, name) == 0) return &placement_policies[i];
+    }
+    return NULL;
+}
+
+// Reads NS_PLACEMENT and NS_PLACEMENT_COLOCATE. Called once at startup.
+void placement_configure() {
+    const char* name = getenv("NS_PLACEMENT");
+    if (name && *name) {
+        PlacementPolicy* policy = placement_find(name);
+        if (policy) {
+            placement_policy = policy;
+        } else {
+            char log_buf[150];
+            snprintf(log_buf, sizeof(log_buf), "Unknown NS_PLACEMENT '%.50s'; using '%s'.", name, placement_policy->name);
+            log_message(LOG_WARN, "NameServer", log_buf);
+        }
+    }
+    const char* colocate = getenv("NS_PLACEMENT_COLOCATE");
+    placement_colocate = colocate && atoi(colocate) > 0;
+}
+
+// The server for a new entry, from the servers in 'list', or NULL if none
+// is up. 'parent' is the server of the folder it goes in, if any. Caller
+// holds ns_lock.
+StorageServer* placement_choose(StorageServer* list, StorageServer* parent) {
+    StorageServer* chosen = NULL;
+    if (placement_colocate && parent && ss_is_up(parent)) {
+        chosen = parent;
+    } else {
+        int up = 0;
+        for (StorageServer* ss = list; ss; ss = ss->next) up += ss_is_up(ss);
+        if (up) chosen = placement_policy->choose(list, up);
+    }
+    if (chosen) __atomic_fetch_add(&chosen->load.placed, 1, __ATOMIC_RELAXED);
+    return chosen;
+}
+
+#endif // PLACEMENT_H
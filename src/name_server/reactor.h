@@ -0,0 +1,693 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+/*
+ * reactor.h
+ *
+ * Event-driven connection handling for the Name Server.
+ * One reactor thread owns the listening socket and an epoll set. It reads
+ * whatever bytes are available on a connection, and once a full command
+ * has arrived (a line, or a request frame once the session negotiated
+ * framing; see frame.h) it hands the connection to a fixed pool of workers.
+ *
+ * Every connection is registered with EPOLLONESHOT, so while a worker is
+ * running commands for it the reactor will not touch it again. The worker
+ * re-arms it when done. That keeps commands on a text session in order
+ * without any per-connection locking.
+ *
+ * Framed sessions are multiplexed instead. Each request frame becomes its
+ * own job as soon as it arrives, and the session is re-armed straight away,
+ * so a client can pipeline requests back to back and a slow one (EXEC, a
+ * long listing) does not hold up the rest. Replies carry the request ID and
+ * go out in whatever order the requests finish. At most NS_MAX_IN_FLIGHT
+ * requests per session are queued or running; past that the session is
+ * not read until one of them finishes.
+ *
+ * Client sockets are non-blocking. A reply goes straight out if the socket
+ * takes it; what it will not take yet is queued on the session and sent by
+ * the reactor as room appears (EPOLLOUT), so a worker never waits on a
+ * client that is slow to read. Once a session has more than
+ * CONN_MAX_QUEUED bytes of replies unread, no more of its commands are run
+ * and it is not read until the client catches up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <arpa/inet.h>
+#include "types.h"
+#include "response.h"
+#include "../frame.h"
+#include "../logger.h"
+
+#define NS_WORKER_THREADS 16
+#define NS_EPOLL_BATCH 256
+#define CONN_INITIAL_BUF 1024
+#define CONN_MAX_LINE (64 * 1024) // REGISTER_SS carries the whole file list
+#define NS_MAX_IN_FLIGHT 32 // Framed requests per session queued or running
+#define CONN_MAX_QUEUED (1024 * 1024) // Unread reply bytes past which a session is not read
+
+// Implemented in name_server.c. Runs one complete command for a session.
+void dispatch_command(Connection* conn, char* line);
+
+int reactor_epfd = -1;
+int reserve_fd = -1; // Spare descriptor, released to shed connections on EMFILE
+
+// --- Connection state ---
+
+Connection* conn_create(int sock, const struct sockaddr_in* addr) {
+    Connection* conn = (Connection*)calloc(1, sizeof(Connection));
+    if (!conn) return NULL;
+    conn->sock = sock;
+    conn->addr = *addr;
+    inet_ntop(AF_INET, &addr->sin_addr, conn->ip_addr, sizeof(conn->ip_addr));
+    conn->state = CONN_AWAIT_REGISTER;
+    strcpy(conn->username, "anonymous");
+    conn->in_buf = (char*)malloc(CONN_INITIAL_BUF);
+    conn->in_cap = conn->in_buf ? CONN_INITIAL_BUF : 0;
+    conn->job.conn = conn;
+    conn->refs = 1;
+    pthread_mutex_init(&conn->lock, NULL);
+    pthread_mutex_init(&conn->write_lock, NULL);
+    return conn;
+}
+
+void conn_destroy(Connection* conn) {
+    close(conn->sock);
+    while (conn->out_head) {
+        OutChunk* next = conn->out_head->next;
+        free(conn->out_head);
+        conn->out_head = next;
+    }
+    pthread_mutex_destroy(&conn->lock);
+    pthread_mutex_destroy(&conn->write_lock);
+    free(conn->in_buf);
+    free(conn);
+}
+
+// Whether 'conn' has more than CONN_MAX_QUEUED bytes of replies unread.
+static int conn_backlogged(Connection* conn) {
+    pthread_mutex_lock(&conn->write_lock);
+    int backlogged = conn->out_len > CONN_MAX_QUEUED;
+    pthread_mutex_unlock(&conn->write_lock);
+    return backlogged;
+}
+
+// Pulls bytes off the socket into in_buf. With 'blocking' == 0 it drains
+// everything currently queued and returns; otherwise it waits for at least
+// one recv(). Returns 0 normally, -1 if the peer closed or misbehaved.
+int conn_fill(Connection* conn, int blocking) {
+    int flags = blocking ? 0 : MSG_DONTWAIT;
+    while (1) {
+        if (conn->in_cap - conn->in_len < 512) {
+            if (conn->in_cap >= CONN_MAX_LINE) {
+                // No newline (or frame end) in 64 KB: not a client we understand.
+                log_message(LOG_WARN, "Reactor", "Command line too long. Dropping connection.");
+                conn->peer_closed = 1;
+                return -1;
+            }
+            char* bigger = (char*)realloc(conn->in_buf, conn->in_cap * 2);
+            if (!bigger) {
+                conn->peer_closed = 1;
+                return -1;
+            }
+            conn->in_buf = bigger;
+            conn->in_cap *= 2;
+        }
+
+        ssize_t n = recv(conn->sock, conn->in_buf + conn->in_len, conn->in_cap - conn->in_len - 1, flags);
+        if (n > 0) {
+            conn->in_len += n;
+            if (blocking) return 0;
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+        if (n < 0 && errno == EINTR) continue;
+        conn->peer_closed = 1;
+        return -1;
+    }
+}
+
+// Looks for a whole request frame at in_buf + start. Returns its size with
+// the header, 0 if more bytes are needed, or -1 if it is not a request
+// frame we accept.
+static long conn_frame_at(Connection* conn, size_t start, FrameHeader* h) {
+    if (conn->in_len - start < FRAME_HEADER_LEN) return 0;
+    if (!frame_unpack((const unsigned char*)conn->in_buf + start, h) ||
+        h->opcode != FRAME_REQUEST || h->length > FRAME_MAX_REQUEST) return -1;
+    if (conn->in_len - start < FRAME_HEADER_LEN + (size_t)h->length) return 0;
+    return FRAME_HEADER_LEN + (long)h->length;
+}
+
+// A text session has a whole command line to run. (Framed sessions are
+// handled as frames arrive; see conn_queue_frames().)
+int conn_has_command(Connection* conn) {
+    return memchr(conn->in_buf, '\n', conn->in_len) != NULL;
+}
+
+// Runs one request from a framed session. Every request gets a final reply
+// frame, even one dispatch_command() ignored (a command missing its
+// arguments), since the client is waiting on that request ID.
+void conn_run_frame(Connection* conn, uint32_t request_id, char* command) {
+    resp_set_framing(1, request_id, conn);
+    dispatch_command(conn, command);
+    if (resp_replies_ended() == 0) {
+        Response r;
+        resp_init(&r, conn->sock);
+        resp_printf(&r, "%s;%d;Incomplete or unknown command.\n", ERROR_PREFIX, ERR_INVALID_ARGS);
+        resp_end(&r);
+    }
+}
+
+// Drops the compacted prefix of in_buf.
+static void conn_consume(Connection* conn, size_t len) {
+    if (len == 0) return;
+    memmove(conn->in_buf, conn->in_buf + len, conn->in_len - len);
+    conn->in_len -= len;
+}
+
+// Runs every complete command currently buffered, then compacts the buffer
+// so only the incomplete tail (if any) remains. A session can switch to
+// frames partway through the buffer, right after its registration; with
+// 'run_frames' == 0 this stops there and leaves the frames buffered for
+// conn_queue_frames(). It also stops, leaving the rest buffered, once the
+// client has too many replies unread.
+void conn_run_commands(Connection* conn, int run_frames) {
+    size_t start = 0;
+    while (conn->state != CONN_CLOSING && !conn_backlogged(conn)) {
+        if (conn->framed) {
+            if (!run_frames) break;
+            FrameHeader h;
+            long len = conn_frame_at(conn, start, &h);
+            if (len == 0) break;
+            if (len < 0) {
+                log_message(LOG_WARN, "Reactor", "Malformed frame. Dropping connection.");
+                conn->state = CONN_CLOSING;
+                break;
+            }
+            char* payload = conn->in_buf + start + FRAME_HEADER_LEN;
+            start += len;
+            // Terminate the payload in place; conn_fill() always leaves a
+            // spare byte past in_len.
+            char saved = conn->in_buf[start];
+            conn->in_buf[start] = '\0';
+            conn_run_frame(conn, h.request_id, payload);
+            conn->in_buf[start] = saved;
+            continue;
+        }
+        char* nl = (char*)memchr(conn->in_buf + start, '\n', conn->in_len - start);
+        if (!nl) break;
+        *nl = '\0';
+        char* line = conn->in_buf + start;
+        start = (nl - conn->in_buf) + 1;
+        resp_set_framing(0, 0, conn);
+        dispatch_command(conn, line);
+    }
+    conn_consume(conn, start);
+}
+
+void conn_close(Connection* conn) {
+    char log_buf[150];
+    if (conn->state == CONN_CLIENT) {
+        snprintf(log_buf, sizeof(log_buf), "Client '%s' (IP: %s) disconnected.", conn->username, conn->ip_addr);
+        log_message(LOG_INFO, "NameServer", log_buf);
+    } else if (conn->state == CONN_STORAGE) {
+        ss_session_closed(conn->ss); // SS entries are never freed
+    }
+    conn_destroy(conn);
+}
+
+// Lets go of one reference; the last one closes the connection.
+void conn_release(Connection* conn) {
+    pthread_mutex_lock(&conn->lock);
+    int last = --conn->refs == 0;
+    pthread_mutex_unlock(&conn->lock);
+    if (last) conn_close(conn);
+}
+
+// --- Worker pool ---
+
+typedef struct {
+    Job *head, *tail;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+} WorkQueue;
+
+WorkQueue work_queue = { NULL, NULL, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+void work_queue_push(Job* job) {
+    pthread_mutex_lock(&work_queue.lock);
+    job->next = NULL;
+    if (work_queue.tail) work_queue.tail->next = job;
+    else work_queue.head = job;
+    work_queue.tail = job;
+    pthread_cond_signal(&work_queue.ready);
+    pthread_mutex_unlock(&work_queue.lock);
+}
+
+Job* work_queue_pop() {
+    pthread_mutex_lock(&work_queue.lock);
+    while (!work_queue.head) {
+        pthread_cond_wait(&work_queue.ready, &work_queue.lock);
+    }
+    Job* job = work_queue.head;
+    work_queue.head = job->next;
+    if (!work_queue.head) work_queue.tail = NULL;
+    pthread_mutex_unlock(&work_queue.lock);
+    return job;
+}
+
+// Sets what epoll watches 'conn' for: input while the reading side is
+// with epoll, and room to write while output is queued. Caller holds
+// conn->lock. Returns 0 if epoll_ctl failed.
+static int conn_arm_locked(Connection* conn, int op) {
+    struct epoll_event ev;
+    ev.events = EPOLLONESHOT;
+    if (conn->reading) ev.events |= EPOLLIN | EPOLLRDHUP;
+    if (conn->out_waiting) ev.events |= EPOLLOUT;
+    if (ev.events == EPOLLONESHOT) return 1; // Nothing to watch; a hangup would still fire
+    ev.data.ptr = conn;
+    if (epoll_ctl(reactor_epfd, op, conn->sock, &ev) < 0) {
+        perror("[Reactor] epoll_ctl failed");
+        return 0;
+    }
+    return 1;
+}
+
+// Hands the reading side back to epoll, or lets go of it if the session
+// is over. If the client has too many replies unread, the reading side is
+// parked instead (even after the client closed its end, since commands may
+// still be buffered), and the reactor picks it up again once enough of
+// them are sent (conn_flush_output()).
+void conn_done_reading(Connection* conn) {
+    pthread_mutex_lock(&conn->write_lock);
+    if (conn->out_len > CONN_MAX_QUEUED && conn->state != CONN_CLOSING) {
+        conn->out_parked = 1;
+        pthread_mutex_unlock(&conn->write_lock);
+        return;
+    }
+    pthread_mutex_unlock(&conn->write_lock);
+    if (conn->state == CONN_CLOSING || conn->peer_closed) {
+        conn_release(conn);
+        return;
+    }
+    pthread_mutex_lock(&conn->lock);
+    conn->reading = 1;
+    int armed = conn_arm_locked(conn, EPOLL_CTL_MOD);
+    if (!armed) conn->reading = 0;
+    pthread_mutex_unlock(&conn->lock);
+    if (!armed) conn_release(conn);
+}
+
+// Queues every complete request frame buffered on a framed session as its
+// own job, then re-arms the session. Called by whichever thread holds the
+// reading side. If the session already has NS_MAX_IN_FLIGHT requests it is
+// parked instead, and the request that finishes next takes the reading
+// side over and calls this again. Likewise, once the client has more than
+// CONN_MAX_QUEUED bytes of replies unread, the frames still buffered wait
+// until conn_flush_output() has sent enough of them.
+void conn_queue_frames(Connection* conn) {
+    while (1) {
+        size_t start = 0;
+        int full = 0, backlogged = 0;
+        while (conn->state != CONN_CLOSING) {
+            FrameHeader h;
+            long len = conn_frame_at(conn, start, &h);
+            if (len == 0) break;
+            if (len < 0) {
+                log_message(LOG_WARN, "Reactor", "Malformed frame. Dropping connection.");
+                conn->state = CONN_CLOSING;
+                break;
+            }
+            if (conn_backlogged(conn)) {
+                backlogged = 1;
+                break;
+            }
+            pthread_mutex_lock(&conn->lock);
+            full = conn->in_flight >= NS_MAX_IN_FLIGHT;
+            if (!full) {
+                conn->in_flight++;
+                conn->refs++;
+            }
+            pthread_mutex_unlock(&conn->lock);
+            if (full) break;
+
+            Job* job = (Job*)malloc(sizeof(Job) + h.length + 1);
+            if (!job) {
+                log_message(LOG_ERROR, "Reactor", "Out of memory queueing a request. Dropping connection.");
+                conn->state = CONN_CLOSING;
+                pthread_mutex_lock(&conn->lock);
+                conn->in_flight--;
+                conn->refs--; // The reading side still holds one
+                pthread_mutex_unlock(&conn->lock);
+                break;
+            }
+            job->conn = conn;
+            job->request_id = h.request_id;
+            job->command = (char*)(job + 1);
+            memcpy(job->command, conn->in_buf + start + FRAME_HEADER_LEN, h.length);
+            job->command[h.length] = '\0';
+            start += len;
+            work_queue_push(job);
+        }
+        conn_consume(conn, start);
+        if (backlogged) {
+            // Park, unless the client caught up in the meantime.
+            pthread_mutex_lock(&conn->write_lock);
+            if (conn->out_len > CONN_MAX_QUEUED) {
+                conn->out_parked = 1;
+                pthread_mutex_unlock(&conn->write_lock);
+                return;
+            }
+            pthread_mutex_unlock(&conn->write_lock);
+            continue;
+        }
+        if (!full) break;
+
+        // Park, unless a request finished while the buffer was compacted.
+        pthread_mutex_lock(&conn->lock);
+        if (conn->in_flight >= NS_MAX_IN_FLIGHT) {
+            conn->parked = 1;
+            pthread_mutex_unlock(&conn->lock);
+            return;
+        }
+        pthread_mutex_unlock(&conn->lock);
+    }
+    conn_done_reading(conn);
+}
+
+// Runs one queued request frame, resuming the session's reading if it was
+// parked on this request.
+void worker_run_frame(Job* job) {
+    Connection* conn = job->conn;
+    conn_run_frame(conn, job->request_id, job->command);
+    free(job);
+
+    pthread_mutex_lock(&conn->lock);
+    conn->in_flight--;
+    int resume = conn->parked;
+    conn->parked = 0;
+    pthread_mutex_unlock(&conn->lock);
+    if (resume) conn_queue_frames(conn);
+    conn_release(conn);
+}
+
+// --- Output ---
+
+// Throws away queued output and shuts the socket, which wakes epoll so
+// the reactor lets go of the queue's reference. Caller holds write_lock.
+static void conn_drop_output(Connection* conn) {
+    while (conn->out_head) {
+        OutChunk* next = conn->out_head->next;
+        free(conn->out_head);
+        conn->out_head = next;
+    }
+    conn->out_tail = NULL;
+    conn->out_len = 0;
+    conn->out_failed = 1;
+    shutdown(conn->sock, SHUT_RDWR);
+}
+
+// Copies 'iov' to the end of the output queue, and has epoll watch for
+// room to send it if it is the first. Caller holds write_lock.
+static int conn_queue_output(Connection* conn, struct iovec* iov, int count) {
+    size_t len = 0;
+    for (int i = 0; i < count; i++) len += iov[i].iov_len;
+    OutChunk* chunk = (OutChunk*)malloc(sizeof(OutChunk) + len);
+    if (!chunk) {
+        log_message(LOG_ERROR, "Reactor", "Out of memory queueing a reply. Dropping connection.");
+        conn_drop_output(conn);
+        return 0;
+    }
+    chunk->next = NULL;
+    chunk->len = len;
+    chunk->sent = 0;
+    size_t at = 0;
+    for (int i = 0; i < count; i++) {
+        memcpy(chunk->data + at, iov[i].iov_base, iov[i].iov_len);
+        at += iov[i].iov_len;
+    }
+    if (conn->out_tail) conn->out_tail->next = chunk;
+    else conn->out_head = chunk;
+    conn->out_tail = chunk;
+    conn->out_len += len;
+
+    int armed = 1;
+    pthread_mutex_lock(&conn->lock);
+    if (!conn->out_waiting) {
+        conn->out_waiting = 1;
+        conn->refs++; // The caller holds a reference too, so this is never the last
+        armed = conn_arm_locked(conn, EPOLL_CTL_MOD);
+        if (!armed) {
+            conn->out_waiting = 0;
+            conn->refs--;
+        }
+    }
+    pthread_mutex_unlock(&conn->lock);
+    if (!armed) conn_drop_output(conn);
+    return armed;
+}
+
+// Sends 'iov' on 'conn', or queues what the socket will not take yet.
+// Caller holds conn->write_lock. Returns 0 if the session is gone.
+int conn_send(Connection* conn, struct iovec* iov, int count) {
+    if (conn->out_failed) return 0;
+    while (count > 0 && !conn->out_head) { // Earlier bytes go first
+        ssize_t n = writev(conn->sock, iov, count);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n < 0) {
+            conn_drop_output(conn);
+            return 0;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return count == 0 || conn_queue_output(conn, iov, count);
+}
+
+// Sends queued output until the socket is full. Once the queue is empty
+// (or dropped) it lets go of the queue's reference, which the caller's own
+// keeps from being the last. If the reading side was parked on the
+// backlog and it is back under CONN_MAX_QUEUED, reading resumes.
+static void conn_flush_output(Connection* conn) {
+    pthread_mutex_lock(&conn->write_lock);
+    while (conn->out_head) {
+        OutChunk* chunk = conn->out_head;
+        ssize_t n = send(conn->sock, chunk->data + chunk->sent, chunk->len - chunk->sent, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            conn_drop_output(conn);
+            break;
+        }
+        chunk->sent += n;
+        conn->out_len -= n;
+        if (chunk->sent == chunk->len) {
+            conn->out_head = chunk->next;
+            if (!conn->out_head) conn->out_tail = NULL;
+            free(chunk);
+        }
+    }
+    if (!conn->out_head) {
+        pthread_mutex_lock(&conn->lock);
+        conn->out_waiting = 0;
+        conn->refs--;
+        pthread_mutex_unlock(&conn->lock);
+    }
+    int resume = conn->out_parked && conn->out_len <= CONN_MAX_QUEUED;
+    if (resume) conn->out_parked = 0;
+    pthread_mutex_unlock(&conn->write_lock);
+
+    if (!resume) return;
+    if (conn->framed) conn_queue_frames(conn);
+    else if (conn_has_command(conn)) work_queue_push(&conn->job);
+    else conn_done_reading(conn);
+}
+
+void* worker_main(void* arg) {
+    (void)arg;
+    while (1) {
+        Job* job = work_queue_pop();
+        if (job->command) {
+            worker_run_frame(job);
+            continue;
+        }
+
+        Connection* conn = job->conn;
+        conn_run_commands(conn, 0);
+
+        // Pick up anything that arrived while we were busy before re-arming.
+        if (!conn->framed && conn->state != CONN_CLOSING && !conn->peer_closed && !conn_backlogged(conn)) {
+            conn_fill(conn, 0);
+            if (conn_has_command(conn)) conn_run_commands(conn, 0);
+        }
+
+        // A session that just negotiated framing may have frames buffered.
+        if (conn->framed) conn_queue_frames(conn);
+        else conn_done_reading(conn);
+    }
+    return NULL;
+}
+
+// --- Reactor loop ---
+
+void reactor_accept(int listen_sock) {
+    while (1) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int sock = accept(listen_sock, (struct sockaddr*)&addr, &len);
+        if (sock < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if ((errno == EMFILE || errno == ENFILE) && reserve_fd >= 0) {
+                // Out of descriptors. The listen socket is level-triggered, so
+                // leaving the connection in the backlog would spin this loop.
+                // Free the spare, accept and drop the client, take it back.
+                close(reserve_fd);
+                sock = accept(listen_sock, NULL, NULL);
+                if (sock >= 0) close(sock);
+                reserve_fd = open("/dev/null", O_RDONLY);
+                log_message(LOG_WARN, "Reactor", "Descriptor limit reached. Rejected a connection.");
+                continue;
+            }
+            perror("[Reactor] accept failed");
+            return;
+        }
+
+        Connection* conn = conn_create(sock, &addr);
+        if (!conn) {
+            close(sock);
+            continue;
+        }
+        fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+        char log_buf[100];
+        snprintf(log_buf, sizeof(log_buf), "Connection accepted from %s:%d", conn->ip_addr, ntohs(addr.sin_port));
+        log_message(LOG_INFO, "NameServer", log_buf);
+        conn->reading = 1;
+        if (!conn_arm_locked(conn, EPOLL_CTL_ADD)) conn_release(conn); // Not shared yet
+    }
+}
+
+// Handles one epoll event on 'conn'. The registration is one-shot, so
+// whatever is still wanted gets watched for again afterwards.
+void reactor_event(Connection* conn, uint32_t events) {
+    pthread_mutex_lock(&conn->lock);
+    int readable = conn->reading && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR));
+    int writable = conn->out_waiting && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR));
+    if (readable) conn->reading = 0; // The reading side is ours now
+    conn->refs++; // Held until the re-arm below
+    pthread_mutex_unlock(&conn->lock);
+
+    if (writable) conn_flush_output(conn);
+    if (readable) {
+        conn_fill(conn, 0);
+        if (conn->framed) {
+            conn_queue_frames(conn);
+        } else if (conn_has_command(conn) || conn->peer_closed) {
+            work_queue_push(&conn->job);
+        } else {
+            conn_done_reading(conn);
+        }
+    }
+
+    pthread_mutex_lock(&conn->lock);
+    conn_arm_locked(conn, EPOLL_CTL_MOD);
+    pthread_mutex_unlock(&conn->lock);
+    conn_release(conn);
+}
+
+// Never returns. 'listen_sock' must already be bound and listening.
+void reactor_run(int listen_sock) {
+    reactor_epfd = epoll_create1(0);
+    if (reactor_epfd < 0) {
+        perror("[Reactor] epoll_create1 failed");
+        exit(1);
+    }
+
+    reserve_fd = open("/dev/null", O_RDONLY);
+    fcntl(listen_sock, F_SETFL, fcntl(listen_sock, F_GETFL, 0) | O_NONBLOCK);
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // NULL marks the listening socket
+    epoll_ctl(reactor_epfd, EPOLL_CTL_ADD, listen_sock, &ev);
+
+    for (int i = 0; i < NS_WORKER_THREADS; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, worker_main, NULL) != 0) {
+            perror("[Reactor] could not create worker thread");
+            exit(1);
+        }
+        pthread_detach(tid);
+    }
+
+    struct epoll_event events[NS_EPOLL_BATCH];
+    while (1) {
+        int n = epoll_wait(reactor_epfd, events, NS_EPOLL_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("[Reactor] epoll_wait failed");
+            exit(1);
+        }
+
+        for (int i = 0; i < n; i++) {
+            Connection* conn = (Connection*)events[i].data.ptr;
+            if (!conn) {
+                reactor_accept(listen_sock);
+                continue;
+            }
+            reactor_event(conn, events[i].events);
+        }
+    }
+}
+
+// --- Thread-per-connection model ---
+// The pre-reactor model, kept so bench_sessions can compare the two.
+// Build with -DNS_THREAD_PER_CONNECTION to use it.
+
+void* conn_thread_main(void* arg) {
+    Connection* conn = (Connection*)arg;
+    while (conn->state != CONN_CLOSING && conn_fill(conn, 1) == 0) {
+        conn_run_commands(conn, 1);
+    }
+    conn_run_commands(conn, 1);
+    conn_close(conn);
+    return NULL;
+}
+
+void thread_per_connection_run(int listen_sock) {
+    while (1) {
+        struct sockaddr_in addr;
+        socklen_t len = sizeof(addr);
+        int sock = accept(listen_sock, (struct sockaddr*)&addr, &len);
+        if (sock < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            perror("accept failed");
+            sleep(1);
+            continue;
+        }
+        Connection* conn = conn_create(sock, &addr);
+        pthread_t tid;
+        if (!conn || pthread_create(&tid, NULL, conn_thread_main, conn) != 0) {
+            perror("could not create thread");
+            if (conn) conn_destroy(conn); else close(sock);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+}
+
+#endif // REACTOR_H
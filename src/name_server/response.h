@@ -0,0 +1,266 @@
+#ifndef RESPONSE_H
+#define RESPONSE_H
+
+/*
+ * response.h
+ *
+ * Builds a handler's reply and sends it with writev().
+ *
+ * A Response is a list of pieces (an iovec array). Formatted text is
+ * appended to the buffer being filled: first a small one inside the
+ * Response, so most replies allocate nothing, then 4 KB chunks from a slab
+ * pool (slab.h). resp_ref() adds caller-owned bytes as their own piece
+ * without copying them. Appending is O(bytes), so a long listing costs no
+ * more than its size, and nothing is cut off at a fixed buffer length.
+ *
+ * resp_end() adds the "__END__" terminator and writes everything with as
+ * few writev() calls as the kernel allows, resuming after short writes.
+ * Replies to a reactor session go through conn_send() (reactor.h), which
+ * queues whatever the socket will not take yet instead of waiting for the
+ * client to read it. On a framed session (frame.h) there is no terminator:
+ * each write is one frame, the last one FRAME_REPLY and any earlier ones
+ * FRAME_REPLY_PART, tagged with the request ID the reactor set for the
+ * thread. Requests on one framed session may run at the same time on
+ * different workers, so each write is made under the session's write
+ * lock: frames of different replies can interleave, but never the bytes
+ * of two frames.
+ * Build the reply under whatever locks the handler needs, release them,
+ * then call resp_end(). A reply with more than RESPONSE_MAX_IOV pieces is
+ * written out early as it grows, so very large replies stream in
+ * pieces; build those outside the locks.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "types.h"
+#include "slab.h"
+#include "../frame.h"
+#include "../logger.h"
+
+#define RESPONSE_INLINE 1024  // Bytes held in the Response itself
+#define RESPONSE_CHUNK 4096   // Pooled buffers for anything longer
+#define RESPONSE_MAX_IOV 64   // Pieces per writev(); flushed early past this
+
+// Implemented in reactor.h. Sends or queues bytes on a session; caller
+// holds its write_lock. Returns 0 if the session is gone.
+int conn_send(Connection* conn, struct iovec* iov, int count);
+
+typedef struct Response {
+    int sock;
+    int failed;                  // The peer went away; the rest is dropped
+    int framed;                  // Send frames instead of a terminated text reply
+    uint32_t request_id;         // Framed: the request this answers
+    int status;                  // Set by the first write; -1 before it
+    Connection* conn;            // The session replied to; NULL writes straight to 'sock'
+    struct iovec iov[RESPONSE_MAX_IOV];
+    int iov_count;
+    char* fill;                  // Free space in the buffer being filled
+    size_t fill_room;
+    void* chunks[RESPONSE_MAX_IOV]; // Pool buffers to give back after writing
+    int chunk_count;
+    size_t length;               // Bytes not yet written
+    char inline_buf[RESPONSE_INLINE];
+} Response;
+
+SlabPool response_chunk_pool = SLAB_POOL("response", RESPONSE_CHUNK, 64);
+
+// How replies built on this thread go out: set per command by the
+// reactor, read by resp_init().
+static __thread int reply_framed = 0;
+static __thread uint32_t reply_request_id = 0;
+static __thread Connection* reply_conn = NULL;
+static __thread int replies_ended = 0;
+static __thread int reply_status = 0;
+
+void resp_set_framing(int framed, uint32_t request_id, Connection* conn) {
+    reply_framed = framed;
+    reply_request_id = request_id;
+    reply_conn = conn;
+    replies_ended = 0;
+    reply_status = 0;
+}
+
+// Replies finished with resp_end() since the last resp_set_framing()
+static inline int resp_replies_ended() {
+    return replies_ended;
+}
+
+// Status of the last reply ended on this thread: 0, or the code of an
+// "ERROR;<code>;..." reply. Feeds the per-command counters.
+static inline int resp_last_status() {
+    return reply_status;
+}
+
+void resp_init(Response* r, int sock) {
+    r->sock = sock;
+    r->failed = 0;
+    r->framed = reply_framed;
+    r->request_id = reply_request_id;
+    r->status = -1;
+    r->conn = reply_conn;
+    r->iov_count = 0;
+    r->fill = r->inline_buf;
+    r->fill_room = sizeof(r->inline_buf);
+    r->chunk_count = 0;
+    r->length = 0;
+}
+
+// Bytes appended since the last write
+static inline size_t resp_length(const Response* r) {
+    return r->length;
+}
+
+// Writes every piece so far, as one frame on a framed session, and starts
+// the next piece from the inline buffer again. Returns 0 if the peer is gone.
+static int resp_send(Response* r, int opcode) {
+    if (r->status < 0) { // Status comes from how the reply starts
+        r->status = r->iov_count ? frame_status_of((const char*)r->iov[0].iov_base, r->iov[0].iov_len) : 0;
+    }
+    if (!r->failed) {
+        unsigned char header[FRAME_HEADER_LEN];
+        struct iovec out[RESPONSE_MAX_IOV + 1];
+        struct iovec* iov = r->iov;
+        int count = r->iov_count;
+        if (r->framed) {
+            frame_pack(header, opcode, r->status, r->request_id, (uint32_t)r->length);
+            out[0].iov_base = header;
+            out[0].iov_len = sizeof(header);
+            memcpy(out + 1, r->iov, r->iov_count * sizeof(struct iovec));
+            iov = out;
+            count++;
+        }
+        int ok;
+        if (r->conn) {
+            pthread_mutex_lock(&r->conn->write_lock);
+            ok = conn_send(r->conn, iov, count);
+            pthread_mutex_unlock(&r->conn->write_lock);
+        } else {
+            ok = frame_writev_all(r->sock, iov, count);
+        }
+        if (!ok) r->failed = 1;
+    }
+    for (int i = 0; i < r->chunk_count; i++) slab_free(&response_chunk_pool, r->chunks[i]);
+    r->chunk_count = 0;
+    r->iov_count = 0;
+    r->length = 0;
+    r->fill = r->inline_buf;
+    r->fill_room = sizeof(r->inline_buf);
+    return !r->failed;
+}
+
+// Writes out what the reply holds so far; more of it follows.
+int resp_flush(Response* r) {
+    return resp_send(r, FRAME_REPLY_PART);
+}
+
+// Moves filling to a fresh pool buffer, writing out what is there first
+// if the piece or buffer tables are full. If the pool is out of memory it
+// writes everything out and goes on in the inline buffer instead.
+static void resp_new_chunk(Response* r) {
+    if (r->iov_count == RESPONSE_MAX_IOV || r->chunk_count == RESPONSE_MAX_IOV) resp_flush(r);
+    void* chunk = slab_alloc(&response_chunk_pool);
+    if (!chunk) {
+        resp_flush(r);
+        return;
+    }
+    r->chunks[r->chunk_count++] = chunk;
+    r->fill = (char*)chunk;
+    r->fill_room = RESPONSE_CHUNK;
+}
+
+// Records 'len' bytes just placed at r->fill as part of the reply. There
+// is always a free iovec: resp_new_chunk() and resp_ref() make sure of it.
+static void resp_commit(Response* r, size_t len) {
+    struct iovec* last = r->iov_count ? &r->iov[r->iov_count - 1] : NULL;
+    if (last && (char*)last->iov_base + last->iov_len == r->fill) {
+        last->iov_len += len; // Same buffer as the previous piece
+    } else {
+        r->iov[r->iov_count].iov_base = r->fill;
+        r->iov[r->iov_count].iov_len = len;
+        r->iov_count++;
+    }
+    r->fill += len;
+    r->fill_room -= len;
+    r->length += len;
+}
+
+// Appends a copy of 'len' bytes.
+void resp_write(Response* r, const void* data, size_t len) {
+    const char* bytes = (const char*)data;
+    while (len > 0 && !r->failed) {
+        if (r->fill_room == 0) resp_new_chunk(r);
+        size_t n = len < r->fill_room ? len : r->fill_room;
+        memcpy(r->fill, bytes, n);
+        resp_commit(r, n);
+        bytes += n;
+        len -= n;
+    }
+}
+
+void resp_puts(Response* r, const char* s) {
+    resp_write(r, s, strlen(s));
+}
+
+// Appends formatted text.
+__attribute__((format(printf, 2, 3)))
+void resp_printf(Response* r, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(r->fill, r->fill_room, fmt, args);
+    va_end(args);
+    if (n < 0 || r->failed) return;
+    if ((size_t)n < r->fill_room) {
+        resp_commit(r, n);
+        return;
+    }
+    // Did not fit: format again into a fresh buffer, or the heap if it is
+    // longer than that.
+    resp_new_chunk(r);
+    if ((size_t)n < r->fill_room) {
+        va_start(args, fmt);
+        vsnprintf(r->fill, r->fill_room, fmt, args);
+        va_end(args);
+        resp_commit(r, n);
+        return;
+    }
+    char* text = (char*)malloc(n + 1);
+    if (!text) {
+        log_message(LOG_ERROR, "Response", "Out of memory; part of a reply was left out.");
+        return;
+    }
+    va_start(args, fmt);
+    vsnprintf(text, n + 1, fmt, args);
+    va_end(args);
+    resp_write(r, text, n);
+    free(text);
+}
+
+// Appends 'len' bytes without copying them. They must stay valid and
+// unchanged until the reply is written (resp_end()).
+void resp_ref(Response* r, const void* data, size_t len) {
+    if (len == 0 || r->failed) return;
+    if (r->iov_count == RESPONSE_MAX_IOV) resp_flush(r);
+    r->iov[r->iov_count].iov_base = (void*)data;
+    r->iov[r->iov_count].iov_len = len;
+    r->iov_count++;
+    r->length += len;
+    if (r->iov_count == RESPONSE_MAX_IOV) resp_flush(r); // Keep a slot for the next piece
+}
+
+// Ends the reply with the terminator and writes it. The Response can then
+// be reused for another reply. Returns 0 if the peer is gone.
+int resp_end(Response* r) {
+    if (!r->framed) resp_write(r, "__END__\n", 8);
+    int ok = resp_send(r, FRAME_REPLY);
+    replies_ended++;
+    reply_status = r->status;
+    r->failed = 0;
+    r->status = -1;
+    return ok;
+}
+
+#endif // RESPONSE_H
@@ -0,0 +1,349 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+/*
+ * slab.h
+ *
+ * Fixed-size object pools for the Name Server's small and numerous
+ * metadata objects: FileMetadata, hash table entries, ACLs, access
+ * requests and retired-node records. A 10M-file namespace would otherwise
+ * be tens of millions of separate malloc() calls, each with its own header
+ * and its own spot in the heap.
+ *
+ * Each SlabPool hands out objects of one size. Memory comes from the slab
+ * arena in slabs of many objects and is never returned to the OS; a freed
+ * object goes back to its pool for the next allocation of that type.
+ *
+ * Every thread keeps a magazine of up to SLAB_MAGAZINE free objects per
+ * pool, so most allocations and frees touch no shared state. An empty
+ * magazine is refilled from the pool's depot (unused slab space, then
+ * freed objects, then a new slab), and a full one gives half back, under
+ * the pool lock. The pool lock is a leaf: nothing else is taken while
+ * holding it.
+ *
+ * Short strings (file names, annotations) use slab_strdup(), which picks
+ * a pool by length.
+ *
+ * Bulk loads call slab_reserve() first, which carves one contiguous run
+ * for everything about to be loaded, so objects loaded together sit
+ * together in memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define SLAB_MAX_POOLS 32
+#define SLAB_MAGAZINE 32                 // Free objects a thread caches per pool
+#define SLAB_BYTES (64 * 1024)           // Usual slab size
+#define SLAB_ARENA_CHUNK (4 << 20)       // Arena grows this much at a time
+#define SLAB_ARENA_ALIGN 64
+
+// All objects of one type. Size and alignment are fixed at compile time;
+// the pool registers itself (gets an 'id') on first use.
+typedef struct SlabPool {
+    const char* name;
+    size_t size;              // Object size, a multiple of 'align'
+    size_t align;             // Power of 2, at least sizeof(void*)
+    int id;                   // Index into each thread's magazines; -1 until first use
+    pthread_mutex_t lock;     // Guards the depot below
+    void* free_list;          // Freed objects, linked through their first word
+    char* bump;               // Unused tail of the newest slab or reservation
+    unsigned long bump_left;  // Objects left there
+    unsigned long carved;     // Objects ever taken from the arena
+} SlabPool;
+
+#define SLAB_POOL(name, bytes, align) \
+    { name, ((bytes) + (align) - 1) / (align) * (align), align, -1, PTHREAD_MUTEX_INITIALIZER, NULL, NULL, 0, 0 }
+
+// Backing memory for every pool. Large chunks are carved front to back.
+typedef struct SlabArena {
+    pthread_mutex_t lock;
+    char* chunk;              // Current chunk
+    size_t left;              // Bytes left in it
+    size_t reserved;          // Bytes allocated from the system, all chunks
+    size_t unused;            // Chunk tails abandoned for a new chunk
+    unsigned long chunks;
+} SlabArena;
+
+typedef struct SlabMagazine {
+    int count;
+    void* objects[SLAB_MAGAZINE];
+} SlabMagazine;
+
+// One per thread that has allocated from a pool. Like EpochRecord, never
+// freed; a thread that exits empties its magazines and leaves the record
+// for reuse. Only the owner writes the counters; slab_report() reads them.
+typedef struct SlabThreadCache {
+    SlabMagazine mags[SLAB_MAX_POOLS];
+    unsigned long allocs[SLAB_MAX_POOLS];
+    unsigned long frees[SLAB_MAX_POOLS];
+    int in_use;               // Owned by a live thread
+    struct SlabThreadCache* next;
+} SlabThreadCache;
+
+SlabArena slab_arena = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 0, 0 };
+SlabPool* slab_pools[SLAB_MAX_POOLS];
+int slab_pool_count = 0;
+pthread_mutex_t slab_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+SlabThreadCache* slab_caches = NULL;
+
+static __thread SlabThreadCache* thread_slab_cache = NULL;
+static pthread_key_t slab_key;
+static pthread_once_t slab_key_once = PTHREAD_ONCE_INIT;
+
+// Returns 'bytes' of memory aligned to 'align' (at most SLAB_ARENA_ALIGN),
+// or NULL if the system is out of memory. Never freed.
+static void* arena_alloc(size_t bytes, size_t align) {
+    pthread_mutex_lock(&slab_arena.lock);
+    size_t pad = slab_arena.chunk ? (size_t)(-(uintptr_t)slab_arena.chunk & (align - 1)) : 0;
+    if (!slab_arena.chunk || pad + bytes > slab_arena.left) {
+        // Big requests (bulk reservations) get a chunk of their own, so the
+        // current chunk's tail is not thrown away for them.
+        size_t chunk_bytes = bytes > SLAB_ARENA_CHUNK / 4 ? bytes : SLAB_ARENA_CHUNK;
+        void* chunk = NULL;
+        if (posix_memalign(&chunk, SLAB_ARENA_ALIGN, chunk_bytes) != 0) {
+            pthread_mutex_unlock(&slab_arena.lock);
+            return NULL;
+        }
+        slab_arena.reserved += chunk_bytes;
+        slab_arena.chunks++;
+        if (chunk_bytes != SLAB_ARENA_CHUNK) {
+            pthread_mutex_unlock(&slab_arena.lock);
+            return chunk;
+        }
+        slab_arena.unused += slab_arena.left;
+        slab_arena.chunk = (char*)chunk;
+        slab_arena.left = chunk_bytes;
+        pad = 0;
+    }
+    char* result = slab_arena.chunk + pad;
+    slab_arena.chunk += pad + bytes;
+    slab_arena.left -= pad + bytes;
+    slab_arena.unused += pad;
+    pthread_mutex_unlock(&slab_arena.lock);
+    return result;
+}
+
+// Returns the pool's magazine index, registering it on first use.
+static int slab_pool_id(SlabPool* pool) {
+    int id = __atomic_load_n(&pool->id, __ATOMIC_ACQUIRE);
+    if (id >= 0) return id;
+    pthread_mutex_lock(&slab_registry_lock);
+    if (pool->id < 0) {
+        if (slab_pool_count == SLAB_MAX_POOLS) abort(); // Raise SLAB_MAX_POOLS
+        slab_pools[slab_pool_count] = pool;
+        __atomic_store_n(&pool->id, slab_pool_count++, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&slab_registry_lock);
+    return pool->id;
+}
+
+// Moves the 'n' oldest objects of a magazine back to the pool's free list.
+static void slab_flush(SlabPool* pool, SlabMagazine* mag, int n) {
+    pthread_mutex_lock(&pool->lock);
+    for (int i = 0; i < n; i++) {
+        *(void**)mag->objects[i] = pool->free_list;
+        pool->free_list = mag->objects[i];
+    }
+    pthread_mutex_unlock(&pool->lock);
+    memmove(mag->objects, mag->objects + n, (mag->count - n) * sizeof(void*));
+    mag->count -= n;
+}
+
+static void slab_thread_exit(void* arg) {
+    SlabThreadCache* cache = (SlabThreadCache*)arg;
+    int pools = __atomic_load_n(&slab_pool_count, __ATOMIC_ACQUIRE);
+    for (int id = 0; id < pools; id++) {
+        if (cache->mags[id].count) slab_flush(slab_pools[id], &cache->mags[id], cache->mags[id].count);
+    }
+    __atomic_store_n(&cache->in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void slab_make_key() {
+    pthread_key_create(&slab_key, slab_thread_exit);
+}
+
+// Finds (or creates) this thread's magazines.
+static SlabThreadCache* slab_self() {
+    if (thread_slab_cache) return thread_slab_cache;
+    pthread_once(&slab_key_once, slab_make_key);
+
+    SlabThreadCache* cache = __atomic_load_n(&slab_caches, __ATOMIC_ACQUIRE);
+    for (; cache; cache = cache->next) {
+        int expected = 0;
+        if (__atomic_compare_exchange_n(&cache->in_use, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) break;
+    }
+
+    if (!cache) {
+        cache = (SlabThreadCache*)calloc(1, sizeof(SlabThreadCache));
+        if (!cache) abort(); // Same policy as epoch_self()
+        cache->in_use = 1;
+        SlabThreadCache* head = __atomic_load_n(&slab_caches, __ATOMIC_RELAXED);
+        do {
+            cache->next = head;
+        } while (!__atomic_compare_exchange_n(&slab_caches, &head, cache, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+    }
+
+    thread_slab_cache = cache;
+    pthread_setspecific(slab_key, cache);
+    return cache;
+}
+
+// Refills an empty magazine halfway: unused slab space first (keeps bulk
+// loads contiguous), then freed objects, then a new slab.
+static void slab_refill(SlabPool* pool, SlabMagazine* mag) {
+    int want = SLAB_MAGAZINE / 2;
+    pthread_mutex_lock(&pool->lock);
+    while (mag->count < want) {
+        if (pool->bump_left) {
+            // Lowest address last, so it is handed out first.
+            int n = want - mag->count;
+            if ((unsigned long)n > pool->bump_left) n = (int)pool->bump_left;
+            for (int i = n - 1; i >= 0; i--) mag->objects[mag->count++] = pool->bump + i * pool->size;
+            pool->bump += n * pool->size;
+            pool->bump_left -= n;
+        } else if (pool->free_list) {
+            void* obj = pool->free_list;
+            pool->free_list = *(void**)obj;
+            mag->objects[mag->count++] = obj;
+        } else {
+            unsigned long objects = SLAB_BYTES / pool->size;
+            if (objects < SLAB_MAGAZINE) objects = SLAB_MAGAZINE;
+            char* slab = (char*)arena_alloc(objects * pool->size, pool->align);
+            if (!slab) break;
+            pool->bump = slab;
+            pool->bump_left = objects;
+            pool->carved += objects;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Returns an uninitialized object from 'pool', or NULL if out of memory.
+void* slab_alloc(SlabPool* pool) {
+    int id = slab_pool_id(pool);
+    SlabThreadCache* cache = slab_self();
+    SlabMagazine* mag = &cache->mags[id];
+    if (mag->count == 0) slab_refill(pool, mag);
+    if (mag->count == 0) return NULL;
+    __atomic_store_n(&cache->allocs[id], cache->allocs[id] + 1, __ATOMIC_RELAXED);
+    return mag->objects[--mag->count];
+}
+
+// Gives 'obj' (from slab_alloc() on the same pool, any thread) back.
+void slab_free(SlabPool* pool, void* obj) {
+    if (!obj) return;
+    int id = slab_pool_id(pool);
+    SlabThreadCache* cache = slab_self();
+    SlabMagazine* mag = &cache->mags[id];
+    if (mag->count == SLAB_MAGAZINE) slab_flush(pool, mag, SLAB_MAGAZINE / 2);
+    mag->objects[mag->count++] = obj;
+    __atomic_store_n(&cache->frees[id], cache->frees[id] + 1, __ATOMIC_RELAXED);
+}
+
+// Makes room for 'count' more objects in one contiguous run, which the
+// next allocations are served from. Used before bulk loads; if memory is
+// short it does nothing and allocation falls back to ordinary slabs.
+void slab_reserve(SlabPool* pool, unsigned long count) {
+    pthread_mutex_lock(&pool->lock);
+    if (pool->bump_left < count) {
+        char* run = (char*)arena_alloc(count * pool->size, pool->align);
+        if (run) {
+            // Keep what is left of the old run on the free list.
+            for (; pool->bump_left; pool->bump_left--, pool->bump += pool->size) {
+                *(void**)pool->bump = pool->free_list;
+                pool->free_list = pool->bump;
+            }
+            pool->bump = run;
+            pool->bump_left = count;
+            pool->carved += count;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Size classes for slab_strdup(), up to 255 characters
+#define SLAB_STR_CLASSES 5
+SlabPool slab_str_pools[SLAB_STR_CLASSES] = {
+    SLAB_POOL("str_16", 16, 8),
+    SLAB_POOL("str_32", 32, 8),
+    SLAB_POOL("str_64", 64, 8),
+    SLAB_POOL("str_128", 128, 8),
+    SLAB_POOL("str_256", 256, 8),
+};
+
+static SlabPool* slab_str_pool(size_t bytes) {
+    for (int i = 0; i < SLAB_STR_CLASSES; i++) {
+        if (bytes <= slab_str_pools[i].size) return &slab_str_pools[i];
+    }
+    return NULL;
+}
+
+// Copies at most 'max_len' characters of 's' into a pooled string.
+// Returns NULL if out of memory. Free with slab_strfree().
+char* slab_strndup(const char* s, size_t max_len) {
+    size_t len = strnlen(s, max_len);
+    SlabPool* pool = slab_str_pool(len + 1);
+    char* copy = (char*)(pool ? slab_alloc(pool) : malloc(len + 1));
+    if (!copy) return NULL;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+char* slab_strdup(const char* s) {
+    return slab_strndup(s, (size_t)-1);
+}
+
+void slab_strfree(char* s) {
+    if (!s) return;
+    SlabPool* pool = slab_str_pool(strlen(s) + 1);
+    if (pool) slab_free(pool, s);
+    else free(s);
+}
+
+// Objects of 'pool' currently handed out, summed over every thread.
+static unsigned long slab_in_use(SlabPool* pool) {
+    long in_use = 0;
+    int id = __atomic_load_n(&pool->id, __ATOMIC_ACQUIRE);
+    if (id < 0) return 0;
+    for (SlabThreadCache* cache = __atomic_load_n(&slab_caches, __ATOMIC_ACQUIRE); cache; cache = cache->next) {
+        in_use += (long)__atomic_load_n(&cache->allocs[id], __ATOMIC_RELAXED);
+        in_use -= (long)__atomic_load_n(&cache->frees[id], __ATOMIC_RELAXED);
+    }
+    return in_use > 0 ? (unsigned long)in_use : 0; // Counters are read without a lock
+}
+
+// Writes one line per pool plus the arena totals into 'buf'.
+// Returns the number of bytes written (snprintf rules).
+int slab_report(char* buf, size_t len, size_t* in_use_bytes) {
+    int n = snprintf(buf, len, "%-10s %6s %10s %10s %10s\n", "pool", "size", "in use", "free", "reserved");
+    size_t used_total = 0;
+    int pools = __atomic_load_n(&slab_pool_count, __ATOMIC_ACQUIRE);
+    for (int id = 0; id < pools && (size_t)n < len; id++) {
+        SlabPool* pool = slab_pools[id];
+        pthread_mutex_lock(&pool->lock);
+        unsigned long carved = pool->carved;
+        pthread_mutex_unlock(&pool->lock);
+        unsigned long in_use = slab_in_use(pool);
+        if (in_use > carved) in_use = carved;
+        used_total += in_use * pool->size;
+        n += snprintf(buf + n, len - n, "%-10s %6lu %10lu %10lu %7.1f MB\n", pool->name, (unsigned long)pool->size,
+                      in_use, carved - in_use, carved * pool->size / 1048576.0);
+    }
+    pthread_mutex_lock(&slab_arena.lock);
+    size_t reserved = slab_arena.reserved, unused = slab_arena.unused + slab_arena.left;
+    unsigned long chunks = slab_arena.chunks;
+    pthread_mutex_unlock(&slab_arena.lock);
+    if ((size_t)n < len) {
+        n += snprintf(buf + n, len - n, "Arena: %.1f MB in %lu chunks (%.1f MB not carved yet)\n",
+                      reserved / 1048576.0, chunks, unused / 1048576.0);
+    }
+    if (in_use_bytes) *in_use_bytes = used_total;
+    return n;
+}
+
+#endif // SLAB_H
@@ -0,0 +1,117 @@
+#ifndef SS_HEALTH_H
+#define SS_HEALTH_H
+
+/*
+ * ss_health.h
+ *
+ * Liveness and load of the Storage Servers, from their heartbeats.
+ *
+ * A Storage Server keeps its REGISTER_SS session open and every
+ * SS_HEARTBEAT_SECS sends
+ *   SS_HEARTBEAT;<free kb>;<total kb>;<sessions>;<in flight>;
+ *                <commands>;<interval ms>;<p50 us>;<p99 us>
+ * with its free disk, open connections, commands running, commands run
+ * over the last interval, and latency percentiles over that interval.
+ * The latest report is kept in the server's SsLoad for STORAGE_STATS and
+ * for choosing where new files go.
+ *
+ * A server is marked down when its heartbeat session closes or
+ * SS_DOWN_SECS pass without a heartbeat. Its pooled connections are closed
+ * then, and it gets no new files. Its next heartbeat or registration marks
+ * it up again. A server known only from saved metadata is down until it
+ * registers. One that registered but never sends heartbeats (an older
+ * build) is up until the Name Server fails to connect to it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "types.h"
+#include "ss_pool.h"
+#include "../logger.h"
+
+#define SS_HEARTBEAT_SECS 2 // How often a Storage Server reports
+#define SS_DOWN_SECS 10     // Silence after which it is taken to be down
+
+#define SS_HEALTH_HEADER "server                 state   seen   free MB  total MB sessions in-flight    req/s   p50 us   p99 us\n"
+
+int ss_is_up(StorageServer* ss) {
+    return !__atomic_load_n(&ss->load.down, __ATOMIC_RELAXED);
+}
+
+// Marks 'ss' up, if it was down.
+void ss_mark_up(StorageServer* ss) {
+    if (!__atomic_exchange_n(&ss->load.down, 0, __ATOMIC_RELAXED)) return;
+    char log_buf[100];
+    snprintf(log_buf, sizeof(log_buf), "Storage Server %s:%d is up.", ss->ip_addr, ss->port);
+    log_message(LOG_INFO, "NameServer", log_buf);
+}
+
+// Marks 'ss' down and closes its pooled connections; 'why' is logged.
+void ss_mark_down(StorageServer* ss, const char* why) {
+    if (__atomic_exchange_n(&ss->load.down, 1, __ATOMIC_RELAXED)) return;
+    char log_buf[150];
+    snprintf(log_buf, sizeof(log_buf), "Storage Server %s:%d %s; marking it down.", ss->ip_addr, ss->port, why);
+    log_message(LOG_WARN, "NameServer", log_buf);
+    ss_pool_flush(&ss->pool);
+}
+
+// Records one SS_HEARTBEAT; 'args' are its eight numeric fields, in order.
+void ss_heartbeat_apply(StorageServer* ss, char** args) {
+    SsLoad* load = &ss->load;
+    unsigned long commands = strtoul(args[4], NULL, 10);
+    unsigned long interval_ms = strtoul(args[5], NULL, 10);
+    __atomic_store_n(&load->free_kb, strtoul(args[0], NULL, 10), __ATOMIC_RELAXED);
+    __atomic_store_n(&load->total_kb, strtoul(args[1], NULL, 10), __ATOMIC_RELAXED);
+    __atomic_store_n(&load->sessions, (unsigned int)strtoul(args[2], NULL, 10), __ATOMIC_RELAXED);
+    __atomic_store_n(&load->in_flight, (unsigned int)strtoul(args[3], NULL, 10), __ATOMIC_RELAXED);
+    __atomic_store_n(&load->rate_milli, interval_ms ? (unsigned int)(commands * 1000000 / interval_ms) : 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&load->p50_us, (unsigned int)strtoul(args[6], NULL, 10), __ATOMIC_RELAXED);
+    __atomic_store_n(&load->p99_us, (unsigned int)strtoul(args[7], NULL, 10), __ATOMIC_RELAXED);
+    __atomic_store_n(&load->last_heartbeat, time(NULL), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&load->heartbeats, 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&load->placed, 0, __ATOMIC_RELAXED); // Its load now shows in the report
+    ss_mark_up(ss);
+}
+
+// Marks 'ss' down if it has gone quiet. Run periodically.
+void ss_health_sweep(StorageServer* ss, time_t now) {
+    time_t last = __atomic_load_n(&ss->load.last_heartbeat, __ATOMIC_RELAXED);
+    if (last && now - last > SS_DOWN_SECS && ss_is_up(ss)) ss_mark_down(ss, "missed its heartbeats");
+}
+
+// The heartbeat session of 'ss' closed. Only a server that sends
+// heartbeats keeps that session open, so for one that never sent any,
+// this is just the end of its registration.
+void ss_session_closed(StorageServer* ss) {
+    if (__atomic_load_n(&ss->load.last_heartbeat, __ATOMIC_RELAXED)) ss_mark_down(ss, "closed its session");
+}
+
+// A connection to 'ss' could not be opened. A server that sends
+// heartbeats is judged by those, but for one that never has, this is the
+// only sign that it died.
+void ss_connect_failed(StorageServer* ss) {
+    if (!__atomic_load_n(&ss->load.last_heartbeat, __ATOMIC_RELAXED)) ss_mark_down(ss, "refused connections");
+}
+
+// One STORAGE_STATS line for 'ss'. Returns its length.
+int ss_health_line(StorageServer* ss, char* out, size_t cap, time_t now) {
+    SsLoad* load = &ss->load;
+    char addr[32], seen[16];
+    snprintf(addr, sizeof(addr), "%s:%d", ss->ip_addr, ss->port);
+    time_t last = __atomic_load_n(&load->last_heartbeat, __ATOMIC_RELAXED);
+    if (last) snprintf(seen, sizeof(seen), "%lds", (long)(now - last));
+    else snprintf(seen, sizeof(seen), "never");
+    int n = snprintf(out, cap, "%-22s %-5s %6s %9lu %9lu %8u %9u %8.1f %8u %8u\n", addr,
+                     ss_is_up(ss) ? "up" : "down", seen,
+                     __atomic_load_n(&load->free_kb, __ATOMIC_RELAXED) / 1024,
+                     __atomic_load_n(&load->total_kb, __ATOMIC_RELAXED) / 1024,
+                     __atomic_load_n(&load->sessions, __ATOMIC_RELAXED),
+                     __atomic_load_n(&load->in_flight, __ATOMIC_RELAXED),
+                     __atomic_load_n(&load->rate_milli, __ATOMIC_RELAXED) / 1000.0,
+                     __atomic_load_n(&load->p50_us, __ATOMIC_RELAXED),
+                     __atomic_load_n(&load->p99_us, __ATOMIC_RELAXED));
+    return n < (int)cap ? n : (int)cap - 1;
+}
+
+#endif // SS_HEALTH_H
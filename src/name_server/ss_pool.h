@@ -0,0 +1,415 @@
+#ifndef SS_POOL_H
+#define SS_POOL_H
+
+/*
+ * ss_pool.h
+ *
+ * Keep-alive connections from the Name Server to each Storage Server.
+ *
+ * Opening a TCP connection per SS request costs a handshake and an
+ * ephemeral port each time, and the SS a thread. Instead every
+ * StorageServer keeps up to SS_POOL_MAX open connections:
+ *   - A request takes an idle connection (checked first with a
+ *     non-blocking MSG_PEEK, so one the SS has closed is dropped rather
+ *     than used) or opens a new one while the pool has room.
+ *   - When every connection is busy and the pool is full, a request to a
+ *     framed SS is pipelined onto the least busy connection: the SS runs a
+ *     connection's commands in order, so each request takes a ticket when
+ *     it is sent and reads its reply when its ticket comes up. A text SS
+ *     has no request IDs to check replies against, so there requests wait
+ *     for a connection to go idle instead.
+ *   - A connection that fails is closed once its last user lets go, and a
+ *     Storage Server that registers again gets its pool emptied, since its
+ *     old connections died with it.
+ *   - ss_pool_reap() closes connections that have been idle for
+ *     SS_POOL_IDLE_SECS; CRWD.c runs it from a background thread.
+ *
+ * Every request has a deadline (deadline.h) covering the wait for a
+ * connection, the connect, the wait behind pipelined requests and the
+ * reply. A connection whose request timed out is closed, since the late
+ * reply would otherwise be taken for the next request's. Requests that
+ * could not connect may be retried, but only within the SS's retry budget:
+ * each successful request earns ss_retry_percent hundredths of a retry, up
+ * to SS_RETRY_BURST retries saved. A Storage Server that is down thus gets
+ * few retries on top of the requests themselves, while one that failed
+ * only briefly is retried right away.
+ *
+ * SsPool.lock is never held across connect() or a reply.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "types.h"
+#include "../frame.h"
+#include "../deadline.h"
+
+#define SS_POOL_MAX 8          // Open connections per Storage Server
+#define SS_POOL_IDLE_SECS 30   // Idle connections older than this are closed
+
+#define SS_RETRY_BURST 10      // Retries an SS can save up
+#define SS_RETRY_BACKOFF_MS 50 // First wait before a retry; doubles after
+
+// Limits on requests to Storage Servers; see ss_pool_configure().
+int ss_timeout_ms = 5000;         // A whole request, connecting included
+int ss_connect_timeout_ms = 1000; // One connect attempt
+int ss_max_attempts = 3;          // Tries per request, the first included
+int ss_retry_percent = 20;        // Retry budget, see above
+
+// How ss_pool_acquire() came by a connection
+#define SS_CONN_NEW 0          // Just opened
+#define SS_CONN_IDLE 1         // Reused; the SS may have closed it since
+#define SS_CONN_SHARED 2       // Pipelined behind other requests
+
+// Results of ss_conn_request()
+#define SS_REQ_OK 1
+#define SS_REQ_FAILED 0
+#define SS_REQ_TIMEOUT -1
+
+// Reads the limits above from the environment, if set: NS_SS_TIMEOUT_MS,
+// NS_SS_CONNECT_TIMEOUT_MS, NS_SS_ATTEMPTS and NS_SS_RETRY_BUDGET (retries
+// per 100 successful requests). Call once at startup.
+void ss_pool_configure() {
+    const char* value;
+    if ((value = getenv("NS_SS_TIMEOUT_MS")) && atoi(value) > 0) ss_timeout_ms = atoi(value);
+    if ((value = getenv("NS_SS_CONNECT_TIMEOUT_MS")) && atoi(value) > 0) ss_connect_timeout_ms = atoi(value);
+    if ((value = getenv("NS_SS_ATTEMPTS")) && atoi(value) > 0) ss_max_attempts = atoi(value);
+    if ((value = getenv("NS_SS_RETRY_BUDGET")) && atoi(value) >= 0) ss_retry_percent = atoi(value);
+}
+
+// Condition variables here wait on deadline.h deadlines.
+static void ss_cond_init(pthread_cond_t* cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+void ss_pool_init(SsPool* pool) {
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    ss_cond_init(&pool->freed);
+    pool->retry_credit = SS_RETRY_BURST * 100;
+}
+
+// Connects to ip:port by 'deadline', or within ss_connect_timeout_ms if
+// that is sooner. Returns NULL with errno set on failure.
+static SsConn* ss_conn_open(const char* ip, int port, int framed, long long deadline) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("[NS] Could not create socket to SS");
+        return NULL;
+    }
+    struct sockaddr_in ss_addr;
+    memset(&ss_addr, 0, sizeof(ss_addr));
+    ss_addr.sin_addr.s_addr = inet_addr(ip);
+    ss_addr.sin_family = AF_INET;
+    ss_addr.sin_port = htons(port);
+    deadline = deadline_min(deadline, deadline_in(ss_connect_timeout_ms));
+    if (deadline_connect(sock, (struct sockaddr*)&ss_addr, sizeof(ss_addr), deadline) < 0) {
+        int saved = errno;
+        perror("[NS] SS Connect failed");
+        close(sock);
+        errno = saved;
+        return NULL;
+    }
+    int one = 1; // Pipelined requests must not wait on each other's ACKs
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // Commands are short, so a send only blocks if the SS stopped reading.
+    struct timeval send_timeout = { ss_timeout_ms / 1000, (ss_timeout_ms % 1000) * 1000 };
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &send_timeout, sizeof(send_timeout));
+
+    SsConn* c = (SsConn*)calloc(1, sizeof(SsConn));
+    if (!c) {
+        close(sock);
+        return NULL;
+    }
+    c->sock = sock;
+    c->framed = framed;
+    pthread_mutex_init(&c->send_lock, NULL);
+    pthread_mutex_init(&c->turn_lock, NULL);
+    ss_cond_init(&c->turn);
+    return c;
+}
+
+static void ss_conn_free(SsConn* c) {
+    close(c->sock);
+    pthread_mutex_destroy(&c->send_lock);
+    pthread_mutex_destroy(&c->turn_lock);
+    pthread_cond_destroy(&c->turn);
+    free(c);
+}
+
+// An idle connection is usable if the SS has neither closed it nor sent
+// anything unasked.
+static int ss_conn_healthy(SsConn* c) {
+    char byte;
+    ssize_t n = recv(c->sock, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+// Takes a connection to 'ss' for one request, opening or sharing one as
+// described above. '*how' says which (SS_CONN_*). Returns NULL with errno
+// set if a new connection was needed and could not be opened, or with
+// ETIMEDOUT if none came free by 'deadline'.
+SsConn* ss_pool_acquire(StorageServer* ss, int* how, long long deadline) {
+    SsPool* pool = &ss->pool;
+    int framed = __atomic_load_n(&ss->framed, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        SsConn* shared = NULL;
+        for (SsConn** link = &pool->conns; *link;) {
+            SsConn* c = *link;
+            if (c->users == 0 && (__atomic_load_n(&c->failed, __ATOMIC_ACQUIRE) || c->framed != framed ||
+                                  !ss_conn_healthy(c))) {
+                *link = c->next;
+                pool->count--;
+                pool->failed++;
+                ss_conn_free(c);
+                continue;
+            }
+            if (c->users == 0) {
+                c->users = 1;
+                pool->reused++;
+                pthread_mutex_unlock(&pool->lock);
+                *how = SS_CONN_IDLE;
+                return c;
+            }
+            if (c->framed && !__atomic_load_n(&c->failed, __ATOMIC_ACQUIRE) && (!shared || c->users < shared->users)) {
+                shared = c;
+            }
+            link = &c->next;
+        }
+
+        if (pool->count < SS_POOL_MAX) {
+            pool->count++; // Hold the slot while connecting unlocked
+            pthread_mutex_unlock(&pool->lock);
+            SsConn* c = ss_conn_open(ss->ip_addr, ss->port, framed, deadline);
+            int saved = errno;
+            pthread_mutex_lock(&pool->lock);
+            if (!c) {
+                pool->count--;
+                pthread_cond_broadcast(&pool->freed);
+                pthread_mutex_unlock(&pool->lock);
+                errno = saved;
+                return NULL;
+            }
+            c->users = 1;
+            c->next = pool->conns;
+            pool->conns = c;
+            pool->opened++;
+            pthread_mutex_unlock(&pool->lock);
+            *how = SS_CONN_NEW;
+            return c;
+        }
+        if (shared) {
+            shared->users++;
+            pool->pipelined++;
+            pthread_mutex_unlock(&pool->lock);
+            *how = SS_CONN_SHARED;
+            return shared;
+        }
+        if (!deadline) {
+            pthread_cond_wait(&pool->freed, &pool->lock);
+            continue;
+        }
+        struct timespec until;
+        deadline_timespec(deadline, &until);
+        if (pthread_cond_timedwait(&pool->freed, &pool->lock, &until) == ETIMEDOUT) {
+            pool->timeouts++;
+            pthread_mutex_unlock(&pool->lock);
+            errno = ETIMEDOUT;
+            return NULL;
+        }
+    }
+}
+
+// Gives a connection back after a request that ended with 'result'
+// (SS_REQ_*), closing it if it failed.
+void ss_pool_release(StorageServer* ss, SsConn* c, int result) {
+    SsPool* pool = &ss->pool;
+    SsConn* dead = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (result == SS_REQ_OK) {
+        pool->retry_credit += ss_retry_percent;
+        if (pool->retry_credit > SS_RETRY_BURST * 100) pool->retry_credit = SS_RETRY_BURST * 100;
+    } else if (result == SS_REQ_TIMEOUT) {
+        pool->timeouts++;
+    }
+    if (--c->users == 0) {
+        if (__atomic_load_n(&c->failed, __ATOMIC_ACQUIRE)) {
+            for (SsConn** link = &pool->conns; *link; link = &(*link)->next) {
+                if (*link == c) {
+                    *link = c->next;
+                    break;
+                }
+            }
+            pool->count--;
+            pool->failed++;
+            dead = c;
+        } else {
+            c->idle_since = time(NULL);
+        }
+        pthread_cond_broadcast(&pool->freed);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    if (dead) ss_conn_free(dead);
+}
+
+// Marks 'c' broken and wakes every request waiting for a reply on it.
+static void ss_conn_fail(SsConn* c) {
+    __atomic_store_n(&c->failed, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&c->turn_lock);
+    pthread_cond_broadcast(&c->turn);
+    pthread_mutex_unlock(&c->turn_lock);
+}
+
+// 1 and the retry counted if the budget allows one more retry to 'ss'.
+int ss_pool_may_retry(StorageServer* ss) {
+    SsPool* pool = &ss->pool;
+    pthread_mutex_lock(&pool->lock);
+    int allowed = pool->retry_credit >= 100;
+    if (allowed) {
+        pool->retry_credit -= 100;
+        pool->retries++;
+    } else {
+        pool->retries_refused++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return allowed;
+}
+
+// Reads a text reply up to and including its __SS_END__ line into 'reply'
+// (without the token). The SS sends nothing after it unasked, so nothing of
+// a later reply is read. Returns 0 if the connection failed, the reply did
+// not fit or 'deadline' passed, any of which leaves the connection unusable.
+static int ss_conn_read_text(SsConn* c, char* reply, size_t cap, long long deadline) {
+    size_t total = 0;
+    reply[0] = '\0';
+    while (total < cap - 1) {
+        ssize_t n = deadline_recv(c->sock, reply + total, cap - 1 - total, 0, deadline);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        size_t from = total > 9 ? total - 9 : 0; // strlen("__SS_END__") - 1
+        total += n;
+        reply[total] = '\0';
+        char* end_token = strstr(reply + from, "__SS_END__");
+        if (end_token) {
+            *end_token = '\0';
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Sends 'command' on 'c' and reads its reply into 'reply' (cap bytes) by
+// 'deadline'. Requests sharing the connection get their replies in the
+// order they were sent. Returns SS_REQ_*.
+int ss_conn_request(SsConn* c, const char* command, char* reply, size_t cap, long long deadline) {
+    pthread_mutex_lock(&c->send_lock);
+    uint32_t ticket = c->next_ticket++;
+    int sent = !__atomic_load_n(&c->failed, __ATOMIC_ACQUIRE);
+    if (sent && c->framed) {
+        sent = frame_send_command(c->sock, ticket, command);
+    } else if (sent) {
+        struct iovec iov = { (void*)command, strlen(command) };
+        sent = frame_writev_all(c->sock, &iov, 1);
+    }
+    pthread_mutex_unlock(&c->send_lock);
+    if (!sent) {
+        int timed_out = errno == EAGAIN || errno == EWOULDBLOCK; // SO_SNDTIMEO
+        ss_conn_fail(c);
+        return timed_out ? SS_REQ_TIMEOUT : SS_REQ_FAILED;
+    }
+
+    int timed_out = 0;
+    struct timespec until;
+    deadline_timespec(deadline, &until);
+    pthread_mutex_lock(&c->turn_lock);
+    while (c->now_serving != ticket && !__atomic_load_n(&c->failed, __ATOMIC_ACQUIRE) && !timed_out) {
+        if (!deadline) pthread_cond_wait(&c->turn, &c->turn_lock);
+        else timed_out = pthread_cond_timedwait(&c->turn, &c->turn_lock, &until) == ETIMEDOUT;
+    }
+    pthread_mutex_unlock(&c->turn_lock);
+    if (timed_out) {
+        ss_conn_fail(c); // Our reply is still to come, ahead of later ones
+        return SS_REQ_TIMEOUT;
+    }
+    if (__atomic_load_n(&c->failed, __ATOMIC_ACQUIRE)) return SS_REQ_FAILED;
+
+    // Only the holder of the current ticket reads.
+    errno = 0;
+    int ok = c->framed ? frame_recv_reply_by(c->sock, reply, cap, deadline) >= 0
+                       : ss_conn_read_text(c, reply, cap, deadline);
+    if (!ok) {
+        timed_out = errno == ETIMEDOUT;
+        ss_conn_fail(c);
+        return timed_out ? SS_REQ_TIMEOUT : SS_REQ_FAILED;
+    }
+    pthread_mutex_lock(&c->turn_lock);
+    c->now_serving++;
+    pthread_cond_broadcast(&c->turn);
+    pthread_mutex_unlock(&c->turn_lock);
+    return SS_REQ_OK;
+}
+
+// Closes every connection: idle ones now, busy ones when released.
+void ss_pool_flush(SsPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    for (SsConn** link = &pool->conns; *link;) {
+        SsConn* c = *link;
+        __atomic_store_n(&c->failed, 1, __ATOMIC_RELEASE);
+        if (c->users == 0) {
+            *link = c->next;
+            pool->count--;
+            ss_conn_free(c);
+            continue;
+        }
+        link = &c->next;
+    }
+    pthread_cond_broadcast(&pool->freed);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Closes connections idle since before 'cutoff'.
+void ss_pool_reap(SsPool* pool, time_t cutoff) {
+    pthread_mutex_lock(&pool->lock);
+    for (SsConn** link = &pool->conns; *link;) {
+        SsConn* c = *link;
+        if (c->users == 0 && c->idle_since < cutoff) {
+            *link = c->next;
+            pool->count--;
+            pool->reaped++;
+            ss_conn_free(c);
+            continue;
+        }
+        link = &c->next;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// One line of pool counters for 'ss'. Returns its length.
+int ss_pool_stats_line(StorageServer* ss, char* out, size_t cap) {
+    SsPool* pool = &ss->pool;
+    pthread_mutex_lock(&pool->lock);
+    int idle = 0;
+    for (SsConn* c = pool->conns; c; c = c->next) idle += c->users == 0;
+    int n = snprintf(out, cap, "%s:%-5d open %d (idle %d), opened %lu, reused %lu, pipelined %lu, reaped %lu, failed %lu, "
+                     "timed out %lu, retried %lu (%lu refused)\n",
+                     ss->ip_addr, ss->port, pool->count, idle, pool->opened, pool->reused,
+                     pool->pipelined, pool->reaped, pool->failed, pool->timeouts, pool->retries,
+                     pool->retries_refused);
+    pthread_mutex_unlock(&pool->lock);
+    return n < (int)cap ? n : (int)cap - 1;
+}
+
+#endif // SS_POOL_H
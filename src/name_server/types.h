@@ -2,6 +2,8 @@
 #define TYPES_H
 
 #include <time.h>
+#include <stdint.h>
+#include <pthread.h>
 #include <netinet/in.h> // Required for the sockaddr_in struct definition
 
 // --- FORWARD DECLARATION ---
@@ -10,55 +12,195 @@
 // This allows FileMetadata to contain a pointer to a StorageServer
 // without needing the full StorageServer definition yet, breaking the circular dependency.
 struct StorageServer;
+struct DirNode; // dir_index.h
 
 // --- STRUCT DEFINITIONS ---
 
-// Describes a user with permission on a specific file
-typedef struct AccessNode {
-    char username[50];
-    char permission; // 'R' for read, 'W' for write
-    struct AccessNode* next;
-} AccessNode;
+// The users with permission on a specific file, by interned user ID
+// (see access_list.h). Immutable once built; changes publish a new list.
+typedef struct AccessList {
+    uint32_t count;  // Users with an entry
+    uint32_t words;  // 0: 'data' is a sorted entry array; else bitmap words
+    uint32_t data[]; // Array: (user_id << 1) | is_write per entry.
+                     // Bitmap: 'words' has-access words, then 'words' write words.
+} AccessList;
 typedef struct RequestNode {
     char username[50];
     struct RequestNode* next;
 } RequestNode;
 
-// Contains all metadata for a single file
-typedef struct FileMetadata {
-    char filename[100];
-    int is_directory; // 1 if directory, 0 if regular file
-    char owner[50];
-    int word_count;
-    int char_count;
-    time_t last_access;
-    struct StorageServer* ss; // Pointer to the SS that holds this file
-    AccessNode* access_list;
-    struct FileMetadata* next; // Pointer for the main linked list
+// The parts of a file's metadata that whole-namespace scans never read:
+// the lock and everything only a single-file command touches. One per
+// file, kept in its own pool (file_cold_pool) so it stays out of the way of
+// the hot records.
+typedef struct FileColdData {
+    // Guards acl, pending_requests, annotation and the counters here and
+    // last_access in FileMetadata. The other FileMetadata fields never
+    // change after creation. acl is also read lock-free by redirect lookups
+    // and VIEW, so writers publish a new list with a release store and
+    // retire the old one via epoch.h.
+    pthread_rwlock_t lock;
     RequestNode* pending_requests;
     // --- UNIQUE FEATURE ---
-    char annotation[256]; // Stores the sticky note
+    char* annotation; // The sticky note (slab string), or NULL if none
     // ----------------------
+    int word_count;
+    int char_count;
+} FileColdData;
+
+// The fields every scan touches (VIEW, VIEWFOLDER, checkpoints), packed
+// into one 64-byte cache line. Records come from file_pool in contiguous
+// slabs, so walking the namespace streams through them; the name is read
+// only for files that are actually listed.
+typedef struct FileMetadata {
+    // "<parent ino>:<name>" (dir_index.h), the file_hash_table key; the
+    // full path until file_link(). Slab string, replaced only by a rename.
+    const char* key;
+    struct StorageServer* ss; // Pointer to the SS that holds this file
+    AccessList* acl;
+    struct DirNode* parent;    // Directory it is in, once linked
+    FileColdData* cold;        // Never NULL
+    time_t last_access;
+    uint32_t owner_id; // Interned owner (user_ids.h); see file_owner()
+    int is_directory;  // 1 if directory, 0 if regular file
+    uint32_t dir_slot; // Position in its folder's entry array (dir_index.h)
 } FileMetadata;
 
+// One keep-alive connection from the Name Server to a Storage Server
+// (ss_pool.h). A framed connection can carry several requests at once: the
+// SS runs a connection's commands in order, so replies come back in the
+// order the requests were sent, and each request waits for its turn.
+typedef struct SsConn {
+    int sock;
+    int framed;
+    int users;                // Requests using it. Pool lock
+    time_t idle_since;        // When 'users' last dropped to 0. Pool lock
+    int failed;               // Broken; closed once its last user lets go. Atomic
+    pthread_mutex_t send_lock; // Sends one request at a time and numbers it
+    uint32_t next_ticket;     // send_lock
+    pthread_mutex_t turn_lock;
+    pthread_cond_t turn;
+    uint32_t now_serving;     // turn_lock: the ticket whose reply is next
+    struct SsConn* next;
+} SsConn;
+
+// The Name Server's connections to one Storage Server (ss_pool.h)
+typedef struct SsPool {
+    pthread_mutex_t lock;
+    pthread_cond_t freed;     // A connection went idle or was closed
+    SsConn* conns;
+    int count;                // Open, plus any being opened
+    int retry_credit;         // Retry budget, in hundredths of a retry
+    unsigned long opened, reused, pipelined, reaped, failed; // Pool lock
+    unsigned long timeouts, retries, retries_refused;
+} SsPool;
+
+// What a Storage Server last reported in a heartbeat (ss_health.h).
+// Written by its heartbeat session, read by anyone; atomic fields.
+typedef struct SsLoad {
+    time_t last_heartbeat;    // 0 if it never sent one (an older SS)
+    int down;                 // Missed its heartbeats or closed their session
+    unsigned long free_kb;    // Disk space left under its root
+    unsigned long total_kb;
+    unsigned int sessions;    // Open connections, the NS's included
+    unsigned int in_flight;   // Commands running
+    unsigned int rate_milli;  // Commands per second, times 1000
+    unsigned int p50_us;      // Command latency over the last interval
+    unsigned int p99_us;
+    unsigned long heartbeats;
+    unsigned int placed;      // New entries put on it since the last one (placement.h)
+} SsLoad;
+
 // Describes a registered Storage Server
 typedef struct StorageServer {
     char ip_addr[20];
     int port;
+    int framed; // Registered with FRAMED/1: takes frame.h requests
+    SsPool pool;
+    SsLoad load;
     struct StorageServer* next;
 } StorageServer;
 
-// Describes a registered user
-typedef struct User {
-    char username[50];
+// A set of files, hashed by address (user_files.h)
+typedef struct FileSet {
+    struct FileMetadata** slots; // Open addressing; NULL is an empty slot
+    uint32_t count;
+    uint32_t mask;               // Slot count - 1; 0 while 'slots' is NULL
+} FileSet;
+
+// One entry in the user directory (user_ids.h), for every username the
+// Name Server has seen, registered or not.
+typedef struct UserRecord {
+    const char* name;         // Interned; never changes or goes away
+    int registered;           // Has registered (now or in saved metadata). user_lock
+    char ip_addr[20];         // Last IP it registered from. user_lock
+    unsigned long sessions;   // Registrations since startup. Atomic
+    long owned_files;         // Files in the namespace it owns. Atomic
+    long image_files;         // Files it owns still only in the boot image. Atomic
+    FileSet files;            // Files it owns or is in the ACL of. user_files.h stripe lock
+} UserRecord;
+
+// Where a connection is in its session. Every session must register first.
+// A Storage Server keeps its registration session open to send heartbeats
+// (older ones just close it after the ACK).
+typedef enum {
+    CONN_AWAIT_REGISTER,
+    CONN_CLIENT,
+    CONN_STORAGE,
+    CONN_CLOSING
+} ConnState;
+
+struct Connection;
+
+// A unit of work for the Name Server's worker pool (reactor.h): the
+// buffered commands of a text session, or one request frame split off a
+// framed session so it can run alongside that session's other requests.
+typedef struct Job {
+    struct Job* next;             // Link in the run queue
+    struct Connection* conn;
+    char* command;                // NULL: run the session's buffered commands
+    uint32_t request_id;          // Framed requests: echoed in the reply frames
+} Job;
+
+// Reply bytes the socket would not take yet (reactor.h).
+typedef struct OutChunk {
+    struct OutChunk* next;
+    size_t len;
+    size_t sent;
+    char data[];
+} OutChunk;
+
+// Per-connection state owned by the reactor. Bytes are accumulated in in_buf
+// until a full command is available: a '\n'-terminated line, or once the
+// session has switched to framing, a whole request frame (frame.h).
+// A framed session can have several requests running at once, so it is
+// freed only when the reactor, every one of them and its unsent replies
+// have let go of it.
+typedef struct Connection {
+    int sock;
+    struct sockaddr_in addr;
     char ip_addr[20];
-    struct User* next;
-} User;
-
-// Bundles information about a connected client for passing to a thread
-typedef struct {
-    int client_socket;
-    struct sockaddr_in client_addr;
-} client_info_t;
+    ConnState state;
+    int peer_closed;          // recv() returned 0 or a hard error
+    char username[50];        // "anonymous" until REGISTER_CLIENT
+    struct StorageServer* ss; // The SS a CONN_STORAGE session registered
+    int framed;               // Negotiated FRAMED/1 at registration
+    char* in_buf;
+    size_t in_len;            // Bytes currently held in in_buf
+    size_t in_cap;
+    Job job;                  // Queues the session itself (text commands)
+    pthread_mutex_t lock;     // Guards refs, in_flight, parked, reading and out_waiting
+    int refs;                 // 1 for the reading side, 1 per request in flight, 1 for queued output
+    int in_flight;            // Framed requests queued or running
+    int parked;               // Reading paused at NS_MAX_IN_FLIGHT requests
+    int reading;              // The reading side is with epoll
+    int out_waiting;          // epoll is watching for room to send out_head
+    pthread_mutex_t write_lock; // Keeps replies whole; guards the out_* fields
+    OutChunk* out_head;       // Queued reply bytes, oldest first
+    OutChunk* out_tail;
+    size_t out_len;           // Bytes queued
+    int out_failed;           // The peer is gone
+    int out_parked;           // Reading paused until the client reads its replies
+} Connection;
 
 #endif // TYPES_H
\ No newline at end of file
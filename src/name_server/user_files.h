@@ -0,0 +1,189 @@
+#ifndef USER_FILES_H
+#define USER_FILES_H
+
+/*
+ * user_files.h
+ *
+ * Reverse index from user to the files that user can see: the ones it owns
+ * plus the ones whose ACL names it. A filtered VIEW reads the caller's set
+ * instead of checking every file in the namespace, so it costs O(files
+ * visible to the user).
+ *
+ * Each UserRecord (user_ids.h) holds a FileSet, an open-addressing table of
+ * file pointers with linear probing. Removal shifts the following entries
+ * back rather than leaving tombstones, so a set that churns (DELETE and
+ * CREATE, access granted and revoked) never needs rebuilding.
+ *
+ * The sets change with the namespace: file_link()/file_unlink() add and
+ * remove a file for its owner and every ACL entry, and acl_publish() adds
+ * or removes the users whose entries changed. Different files' ACLs change
+ * in parallel (under their own file locks), so each set is guarded by one
+ * of USER_FILES_STRIPES mutexes picked by user ID. Readers hold ns_lock,
+ * which keeps the files in a set alive.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "types.h"
+#include "user_ids.h"
+#include "access_list.h"
+#include "../logger.h"
+
+#define USER_FILES_STRIPES 64   // Power of 2
+#define USER_FILES_MIN_SLOTS 8  // Power of 2
+
+pthread_mutex_t user_files_locks[USER_FILES_STRIPES] = {
+#define UF_LOCK4 PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER
+    UF_LOCK4, UF_LOCK4, UF_LOCK4, UF_LOCK4, UF_LOCK4, UF_LOCK4, UF_LOCK4, UF_LOCK4,
+    UF_LOCK4, UF_LOCK4, UF_LOCK4, UF_LOCK4, UF_LOCK4, UF_LOCK4, UF_LOCK4, UF_LOCK4,
+#undef UF_LOCK4
+};
+unsigned long user_files_bytes = 0; // Slot arrays across all sets. Atomic
+
+static pthread_mutex_t* user_files_lock(uint32_t user) {
+    return &user_files_locks[user & (USER_FILES_STRIPES - 1)];
+}
+
+// Home slot for 'file'. Records are 64-byte aligned, so drop those bits.
+static inline uint32_t file_set_home(const FileSet* set, const FileMetadata* file) {
+    return (uint32_t)((((uintptr_t)file >> 6) * 0x9E3779B97F4A7C15ull) >> 32) & set->mask;
+}
+
+// Rehashes into 'slots' entries. Returns 0 if out of memory.
+static int file_set_resize(FileSet* set, uint32_t slots) {
+    FileMetadata** old = set->slots;
+    uint32_t old_slots = old ? set->mask + 1 : 0;
+    FileMetadata** grown = (FileMetadata**)calloc(slots, sizeof(FileMetadata*));
+    if (!grown) return 0;
+    set->slots = grown;
+    set->mask = slots - 1;
+    for (uint32_t i = 0; i < old_slots; i++) {
+        if (!old[i]) continue;
+        uint32_t slot = file_set_home(set, old[i]);
+        while (grown[slot]) slot = (slot + 1) & set->mask;
+        grown[slot] = old[i];
+    }
+    free(old);
+    __atomic_fetch_add(&user_files_bytes, ((unsigned long)slots - old_slots) * sizeof(FileMetadata*), __ATOMIC_RELAXED);
+    return 1;
+}
+
+// Adds 'file' unless it is already there. Returns 0 if out of memory.
+static int file_set_add(FileSet* set, FileMetadata* file) {
+    if (!set->slots || (set->count + 1) * 4 > (set->mask + 1) * 3) { // Keep the load under 3/4
+        if (!file_set_resize(set, set->slots ? (set->mask + 1) * 2 : USER_FILES_MIN_SLOTS)) return 0;
+    }
+    uint32_t slot = file_set_home(set, file);
+    while (set->slots[slot]) {
+        if (set->slots[slot] == file) return 1;
+        slot = (slot + 1) & set->mask;
+    }
+    set->slots[slot] = file;
+    set->count++;
+    return 1;
+}
+
+static void file_set_remove(FileSet* set, FileMetadata* file) {
+    if (!set->slots) return;
+    uint32_t slot = file_set_home(set, file);
+    while (set->slots[slot] != file) {
+        if (!set->slots[slot]) return; // Not in the set
+        slot = (slot + 1) & set->mask;
+    }
+    // Shift later entries of the run back into the hole, if that does not
+    // move them in front of their home slot.
+    uint32_t hole = slot;
+    for (uint32_t next = (hole + 1) & set->mask; set->slots[next]; next = (next + 1) & set->mask) {
+        uint32_t home = file_set_home(set, set->slots[next]);
+        if (((next - home) & set->mask) >= ((next - hole) & set->mask)) {
+            set->slots[hole] = set->slots[next];
+            hole = next;
+        }
+    }
+    set->slots[hole] = NULL;
+    if (--set->count == 0) { // Give the memory back to users who lose everything
+        __atomic_fetch_sub(&user_files_bytes, (unsigned long)(set->mask + 1) * sizeof(FileMetadata*), __ATOMIC_RELAXED);
+        free(set->slots);
+        set->slots = NULL;
+        set->mask = 0;
+    }
+}
+
+// Records that 'user' can now see 'file'.
+void user_files_add(uint32_t user, FileMetadata* file) {
+    UserRecord* record = user_record(user);
+    if (!record) return;
+    pthread_mutex_t* lock = user_files_lock(user);
+    pthread_mutex_lock(lock);
+    int added = file_set_add(&record->files, file);
+    pthread_mutex_unlock(lock);
+    if (!added) log_message(LOG_ERROR, "UserFiles", "Out of memory; a file will not show in its user's VIEW.");
+}
+
+// Records that 'user' can no longer see 'file'. The owner always can.
+void user_files_remove(uint32_t user, FileMetadata* file) {
+    UserRecord* record = user_record(user);
+    if (!record || user == file->owner_id) return;
+    pthread_mutex_t* lock = user_files_lock(user);
+    pthread_mutex_lock(lock);
+    file_set_remove(&record->files, file);
+    pthread_mutex_unlock(lock);
+}
+
+// Adds a newly linked file for its owner and everyone in its ACL.
+void user_files_link(FileMetadata* file) {
+    user_files_add(file->owner_id, file);
+    uint32_t pos = 0, user;
+    char perm;
+    while (acl_next(file->acl, &pos, &user, &perm)) {
+        if (user != file->owner_id) user_files_add(user, file);
+    }
+}
+
+// Removes an unlinked file from every set that holds it.
+void user_files_unlink(FileMetadata* file) {
+    uint32_t pos = 0, user;
+    char perm;
+    while (acl_next(file->acl, &pos, &user, &perm)) {
+        user_files_remove(user, file);
+    }
+    UserRecord* owner = user_record(file->owner_id);
+    if (!owner) return;
+    pthread_mutex_t* lock = user_files_lock(file->owner_id);
+    pthread_mutex_lock(lock);
+    file_set_remove(&owner->files, file);
+    pthread_mutex_unlock(lock);
+}
+
+// Updates the sets of the users whose access changed when a linked file's
+// ACL went from 'old' to 'acl'. Caller holds the file lock exclusively.
+void user_files_acl_changed(FileMetadata* file, const AccessList* old, const AccessList* acl) {
+    uint32_t pos = 0, user;
+    char perm;
+    while (acl_next(acl, &pos, &user, &perm)) {
+        if (!acl_lookup(old, user)) user_files_add(user, file);
+    }
+    pos = 0;
+    while (acl_next(old, &pos, &user, &perm)) {
+        if (!acl_lookup(acl, user)) user_files_remove(user, file);
+    }
+}
+
+// Calls 'visit' with each file 'user' can see, in no set order, under the
+// user's stripe lock: 'visit' must not take locks above it (CRWD.c).
+// Caller holds ns_lock, which keeps the files alive.
+void user_files_each(uint32_t user, void (*visit)(FileMetadata*, void*), void* arg) {
+    UserRecord* record = user_record(user);
+    if (!record) return;
+    pthread_mutex_t* lock = user_files_lock(user);
+    pthread_mutex_lock(lock);
+    FileSet* set = &record->files;
+    for (uint32_t i = 0; set->slots && i <= set->mask; i++) {
+        if (set->slots[i]) visit(set->slots[i], arg);
+    }
+    pthread_mutex_unlock(lock);
+}
+
+#endif // USER_FILES_H
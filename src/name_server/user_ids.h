@@ -0,0 +1,119 @@
+#ifndef USER_IDS_H
+#define USER_IDS_H
+
+/*
+ * user_ids.h
+ *
+ * The user directory. Every username the Name Server sees (registration,
+ * an ACL entry, a file owner) is interned into a dense integer ID (0, 1,
+ * 2, ...) with one UserRecord behind it. ACLs store the 4-byte IDs instead
+ * of 50-byte names and compare them without strcmp, and registration and
+ * user lookups are a hash probe instead of a list walk.
+ *
+ * An ID is never reassigned and a record never goes away, so both can be
+ * kept anywhere without reference counting. A name that was only ever seen
+ * in an ACL has a record with 'registered' clear.
+ *
+ * Lookups in both directions take no lock: the name -> ID index is an RCU
+ * hash table, and the records sit in fixed chunks that never move once
+ * allocated. Only interning a new name takes user_ids.lock. Which record
+ * fields need which lock is noted on UserRecord (types.h).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "types.h"
+#include "hash_table.h"
+#include "epoch.h"
+
+#define USER_ID_NONE UINT32_MAX
+#define USER_ID_CHUNK 4096        // Records per chunk
+#define USER_ID_MAX_CHUNKS 4096   // Up to 16M distinct names
+
+typedef struct UserIdTable {
+    pthread_mutex_t lock;   // Serializes interning
+    HashTable* index;       // name -> (ID + 1); keys point at record names
+    UserRecord* chunks[USER_ID_MAX_CHUNKS];
+    uint32_t count;         // IDs handed out so far
+} UserIdTable;
+
+UserIdTable user_ids = { PTHREAD_MUTEX_INITIALIZER, NULL, { NULL }, 0 };
+
+// Number of IDs handed out so far; every ID below it has a record.
+uint32_t user_id_count() {
+    return __atomic_load_n(&user_ids.count, __ATOMIC_ACQUIRE);
+}
+
+// Returns the ID of 'username', or USER_ID_NONE if it was never interned.
+// Safe from any thread, with or without other locks held.
+uint32_t user_id_lookup(const char* username) {
+    if (!user_ids.index) return USER_ID_NONE;
+    epoch_enter();
+    uintptr_t value = (uintptr_t)ht_search(user_ids.index, username);
+    epoch_exit();
+    // An ID being interned right now is indexed before it is handed out.
+    if (!value || value - 1 >= user_id_count()) return USER_ID_NONE;
+    return (uint32_t)(value - 1);
+}
+
+// Returns the ID of 'username', assigning the next free one (with a fresh,
+// unregistered record) if it is new. Returns USER_ID_NONE only when out of
+// memory or IDs. Must not be called inside an epoch read section.
+uint32_t user_id_intern(const char* username) {
+    uint32_t id = user_id_lookup(username);
+    if (id != USER_ID_NONE) return id;
+
+    pthread_mutex_lock(&user_ids.lock);
+    if (!user_ids.index) user_ids.index = ht_create_rcu();
+    uintptr_t value = (uintptr_t)ht_search(user_ids.index, username); // Raced with another intern
+    if (value) {
+        pthread_mutex_unlock(&user_ids.lock);
+        return (uint32_t)(value - 1);
+    }
+
+    id = user_ids.count;
+    uint32_t chunk = id / USER_ID_CHUNK;
+    char* name = strdup(username);
+    if (!name || !user_ids.index || chunk >= USER_ID_MAX_CHUNKS) {
+        pthread_mutex_unlock(&user_ids.lock);
+        free(name);
+        return USER_ID_NONE;
+    }
+    if (!user_ids.chunks[chunk]) {
+        UserRecord* records = (UserRecord*)calloc(USER_ID_CHUNK, sizeof(UserRecord));
+        if (!records) {
+            pthread_mutex_unlock(&user_ids.lock);
+            free(name);
+            return USER_ID_NONE;
+        }
+        __atomic_store_n(&user_ids.chunks[chunk], records, __ATOMIC_RELEASE);
+    }
+    user_ids.chunks[chunk][id % USER_ID_CHUNK].name = name;
+    // Indexed before the ID is handed out, so a failure leaves it free;
+    // user_id_lookup() does not return it until then.
+    if (!ht_insert(user_ids.index, name, (void*)(uintptr_t)(id + 1))) {
+        user_ids.chunks[chunk][id % USER_ID_CHUNK].name = NULL;
+        pthread_mutex_unlock(&user_ids.lock);
+        free(name);
+        return USER_ID_NONE;
+    }
+    __atomic_store_n(&user_ids.count, id + 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&user_ids.lock);
+    return id;
+}
+
+// Returns the record behind 'id', or NULL if no such ID exists.
+UserRecord* user_record(uint32_t id) {
+    if (id >= user_id_count()) return NULL;
+    return &__atomic_load_n(&user_ids.chunks[id / USER_ID_CHUNK], __ATOMIC_ACQUIRE)[id % USER_ID_CHUNK];
+}
+
+// Returns the name behind 'id'. The string lives forever.
+const char* user_id_name(uint32_t id) {
+    UserRecord* record = user_record(id);
+    return record ? record->name : "?";
+}
+
+#endif // USER_IDS_H
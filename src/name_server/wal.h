@@ -0,0 +1,404 @@
+#ifndef WAL_H
+#define WAL_H
+
+/*
+ * wal.h
+ *
+ * Append-only write-ahead log for Name Server metadata. Every mutation
+ * appends one small binary record instead of rewriting the .dat files, so
+ * its cost no longer grows with the namespace.
+ *
+ * Record layout (little-endian, as written by this host):
+ *   WalRecordHeader { magic, length, crc, type, lsn } + 'length' payload bytes
+ * The CRC covers type, lsn and payload. Replay stops at the first record
+ * that is short or fails its check, which is where a crash cut the log.
+ *
+ * Group commit: wal_append() only copies the record into a memory buffer
+ * and returns its LSN. A single flusher thread writes whatever has
+ * accumulated and issues one fdatasync() for the whole batch, so N
+ * concurrent mutations share one sync. wal_commit(lsn) waits until that
+ * record is on disk; call it after dropping locks, before replying.
+ *
+ * The log is split into segments by wal_rotate(): the current segment is
+ * renamed to 'old_path' and a fresh one is started. The checkpointer
+ * (CRWD.c) rotates, writes a full snapshot, then deletes the old segment.
+ * What the records mean is up to the caller; this file only moves bytes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../logger.h"
+
+#define WAL_MAGIC 0x4C41574EU      // "NWAL"
+#define WAL_MAX_PAYLOAD 1024       // Largest record body
+#define WAL_BUFFER_INITIAL 65536
+
+typedef struct WalRecordHeader {
+    uint32_t magic;
+    uint32_t length; // Payload bytes that follow
+    uint32_t crc;    // CRC-32 of type, lsn and payload
+    uint8_t type;
+    uint64_t lsn;
+} __attribute__((packed)) WalRecordHeader;
+
+// A record body being built. Fields are appended in order and must be read
+// back in the same order.
+typedef struct WalRecord {
+    uint8_t type;
+    size_t length;
+    char data[WAL_MAX_PAYLOAD];
+    int overflow; // A field did not fit; the record will not be logged
+} WalRecord;
+
+// Reads the fields of one record body during replay.
+typedef struct WalReader {
+    const char* data;
+    size_t left;
+} WalReader;
+
+typedef struct WalLog {
+    pthread_mutex_t mutex;        // Leaf lock: never held across I/O
+    pthread_cond_t flush_cond;    // Work for the flusher
+    pthread_cond_t durable_cond;  // durable_lsn moved
+    int fd;
+    char path[256];
+
+    char* buf;                    // Records not yet handed to the flusher
+    size_t len, cap;
+    char* spare;                  // Swapped with buf by the flusher
+    size_t spare_cap;
+
+    uint64_t next_lsn;
+    uint64_t durable_lsn;         // Every record <= this is on disk
+    unsigned long segment_bytes;  // Appended since the last rotation
+    unsigned long syncs;          // fdatasync() calls, for stats
+    char rotate_to[256];          // Non-empty: rotate after the next flush
+    int rotated;                  // Outcome of the last rotation
+    int failed;                   // A write or sync failed; stop acking
+} WalLog;
+
+WalLog wal = { .mutex = PTHREAD_MUTEX_INITIALIZER, .flush_cond = PTHREAD_COND_INITIALIZER,
+               .durable_cond = PTHREAD_COND_INITIALIZER, .fd = -1, .next_lsn = 1 };
+
+// --- CRC-32 (IEEE, reflected) ---
+
+static uint32_t wal_crc_table[256];
+static pthread_once_t wal_crc_once = PTHREAD_ONCE_INIT;
+
+static void wal_crc_init() {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+        wal_crc_table[i] = c;
+    }
+}
+
+static uint32_t wal_crc(uint32_t crc, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    crc = ~crc;
+    while (len--) crc = wal_crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static uint32_t wal_record_crc(uint8_t type, uint64_t lsn, const char* payload, size_t len) {
+    pthread_once(&wal_crc_once, wal_crc_init);
+    uint32_t crc = wal_crc(0, &type, sizeof(type));
+    crc = wal_crc(crc, &lsn, sizeof(lsn));
+    return wal_crc(crc, payload, len);
+}
+
+// --- Record encoding ---
+
+void wal_record_init(WalRecord* rec, uint8_t type) {
+    rec->type = type;
+    rec->length = 0;
+    rec->overflow = 0;
+}
+
+void wal_put_str(WalRecord* rec, const char* str) {
+    size_t len = strlen(str);
+    if (len > UINT16_MAX || rec->length + sizeof(uint16_t) + len > WAL_MAX_PAYLOAD) {
+        rec->overflow = 1;
+        return;
+    }
+    uint16_t len16 = (uint16_t)len;
+    memcpy(rec->data + rec->length, &len16, sizeof(len16));
+    memcpy(rec->data + rec->length + sizeof(len16), str, len);
+    rec->length += sizeof(len16) + len;
+}
+
+void wal_put_int(WalRecord* rec, int32_t value) {
+    if (rec->length + sizeof(value) > WAL_MAX_PAYLOAD) {
+        rec->overflow = 1;
+        return;
+    }
+    memcpy(rec->data + rec->length, &value, sizeof(value));
+    rec->length += sizeof(value);
+}
+
+// Copies the next string field into 'out' (truncated to 'size').
+// Returns 0 on success, -1 if the record is malformed.
+int wal_get_str(WalReader* reader, char* out, size_t size) {
+    uint16_t len;
+    if (reader->left < sizeof(len)) return -1;
+    memcpy(&len, reader->data, sizeof(len));
+    if (reader->left < sizeof(len) + len) return -1;
+    size_t copy = len < size - 1 ? len : size - 1;
+    memcpy(out, reader->data + sizeof(len), copy);
+    out[copy] = '\0';
+    reader->data += sizeof(len) + len;
+    reader->left -= sizeof(len) + len;
+    return 0;
+}
+
+int wal_get_int(WalReader* reader, int32_t* value) {
+    if (reader->left < sizeof(*value)) return -1;
+    memcpy(value, reader->data, sizeof(*value));
+    reader->data += sizeof(*value);
+    reader->left -= sizeof(*value);
+    return 0;
+}
+
+// --- Writer ---
+
+static int wal_write_all(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n < 0) return -1;
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+// Makes renames and creations in the working directory durable.
+void wal_sync_dir() {
+    int dir_fd = open(".", O_RDONLY);
+    if (dir_fd < 0) return;
+    fsync(dir_fd);
+    close(dir_fd);
+}
+
+// Flushes a file written through stdio to disk. Returns 0 on success.
+int wal_sync_file(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    int result = fsync(fd);
+    close(fd);
+    return result;
+}
+
+// Renames the current segment to 'old_path' and opens an empty one in its
+// place. Returns the new descriptor, or -1 with the old segment left as is.
+static int wal_do_rotate(const char* old_path) {
+    if (rename(wal.path, old_path) < 0) {
+        log_message(LOG_ERROR, "WAL", "Could not rotate the log segment.");
+        return -1;
+    }
+    int fd = open(wal.path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        log_message(LOG_ERROR, "WAL", "Could not open a new log segment.");
+        rename(old_path, wal.path);
+        return -1;
+    }
+    wal_sync_dir();
+    return fd;
+}
+
+// Writes and syncs batches until the process exits.
+static void* wal_flusher_main(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&wal.mutex);
+    while (1) {
+        while (wal.len == 0 && wal.rotate_to[0] == '\0') {
+            pthread_cond_wait(&wal.flush_cond, &wal.mutex);
+        }
+
+        // Take the whole batch; appenders keep filling the other buffer.
+        char* batch = wal.buf;
+        size_t batch_len = wal.len, batch_cap = wal.cap;
+        wal.buf = wal.spare;
+        wal.cap = wal.spare_cap;
+        wal.len = 0;
+        wal.spare = batch;
+        wal.spare_cap = batch_cap;
+        uint64_t upto = wal.next_lsn - 1;
+        char rotate_to[256];
+        strcpy(rotate_to, wal.rotate_to);
+        pthread_mutex_unlock(&wal.mutex);
+
+        // Only this thread writes or replaces wal.fd.
+        int ok = 1, new_fd = -1;
+        if (batch_len > 0) {
+            ok = wal_write_all(wal.fd, batch, batch_len) == 0 && fdatasync(wal.fd) == 0;
+        }
+        if (ok && rotate_to[0]) new_fd = wal_do_rotate(rotate_to);
+
+        pthread_mutex_lock(&wal.mutex);
+        if (batch_len > 0) wal.syncs++;
+        if (new_fd >= 0) {
+            close(wal.fd);
+            wal.fd = new_fd;
+        }
+        if (ok) {
+            wal.durable_lsn = upto;
+        } else if (!wal.failed) {
+            wal.failed = 1;
+            log_message(LOG_ERROR, "WAL", "Write to the metadata log failed. Mutations are no longer durable.");
+        }
+        if (rotate_to[0]) {
+            wal.rotated = new_fd >= 0;
+            wal.rotate_to[0] = '\0';
+        }
+        pthread_cond_broadcast(&wal.durable_cond);
+    }
+    return NULL;
+}
+
+// Opens 'path' for appending and starts the flusher. Call after replay.
+int wal_open(const char* path) {
+    snprintf(wal.path, sizeof(wal.path), "%s", path);
+    wal.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (wal.fd < 0) {
+        log_message(LOG_ERROR, "WAL", "Could not open the metadata log.");
+        return -1;
+    }
+    wal.buf = (char*)malloc(WAL_BUFFER_INITIAL);
+    wal.spare = (char*)malloc(WAL_BUFFER_INITIAL);
+    if (!wal.buf || !wal.spare) return -1;
+    wal.cap = wal.spare_cap = WAL_BUFFER_INITIAL;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, wal_flusher_main, NULL) != 0) return -1;
+    pthread_detach(tid);
+    return 0;
+}
+
+// Queues 'rec' and returns its LSN, or 0 if it could not be logged.
+// Safe under any Name Server lock: it only copies into memory.
+uint64_t wal_append(const WalRecord* rec) {
+    if (rec->overflow) {
+        log_message(LOG_ERROR, "WAL", "Record too large to log; skipped.");
+        return 0;
+    }
+    WalRecordHeader header;
+    header.magic = WAL_MAGIC;
+    header.length = (uint32_t)rec->length;
+    header.type = rec->type;
+
+    pthread_mutex_lock(&wal.mutex);
+    if (wal.fd < 0) {
+        pthread_mutex_unlock(&wal.mutex);
+        return 0;
+    }
+    size_t need = wal.len + sizeof(header) + rec->length;
+    if (need > wal.cap) {
+        size_t new_cap = wal.cap * 2;
+        while (new_cap < need) new_cap *= 2;
+        char* grown = (char*)realloc(wal.buf, new_cap);
+        if (!grown) {
+            pthread_mutex_unlock(&wal.mutex);
+            log_message(LOG_ERROR, "WAL", "Out of memory. Record not logged.");
+            return 0;
+        }
+        wal.buf = grown;
+        wal.cap = new_cap;
+    }
+    header.lsn = wal.next_lsn++;
+    header.crc = wal_record_crc(header.type, header.lsn, rec->data, rec->length);
+    memcpy(wal.buf + wal.len, &header, sizeof(header));
+    memcpy(wal.buf + wal.len + sizeof(header), rec->data, rec->length);
+    wal.len = need;
+    wal.segment_bytes += sizeof(header) + rec->length;
+    pthread_cond_signal(&wal.flush_cond);
+    pthread_mutex_unlock(&wal.mutex);
+    return header.lsn;
+}
+
+// Waits until record 'lsn' is on disk. Returns 0 once durable, -1 if the
+// log has failed. Must not be called with Name Server locks held.
+int wal_commit(uint64_t lsn) {
+    if (lsn == 0) return 0;
+    pthread_mutex_lock(&wal.mutex);
+    while (wal.durable_lsn < lsn && !wal.failed) {
+        pthread_cond_wait(&wal.durable_cond, &wal.mutex);
+    }
+    int result = wal.durable_lsn >= lsn ? 0 : -1;
+    pthread_mutex_unlock(&wal.mutex);
+    return result;
+}
+
+// Starts a new segment. Every record appended before this call ends up in
+// 'old_path'; the ones after it in the fresh segment. Returns 0 if the old
+// segment was set aside, -1 otherwise. Must not be called with Name Server
+// locks held (it waits for a sync).
+int wal_rotate(const char* old_path) {
+    pthread_mutex_lock(&wal.mutex);
+    if (wal.fd < 0 || wal.failed) {
+        pthread_mutex_unlock(&wal.mutex);
+        return -1;
+    }
+    snprintf(wal.rotate_to, sizeof(wal.rotate_to), "%s", old_path);
+    pthread_cond_signal(&wal.flush_cond);
+    while (wal.rotate_to[0] != '\0') {
+        pthread_cond_wait(&wal.durable_cond, &wal.mutex);
+    }
+    int result = wal.rotated ? 0 : -1;
+    if (wal.rotated) wal.segment_bytes = wal.len; // Still buffered, so in the new segment
+    pthread_mutex_unlock(&wal.mutex);
+    return result;
+}
+
+unsigned long wal_segment_bytes() {
+    pthread_mutex_lock(&wal.mutex);
+    unsigned long bytes = wal.segment_bytes;
+    pthread_mutex_unlock(&wal.mutex);
+    return bytes;
+}
+
+// --- Replay ---
+
+// Calls 'apply' for every intact record in 'path', in order. A torn or
+// corrupt tail is reported and, if 'truncate_tail' is set, cut off so new
+// records follow the last good one. Returns the number of records applied,
+// or -1 if the file does not exist.
+int wal_replay(const char* path, int truncate_tail, void (*apply)(uint8_t type, WalReader* reader)) {
+    FILE* log_file = fopen(path, "rb");
+    if (!log_file) return -1;
+
+    int applied = 0;
+    long good_end = 0;
+    char payload[WAL_MAX_PAYLOAD];
+    WalRecordHeader header;
+    while (fread(&header, sizeof(header), 1, log_file) == 1) {
+        if (header.magic != WAL_MAGIC || header.length > WAL_MAX_PAYLOAD) break;
+        if (fread(payload, 1, header.length, log_file) != header.length) break;
+        if (header.crc != wal_record_crc(header.type, header.lsn, payload, header.length)) break;
+
+        WalReader reader = { payload, header.length };
+        apply(header.type, &reader);
+        applied++;
+        good_end = ftell(log_file);
+        if (header.lsn >= wal.next_lsn) wal.next_lsn = header.lsn + 1;
+    }
+
+    fseek(log_file, 0, SEEK_END);
+    long size = ftell(log_file);
+    fclose(log_file);
+    if (size > good_end) {
+        char log_buf[300];
+        snprintf(log_buf, sizeof(log_buf), "%s: dropped %ld bytes of torn or corrupt records after record %d.", path, size - good_end, applied);
+        log_message(LOG_WARN, "WAL", log_buf);
+        if (truncate_tail && truncate(path, good_end) < 0) {
+            log_message(LOG_ERROR, "WAL", "Could not truncate the damaged log tail.");
+        }
+    }
+    return applied;
+}
+
+#endif // WAL_H
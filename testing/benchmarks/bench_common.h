@@ -0,0 +1,147 @@
+#ifndef BENCH_COMMON_H
+#define BENCH_COMMON_H
+
+/*
+ * bench_common.h
+ *
+ * Small helpers shared by the Name Server benchmarks: connecting and
+ * registering sessions (text or framed), timing, and latency percentiles.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "../../src/frame.h"
+
+#define BENCH_NS_IP "127.0.0.1"
+#define BENCH_NS_PORT 8080
+#define BENCH_REPLY_LEN 65536
+
+static inline double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static inline void raise_fd_limit() {
+    struct rlimit lim;
+    if (getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+        lim.rlim_cur = lim.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+}
+
+static inline int connect_to(const char* ip, int port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0) return -1;
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr(ip);
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+// Sends one command line and reads until the "__END__\n" terminator.
+// Returns the reply length, or -1 if the connection failed.
+static inline int ns_request(int sock, const char* line, char* reply, int cap) {
+    if (send(sock, line, strlen(line), 0) < 0) return -1;
+    int total = 0;
+    reply[0] = '\0';
+    while (1) {
+        int n = recv(sock, reply + total, cap - total - 1, 0);
+        if (n <= 0) return -1;
+        total += n;
+        reply[total] = '\0';
+        if (strstr(reply, "__END__\n")) return total;
+        if (total >= cap - 1) total = 0; // Oversized reply: keep draining
+    }
+}
+
+// Opens a session and registers it as 'user'. Returns the socket or -1.
+static inline int ns_session(const char* user) {
+    char line[128], reply[256];
+    int sock = connect_to(BENCH_NS_IP, BENCH_NS_PORT);
+    if (sock < 0) return -1;
+    snprintf(line, sizeof(line), "REGISTER_CLIENT;%s\n", user);
+    if (ns_request(sock, line, reply, sizeof(reply)) < 0 || !strstr(reply, "ACK_CLIENT_REG")) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Opens a session registered as 'user' that negotiated FRAMED/1, so every
+// request and reply after the ACK is a frame (frame.h). Returns the socket
+// or -1.
+static inline int ns_framed_session(const char* user) {
+    char line[128], reply[256];
+    int sock = connect_to(BENCH_NS_IP, BENCH_NS_PORT);
+    if (sock < 0) return -1;
+    snprintf(line, sizeof(line), "REGISTER_CLIENT;%s;" FRAME_CAPABILITY "\n", user);
+    if (ns_request(sock, line, reply, sizeof(reply)) < 0 || !strstr(reply, "ACK_CLIENT_REG;" FRAME_CAPABILITY)) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// Reads the next frame on a framed session into 'payload' (cut to cap - 1
+// bytes). Replies to pipelined requests can arrive in any order and their
+// parts can interleave, so match them up by h->request_id; a reply is over
+// at its FRAME_REPLY frame. Returns 0 if the connection failed.
+static inline int ns_recv_frame(int sock, FrameHeader* h, char* payload, size_t cap) {
+    if (!frame_recv_header(sock, h)) return 0;
+    size_t keep = h->length < cap - 1 ? h->length : cap - 1;
+    if (!frame_recv_all(sock, payload, keep)) return 0;
+    payload[keep] = '\0';
+    for (size_t left = h->length - keep; left > 0;) {
+        char discard[4096];
+        size_t n = left < sizeof(discard) ? left : sizeof(discard);
+        if (!frame_recv_all(sock, discard, n)) return 0;
+        left -= n;
+    }
+    return 1;
+}
+
+static inline int cmp_double(const void* a, const void* b) {
+    double x = *(const double*)a, y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts 'samples' in place and returns the p-th percentile (0..100).
+static inline double percentile(double* samples, int n, double p) {
+    if (n == 0) return 0;
+    qsort(samples, n, sizeof(double), cmp_double);
+    int idx = (int)(p / 100.0 * (n - 1) + 0.5);
+    return samples[idx];
+}
+
+// Prints "VmRSS" and "Threads" of a process from /proc, if a pid was given.
+static inline void print_proc_stats(int pid) {
+    if (pid <= 0) return;
+    char path[64], line[256];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE* f = fopen(path, "r");
+    if (!f) return;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "VmRSS", 5) == 0 || strncmp(line, "Threads", 7) == 0) {
+            printf("  ns %s", line);
+        }
+    }
+    fclose(f);
+}
+
+#endif // BENCH_COMMON_H
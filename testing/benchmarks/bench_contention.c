@@ -0,0 +1,193 @@
+/*
+ * bench_contention.c
+ *
+ * Measures Name Server throughput under a mixed metadata workload as the
+ * number of client threads grows: 45% READ, 45% INFO and 10% CREATE over a
+ * set of preloaded files. READ and INFO only need shared locks, so they
+ * should keep scaling while CREATE takes the namespace lock exclusively.
+ *
+ * The benchmark starts its own stand-in Storage Server that registers with
+ * the Name Server and acknowledges SS_CREATE, so no real SS is needed. Start
+ * the Name Server in an empty directory (no saved metadata) before running.
+ *
+ * Usage: bench_contention [files] [ops_per_thread] [ss_port] [ns_pid]
+ */
+
+#include <pthread.h>
+#include "bench_common.h"
+
+#define BENCH_OWNER "bench_owner"
+
+static const int thread_counts[] = { 1, 4, 16, 64 };
+
+int preload_files = 200;
+int ops_per_thread = 2000;
+int fake_ss_port = 9100;
+int run_id = 0; // Keeps CREATE names unique across rounds
+
+// --- Stand-in Storage Server ---
+
+// Answers each command line on a connection until the Name Server closes
+// it, as the real SS does for its pooled connections.
+void* fake_ss_conn(void* arg) {
+    int sock = (int)(long)arg;
+    char buf[1024];
+    size_t buffered = 0;
+    int n;
+    while ((n = recv(sock, buf + buffered, sizeof(buf) - 1 - buffered, 0)) > 0) {
+        buffered += n;
+        char* nl;
+        while ((nl = memchr(buf, '\n', buffered))) {
+            const char* reply = strncmp(buf, "SS_CREATE", 9) == 0 ? "ACK_CREATE\n__SS_END__\n" : "ERROR\n__SS_END__\n";
+            send(sock, reply, strlen(reply), 0);
+            buffered -= nl + 1 - buf;
+            memmove(buf, nl + 1, buffered);
+        }
+        if (buffered == sizeof(buf) - 1) break;
+    }
+    close(sock);
+    return NULL;
+}
+
+void* fake_ss_main(void* arg) {
+    int listen_sock = (int)(long)arg;
+    while (1) {
+        int sock = accept(listen_sock, NULL, NULL);
+        if (sock < 0) continue;
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, fake_ss_conn, (void*)(long)sock) != 0) {
+            close(sock);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+    return NULL;
+}
+
+int start_fake_ss() {
+    int listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(fake_ss_port);
+    addr.sin_addr.s_addr = inet_addr(BENCH_NS_IP);
+    if (bind(listen_sock, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listen_sock, SOMAXCONN) < 0) {
+        perror("fake SS bind/listen failed");
+        return -1;
+    }
+    pthread_t tid;
+    pthread_create(&tid, NULL, fake_ss_main, (void*)(long)listen_sock);
+    pthread_detach(tid);
+
+    char line[128], reply[256];
+    int sock = connect_to(BENCH_NS_IP, BENCH_NS_PORT);
+    if (sock < 0) return -1;
+    snprintf(line, sizeof(line), "REGISTER_SS;%s;%d;\n", BENCH_NS_IP, fake_ss_port);
+    int ok = ns_request(sock, line, reply, sizeof(reply)) >= 0 && strstr(reply, "ACK_SS_REG");
+    close(sock);
+    return ok ? 0 : -1;
+}
+
+// --- Client threads ---
+
+typedef struct {
+    int id;
+    double* latencies;
+    int done;
+    int errors;
+} ClientArgs;
+
+void* client_main(void* arg) {
+    ClientArgs* a = (ClientArgs*)arg;
+    char cmd[128], reply[BENCH_REPLY_LEN];
+    int sock = ns_session(BENCH_OWNER);
+    if (sock < 0) return NULL;
+
+    unsigned int seed = a->id * 7919 + run_id;
+    for (int i = 0; i < ops_per_thread; i++) {
+        int roll = rand_r(&seed) % 100;
+        int f = rand_r(&seed) % preload_files;
+        if (roll < 45) {
+            snprintf(cmd, sizeof(cmd), "READ;bench_%d.txt\n", f);
+        } else if (roll < 90) {
+            snprintf(cmd, sizeof(cmd), "INFO;bench_%d.txt\n", f);
+        } else {
+            snprintf(cmd, sizeof(cmd), "CREATE;bench_r%d_t%d_%d.txt\n", run_id, a->id, i);
+        }
+        double t0 = now_sec();
+        if (ns_request(sock, cmd, reply, sizeof(reply)) < 0) break;
+        a->latencies[a->done++] = now_sec() - t0;
+        if (strncmp(reply, "ERROR", 5) == 0) a->errors++;
+    }
+    close(sock);
+    return NULL;
+}
+
+void run_round(int threads) {
+    pthread_t* tids = (pthread_t*)malloc(sizeof(pthread_t) * threads);
+    ClientArgs* args = (ClientArgs*)calloc(threads, sizeof(ClientArgs));
+    run_id++;
+
+    double t0 = now_sec();
+    for (int i = 0; i < threads; i++) {
+        args[i].id = i;
+        args[i].latencies = (double*)malloc(sizeof(double) * ops_per_thread);
+        pthread_create(&tids[i], NULL, client_main, &args[i]);
+    }
+    int total = 0, errors = 0;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(tids[i], NULL);
+        total += args[i].done;
+        errors += args[i].errors;
+    }
+    double elapsed = now_sec() - t0;
+
+    double* all = (double*)malloc(sizeof(double) * (total ? total : 1));
+    int k = 0;
+    for (int i = 0; i < threads; i++) {
+        memcpy(all + k, args[i].latencies, sizeof(double) * args[i].done);
+        k += args[i].done;
+        free(args[i].latencies);
+    }
+    printf("%7d | %8d | %9.0f | %8.1f | %8.1f | %d\n", threads, total, total / elapsed,
+           percentile(all, total, 50) * 1e6, percentile(all, total, 99) * 1e6, errors);
+    free(all);
+    free(args);
+    free(tids);
+}
+
+int main(int argc, char** argv) {
+    preload_files = argc > 1 ? atoi(argv[1]) : 200;
+    ops_per_thread = argc > 2 ? atoi(argv[2]) : 2000;
+    fake_ss_port = argc > 3 ? atoi(argv[3]) : 9100;
+    int ns_pid = argc > 4 ? atoi(argv[4]) : 0;
+
+    raise_fd_limit();
+    if (start_fake_ss() < 0) {
+        printf("Could not register the stand-in Storage Server.\n");
+        return 1;
+    }
+
+    // --- 1. Preload files owned by the benchmark user ---
+    char cmd[128], reply[BENCH_REPLY_LEN];
+    int sock = ns_session(BENCH_OWNER);
+    if (sock < 0) {
+        printf("Could not open a session with the Name Server.\n");
+        return 1;
+    }
+    for (int i = 0; i < preload_files; i++) {
+        snprintf(cmd, sizeof(cmd), "CREATE;bench_%d.txt\n", i);
+        ns_request(sock, cmd, reply, sizeof(reply));
+    }
+    close(sock);
+    printf("Preloaded %d files. Mix: 45%% READ, 45%% INFO, 10%% CREATE.\n", preload_files);
+
+    // --- 2. Mixed workload at increasing thread counts ---
+    printf("threads |      ops |     ops/s |  p50 us  |  p99 us  | errors\n");
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        run_round(thread_counts[i]);
+    }
+    print_proc_stats(ns_pid);
+    return 0;
+}
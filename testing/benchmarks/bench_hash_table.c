@@ -0,0 +1,97 @@
+/*
+ * bench_hash_table.c
+ *
+ * Single-threaded microbenchmark of the Name Server's file index: the
+ * open-addressing table in src/name_server/hash_table.h against the
+ * previous chained table (chained_hash_table.h).
+ *
+ * Keys look like Name Server paths ("dir_12/file_3456.txt"). For each table
+ * it measures inserting every key, looking up every key in random order
+ * (hits), and looking up the same number of absent keys (misses).
+ *
+ * Usage: bench_hash_table [keys] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench_common.h"
+#include "../../src/name_server/hash_table.h"
+#include "chained_hash_table.h"
+
+#define BENCH_KEY_LEN 48
+
+int num_keys = 1000000;
+char (*keys)[BENCH_KEY_LEN];
+char (*missing)[BENCH_KEY_LEN];
+int* order;
+volatile unsigned long sink; // Keeps lookups from being optimized out
+
+void make_keys() {
+    keys = malloc((size_t)num_keys * BENCH_KEY_LEN);
+    missing = malloc((size_t)num_keys * BENCH_KEY_LEN);
+    order = malloc(sizeof(int) * num_keys);
+    for (int i = 0; i < num_keys; i++) {
+        snprintf(keys[i], BENCH_KEY_LEN, "dir_%d/file_%d.txt", i % 997, i);
+        snprintf(missing[i], BENCH_KEY_LEN, "dir_%d/absent_%d.txt", i % 997, i);
+        order[i] = i;
+    }
+    // Shuffle the lookup order so hits are not in insertion order.
+    unsigned int seed = 12345;
+    for (int i = num_keys - 1; i > 0; i--) {
+        int j = rand_r(&seed) % (i + 1);
+        int t = order[i]; order[i] = order[j]; order[j] = t;
+    }
+}
+
+void report(const char* name, const char* op, double seconds) {
+    printf("%-8s | %-6s | %8.1f ns/op | %7.2f Mops/s\n", name, op,
+           seconds * 1e9 / num_keys, num_keys / seconds / 1e6);
+}
+
+void bench_open_addressing() {
+    HashTable* table = ht_create();
+    double t0 = now_sec();
+    for (int i = 0; i < num_keys; i++) ht_insert(table, keys[i], keys[i]);
+    report("swiss", "insert", now_sec() - t0);
+
+    t0 = now_sec();
+    for (int i = 0; i < num_keys; i++) sink += (unsigned long)ht_search(table, keys[order[i]]);
+    report("swiss", "hit", now_sec() - t0);
+
+    t0 = now_sec();
+    for (int i = 0; i < num_keys; i++) sink += (unsigned long)ht_search(table, missing[order[i]]);
+    report("swiss", "miss", now_sec() - t0);
+
+    for (int i = 0; i < num_keys; i++) ht_delete(table, keys[i]);
+}
+
+void bench_chained() {
+    ChainedTable* table = ch_create();
+    double t0 = now_sec();
+    for (int i = 0; i < num_keys; i++) ch_insert(table, keys[i], keys[i]);
+    report("chained", "insert", now_sec() - t0);
+
+    t0 = now_sec();
+    for (int i = 0; i < num_keys; i++) sink += (unsigned long)ch_search(table, keys[order[i]]);
+    report("chained", "hit", now_sec() - t0);
+
+    t0 = now_sec();
+    for (int i = 0; i < num_keys; i++) sink += (unsigned long)ch_search(table, missing[order[i]]);
+    report("chained", "miss", now_sec() - t0);
+
+    for (int i = 0; i < num_keys; i++) ch_delete(table, keys[i]);
+}
+
+int main(int argc, char** argv) {
+    num_keys = argc > 1 ? atoi(argv[1]) : 1000000;
+    int rounds = argc > 2 ? atoi(argv[2]) : 3;
+    make_keys();
+
+    printf("%d keys, %d rounds\n", num_keys, rounds);
+    printf("table    | op     |     latency     |  throughput\n");
+    for (int r = 0; r < rounds; r++) {
+        bench_chained();
+        bench_open_addressing();
+    }
+    return 0;
+}
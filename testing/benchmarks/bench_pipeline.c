@@ -0,0 +1,85 @@
+/*
+ * bench_pipeline.c
+ *
+ * Requests per second over a single Name Server session, sending a mix of
+ * INFO, READ and VIEW. First on a text session, one request at a time
+ * (each pays a full round trip), then on a framed session with 1, 4, 16
+ * and 64 requests in flight, matching replies to requests by request ID.
+ * It also counts how many replies overtook an earlier request, and checks
+ * that every request got exactly one reply.
+ *
+ * The requests name files that do not exist, so no Storage Server is
+ * needed and the numbers are the Name Server's protocol and dispatch cost.
+ *
+ * Usage: bench_pipeline [requests] [ns_pid]
+ */
+
+#include "bench_common.h"
+
+const char* commands[] = { "INFO;bench_missing.txt", "READ;bench_missing.txt", "VIEW;-" };
+
+// One text session, request after request.
+void run_text(int requests) {
+    char line[64], reply[BENCH_REPLY_LEN];
+    int sock = ns_session("bench_pipeline_text");
+    if (sock < 0) {
+        printf("text:      could not register\n");
+        return;
+    }
+    double t0 = now_sec();
+    int done = 0;
+    for (; done < requests; done++) {
+        snprintf(line, sizeof(line), "%s\n", commands[done % 3]);
+        if (ns_request(sock, line, reply, sizeof(reply)) < 0) break;
+    }
+    double elapsed = now_sec() - t0;
+    printf("text:      %6d requests in %.2fs (%8.0f req/s)\n", done, elapsed, done / elapsed);
+    close(sock);
+}
+
+// One framed session keeping up to 'depth' requests in flight.
+void run_framed(int requests, int depth) {
+    char payload[BENCH_REPLY_LEN];
+    int sock = ns_framed_session("bench_pipeline_framed");
+    if (sock < 0) {
+        printf("framed:    could not register\n");
+        return;
+    }
+    unsigned char* answered = (unsigned char*)calloc(requests, 1);
+    int sent = 0, done = 0, oldest = 0, overtaken = 0, duplicates = 0;
+    double t0 = now_sec();
+    while (done < requests) {
+        while (sent < requests && sent - done < depth) {
+            if (!frame_send_command(sock, (uint32_t)sent, commands[sent % 3])) goto out;
+            sent++;
+        }
+        FrameHeader h;
+        if (!ns_recv_frame(sock, &h, payload, sizeof(payload))) goto out;
+        if (h.opcode != FRAME_REPLY) continue;
+        if (h.request_id >= (uint32_t)requests || answered[h.request_id]) {
+            duplicates++;
+            continue;
+        }
+        answered[h.request_id] = 1;
+        if ((int)h.request_id != oldest) overtaken++;
+        while (oldest < requests && answered[oldest]) oldest++;
+        done++;
+    }
+out:;
+    double elapsed = now_sec() - t0;
+    printf("framed x%-2d %6d requests in %.2fs (%8.0f req/s), %d out of order, %d unexpected\n",
+           depth, done, elapsed, done / elapsed, overtaken, duplicates);
+    free(answered);
+    close(sock);
+}
+
+int main(int argc, char** argv) {
+    int requests = argc > 1 ? atoi(argv[1]) : 20000;
+    int ns_pid = argc > 2 ? atoi(argv[2]) : 0;
+
+    run_text(requests);
+    int depths[] = { 1, 4, 16, 64 };
+    for (int i = 0; i < 4; i++) run_framed(requests, depths[i]);
+    print_proc_stats(ns_pid);
+    return 0;
+}
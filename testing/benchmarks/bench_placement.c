@@ -0,0 +1,160 @@
+/*
+ * bench_placement.c
+ *
+ * Simulates where the Name Server's placement policies (placement.h) put
+ * new files across 'servers' Storage Servers, and how even the result is.
+ *
+ * The servers differ: disks cycle through 100, 200 and 400 GB, and every
+ * fourth server takes twice as long per request. 'files' files are created
+ * in folders of 'per_folder'; each has a size (skewed toward small, sized
+ * so the files fill 60% of all disks in the end) and a request rate (the
+ * same shape, mean 0.5 per second). Every 'heartbeat' creates each server
+ * reports its free disk, request rate, requests in flight and latency
+ * through the same code the Name Server runs on a real SS_HEARTBEAT, so
+ * the policies see load that is up to one heartbeat old, as they would
+ * live.
+ *
+ * Each policy runs with and without co-locating a folder's files. Reported
+ * are the most files, request load and in-flight requests on one server
+ * over the mean (1.00 is perfectly even), the least and most full disks,
+ * the share of folders kept on one server, and the time per choice.
+ *
+ * Usage: bench_placement [servers] [files] [per_folder] [heartbeat]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "bench_common.h"
+#include "../../src/name_server/placement.h"
+
+#define GB_KB (1024.0 * 1024.0)
+
+int num_servers = 8;
+int num_files = 200000;
+int per_folder = 20;
+int heartbeat_every = 500;
+
+typedef struct SimServer {
+    double disk_kb;    // Capacity
+    double used_kb;
+    double rate;       // Requests per second to its files
+    double service_ms; // Time per request
+    int files;
+} SimServer;
+
+StorageServer* servers;
+SimServer* sim;
+
+// Between 0 and 3 times 'mean', mostly small: 3 * mean * u^2 for a
+// uniform u, which has mean 'mean'.
+double draw_skewed(unsigned int* seed, double mean) {
+    double u = rand_r(seed) / (double)RAND_MAX;
+    return 3 * mean * u * u;
+}
+
+void setup_servers() {
+    for (int i = 0; i < num_servers; i++) {
+        memset(&servers[i], 0, sizeof(StorageServer));
+        snprintf(servers[i].ip_addr, sizeof(servers[i].ip_addr), "10.0.0.%d", i + 1);
+        servers[i].port = 9001;
+        ss_pool_init(&servers[i].pool);
+        servers[i].next = i + 1 < num_servers ? &servers[i + 1] : NULL;
+        memset(&sim[i], 0, sizeof(SimServer));
+        sim[i].disk_kb = 100 * GB_KB * (1 << (i % 3));
+        sim[i].service_ms = i % 4 == 3 ? 4.0 : 2.0;
+    }
+}
+
+// Reports every server's state as an SS_HEARTBEAT would.
+void send_heartbeats() {
+    for (int i = 0; i < num_servers; i++) {
+        double free_kb = sim[i].disk_kb > sim[i].used_kb ? sim[i].disk_kb - sim[i].used_kb : 0;
+        char fields[8][32];
+        char* args[8];
+        snprintf(fields[0], 32, "%lu", (unsigned long)free_kb);
+        snprintf(fields[1], 32, "%lu", (unsigned long)sim[i].disk_kb);
+        snprintf(fields[2], 32, "1");
+        snprintf(fields[3], 32, "%u", (unsigned int)(sim[i].rate * sim[i].service_ms / 1000.0));
+        snprintf(fields[4], 32, "%lu", (unsigned long)(sim[i].rate * 2)); // Over a 2 s interval
+        snprintf(fields[5], 32, "2000");
+        snprintf(fields[6], 32, "%u", (unsigned int)(sim[i].service_ms * 1000));
+        snprintf(fields[7], 32, "%u", (unsigned int)(sim[i].service_ms * 4000));
+        for (int k = 0; k < 8; k++) args[k] = fields[k];
+        ss_heartbeat_apply(&servers[i], args);
+    }
+}
+
+void run(PlacementPolicy* policy, int colocate) {
+    placement_policy = policy;
+    placement_colocate = colocate;
+    setup_servers();
+
+    double total_disk = 0;
+    for (int i = 0; i < num_servers; i++) total_disk += sim[i].disk_kb;
+    double mean_size = total_disk * 0.6 / num_files;
+    unsigned int seed = 42; // Same files for every run
+    int folders = (num_files + per_folder - 1) / per_folder, whole = 0;
+    double spent = 0;
+
+    StorageServer* folder_ss = NULL;
+    int folder_whole = 1;
+    send_heartbeats();
+    for (int f = 0; f < num_files; f++) {
+        if (f % per_folder == 0) {
+            if (f) whole += folder_whole;
+            folder_ss = placement_choose(servers, NULL); // CREATEFOLDER
+            folder_whole = 1;
+        }
+        double t0 = now_sec();
+        StorageServer* ss = placement_choose(servers, folder_ss);
+        spent += now_sec() - t0;
+        int i = (int)(ss - servers);
+        folder_whole &= ss == folder_ss;
+        sim[i].files++;
+        sim[i].used_kb += draw_skewed(&seed, mean_size);
+        sim[i].rate += draw_skewed(&seed, 0.5);
+        if ((f + 1) % heartbeat_every == 0) send_heartbeats();
+    }
+    whole += folder_whole;
+
+    double max_files = 0, max_rate = 0, max_busy = 0, sum_rate = 0, sum_busy = 0;
+    double min_full = 1e9, max_full = 0;
+    for (int i = 0; i < num_servers; i++) {
+        double busy = sim[i].rate * sim[i].service_ms / 1000.0; // Requests in flight
+        if (sim[i].files > max_files) max_files = sim[i].files;
+        if (sim[i].rate > max_rate) max_rate = sim[i].rate;
+        if (busy > max_busy) max_busy = busy;
+        sum_rate += sim[i].rate;
+        sum_busy += busy;
+        double full = sim[i].used_kb / sim[i].disk_kb;
+        if (full < min_full) min_full = full;
+        if (full > max_full) max_full = full;
+    }
+    printf("%-7s %-8s | %6.2f | %6.2f | %6.2f | %4.0f%% - %4.0f%% | %6.1f%% | %6.1f\n",
+           policy->name, colocate ? "yes" : "no",
+           max_files / ((double)num_files / num_servers), max_rate / (sum_rate / num_servers),
+           max_busy / (sum_busy / num_servers), min_full * 100, max_full * 100,
+           100.0 * whole / folders, spent * 1e9 / num_files);
+}
+
+int main(int argc, char** argv) {
+    num_servers = argc > 1 ? atoi(argv[1]) : 8;
+    num_files = argc > 2 ? atoi(argv[2]) : 200000;
+    per_folder = argc > 3 ? atoi(argv[3]) : 20;
+    heartbeat_every = argc > 4 ? atoi(argv[4]) : 500;
+    if (num_servers < 1 || num_files < 1 || per_folder < 1 || heartbeat_every < 1) {
+        printf("Usage: bench_placement [servers] [files] [per_folder] [heartbeat]\n");
+        return 1;
+    }
+    servers = calloc(num_servers, sizeof(StorageServer));
+    sim = calloc(num_servers, sizeof(SimServer));
+
+    printf("%d servers, %d files in folders of %d, a heartbeat every %d creates\n",
+           num_servers, num_files, per_folder, heartbeat_every);
+    printf("policy  colocate |  files |   load | flight |  disks full   | folders | ns/pick\n");
+    for (int p = 0; p < PLACEMENT_POLICY_COUNT; p++) {
+        run(&placement_policies[p], 0);
+        run(&placement_policies[p], 1);
+    }
+    return 0;
+}
@@ -0,0 +1,104 @@
+/*
+ * bench_sessions.c
+ *
+ * Measures how many idle REGISTER_CLIENT sessions one Name Server can hold,
+ * and the request latency seen by a few active sessions while they are held.
+ *
+ * Usage: bench_sessions [idle_sessions] [active_sessions] [requests_each] [ns_pid]
+ *
+ * Run it once against bin/name_server (epoll reactor) and once against
+ * bin/name_server_threaded (thread per connection, see `make bench`).
+ */
+
+#include <pthread.h>
+#include "bench_common.h"
+
+typedef struct {
+    int id;
+    int requests;
+    double* latencies;
+    int done;
+} ActiveArgs;
+
+void* active_session(void* arg) {
+    ActiveArgs* a = (ActiveArgs*)arg;
+    char user[64], reply[BENCH_REPLY_LEN];
+    snprintf(user, sizeof(user), "bench_active_%d", a->id);
+    int sock = ns_session(user);
+    if (sock < 0) return NULL;
+
+    for (int i = 0; i < a->requests; i++) {
+        const char* cmd = (i % 2) ? "VIEW;-\n" : "INFO;bench_missing.txt\n";
+        double t0 = now_sec();
+        if (ns_request(sock, cmd, reply, sizeof(reply)) < 0) break;
+        a->latencies[a->done++] = now_sec() - t0;
+    }
+    close(sock);
+    return NULL;
+}
+
+int main(int argc, char** argv) {
+    int idle = argc > 1 ? atoi(argv[1]) : 10000;
+    int active = argc > 2 ? atoi(argv[2]) : 8;
+    int requests = argc > 3 ? atoi(argv[3]) : 2000;
+    int ns_pid = argc > 4 ? atoi(argv[4]) : 0;
+
+    raise_fd_limit();
+
+    // --- 1. Open and hold idle sessions ---
+    int* idle_socks = (int*)malloc(sizeof(int) * idle);
+    int held = 0;
+    double t0 = now_sec();
+    for (int i = 0; i < idle; i++) {
+        char user[64];
+        snprintf(user, sizeof(user), "bench_idle_%d", i);
+        int sock = ns_session(user);
+        if (sock < 0) {
+            printf("Registration failed after %d sessions.\n", held);
+            break;
+        }
+        idle_socks[held++] = sock;
+    }
+    printf("Idle sessions held: %d / %d (%.2fs to register)\n", held, idle, now_sec() - t0);
+    print_proc_stats(ns_pid);
+
+    // --- 2. Latency of active sessions while the idle ones are held ---
+    pthread_t* threads = (pthread_t*)malloc(sizeof(pthread_t) * active);
+    ActiveArgs* args = (ActiveArgs*)calloc(active, sizeof(ActiveArgs));
+    t0 = now_sec();
+    for (int i = 0; i < active; i++) {
+        args[i].id = i;
+        args[i].requests = requests;
+        args[i].latencies = (double*)malloc(sizeof(double) * requests);
+        pthread_create(&threads[i], NULL, active_session, &args[i]);
+    }
+
+    int total = 0;
+    for (int i = 0; i < active; i++) {
+        pthread_join(threads[i], NULL);
+        total += args[i].done;
+    }
+    double elapsed = now_sec() - t0;
+
+    double* all = (double*)malloc(sizeof(double) * (total ? total : 1));
+    int k = 0;
+    for (int i = 0; i < active; i++) {
+        memcpy(all + k, args[i].latencies, sizeof(double) * args[i].done);
+        k += args[i].done;
+    }
+    printf("Active: %d sessions, %d requests in %.2fs (%.0f req/s)\n", active, total, elapsed, total / elapsed);
+    printf("Latency: p50 %.1f us, p99 %.1f us, max %.1f us\n",
+           percentile(all, total, 50) * 1e6, percentile(all, total, 99) * 1e6,
+           percentile(all, total, 100) * 1e6);
+
+    // --- 3. Check the idle sessions survived ---
+    int alive = 0;
+    char reply[BENCH_REPLY_LEN];
+    for (int i = 0; i < held; i++) {
+        if (i % 100 == 0 && ns_request(idle_socks[i], "INFO;bench_missing.txt\n", reply, sizeof(reply)) < 0) continue;
+        if (i % 100 == 0) alive++;
+        close(idle_socks[i]);
+    }
+    printf("Idle sessions still answering (sampled 1 in 100): %d / %d\n", alive, (held + 99) / 100);
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * bench_startup.c
+ *
+ * Measures how long the Name Server takes to come up with a large saved
+ * namespace, first from the text .dat files and then from metadata.img
+ * after running the converter (name_server --convert-metadata).
+ *
+ * It writes a synthetic namespace into a scratch directory, starts the
+ * given Name Server binary there, and times until port 8080 accepts a
+ * session. It then times the first INFO on a file (which materializes it
+ * from the image) and a repeat of the same INFO. Port 8080 must be free.
+ *
+ * Usage: bench_startup [name_server_binary] [files]
+ */
+
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "bench_common.h"
+
+#define BENCH_USERS 1000
+
+const char* ns_binary = "bin/name_server";
+char ns_path[4096];
+int num_files = 1000000;
+
+void write_namespace() {
+    FILE* users = fopen("user_data.dat", "w");
+    for (int i = 0; i < BENCH_USERS; i++) fprintf(users, "user_%d\n", i);
+    fclose(users);
+
+    FILE* meta = fopen("file_metadata.dat", "w");
+    FILE* notes = fopen("annotations.dat", "w");
+    for (int i = 0; i < num_files; i++) {
+        fprintf(meta, "dir_%d/file_%d.txt;user_%d;127.0.0.1;9001;user_%d,R;user_%d,W\n",
+                i % 1000, i, i % BENCH_USERS, (i + 1) % BENCH_USERS, (i + 2) % BENCH_USERS);
+        if (i % 10 == 0) fprintf(notes, "dir_%d/file_%d.txt;note %d\n", i % 1000, i, i);
+    }
+    fclose(meta);
+    fclose(notes);
+}
+
+pid_t spawn_ns(const char* arg) {
+    fflush(stdout); // Or the child repeats our buffered output
+    pid_t pid = fork();
+    if (pid == 0) {
+        freopen("/dev/null", "w", stdout);
+        execl(ns_path, ns_path, arg, (char*)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+// Starts the NS and returns seconds until a session registers, or -1.
+double time_startup(pid_t* pid) {
+    double t0 = now_sec();
+    *pid = spawn_ns(NULL);
+    while (now_sec() - t0 < 120) {
+        int sock = ns_session("bench_startup");
+        if (sock >= 0) {
+            close(sock);
+            return now_sec() - t0;
+        }
+        usleep(1000);
+    }
+    return -1;
+}
+
+// Times one INFO on a file the NS has not looked at yet, then a repeat.
+void time_first_touch(double* first, double* repeat) {
+    char cmd[128], reply[BENCH_REPLY_LEN];
+    int sock = ns_session("user_0");
+    snprintf(cmd, sizeof(cmd), "INFO;dir_%d/file_%d.txt\n", (num_files / 2) % 1000, num_files / 2);
+    double t0 = now_sec();
+    ns_request(sock, cmd, reply, sizeof(reply));
+    *first = now_sec() - t0;
+    t0 = now_sec();
+    ns_request(sock, cmd, reply, sizeof(reply));
+    *repeat = now_sec() - t0;
+    if (!strstr(reply, "Owner")) printf("  (unexpected INFO reply: %.60s)\n", reply);
+    close(sock);
+}
+
+void stop_ns(pid_t pid) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+void run(const char* label) {
+    pid_t pid;
+    double startup = time_startup(&pid);
+    if (startup < 0) {
+        printf("%-6s | Name Server did not come up\n", label);
+        stop_ns(pid);
+        return;
+    }
+    double first, repeat;
+    time_first_touch(&first, &repeat);
+    printf("%-6s | %10.1f | %12.1f | %11.1f |\n", label, startup * 1e3, first * 1e6, repeat * 1e6);
+    print_proc_stats(pid);
+    stop_ns(pid);
+}
+
+int main(int argc, char** argv) {
+    ns_binary = argc > 1 ? argv[1] : "bin/name_server";
+    num_files = argc > 2 ? atoi(argv[2]) : 1000000;
+    if (!realpath(ns_binary, ns_path)) {
+        printf("Name Server binary '%s' not found.\n", ns_binary);
+        return 1;
+    }
+
+    char dir[64];
+    snprintf(dir, sizeof(dir), "/tmp/bench_startup_%d", getpid());
+    mkdir(dir, 0755);
+    if (chdir(dir) < 0) return 1;
+
+    double t0 = now_sec();
+    write_namespace();
+    printf("Wrote %d files, %d users in %s (%.1f s).\n", num_files, BENCH_USERS, dir, now_sec() - t0);
+    printf("format | startup ms | first INFO us | repeat us |\n");
+    run("text");
+
+    t0 = now_sec();
+    pid_t pid = spawn_ns("--convert-metadata");
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("Conversion failed.\n");
+        return 1;
+    }
+    double convert = now_sec() - t0;
+    run("image");
+    printf("Conversion took %.1f s.\n", convert);
+
+    const char* files[] = { "user_data.dat", "file_metadata.dat", "annotations.dat", "metadata.img", "metadata.wal" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) unlink(files[i]);
+    chdir("/");
+    rmdir(dir);
+    return 0;
+}
@@ -0,0 +1,225 @@
+/*
+ * bench_view.c
+ *
+ * Times permission-filtered VIEW (no -a), which lists the caller's files,
+ * and reports the Name Server's memory once every file has been loaded.
+ *
+ * It writes a synthetic text namespace into a scratch directory: 'files'
+ * files owned round-robin by 'users' users, each shared with 'acl' other
+ * users, converted to metadata.img. It starts the given Name Server binary
+ * there (port 8080 must be free), loads everything with one VIEW -a, then
+ * times VIEW as a user who can read about 1 in 'users' / 'acl' of the
+ * files: the first page, and every page by following the "-- More:"
+ * cursors. It also times a full VIEW -a the same way. Last it makes dir_7 a folder and times VIEWFOLDER on it, which
+ * lists 1 in 1000 of the files, and then MOVE of that folder back and
+ * forth. A stub Storage Server on port 9001 (which must be free too)
+ * acknowledges the renames, so MOVE is timed as the Name Server's
+ * metadata work plus one loopback round trip.
+ *
+ * Usage: bench_view [name_server_binary] [files] [users] [acl] [repeats]
+ */
+
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "bench_common.h"
+
+const char* ns_binary = "bin/name_server";
+char ns_path[4096];
+int num_files = 200000;
+int num_users = 1000;
+int acl_size = 8;
+int repeats = 20;
+
+void write_namespace() {
+    FILE* users = fopen("user_data.dat", "w");
+    for (int i = 0; i < num_users; i++) fprintf(users, "user_%d\n", i);
+    fclose(users);
+
+    FILE* meta = fopen("file_metadata.dat", "w");
+    for (int i = 0; i < num_files; i++) {
+        fprintf(meta, "dir_%d/file_%d.txt;user_%d;127.0.0.1;9001", i % 1000, i, i % num_users);
+        for (int k = 1; k <= acl_size; k++) {
+            fprintf(meta, ";user_%d,%c", (i + k * 7) % num_users, k % 2 ? 'R' : 'W');
+        }
+        fprintf(meta, "\n");
+    }
+    fclose(meta);
+}
+
+// Answers every connection the way a Storage Server with none of the
+// files would answer SS_RENAME.
+void* stub_ss_main(void* arg) {
+    int listener = *(int*)arg;
+    char buf[1024];
+    int conn;
+    while ((conn = accept(listener, NULL, NULL)) >= 0) {
+        if (recv(conn, buf, sizeof(buf), 0) > 0) {
+            const char* reply = "ACK_RENAME_NONE\n__SS_END__\n";
+            send(conn, reply, strlen(reply), 0);
+        }
+        close(conn);
+    }
+    return NULL;
+}
+
+int start_stub_ss() {
+    static int listener;
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(9001);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    pthread_t tid;
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(listener, 64) < 0 ||
+        pthread_create(&tid, NULL, stub_ss_main, &listener) != 0) return -1;
+    pthread_detach(tid);
+    return 0;
+}
+
+// Sends 'line' and then the command from each page's "-- More: ... --"
+// line until the listing is complete. Returns the number of pages.
+int ns_request_all_pages(int sock, const char* line, char* reply, int cap) {
+    char next[512];
+    snprintf(next, sizeof(next), "%s", line);
+    int pages = 0;
+    while (next[0]) {
+        if (ns_request(sock, next, reply, cap) < 0) return -1;
+        pages++;
+        next[0] = '\0';
+        char* more = strstr(reply, "-- More: ");
+        char* end = more ? strstr(more, " --\n") : NULL;
+        if (!end) break;
+        *end = '\0';
+        more += 9;
+        int out = 0;
+        if (strncmp(more, "LIST ", 5) == 0) {
+            out = snprintf(next, sizeof(next), "LIST_USERS");
+            more += 4;
+        }
+        for (; *more && out < (int)sizeof(next) - 2; more++) next[out++] = *more == ' ' ? ';' : *more;
+        next[out++] = '\n';
+        next[out] = '\0';
+    }
+    return pages;
+}
+
+pid_t spawn_ns(const char* arg) {
+    fflush(stdout); // Or the child repeats our buffered output
+    pid_t pid = fork();
+    if (pid == 0) {
+        freopen("/dev/null", "w", stdout);
+        execl(ns_path, ns_path, arg, (char*)NULL);
+        _exit(127);
+    }
+    return pid;
+}
+
+int main(int argc, char** argv) {
+    ns_binary = argc > 1 ? argv[1] : "bin/name_server";
+    num_files = argc > 2 ? atoi(argv[2]) : 200000;
+    num_users = argc > 3 ? atoi(argv[3]) : 1000;
+    acl_size = argc > 4 ? atoi(argv[4]) : 8;
+    repeats = argc > 5 ? atoi(argv[5]) : 20;
+    if (!realpath(ns_binary, ns_path)) {
+        printf("Name Server binary '%s' not found.\n", ns_binary);
+        return 1;
+    }
+    if (num_users < 2 || acl_size >= num_users) {
+        printf("Need at least 2 users and fewer ACL entries than users.\n");
+        return 1;
+    }
+
+    char dir[64];
+    snprintf(dir, sizeof(dir), "/tmp/bench_view_%d", getpid());
+    mkdir(dir, 0755);
+    if (chdir(dir) < 0) return 1;
+    write_namespace();
+    printf("%d files, %d users, %d ACL entries per file\n", num_files, num_users, acl_size);
+
+    // Load from metadata.img, the format a running NS checkpoints to.
+    int status;
+    pid_t pid = spawn_ns("--convert-metadata");
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("Conversion failed.\n");
+        return 1;
+    }
+
+    pid = spawn_ns(NULL);
+    int sock = -1;
+    double t0 = now_sec();
+    while (sock < 0 && now_sec() - t0 < 120) {
+        sock = ns_session("user_1");
+        if (sock < 0) usleep(1000);
+    }
+    if (sock < 0) {
+        printf("Name Server did not come up.\n");
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return 1;
+    }
+
+    char* reply = (char*)malloc(BENCH_REPLY_LEN);
+    ns_request(sock, "VIEW;-a\n", reply, BENCH_REPLY_LEN); // Load every file
+
+    double* samples = (double*)malloc(repeats * sizeof(double));
+    for (int i = 0; i < repeats; i++) {
+        double start = now_sec();
+        ns_request(sock, "VIEW\n", reply, BENCH_REPLY_LEN);
+        samples[i] = (now_sec() - start) * 1e3;
+    }
+    printf("VIEW (filtered): p50 %.2f ms, p99 %.2f ms over %d runs\n",
+           percentile(samples, repeats, 50), percentile(samples, repeats, 99), repeats);
+
+    int pages = 0;
+    for (int i = 0; i < repeats; i++) {
+        double start = now_sec();
+        pages = ns_request_all_pages(sock, "VIEW\n", reply, BENCH_REPLY_LEN);
+        samples[i] = (now_sec() - start) * 1e3;
+    }
+    printf("  all pages:     p50 %.2f ms, p99 %.2f ms over %d runs (%d pages)\n",
+           percentile(samples, repeats, 50), percentile(samples, repeats, 99), repeats, pages);
+
+    double start_all = now_sec();
+    pages = ns_request_all_pages(sock, "VIEW;-a\n", reply, BENCH_REPLY_LEN);
+    printf("VIEW -a:         %.1f ms for all %d pages\n", (now_sec() - start_all) * 1e3, pages);
+
+    ns_request(sock, "CREATEFOLDER;dir_7\n", reply, BENCH_REPLY_LEN);
+    for (int i = 0; i < repeats; i++) {
+        double start = now_sec();
+        ns_request(sock, "VIEWFOLDER;dir_7\n", reply, BENCH_REPLY_LEN);
+        samples[i] = (now_sec() - start) * 1e3;
+    }
+    printf("VIEWFOLDER:      p50 %.2f ms, p99 %.2f ms over %d runs\n",
+           percentile(samples, repeats, 50), percentile(samples, repeats, 99), repeats);
+
+    // This session created the dir_7 folder, so it owns it and may move it.
+    if (start_stub_ss() == 0) {
+        for (int i = 0; i < repeats; i++) {
+            double start = now_sec();
+            ns_request(sock, i % 2 ? "MOVE;moved/dir_7;dir_7\n" : "MOVE;dir_7;moved/dir_7\n", reply, BENCH_REPLY_LEN);
+            samples[i] = (now_sec() - start) * 1e3;
+        }
+        printf("MOVE (folder):   p50 %.2f ms, p99 %.2f ms over %d runs (%d files inside)\n",
+               percentile(samples, repeats, 50), percentile(samples, repeats, 99), repeats, num_files / 1000);
+    } else {
+        printf("MOVE (folder):   skipped, port 9001 is busy\n");
+    }
+    print_proc_stats(pid);
+
+    close(sock);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    free(samples);
+    free(reply);
+
+    const char* files[] = { "user_data.dat", "file_metadata.dat", "annotations.dat", "metadata.img", "metadata.wal" };
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) unlink(files[i]);
+    if (chdir("/") == 0) rmdir(dir);
+    return 0;
+}
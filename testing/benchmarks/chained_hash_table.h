@@ -0,0 +1,297 @@
+#ifndef CHAINED_HASH_TABLE_H
+#define CHAINED_HASH_TABLE_H
+
+/*
+ * chained_hash_table.h
+ *
+ * The Name Server's previous hash table (separate chaining, djb2, inline
+ * 100-byte keys), renamed to ch_* so bench_hash_table can run it side by
+ * side with the open-addressing table in src/name_server/hash_table.h.
+ * Not used by the servers.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "../../src/name_server/epoch.h"
+
+#define CH_INITIAL_SIZE 1024 // Power of 2 is good practice
+#define CH_MIN_SIZE 1024     // Never shrink below this
+#define CH_MAX_LOAD 1        // Grow when count > size * CH_MAX_LOAD
+#define CH_MIN_LOAD_DIV 8    // Shrink when count < size / CH_MIN_LOAD_DIV
+#define CH_MIGRATE_STEP 8    // Old buckets moved per insert/delete while resizing
+
+// Hash Table item (a node in a collision chain)
+typedef struct CH_Item {
+    char key[100];
+    unsigned long hash; // Full hash of key; the bucket is hash & (size - 1)
+    void* value;
+    struct CH_Item* next;
+} CH_Item;
+
+// A bucket array. 'size' is always a power of 2.
+typedef struct CH_Array {
+    unsigned long size;
+    CH_Item* slots[];
+} CH_Array;
+
+// The arrays a reader should look in. A view is never modified once
+// published; a resize swaps in a new one, so readers always see a matching
+// pair.
+typedef struct CH_View {
+    CH_Array* cur; // Inserts go here
+    CH_Array* old; // Being copied into 'cur' during a resize, else NULL
+} CH_View;
+
+// The Hash Table itself
+// Chains are published with release stores, so ch_search() may run without
+// a lock alongside one writer. Writers must still be serialized by the
+// caller. In an 'rcu' table, deleted items are freed through epoch_retire(),
+// so lock-free readers must search inside epoch_enter()/epoch_exit().
+//
+// Resizing is incremental. When the load factor leaves its range, a new
+// array becomes 'cur' and every later insert/delete copies CH_MIGRATE_STEP
+// old buckets into it. Old chains stay intact until the copy finishes, so a
+// reader holding either view finds every item; the old array is then
+// retired in one piece.
+typedef struct ChainedTable {
+    CH_View* view;
+    unsigned long count;       // Live items (each counted once)
+    unsigned long migrate_pos; // Next old bucket to copy
+    int rcu;
+} ChainedTable;
+
+// --- Hash Function (a good, simple one called djb2) ---
+static unsigned long ch_hash_function(const char* str) {
+    unsigned long hash = 5381;
+    int c;
+    while ((c = *str++)) {
+        hash = ((hash << 5) + hash) + c; // hash * 33 + c
+    }
+    return hash;
+}
+
+static CH_Array* ch_array_create(unsigned long size) {
+    CH_Array* array = (CH_Array*)calloc(1, sizeof(CH_Array) + size * sizeof(CH_Item*));
+    if (array) array->size = size;
+    return array;
+}
+
+// Frees an array together with every item still chained in it
+static void ch_array_free(void* arg) {
+    CH_Array* array = (CH_Array*)arg;
+    for (unsigned long i = 0; i < array->size; i++) {
+        CH_Item* item = array->slots[i];
+        while (item) {
+            CH_Item* next = item->next;
+            free(item);
+            item = next;
+        }
+    }
+    free(array);
+}
+
+// Frees now, or once lock-free readers are done with it
+static void ch_release(ChainedTable* table, void* ptr, void (*free_fn)(void*)) {
+    if (table->rcu) epoch_retire(ptr, free_fn);
+    else free_fn(ptr);
+}
+
+static void ch_publish_view(ChainedTable* table, CH_Array* cur, CH_Array* old) {
+    CH_View* view = (CH_View*)malloc(sizeof(CH_View));
+    if (!view) return; // Keep the current view; the resize simply waits
+    view->cur = cur;
+    view->old = old;
+    CH_View* previous = table->view;
+    __atomic_store_n(&table->view, view, __ATOMIC_RELEASE);
+    ch_release(table, previous, free);
+}
+
+static void ch_chain_push(CH_Array* array, CH_Item* item) {
+    unsigned long index = item->hash & (array->size - 1);
+    item->next = array->slots[index];
+    __atomic_store_n(&array->slots[index], item, __ATOMIC_RELEASE);
+}
+
+// Finds 'key' in one array, or NULL
+static CH_Item* ch_chain_find(CH_Array* array, const char* key, unsigned long hash) {
+    CH_Item* current = __atomic_load_n(&array->slots[hash & (array->size - 1)], __ATOMIC_ACQUIRE);
+    while (current) {
+        if (current->hash == hash && strcmp(current->key, key) == 0) {
+            return current;
+        }
+        current = __atomic_load_n(&current->next, __ATOMIC_ACQUIRE);
+    }
+    return NULL;
+}
+
+// Unlinks 'key' from one array and releases its item. Returns 1 if found.
+static int ch_chain_remove(ChainedTable* table, CH_Array* array, const char* key, unsigned long hash) {
+    unsigned long index = hash & (array->size - 1);
+    CH_Item* current = array->slots[index];
+    CH_Item* prev = NULL;
+
+    while (current) {
+        if (current->hash == hash && strcmp(current->key, key) == 0) {
+            // Readers already on 'current' can still follow its next pointer.
+            if (prev) {
+                __atomic_store_n(&prev->next, current->next, __ATOMIC_RELEASE);
+            } else {
+                __atomic_store_n(&array->slots[index], current->next, __ATOMIC_RELEASE);
+            }
+            ch_release(table, current, free);
+            return 1;
+        }
+        prev = current;
+        current = current->next;
+    }
+    return 0;
+}
+
+// Copies up to CH_MIGRATE_STEP old buckets into 'cur'. Once every bucket is
+// copied, drops the old array.
+static void ch_migrate_step(ChainedTable* table) {
+    CH_View* view = table->view;
+    if (!view->old) return;
+
+    for (int n = 0; n < CH_MIGRATE_STEP && table->migrate_pos < view->old->size; n++) {
+        // Copy the whole bucket before linking any of it, so running out of
+        // memory halfway can't leave duplicates in 'cur'.
+        CH_Item* copies = NULL;
+        for (CH_Item* item = view->old->slots[table->migrate_pos]; item; item = item->next) {
+            CH_Item* copy = (CH_Item*)malloc(sizeof(CH_Item));
+            if (!copy) {
+                while (copies) {
+                    CH_Item* next = copies->next;
+                    free(copies);
+                    copies = next;
+                }
+                return; // Try this bucket again on the next operation
+            }
+            memcpy(copy->key, item->key, sizeof(copy->key));
+            copy->hash = item->hash;
+            copy->value = item->value;
+            copy->next = copies;
+            copies = copy;
+        }
+        while (copies) {
+            CH_Item* next = copies->next;
+            ch_chain_push(view->cur, copies);
+            copies = next;
+        }
+        table->migrate_pos++;
+    }
+
+    if (table->migrate_pos == view->old->size) {
+        CH_Array* old = view->old;
+        ch_publish_view(table, view->cur, NULL);
+        if (table->view->old == NULL) ch_release(table, old, ch_array_free);
+    }
+}
+
+// Starts a resize if the load factor is out of range and none is running.
+static void ch_maybe_resize(ChainedTable* table) {
+    CH_View* view = table->view;
+    if (view->old) return;
+
+    unsigned long size = view->cur->size;
+    unsigned long new_size = size;
+    if (table->count > size * CH_MAX_LOAD) {
+        new_size = size * 2;
+    } else if (size > CH_MIN_SIZE && table->count < size / CH_MIN_LOAD_DIV) {
+        new_size = size / 2;
+    }
+    if (new_size == size) return;
+
+    CH_Array* bigger = ch_array_create(new_size);
+    if (!bigger) return; // Keep running at the higher load factor
+    table->migrate_pos = 0;
+    ch_publish_view(table, bigger, view->cur);
+    if (table->view->cur != bigger) free(bigger);
+}
+
+static ChainedTable* ch_create_sized(unsigned long size, int rcu) {
+    ChainedTable* table = (ChainedTable*)calloc(1, sizeof(ChainedTable));
+    if (!table) return NULL;
+    table->rcu = rcu;
+    table->view = (CH_View*)malloc(sizeof(CH_View));
+    if (!table->view) {
+        free(table);
+        return NULL;
+    }
+    table->view->cur = ch_array_create(size);
+    table->view->old = NULL;
+    if (!table->view->cur) {
+        free(table->view);
+        free(table);
+        return NULL;
+    }
+    return table;
+}
+
+// Creates an empty hash table
+ChainedTable* ch_create() {
+    return ch_create_sized(CH_INITIAL_SIZE, 0);
+}
+
+// Creates a table whose readers may skip the writers' lock (see above)
+ChainedTable* ch_create_rcu() {
+    return ch_create_sized(CH_INITIAL_SIZE, 1);
+}
+
+// Inserts a file into the hash table
+void ch_insert(ChainedTable* table, const char* key, void* value) {
+    if (!table || !key) return;
+
+    CH_Item* new_item = (CH_Item*)malloc(sizeof(CH_Item));
+    if (!new_item) return;
+    strncpy(new_item->key, key, sizeof(new_item->key) - 1);
+    new_item->key[sizeof(new_item->key) - 1] = '\0';
+    new_item->hash = ch_hash_function(new_item->key);
+    new_item->value=value;
+
+    // Insert at the beginning of the chain. The item must be complete
+    // before it becomes reachable.
+    ch_chain_push(table->view->cur, new_item);
+    table->count++;
+
+    ch_migrate_step(table);
+    ch_maybe_resize(table);
+}
+
+// Searches for a file by its key (filename)
+void* ch_search(ChainedTable* table, const char* key) { // Return void*
+    if (!table || !key) return NULL;
+    unsigned long hash = ch_hash_function(key);
+    CH_View* view = __atomic_load_n(&table->view, __ATOMIC_ACQUIRE);
+
+    CH_Item* item = ch_chain_find(view->cur, key, hash);
+    if (!item && view->old) {
+        item = ch_chain_find(view->old, key, hash); // Not copied over yet
+    }
+    return item ? item->value : NULL; // Return the generic value
+}
+
+// Deletes a file from the hash table
+void ch_delete(ChainedTable* table, const char* key) {
+    if (!table || !key) return;
+    unsigned long hash = ch_hash_function(key);
+    CH_View* view = table->view;
+
+    // During a resize the item may be in either array, or both.
+    int found = ch_chain_remove(table, view->cur, key, hash);
+    if (view->old) {
+        found |= ch_chain_remove(table, view->old, key, hash);
+    }
+    // The caller is responsible for freeing the actual value if needed.
+    if (found) table->count--;
+
+    ch_migrate_step(table);
+    ch_maybe_resize(table);
+}
+
+// Number of items currently stored
+unsigned long ch_count(ChainedTable* table) {
+    return table ? table->count : 0;
+}
+
+#endif // CHAINED_HASH_TABLE_H
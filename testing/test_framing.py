@@ -0,0 +1,311 @@
+import re
+import socket
+import struct
+import sys
+import time
+
+# Checks the FRAMED/1 client protocol (src/frame.h): the 16-byte header of
+# replies, request IDs echoed back when many requests are pipelined on one
+# session (more than the Name Server runs at once), replies going out as
+# requests finish with the frames of concurrent replies interleaved, a
+# client that stops reading getting its session parked rather than
+# dropped, frames split across sends, oversized and malformed frames
+# dropping only their own session, and text sessions working alongside
+# framed ones.
+# Needs a running Name Server with a Storage Server registered.
+
+FRAME_MAGIC = 0xF5
+FRAME_VERSION = 1
+FRAME_REQUEST, FRAME_REPLY, FRAME_REPLY_PART = 1, 2, 3
+FRAME_HEADER = "!BBBBHHII"  # magic, version, opcode, flags, status, reserved, request ID, length
+FRAME_MAX_REQUEST = 32 * 1024
+NS_MAX_IN_FLIGHT = 32
+CONN_MAX_QUEUED = 1024 * 1024  # Unread reply bytes past which a session is not read
+
+failures = 0
+
+def check(name, ok, detail=""):
+    """Prints one PASS/FAIL line and counts failures."""
+    global failures
+    if not ok:
+        failures += 1
+    print(f"  [{'PASS' if ok else 'FAIL'}] {name}" + (f" -- {detail}" if detail and not ok else ""))
+
+def frame(request_id, payload, opcode=FRAME_REQUEST, magic=FRAME_MAGIC, version=FRAME_VERSION, length=None):
+    """One frame; the header fields can be overridden to build bad ones."""
+    payload = payload.encode('utf-8') if isinstance(payload, str) else payload
+    return struct.pack(FRAME_HEADER, magic, version, opcode, 0, 0, 0, request_id,
+                       len(payload) if length is None else length) + payload
+
+class Session:
+    """One registered client session; commands and replies are text lines."""
+    def __init__(self, ns_ip, ns_port, username):
+        self.sock = socket.create_connection((ns_ip, ns_port), timeout=10)
+        self.buf = b""
+        self.ack = self.command(f"REGISTER_CLIENT;{username}")
+
+    def command(self, line):
+        """Sends one command and returns its reply without the __END__ line."""
+        self.sock.sendall((line + "\n").encode('utf-8'))
+        while b"__END__\n" not in self.buf:
+            data = self.sock.recv(65536)
+            if not data:
+                break
+            self.buf += data
+        reply, _, self.buf = self.buf.partition(b"__END__\n")
+        return reply.decode('utf-8', errors='replace').strip()
+
+class FramedSession(Session):
+    """A session registered with FRAMED/1; after the (text) ACK every
+    request and reply is a frame. 'rcvbuf' caps the socket's receive
+    buffer, so that replies left unread back up on the Name Server."""
+    def __init__(self, ns_ip, ns_port, username, rcvbuf=None):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        if rcvbuf:
+            self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, rcvbuf)
+        self.sock.settimeout(10)
+        self.sock.connect((ns_ip, ns_port))
+        self.buf = b""
+        self.ack = Session.command(self, f"REGISTER_CLIENT;{username};FRAMED/1")
+        self.headers = []  # Every header received, as tuples
+        self.partial = {}  # Request ID -> [payload so far, frames] of replies not finished
+
+    def need(self, n):
+        while len(self.buf) < n:
+            data = self.sock.recv(65536)
+            if not data:
+                raise EOFError
+            self.buf += data
+
+    def frame(self):
+        """Reads one frame and adds it to its reply. Returns its header."""
+        self.need(16)
+        header = struct.unpack(FRAME_HEADER, self.buf[:16])
+        self.headers.append(header)
+        self.need(16 + header[7])
+        part = self.partial.setdefault(header[6], [b"", 0])
+        part[0] += self.buf[16:16 + header[7]]
+        part[1] += 1
+        self.buf = self.buf[16 + header[7]:]
+        return header
+
+    def reply(self):
+        """Reads frames until a reply is whole (frames of other replies
+        may come in between). Returns its request ID, status, payload and
+        number of frames."""
+        while True:
+            header = self.frame()
+            if header[2] != FRAME_REPLY_PART:
+                payload, frames = self.partial.pop(header[6])
+                return header[6], header[4], payload.decode('utf-8', errors='replace'), frames
+
+    def command(self, line, request_id=1):
+        self.sock.sendall(frame(request_id, line))
+        return self.reply()
+
+def write_file(session, filename, text):
+    """Writes 'text' as the first sentence of 'filename' through its Storage
+    Server, on a text session. Returns "ok" or the reply that failed."""
+    reply = session.command(f"WRITE;{filename};0")
+    if not reply.startswith("REDIRECT_WRITE"):
+        return reply
+    _, ip, port = reply.split(";")[:3]
+    with socket.create_connection((ip, int(port)), timeout=10) as s:
+        for line, ack in [(f"SS_LOCK_SENTENCE;{filename};0", "ACK_LOCK"), (f"WRITE_DATA;0;{text}", "ACK_DATA"),
+                          ("COMMIT_WRITE;", "ACK_COMMIT")]:
+            s.sendall((line + "\n").encode('utf-8'))
+            reply = b""
+            while b"\n" not in reply:
+                data = s.recv(1024)
+                if not data:
+                    break
+                reply += data
+            if not reply.startswith(ack.encode()):
+                return reply.decode('utf-8', errors='replace').strip()
+    session.command(f"UPDATE_META;{filename}")
+    return "ok"
+
+def seq(first, last):
+    """What seq(1) prints."""
+    return "".join(f"{i}\n" for i in range(first, last + 1))
+
+def exec_calls(session):
+    """EXEC's call count from COMMAND_STATS."""
+    match = re.search(r"^EXEC\s+\S+\s+(\d+)", session.command("COMMAND_STATS"), re.M)
+    return int(match.group(1)) if match else -1
+
+def dropped(sock):
+    """True if the Name Server closed 'sock' (without replying)."""
+    sock.settimeout(5)
+    try:
+        return sock.recv(65536) == b""
+    except ConnectionResetError:
+        return True
+    except socket.timeout:
+        return False
+
+def quiet(sock, secs=0.5):
+    """True if nothing arrives on 'sock' for 'secs'."""
+    sock.settimeout(secs)
+    try:
+        sock.recv(1, socket.MSG_PEEK)
+        return False
+    except socket.timeout:
+        return True
+    finally:
+        sock.settimeout(10)
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print("Usage: python3 test_framing.py <NameServer_IP> <NameServer_Port>")
+        sys.exit(1)
+
+    NS_IP = sys.argv[1]
+    NS_PORT = int(sys.argv[2])
+    run = f"fr{int(time.time())}"  # Fresh names, so the test can run again on the same server
+
+    print("--- Starting Framing Test ---")
+
+    print("\n[TEST] Registering with FRAMED/1...")
+    alice = FramedSession(NS_IP, NS_PORT, "alice")
+    check("ACK names the capability", alice.ack == "ACK_CLIENT_REG;FRAMED/1", alice.ack)
+
+    print("\n[TEST] Reply headers...")
+    payload = alice.command(f"CREATE;{run}_f.txt", 7)[2]
+    magic, version, opcode, flags, status, reserved, rid, length = alice.headers[-1]
+    check("magic and version", (magic, version) == (FRAME_MAGIC, FRAME_VERSION), f"{magic:#x} {version}")
+    check("final frame is a REPLY", opcode == FRAME_REPLY, str(opcode))
+    check("flags and reserved are 0", flags == 0 and reserved == 0, f"{flags} {reserved}")
+    check("request ID echoed", rid == 7, str(rid))
+    check("status 0 on success", status == 0, str(status))
+    check("length is the payload's", length == len(payload.encode('utf-8')) and "successfully" in payload, payload)
+    check("no text terminator in the payload", "__END__" not in payload, payload)
+    rid, status, payload, _ = alice.command(f"CREATE;{run}_f.txt", 0xFFFFFFFF)
+    check("any 32-bit request ID is echoed", rid == 0xFFFFFFFF, str(rid))
+    check("status carries the error code", status == 409 and payload.startswith("ERROR;409"), f"{status} {payload}")
+    rid, status, payload, _ = alice.command("BOGUS;x", 9)
+    check("unknown command still gets a final reply", rid == 9 and payload.startswith("ERROR"), payload)
+    reply = alice.command(f"ANNOTATE;{run}_f.txt;a __END__ line", 10)[2]
+    rid, status, payload, _ = alice.command(f"SHOW_ANNOTATION;{run}_f.txt", 11)
+    check("payload may hold __END__", "a __END__ line" in payload, f"{reply} / {payload}")
+
+    print(f"\n[TEST] Pipelining {3 * NS_MAX_IN_FLIGHT} requests on one session...")
+    count = 3 * NS_MAX_IN_FLIGHT  # Past NS_MAX_IN_FLIGHT the session is read as requests finish
+    for i in range(count):
+        alice.command(f"CREATE;{run}_p{i}.txt", 1000 + i)
+    alice.sock.sendall(b"".join(frame(2000 + i, f"INFO;{run}_p{i}.txt") for i in range(count)))
+    replies = {}
+    try:
+        for _ in range(count):
+            rid, status, payload, _ = alice.reply()
+            replies.setdefault(rid, []).append(payload)
+    except (EOFError, socket.timeout) as e:
+        check("every reply arrives", False, f"{len(replies)} of {count}: {e!r}")
+    check("one reply per request ID", sorted(replies) == list(range(2000, 2000 + count)) and
+          all(len(p) == 1 for p in replies.values()), f"{len(replies)} IDs")
+    wrong = [rid for rid, p in replies.items() if f"File: {run}_p{rid - 2000}.txt" not in p[0]]
+    check("each reply answers its own request", not wrong, str(wrong[:5]))
+    check("session still usable", alice.command(f"INFO;{run}_f.txt", 3)[2].startswith("File:"))
+
+    print("\n[TEST] Replies in the order requests finish...")
+    # Prints 700 KB, then takes a second: more than a Response holds before
+    # it is sent early (response.h), so part of the reply goes out first.
+    text = Session(NS_IP, NS_PORT, "alice")
+    alice.command(f"CREATE;{run}_slow.sh", 80)
+    reply = write_file(text, f"{run}_slow.sh", "seq 100000 199999 && sleep 1 && echo done")
+    check("slow script written", reply == "ok", reply)
+    alice.sock.sendall(frame(81, f"EXEC;{run}_slow.sh"))
+    header = alice.frame()
+    check("the slow reply starts with a REPLY_PART", header[6] == 81 and header[2] == FRAME_REPLY_PART, str(header))
+    alice.sock.sendall(b"".join(frame(82 + i, f"INFO;{run}_p{i}.txt") for i in range(10)))
+    order = [alice.reply() for _ in range(11)]
+    ids = [rid for rid, _, _, _ in order]
+    check("requests sent behind it are answered first", ids[-1] == 81 and sorted(ids[:10]) == list(range(82, 92)), str(ids))
+    wrong = [rid for rid, _, payload, _ in order[:10] if f"File: {run}_p{rid - 82}.txt" not in payload]
+    check("each of them answers its own request", not wrong, str(wrong))
+    rid, status, payload, frames = order[-1]
+    check("the slow reply is whole once its parts are put back together",
+          frames > 1 and payload == seq(100000, 199999) + "done\n\n", f"{frames} frames, {len(payload)} bytes")
+
+    print("\n[TEST] A client that stops reading...")
+    # Each EXEC prints 210 KB; together far more than CONN_MAX_QUEUED plus
+    # what the sockets buffer, so the Name Server has to stop reading.
+    text.command(f"CREATE;{run}_big.sh")
+    reply = write_file(text, f"{run}_big.sh", "seq 100000 129999")
+    check("big script written", reply == "ok", reply)
+    count = 200
+    start = exec_calls(text)
+    reader = FramedSession(NS_IP, NS_PORT, "alice", rcvbuf=64 * 1024)
+    reader.sock.sendall(b"".join(frame(3000 + i, f"EXEC;{run}_big.sh") for i in range(count)))
+    time.sleep(2)
+    ran = exec_calls(text) - start
+    time.sleep(1)
+    check(f"requests stop running once {CONN_MAX_QUEUED // 1024} KB of replies are unread",
+          0 < ran < count and exec_calls(text) - start == ran, f"{ran} of {count} ran")
+    began = time.time()
+    reply = alice.command(f"INFO;{run}_f.txt", 90)[2]
+    check("other sessions are still answered", reply.startswith("File:") and time.time() - began < 1,
+          f"{time.time() - began:.1f} s: {reply[:60]}")
+    replies = {}
+    try:
+        for _ in range(count):
+            rid, status, payload, _ = reader.reply()
+            replies[rid] = payload
+    except (EOFError, socket.timeout) as e:
+        check("the parked session is not dropped", False, f"{len(replies)} of {count} replies: {e!r}")
+    check("every reply arrives once the client reads", sorted(replies) == list(range(3000, 3000 + count)),
+          f"{len(replies)} of {count}")
+    short = [rid for rid, payload in replies.items() if payload != seq(100000, 129999) + "\n"]
+    check("and each is complete", not short, str(short[:5]))
+    check("the session is usable again", reader.command(f"INFO;{run}_f.txt", 4000)[2].startswith("File:"))
+
+    print("\n[TEST] Frames split across sends...")
+    data = frame(41, f"INFO;{run}_f.txt") + frame(42, f"INFO;{run}_p0.txt")
+    alice.sock.sendall(data[:5])
+    check("half a header runs nothing", quiet(alice.sock))
+    alice.sock.sendall(data[5:20])
+    check("a header without its payload runs nothing", quiet(alice.sock))
+    alice.sock.sendall(data[20:])
+    first, second = alice.reply(), alice.reply()
+    check("both requests answered once whole", sorted([first[0], second[0]]) == [41, 42], f"{first} {second}")
+
+    print("\n[TEST] Oversized and malformed frames...")
+    bob = Session(NS_IP, NS_PORT, "bob")  # A text session alongside
+    big = FramedSession(NS_IP, NS_PORT, "alice")
+    rid, status, payload, _ = big.command("INFO;" + "x" * (FRAME_MAX_REQUEST - 5), 50)
+    check("a request of FRAME_MAX_REQUEST bytes is answered", rid == 50 and payload.startswith("ERROR"), payload[:80])
+    big.sock.sendall(frame(51, b"", length=FRAME_MAX_REQUEST + 1))
+    check("a longer one drops the session", dropped(big.sock))
+    for name, data in [("bad magic", frame(1, "VIEW;-", magic=0x56)),
+                       ("bad version", frame(1, "VIEW;-", version=2)),
+                       ("REPLY opcode from a client", frame(1, "VIEW;-", opcode=FRAME_REPLY)),
+                       ("text line on a framed session", b"VIEW;-\n" + b"\0" * 16)]:
+        s = FramedSession(NS_IP, NS_PORT, "alice")
+        s.sock.sendall(data)
+        check(f"{name} drops the session", dropped(s.sock))
+    s = FramedSession(NS_IP, NS_PORT, "alice")
+    s.sock.sendall(frame(60, f"CREATE;{run}_cut.txt")[:24])
+    s.sock.close()  # Truncated: the rest never comes
+    time.sleep(0.3)
+    rid, status, payload, _ = alice.command(f"INFO;{run}_cut.txt", 61)
+    check("a truncated frame is never run", payload.startswith("ERROR;404"), payload)
+    check("other framed sessions unaffected", alice.command("VIEW;-", 62)[2].count("\n") > 3)
+
+    print("\n[TEST] Text sessions alongside...")
+    check("text registration gets a plain ACK", "FRAMED" not in bob.ack and bob.ack.startswith("ACK_CLIENT_REG"), bob.ack)
+    reply = bob.command(f"INFO;{run}_f.txt")
+    check("text command answered in text", reply.startswith("File:") or reply.startswith("ERROR;403"), reply)
+    reply = bob.command(f"CREATE;{run}_text.txt")
+    check("text CREATE", "successfully" in reply, reply)
+    rid, status, payload, _ = alice.command(f"INFO;{run}_text.txt", 70)
+    check("framed session sees it", payload.startswith("ERROR;403") or payload.startswith("File:"), payload)
+    old = socket.create_connection((NS_IP, NS_PORT), timeout=10)
+    old.sendall(b"REGISTER_CLIENT;carol;FRAMED/9\nVIEW;-\n")
+    time.sleep(0.5)
+    reply = old.recv(65536).decode('utf-8', errors='replace')
+    check("an unknown capability leaves the session in text", reply.startswith("ACK_CLIENT_REG\n") and
+          reply.count("__END__") == 2, repr(reply))
+
+    print("\n--- Test Complete ---")
+    print("All checks passed." if failures == 0 else f"{failures} check(s) FAILED.")
+    sys.exit(1 if failures else 0)
@@ -0,0 +1,227 @@
+import os
+import re
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+# Checks what the Name Server does when a Storage Server goes away: it is
+# marked down when its heartbeat session closes or its heartbeats stop,
+# CREATE and CREATEFOLDER are placed on the servers still up (or answer
+# ERROR;503 when there are none), a call to a server that hangs ends at
+# its deadline, and calls to one that refuses connections are retried
+# only within its retry budget.
+# Starts its own Name Server and two Storage Servers from <bin dir>, in
+# scratch directories, so ports 8080, 9001 and 9002 must be free.
+
+NS_IP, NS_PORT = "127.0.0.1", 8080
+SS_PORTS = (9001, 9002)
+SS_TIMEOUT_MS = 1500   # NS_SS_TIMEOUT_MS for this run, to keep it short
+SS_DOWN_WAIT = 15      # The Name Server waits SS_DOWN_SECS (10) for a heartbeat
+SS_RETRY_BURST = 10    # As in ss_pool.h
+
+failures = 0
+
+def check(name, ok, detail=""):
+    """Prints one PASS/FAIL line and counts failures."""
+    global failures
+    if not ok:
+        failures += 1
+    print(f"  [{'PASS' if ok else 'FAIL'}] {name}" + (f" -- {detail}" if detail and not ok else ""))
+
+class Session:
+    """One registered client session; commands and replies are text lines."""
+    def __init__(self, ns_ip, ns_port, username):
+        self.sock = socket.create_connection((ns_ip, ns_port), timeout=10)
+        self.buf = b""
+        self.command(f"REGISTER_CLIENT;{username}")
+
+    def command(self, line):
+        """Sends one command and returns its reply without the __END__ line."""
+        self.sock.sendall((line + "\n").encode('utf-8'))
+        while b"__END__\n" not in self.buf:
+            data = self.sock.recv(65536)
+            if not data:
+                raise ConnectionError("Name Server closed the session")
+            self.buf += data
+        reply, _, self.buf = self.buf.partition(b"__END__\n")
+        return reply.decode('utf-8', errors='replace').strip()
+
+    def timed(self, line):
+        """Like command(), and also returns how long the reply took."""
+        start = time.time()
+        reply = self.command(line)
+        return reply, time.time() - start
+
+class Servers:
+    """A Name Server and two Storage Servers, each in its own scratch directory."""
+    def __init__(self, bin_dir):
+        self.bin_dir = os.path.abspath(bin_dir)
+        self.root = tempfile.mkdtemp(prefix="liveness_")
+        self.log = open(os.path.join(self.root, "servers.log"), "w")
+        self.ss = {}
+        ns_dir = os.path.join(self.root, "ns")
+        os.makedirs(ns_dir)
+        env = dict(os.environ, NS_SS_TIMEOUT_MS=str(SS_TIMEOUT_MS))
+        self.ns = subprocess.Popen([os.path.join(self.bin_dir, "name_server")], cwd=ns_dir, env=env,
+                                   stdout=self.log, stderr=subprocess.STDOUT)
+        deadline = time.time() + 10
+        while time.time() < deadline:
+            try:
+                socket.create_connection((NS_IP, NS_PORT), timeout=1).close()
+                break
+            except OSError:
+                time.sleep(0.1)
+        else:
+            raise RuntimeError("Name Server did not start")
+        self.probe = Session(NS_IP, NS_PORT, "admin")
+        for port in SS_PORTS:
+            self.start_ss(port)
+
+    def ss_dir(self, port):
+        return os.path.join(self.root, f"ss{port}")
+
+    def start_ss(self, port):
+        os.makedirs(self.ss_dir(port), exist_ok=True)
+        self.ss[port] = subprocess.Popen([os.path.join(self.bin_dir, "storage_server"), str(port)],
+                                         cwd=self.ss_dir(port), stdout=self.log, stderr=subprocess.STDOUT)
+        if not self.wait_state(port, "up", 15):
+            raise RuntimeError(f"Storage Server {port} did not register")
+
+    def kill_ss(self, port):
+        self.ss[port].send_signal(signal.SIGCONT)
+        self.ss[port].kill()
+        self.ss[port].wait()
+
+    def state(self, port):
+        """'up' or 'down', as STORAGE_STATS reports it, or None if unknown."""
+        match = re.search(rf"^127\.0\.0\.1:{port}\s+(\w+)", self.probe.command("STORAGE_STATS"), re.M)
+        return match and match.group(1)
+
+    def wait_state(self, port, state, seconds):
+        deadline = time.time() + seconds
+        while time.time() < deadline:
+            if self.state(port) == state:
+                return True
+            time.sleep(0.2)
+        return False
+
+    def files(self, port):
+        """Names in the Storage Server's ss_files directory."""
+        path = os.path.join(self.ss_dir(port), "ss_files")
+        return set(os.listdir(path)) if os.path.isdir(path) else set()
+
+    def stop(self):
+        for proc in [self.ns] + list(self.ss.values()):
+            if proc.poll() is None:
+                proc.send_signal(signal.SIGCONT)
+                proc.kill()
+                proc.wait()
+        self.log.close()
+
+def create_all(session, names):
+    """CREATEs (or, for names ending in '/', CREATEFOLDERs) each name and
+    returns the replies that were not a success."""
+    failed = []
+    for name in names:
+        line = f"CREATEFOLDER;{name[:-1]}" if name.endswith("/") else f"CREATE;{name}"
+        reply = session.command(line)
+        if "successfully" not in reply:
+            failed.append(f"{line}: {reply}")
+    return failed
+
+def moved_folders(session, names):
+    """MOVEs each folder in 'names' (those ending in '/') to <name>_moved and
+    returns the replies that were not a success."""
+    failed = []
+    for name in names:
+        if name.endswith("/"):
+            line = f"MOVE;{name[:-1]};{name[:-1]}_moved"
+            reply = session.command(line)
+            if "moved" not in reply.lower():
+                failed.append(f"{line}: {reply}")
+    return failed
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("Usage: python3 test_liveness.py <bin dir>")
+        sys.exit(1)
+
+    a, b = SS_PORTS
+    print("--- Starting Storage Server Liveness Test ---")
+    servers = Servers(sys.argv[1])
+    try:
+        s = Session(NS_IP, NS_PORT, "alice")
+
+        print("\n[TEST] A Storage Server that exits...")
+        servers.kill_ss(b)
+        check("is marked down when its heartbeat session closes", servers.wait_state(b, "down", 3), servers.state(b))
+        names = [f"on_a_{i}.txt" for i in range(20)] + [f"dir_a_{i}/" for i in range(5)]
+        failed = create_all(s, names)
+        check("CREATE and CREATEFOLDER still succeed", not failed, "; ".join(failed[:3]))
+        on_a = servers.files(a)
+        check("all files went to the server still up", all(n in on_a for n in names if not n.endswith("/")),
+              str(sorted(n for n in names if not n.endswith("/") and n not in on_a)[:5]))
+        check("none went to the one that is down", not servers.files(b), str(sorted(servers.files(b))[:5]))
+        failed = moved_folders(s, names)
+        check("the folders did too (a MOVE needs their server up)", not failed, "; ".join(failed[:3]))
+        servers.start_ss(b)
+        check("is marked up again when it registers", servers.state(b) == "up", servers.state(b))
+
+        print("\n[TEST] A Storage Server that hangs (SIGSTOP)...")
+        servers.ss[a].send_signal(signal.SIGSTOP)
+        reply, took = s.timed("DELETE;on_a_0.txt")
+        check("a call to it ends at its deadline", reply.startswith("ERROR;") and took < SS_TIMEOUT_MS / 1000 * 2,
+              f"{reply} after {took:.1f} s")
+        check("and the file is kept", s.command("INFO;on_a_0.txt").startswith("File:"))
+        check("is marked down once its heartbeats stop", servers.wait_state(a, "down", SS_DOWN_WAIT), servers.state(a))
+        names = [f"on_b_{i}.txt" for i in range(20)] + [f"dir_b_{i}/" for i in range(5)]
+        failed = create_all(s, names)
+        check("CREATE and CREATEFOLDER go to the other server", not failed, "; ".join(failed[:3]))
+        on_b = servers.files(b)
+        check("all files are on it", all(n in on_b for n in names if not n.endswith("/")),
+              str(sorted(n for n in names if not n.endswith("/") and n not in on_b)[:5]))
+        failed = moved_folders(s, names)
+        check("and the folders", not failed, "; ".join(failed[:3]))
+        servers.ss[a].send_signal(signal.SIGCONT)
+        time.sleep(0.5)
+        stray = servers.files(a) & set(names)
+        check("none went to the one that is down", not stray, str(sorted(stray)[:5]))
+
+        print("\n[TEST] A Storage Server that refuses connections...")
+        servers.kill_ss(a)
+        times = []
+        for i in range(1, 16):
+            reply, took = s.timed(f"DELETE;on_a_{i}.txt")
+            times.append(took)
+            if not reply.startswith("ERROR;"):
+                check(f"DELETE;on_a_{i}.txt fails", False, reply)
+        check("a failed call is retried", times[0] >= 0.05, f"{times[0] * 1000:.0f} ms")
+        retried = sum(1 for t in times if t >= 0.05)
+        check(f"only while the retry budget lasts ({SS_RETRY_BURST} retries)",
+              retried <= SS_RETRY_BURST and all(t < 0.05 for t in times[-5:]),
+              ", ".join(f"{t * 1000:.0f}" for t in times) + " ms")
+        check("every reply came well within the deadline", max(times) < SS_TIMEOUT_MS / 1000, f"{max(times):.1f} s")
+
+        print("\n[TEST] No Storage Server up...")
+        servers.kill_ss(b)
+        servers.wait_state(b, "down", 3)
+        reply = s.command("CREATE;nowhere.txt")
+        check("CREATE answers ERROR;503", reply.startswith("ERROR;503"), reply)
+        reply = s.command("CREATEFOLDER;nowhere_dir")
+        check("CREATEFOLDER answers ERROR;503", reply.startswith("ERROR;503"), reply)
+        reply = s.command("INFO;nowhere.txt")
+        check("and neither is in the namespace", reply.startswith("ERROR;404"), reply)
+        servers.start_ss(a)
+        reply = s.command("CREATE;nowhere.txt")
+        check("CREATE works again once one registers", "successfully" in reply and "nowhere.txt" in servers.files(a), reply)
+    finally:
+        servers.stop()
+        shutil.rmtree(servers.root, ignore_errors=True)
+
+    print("\n--- Test Complete ---")
+    print("All checks passed." if failures == 0 else f"{failures} check(s) FAILED.")
+    sys.exit(1 if failures else 0)
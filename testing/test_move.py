@@ -0,0 +1,140 @@
+import socket
+import sys
+import time
+
+# Checks MOVE: a file into a folder and a folder into another folder. The
+# moved entries must read back (through the Name Server's redirect and the
+# Storage Server) at the new path with their content, be gone at the old
+# path, and MOVE must refuse a destination that already exists.
+# Needs a running Name Server with a Storage Server registered.
+
+failures = 0
+
+def check(name, ok, detail=""):
+    """Prints one PASS/FAIL line and counts failures."""
+    global failures
+    if not ok:
+        failures += 1
+    print(f"  [{'PASS' if ok else 'FAIL'}] {name}" + (f" -- {detail}" if detail and not ok else ""))
+
+class Session:
+    """One registered client session; commands and replies are text lines."""
+    def __init__(self, ns_ip, ns_port, username):
+        self.sock = socket.create_connection((ns_ip, ns_port), timeout=10)
+        self.buf = b""
+        self.command(f"REGISTER_CLIENT;{username}")
+
+    def command(self, line):
+        """Sends one command and returns its reply without the __END__ line."""
+        self.sock.sendall((line + "\n").encode('utf-8'))
+        while b"__END__\n" not in self.buf:
+            data = self.sock.recv(65536)
+            if not data:
+                break
+            self.buf += data
+        reply, _, self.buf = self.buf.partition(b"__END__\n")
+        return reply.decode('utf-8', errors='replace').strip()
+
+def ss_read(ip, port, ss_name):
+    """Reads a file straight from its Storage Server."""
+    with socket.create_connection((ip, port), timeout=10) as s:
+        s.sendall(f"SS_READ;{ss_name}\n".encode('utf-8'))
+        reply = b""
+        while b"__SS_END__" not in reply:
+            data = s.recv(65536)
+            if not data:
+                break
+            reply += data
+        return reply.decode('utf-8', errors='replace').split("__SS_END__")[0].strip()
+
+def write_file(session, filename, text):
+    """Writes 'text' as the first sentence of 'filename' through its Storage Server."""
+    reply = session.command(f"WRITE;{filename};0")
+    if not reply.startswith("REDIRECT_WRITE"):
+        return reply
+    _, ip, port = reply.split(";")[:3]
+    with socket.create_connection((ip, int(port)), timeout=10) as s:
+        for line, ack in [(f"SS_LOCK_SENTENCE;{filename};0", "ACK_LOCK"), (f"WRITE_DATA;0;{text}", "ACK_DATA"),
+                          ("COMMIT_WRITE;", "ACK_COMMIT")]:
+            s.sendall((line + "\n").encode('utf-8'))
+            reply = b""
+            while b"\n" not in reply:
+                data = s.recv(1024)
+                if not data:
+                    break
+                reply += data
+            if not reply.startswith(ack.encode()):
+                return reply.decode('utf-8', errors='replace').strip()
+    session.command(f"UPDATE_META;{filename}")
+    return "ok"
+
+def read_file(session, filename):
+    """READs 'filename': the Name Server's reply, and the content if it redirected."""
+    reply = session.command(f"READ;{filename}")
+    if not reply.startswith("REDIRECT_READ"):
+        return reply, None
+    _, ip, port, ss_name = reply.split(";")[:4]
+    return reply, ss_read(ip, int(port), ss_name)
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print("Usage: python3 test_move.py <NameServer_IP> <NameServer_Port>")
+        sys.exit(1)
+
+    NS_IP = sys.argv[1]
+    NS_PORT = int(sys.argv[2])
+    run = f"mv{int(time.time())}"  # Fresh names, so the test can run again on the same server
+
+    print("--- Starting MOVE Test ---")
+    alice = Session(NS_IP, NS_PORT, "alice")
+
+    print("\n[TEST] Setting up files and folders...")
+    for line in [f"CREATEFOLDER;{run}_dst", f"CREATE;{run}_f.txt", f"CREATEFOLDER;{run}_src",
+                 f"CREATE;{run}_src/in.txt", f"CREATEFOLDER;{run}_src/sub", f"CREATE;{run}_src/sub/deep.txt",
+                 f"CREATE;{run}_other.txt"]:
+        reply = alice.command(line)
+        check(line, "successfully" in reply, reply)
+    for filename, text in [(f"{run}_f.txt", "moved file text."), (f"{run}_src/in.txt", "inside the folder."),
+                           (f"{run}_src/sub/deep.txt", "two levels down.")]:
+        check(f"write {filename}", write_file(alice, filename, text) == "ok")
+
+    print("\n[TEST] MOVE file -> folder...")
+    reply = alice.command(f"MOVE;{run}_f.txt;{run}_dst/f.txt")
+    check("MOVE succeeds", reply.startswith("Moved"), reply)
+    reply, content = read_file(alice, f"{run}_dst/f.txt")
+    check("READ at the new path redirects", reply.startswith("REDIRECT_READ"), reply)
+    check("content moved with it", content == "moved file text.", repr(content))
+    reply, _ = read_file(alice, f"{run}_f.txt")
+    check("READ at the old path fails", reply.startswith("ERROR;404"), reply)
+    _, ip, port = alice.command(f"READ;{run}_dst/f.txt").split(";")[:3]
+    content = ss_read(ip, int(port), f"{run}_f.txt")
+    check("Storage Server no longer has the old name", content.startswith("ERROR"), repr(content))
+    check("folder lists it", f"-> {run}_dst/f.txt" in alice.command(f"VIEWFOLDER;{run}_dst"))
+
+    print("\n[TEST] MOVE folder -> folder...")
+    reply = alice.command(f"MOVE;{run}_src;{run}_dst/src")
+    check("MOVE succeeds", reply.startswith("Moved"), reply)
+    for old, new, text in [(f"{run}_src/in.txt", f"{run}_dst/src/in.txt", "inside the folder."),
+                           (f"{run}_src/sub/deep.txt", f"{run}_dst/src/sub/deep.txt", "two levels down.")]:
+        reply, content = read_file(alice, new)
+        check(f"READ {new}", reply.startswith("REDIRECT_READ") and content == text, f"{reply} {content!r}")
+        reply, _ = read_file(alice, old)
+        check(f"READ {old} fails", reply.startswith("ERROR;404"), reply)
+    reply = alice.command(f"VIEWFOLDER;{run}_src")
+    check("old folder is gone", reply.startswith("ERROR;404"), reply)
+    listing = alice.command(f"VIEWFOLDER;{run}_dst")
+    check("new folder lists the subtree", f"-> {run}_dst/src (DIR)" in listing and f"-> {run}_dst/src/sub/deep.txt" in listing, listing)
+
+    print("\n[TEST] MOVE onto an existing destination...")
+    reply = alice.command(f"MOVE;{run}_other.txt;{run}_dst/f.txt")
+    check("file onto a file is refused", reply.startswith("ERROR;409"), reply)
+    reply = alice.command(f"MOVE;{run}_dst/src;{run}_other.txt")
+    check("folder onto a file is refused", reply.startswith("ERROR;409"), reply)
+    reply, content = read_file(alice, f"{run}_dst/f.txt")
+    check("destination left as it was", content == "moved file text.", repr(content))
+    reply, _ = read_file(alice, f"{run}_other.txt")
+    check("source left where it was", reply.startswith("REDIRECT_READ"), reply)
+
+    print("\n--- Test Complete ---")
+    print("All checks passed." if failures == 0 else f"{failures} check(s) FAILED.")
+    sys.exit(1 if failures else 0)
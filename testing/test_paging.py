@@ -0,0 +1,226 @@
+import socket
+import sys
+import time
+
+# Checks that listings page through their cursors: VIEW, VIEW -a, VIEWFOLDER
+# and LIST across more entries than fit on one page list each entry once,
+# entries created or deleted between two pages neither repeat nor drop any
+# entry that was there throughout, and a cursor whose entry is gone (or
+# never existed) is refused rather than restarting the listing.
+# Needs a running Name Server with a Storage Server registered.
+
+failures = 0
+
+def check(name, ok, detail=""):
+    """Prints one PASS/FAIL line and counts failures."""
+    global failures
+    if not ok:
+        failures += 1
+    print(f"  [{'PASS' if ok else 'FAIL'}] {name}" + (f" -- {detail}" if detail and not ok else ""))
+
+class Session:
+    """One registered client session; commands and replies are text lines."""
+    def __init__(self, ns_ip, ns_port, username):
+        self.sock = socket.create_connection((ns_ip, ns_port), timeout=10)
+        self.buf = b""
+        self.command(f"REGISTER_CLIENT;{username}")
+
+    def command(self, line):
+        """Sends one command and returns its reply without the __END__ line."""
+        self.sock.sendall((line + "\n").encode('utf-8'))
+        while b"__END__\n" not in self.buf:
+            data = self.sock.recv(65536)
+            if not data:
+                break
+            self.buf += data
+        reply, _, self.buf = self.buf.partition(b"__END__\n")
+        return reply.decode('utf-8', errors='replace').strip()
+
+def page(session, line):
+    """Runs one listing command. Returns its entries, the command for the
+    next page (None on the last page) and the raw reply."""
+    reply = session.command(line)
+    entries, next_line = [], None
+    for text in reply.splitlines():
+        if text.startswith("-- More: ") and text.endswith(" --"):
+            # "-- More: VIEWFOLDER d 7 1:f.txt --" -> "VIEWFOLDER;d;7;1:f.txt"
+            words = text[len("-- More: "):-len(" --")].split(" ")
+            if words[0] == "LIST":
+                words[0] = "LIST_USERS"
+            next_line = ";".join(words)
+        elif text.startswith("-> ") or (text and not text.startswith(("Contents of ", "Registered Users:", "---"))):
+            entries.append(text)
+    return entries, next_line, reply
+
+def follow(session, line, between=None):
+    """Pages through a listing. Calls between(entries so far) before each
+    page after the first. Returns every entry and the number of pages."""
+    entries, pages = [], 0
+    while line:
+        if pages and between:
+            between(entries)
+        more, line, reply = page(session, line)
+        if reply.startswith("ERROR"):
+            entries.append(reply)
+            break
+        entries += more
+        pages += 1
+    return entries, pages
+
+def user_name(entry):
+    """'-> bob (last IP ...)' -> 'bob'"""
+    return entry[3:].split(" ")[0]
+
+def check_listing(name, entries, pages, expected, gone=()):
+    """Checks that 'entries' holds each of 'expected' exactly once, over
+    more than one page, and nothing in 'gone'."""
+    doubled = sorted({e for e in entries if entries.count(e) > 1})
+    missing = sorted(set(expected) - set(entries))
+    check(f"{name}: more than one page", pages > 1, f"{pages} page(s)")
+    check(f"{name}: no entry listed twice", not doubled, str(doubled[:5]))
+    check(f"{name}: no entry dropped", not missing, str(missing[:5]))
+    if gone:
+        shown = sorted(set(gone) & set(entries))
+        check(f"{name}: deleted entries not listed", not shown, str(shown))
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        print("Usage: python3 test_paging.py <NameServer_IP> <NameServer_Port>")
+        sys.exit(1)
+
+    NS_IP = sys.argv[1]
+    NS_PORT = int(sys.argv[2])
+    run = f"pg{int(time.time())}"  # Fresh names, so the test can run again on the same server
+
+    print("--- Starting Paging Test ---")
+    owner = Session(NS_IP, NS_PORT, run)  # A fresh user, so VIEW shows only this run's files
+
+    def create(path, folder=False):
+        reply = owner.command(f"{'CREATEFOLDER' if folder else 'CREATE'};{path}")
+        if "successfully" not in reply:
+            check(f"create {path}", False, reply)
+
+    def delete(path):
+        reply = owner.command(f"DELETE;{path}")
+        if "deleted" not in reply:
+            check(f"delete {path}", False, reply)
+
+    print("\n[TEST] Setting up 3 folders of 40 files...")
+    for folder in ["a", "b", "c"]:
+        create(f"{run}_{folder}", folder=True)
+        for i in range(30):
+            create(f"{run}_{folder}/f{i:02d}.txt")
+        create(f"{run}_{folder}/sub", folder=True)
+        for i in range(9):
+            create(f"{run}_{folder}/sub/g{i}.txt")
+    users = [f"{run}_u{i:02d}" for i in range(12)]
+    for user in users:
+        Session(NS_IP, NS_PORT, user)
+
+    def paths(folder):
+        """Every path in folder run_<folder>, the folder itself first."""
+        top = f"{run}_{folder}"
+        return [top] + [f"{top}/f{i:02d}.txt" for i in range(30)] + [f"{top}/sub"] + [f"{top}/sub/g{i}.txt" for i in range(9)]
+
+    def folder_lines(folder):
+        return [f"-> {p}" + (" (DIR)" if p.endswith("/sub") else "") for p in paths(folder)[1:]]
+
+    print("\n[TEST] Paging across more entries than fit on one page...")
+    entries, pages = follow(owner, f"VIEWFOLDER;{run}_a;7")
+    check_listing("VIEWFOLDER", entries, pages, folder_lines("a"))
+    check("VIEWFOLDER: nothing else listed", len(entries) == 40, f"{len(entries)} entries")
+    entries, pages = follow(owner, "VIEW;-;7")
+    check_listing("VIEW", entries, pages, paths("a") + paths("b") + paths("c"))
+    check("VIEW: nothing else listed", len(entries) == 123, f"{len(entries)} entries")
+    check("VIEW: sorted by path", entries == sorted(entries))
+    entries, pages = follow(owner, "VIEW;-a;25")
+    check_listing("VIEW -a", entries, pages, paths("a") + paths("b") + paths("c"))
+    entries, pages = follow(owner, "LIST_USERS;5")
+    check_listing("LIST", [user_name(e) for e in entries], pages, [run] + users)
+    entries, pages = follow(owner, f"VIEWFOLDER;{run}_a")
+    check("VIEWFOLDER without a page size: one page", pages == 1 and len(entries) == 40, f"{pages} page(s), {len(entries)} entries")
+
+    print("\n[TEST] Creating and deleting entries between pages...")
+    # Before each later page: delete one entry already listed (not the
+    # cursor) and one not listed yet, and create one. Entries that were
+    # there throughout must be listed exactly once, and one deleted before
+    # its page never.
+    def churn(folder, deleted, unlisted):
+        state = {"n": 0}
+        def between(entries):
+            n = state["n"]
+            state["n"] += 1
+            listed = [p for p in paths(folder) if p in entries or f"-> {p}" in entries or f"-> {p} (DIR)" in entries]
+            for p in listed[:-1]:
+                if p not in deleted and not p.endswith("/sub") and p != f"{run}_{folder}":
+                    delete(p)
+                    deleted.append(p)
+                    break
+            for p in paths(folder)[::-1]:
+                if p not in listed and p not in deleted and not p.endswith("/sub"):
+                    delete(p)
+                    deleted.append(p)
+                    unlisted.append(p)
+                    break
+            create(f"{run}_{folder}/new{n:02d}.txt")
+        return between
+
+    deleted, unlisted = [], []
+    entries, pages = follow(owner, f"VIEWFOLDER;{run}_a;7", churn("a", deleted, unlisted))
+    kept = [line for line in folder_lines("a") if line[3:] not in deleted]
+    check_listing("VIEWFOLDER", entries, pages, kept, [f"-> {p}" for p in unlisted])
+    check("VIEWFOLDER: no errors", not any(e.startswith("ERROR") for e in entries), entries[-1])
+
+    deleted, unlisted = [], []
+    entries, pages = follow(owner, "VIEW;-a;7", churn("b", deleted, unlisted))
+    kept = [p for p in paths("b") + paths("c") if p not in deleted]
+    check_listing("VIEW -a", entries, pages, kept, unlisted)
+    check("VIEW -a: no errors", not any(e.startswith("ERROR") for e in entries), entries[-1])
+
+    deleted, unlisted = [], []
+    entries, pages = follow(owner, "VIEW;-;7", churn("c", deleted, unlisted))
+    kept = [p for p in paths("c") if p not in deleted]
+    check_listing("VIEW", entries, pages, kept, unlisted)
+    check("VIEW: no errors", not any(e.startswith("ERROR") for e in entries), entries[-1])
+
+    more = [f"{run}_v{i:02d}" for i in range(6)]
+    def register(entries):
+        if more:
+            Session(NS_IP, NS_PORT, more.pop())
+    entries, pages = follow(owner, "LIST_USERS;5", register)
+    check_listing("LIST", [user_name(e) for e in entries], pages, [run] + users)
+
+    print("\n[TEST] Stale and invalid cursors...")
+    create(f"{run}_d", folder=True)
+    for i in range(10):
+        create(f"{run}_d/f{i}.txt")
+    entries, next_line, _ = page(owner, f"VIEWFOLDER;{run}_d;4")
+    check("first page has a cursor", next_line is not None, str(entries))
+    cursor = next_line.split(";")[-1] if next_line else ""
+    delete(entries[-1][3:])
+    reply = owner.command(next_line or "")
+    check("VIEWFOLDER: cursor of a deleted entry is refused", reply.startswith("ERROR") and "no longer valid" in reply, reply)
+    reply = owner.command(f"VIEWFOLDER;{run}_d;4;zz:nope")
+    check("VIEWFOLDER: made-up cursor is refused", reply.startswith("ERROR") and "no longer valid" in reply, reply)
+    reply = owner.command(f"VIEW;-a;4;{cursor}")
+    check("VIEW -a: cursor of a deleted entry is refused", reply.startswith("ERROR") and "no longer valid" in reply, reply)
+    reply = owner.command("VIEW;-a;4;zz:nope")
+    check("VIEW -a: made-up cursor is refused", reply.startswith("ERROR") and "no longer valid" in reply, reply)
+    entries, next_line, _ = page(owner, f"VIEWFOLDER;{run}_d;4")
+    reply = owner.command(f"VIEWFOLDER;{run}_a/sub;4;{next_line.split(';')[-1]}" if next_line else "")
+    check("VIEWFOLDER: cursor from another folder is refused", reply.startswith("ERROR") and "no longer valid" in reply, reply)
+
+    # VIEW resumes after a path, which needs no entry to stay.
+    entries, next_line, _ = page(owner, f"VIEW;-;3;{run}_d")
+    delete(entries[-1])
+    entries2, _, reply = page(owner, next_line or "")
+    check("VIEW: resumes after a deleted entry", not reply.startswith("ERROR") and entries2 and entries2[0] > entries[-1], reply)
+    reply = owner.command(f"VIEW;-;4;{run}_zzz")
+    check("VIEW: cursor past the end lists nothing", reply == "", reply)
+
+    reply = owner.command(f"LIST_USERS;4;{run}_nobody")
+    check("LIST: unknown user as cursor is refused", reply.startswith("ERROR;105"), reply)
+
+    print("\n--- Test Complete ---")
+    print("All checks passed." if failures == 0 else f"{failures} check(s) FAILED.")
+    sys.exit(1 if failures else 0)
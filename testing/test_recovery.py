@@ -0,0 +1,292 @@
+import os
+import re
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+# Checks that the Name Server comes back from being killed (SIGKILL) with
+# the metadata and ACLs it had: from the write-ahead log alone, from
+# metadata.img plus the log (files are loaded from the image lazily), and
+# with CREATE, DELETE and MOVE cut off between their Storage Server call
+# and their metadata change, which must be settled rather than left half
+# done. Every request that was acknowledged before a kill must survive it.
+# Starts its own Name Server and Storage Server from <bin dir>, in scratch
+# directories, so ports 8080 and 9001 must be free.
+
+NS_IP, NS_PORT = "127.0.0.1", 8080
+CHECKPOINT_WAIT = 45  # The Name Server checkpoints every 30 s
+
+failures = 0
+
+def check(name, ok, detail=""):
+    """Prints one PASS/FAIL line and counts failures."""
+    global failures
+    if not ok:
+        failures += 1
+    print(f"  [{'PASS' if ok else 'FAIL'}] {name}" + (f" -- {detail}" if detail and not ok else ""))
+
+class Session:
+    """One registered client session; commands and replies are text lines."""
+    def __init__(self, ns_ip, ns_port, username):
+        self.sock = socket.create_connection((ns_ip, ns_port), timeout=10)
+        self.buf = b""
+        self.command(f"REGISTER_CLIENT;{username}")
+
+    def command(self, line):
+        """Sends one command and returns its reply without the __END__ line."""
+        self.sock.sendall((line + "\n").encode('utf-8'))
+        while b"__END__\n" not in self.buf:
+            data = self.sock.recv(65536)
+            if not data:
+                raise ConnectionError("Name Server closed the session")
+            self.buf += data
+        reply, _, self.buf = self.buf.partition(b"__END__\n")
+        return reply.decode('utf-8', errors='replace').strip()
+
+class Servers:
+    """A Name Server and a Storage Server, each in its own scratch directory."""
+    def __init__(self, bin_dir):
+        self.bin_dir = os.path.abspath(bin_dir)
+        self.root = tempfile.mkdtemp(prefix="recovery_")
+        self.ns_dir = os.path.join(self.root, "ns")
+        self.ss_dir = os.path.join(self.root, "ss")
+        os.makedirs(self.ns_dir)
+        os.makedirs(self.ss_dir)
+        self.log = open(os.path.join(self.root, "servers.log"), "w")
+        self.ns = self.ss = None
+        self.start_ns()
+        self.ss = subprocess.Popen([os.path.join(self.bin_dir, "storage_server")], cwd=self.ss_dir,
+                                   stdout=self.log, stderr=subprocess.STDOUT)
+        self.wait_ready()
+
+    def start_ns(self):
+        self.ns = subprocess.Popen([os.path.join(self.bin_dir, "name_server")], cwd=self.ns_dir,
+                                   stdout=self.log, stderr=subprocess.STDOUT)
+        deadline = time.time() + 10
+        while time.time() < deadline:
+            try:
+                socket.create_connection((NS_IP, NS_PORT), timeout=1).close()
+                return
+            except OSError:
+                time.sleep(0.1)
+        raise RuntimeError("Name Server did not start")
+
+    def wait_ready(self):
+        """Waits until the Storage Server has (re-)registered."""
+        deadline = time.time() + 15
+        probe = Session(NS_IP, NS_PORT, "admin")
+        while time.time() < deadline:
+            if " up " in probe.command("STORAGE_STATS"):
+                return
+            time.sleep(0.2)
+        raise RuntimeError("Storage Server did not register")
+
+    def kill_ns(self):
+        self.ns.send_signal(signal.SIGKILL)
+        self.ns.wait()
+
+    def restart_ns(self):
+        self.kill_ns()
+        self.start_ns()
+        self.wait_ready()
+
+    def ss_has(self, path):
+        return os.path.exists(os.path.join(self.ss_dir, "ss_files", path))
+
+    def stop(self):
+        for proc in (self.ns, self.ss):
+            if proc and proc.poll() is None:
+                proc.send_signal(signal.SIGCONT)
+                proc.kill()
+                proc.wait()
+        self.log.close()
+
+def listing(session, line):
+    """Every line of a listing, following its "-- More: ... --" pages."""
+    lines = []
+    while line:
+        reply, line = session.command(line), None
+        for text in reply.splitlines():
+            if text.startswith("-- More: "):
+                line = ";".join(text[len("-- More: "):-len(" --")].split(" "))
+            else:
+                lines.append(text)
+    return lines
+
+WRITER_FILE = re.compile(r"\w+_w\d+\.txt")  # Made by Writer, which races the kills
+
+def snapshot(users, paths):
+    """What the Name Server says about 'paths' and to 'users': listings,
+    INFO (owner and ACL) and annotations, as a dict of replies."""
+    state = {}
+    sessions = {user: Session(NS_IP, NS_PORT, user) for user in users}
+    owner = sessions[users[0]]
+    state["VIEW -al"] = sorted(l for l in listing(owner, "VIEW;-al") if not WRITER_FILE.search(l))
+    state["LIST"] = sorted(l.split(" ")[1] for l in listing(owner, "LIST_USERS") if l.startswith("-> "))
+    for user, session in sessions.items():
+        state[f"VIEW as {user}"] = sorted(l for l in listing(session, "VIEW;-") if not WRITER_FILE.search(l))
+        for path in paths:
+            # Not "Last Modified": that is the last access, never persisted.
+            info = session.command(f"INFO;{path}").splitlines()
+            state[f"INFO {path} as {user}"] = [l for l in info if not l.startswith("Last Modified:")]
+    for path in paths:
+        state[f"SHOW_ANNOTATION {path}"] = owner.command(f"SHOW_ANNOTATION;{path}")
+    return state
+
+def check_same(name, before, after):
+    changed = [key for key in before if before[key] != after.get(key)]
+    check(name, not changed, "; ".join(f"{key}: {before[key]!r} -> {after.get(key)!r}" for key in changed[:3]))
+
+def workload(users, prefix, move=True):
+    """Creates files and folders and changes their ACLs and annotations,
+    and with 'move' moves one. Returns the paths it leaves behind."""
+    owner, second, third = users
+    s = Session(NS_IP, NS_PORT, owner)
+    for user in (second, third):
+        Session(NS_IP, NS_PORT, user)
+    paths = [f"{prefix}_{i}.txt" for i in range(8)] + [f"{prefix}_dir", f"{prefix}_dir/in.txt", f"{prefix}_dir/sub",
+                                                        f"{prefix}_dir/sub/deep.txt"]
+    for path in paths:
+        s.command(f"{'CREATEFOLDER' if path.endswith(('_dir', '/sub')) else 'CREATE'};{path}")
+    s.command(f"ADDACCESS;{prefix}_0.txt;{second};W")
+    s.command(f"ADDACCESS;{prefix}_1.txt;{second};R")
+    s.command(f"ADDACCESS;{prefix}_1.txt;{third};R")
+    s.command(f"REMACCESS;{prefix}_1.txt;{third}")
+    s.command(f"ADDACCESS;{prefix}_dir/sub/deep.txt;{third};W")
+    s.command(f"ANNOTATE;{prefix}_0.txt;first note")
+    s.command(f"ANNOTATE;{prefix}_0.txt;second note")
+    s.command(f"DELETE;{prefix}_2.txt")
+    if move:
+        s.command(f"MOVE;{prefix}_3.txt;{prefix}_dir/moved.txt")
+        paths.append(f"{prefix}_dir/moved.txt")
+    Session(NS_IP, NS_PORT, second).command(f"REQUESTACCESS;{prefix}_4.txt")
+    return paths
+
+class Writer(threading.Thread):
+    """Creates files and grants access to them back to back, remembering
+    which requests were acknowledged, until the Name Server goes away."""
+    def __init__(self, user, other, prefix):
+        super().__init__(daemon=True)
+        self.session = Session(NS_IP, NS_PORT, user)
+        self.other, self.prefix = other, prefix
+        self.created, self.granted = [], []
+
+    def run(self):
+        try:
+            for i in range(100000):
+                path = f"{self.prefix}_w{i}.txt"
+                if "successfully" in self.session.command(f"CREATE;{path}"):
+                    self.created.append(path)
+                if "set to" in self.session.command(f"ADDACCESS;{path};{self.other};R"):
+                    self.granted.append(path)
+        except (OSError, ConnectionError):
+            pass
+
+def check_writer(writer, servers):
+    view = set(listing(Session(NS_IP, NS_PORT, writer.other), "VIEW;-"))
+    owner_view = set(listing(Session(NS_IP, NS_PORT, "alice"), "VIEW;-"))
+    lost = [p for p in writer.created if p not in owner_view]
+    check(f"all {len(writer.created)} acknowledged CREATEs survived", writer.created and not lost, str(lost[:5]))
+    lost = [p for p in writer.granted if p not in view]
+    check(f"all {len(writer.granted)} acknowledged ADDACCESSes survived", writer.granted and not lost, str(lost[:5]))
+    ghosts = [p for p in owner_view if p.startswith(writer.prefix + "_w") and not servers.ss_has(p)]
+    check("every file in the metadata is on the Storage Server", not ghosts, str(ghosts[:5]))
+
+if __name__ == "__main__":
+    if len(sys.argv) != 2:
+        print("Usage: python3 test_recovery.py <bin dir>")
+        sys.exit(1)
+
+    users = ["alice", "bob", "carol"]
+    print("--- Starting Crash Recovery Test ---")
+    servers = Servers(sys.argv[1])
+    try:
+        print("\n[TEST] Replaying the log after a kill mid-workload...")
+        paths = workload(users, "wal")
+        before = snapshot(users, paths)
+        writer = Writer("alice", "bob", "wal")
+        writer.start()
+        time.sleep(1)
+        servers.restart_ns()
+        writer.join(5)
+        check_same("metadata and ACLs as before", before, snapshot(users, paths))
+        check_writer(writer, servers)
+
+        print("\n[TEST] Loading metadata.img, then the log on top...")
+        image = os.path.join(servers.ns_dir, "metadata.img")
+        Session(NS_IP, NS_PORT, "alice").command("ANNOTATE;wal_0.txt;third note")  # Checkpoints skip an empty log
+        deadline = time.time() + CHECKPOINT_WAIT
+        while not os.path.exists(image) and time.time() < deadline:
+            time.sleep(1)
+        check("checkpoint wrote metadata.img", os.path.exists(image))
+        # Changes after the checkpoint are only in the log. (Replaying a
+        # MOVE loads every file from the image, so there is none here.)
+        more = workload(users, "img", move=False)
+        s = Session(NS_IP, NS_PORT, "alice")
+        s.command("ADDACCESS;wal_5.txt;carol;R")
+        s.command("DELETE;wal_6.txt")
+        s.command("REMACCESS;wal_dir/sub/deep.txt;carol")
+        before = snapshot(users, paths + more)
+        writer = Writer("alice", "carol", "img")
+        writer.start()
+        time.sleep(1)
+        servers.restart_ns()
+        writer.join(5)
+        stats = Session(NS_IP, NS_PORT, "alice").command("MEM_STATS")
+        unloaded = re.search(r"(\d+) not loaded from the image", stats)
+        check("files are left in the image until used", unloaded and int(unloaded.group(1)) > 0, stats)
+        check_same("metadata and ACLs as before", before, snapshot(users, paths + more))
+        check_writer(writer, servers)
+
+        print("\n[TEST] Killing the Name Server between the SS call and the metadata change...")
+        s = Session(NS_IP, NS_PORT, "alice")
+        for line in ["CREATE;mid_gone.txt", "CREATEFOLDER;mid_dir", "CREATE;mid_dir/a.txt", "CREATE;mid_dir/b.txt"]:
+            s.command(line)
+        servers.ss.send_signal(signal.SIGSTOP)  # Holds each request at step 2 (intents.h)
+        cut = []
+        for line in ["CREATE;mid_new.txt", "DELETE;mid_gone.txt", "MOVE;mid_dir;mid_moved"]:
+            sock = socket.create_connection((NS_IP, NS_PORT), timeout=10)
+            sock.sendall(f"REGISTER_CLIENT;alice\n{line}\n".encode('utf-8'))
+            cut.append(sock)
+        time.sleep(0.5)
+        servers.kill_ns()
+        servers.ss.send_signal(signal.SIGCONT)  # The SS now does all three
+        time.sleep(0.5)
+        servers.start_ns()
+        servers.wait_ready()
+        s = Session(NS_IP, NS_PORT, "alice")
+        deadline = time.time() + 10
+        while time.time() < deadline and (servers.ss_has("mid_new.txt") or s.command("INFO;mid_gone.txt").startswith("File:")
+                                          or not s.command("INFO;mid_moved/a.txt").startswith("File:")):
+            time.sleep(0.2)  # Settled once the SS is back
+        for sock in cut:
+            sock.close()
+        reply = s.command("INFO;mid_new.txt")
+        check("interrupted CREATE is undone", reply.startswith("ERROR;404") and not servers.ss_has("mid_new.txt"),
+              f"{reply} / on SS: {servers.ss_has('mid_new.txt')}")
+        reply = s.command("CREATE;mid_new.txt")
+        check("its name can be created again", "successfully" in reply, reply)
+        reply = s.command("INFO;mid_gone.txt")
+        check("interrupted DELETE is finished", reply.startswith("ERROR;404") and not servers.ss_has("mid_gone.txt"), reply)
+        reply = s.command("INFO;mid_moved/a.txt")
+        check("interrupted MOVE is finished", reply.startswith("File:") and servers.ss_has("mid_moved/b.txt"), reply)
+        reply = s.command("INFO;mid_dir/a.txt")
+        check("nothing left at the old path", reply.startswith("ERROR;404") and not servers.ss_has("mid_dir"), reply)
+        adopted = [l for l in listing(s, "VIEW;-al") if "ss_owner" in l]
+        check("no entry adopted from the SS", not adopted, str(adopted[:5]))
+        before = snapshot(users, ["mid_new.txt", "mid_moved", "mid_moved/a.txt", "mid_moved/b.txt"])
+        servers.restart_ns()
+        check_same("settled state survives another restart", before,
+                   snapshot(users, ["mid_new.txt", "mid_moved", "mid_moved/a.txt", "mid_moved/b.txt"]))
+    finally:
+        servers.stop()
+        shutil.rmtree(servers.root, ignore_errors=True)
+
+    print("\n--- Test Complete ---")
+    print("All checks passed." if failures == 0 else f"{failures} check(s) FAILED.")
+    sys.exit(1 if failures else 0)